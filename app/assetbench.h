@@ -0,0 +1,69 @@
+//
+//  assetbench.h
+//  app
+//
+
+#ifndef assetbench_h
+#define assetbench_h
+
+#include <chrono>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "jobs.h"
+#include "decode.h"
+
+// What the texture pipeline benchmarks ("--decode-bench", "--mip-bench", "--compress-bench")
+// share: the timing loop and the walk over the asset textures in the directory they are given.
+
+const char* const benchmarkAssets[] = { "container.jpg", "awesomeface.png" };
+
+// runs `run` until at least half a second (and 3 runs) went by, returns the mean time of one run
+template <typename F>
+double timeRuns(const F& run) {
+    int runs = 0;
+    double seconds = 0.0;
+    auto start = std::chrono::high_resolution_clock::now();
+    while (runs < 3 || seconds < 0.5) {
+        run();
+        runs++;
+        seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    }
+    return seconds / runs;
+}
+
+// `bench(name, file)` on the encoded bytes of every asset, false from it counts as a failure;
+// returns the failures, missing files included
+template <typename F>
+int benchmarkAssetFiles(const char* tag, const std::string& assetDirectory, const F& bench) {
+    std::cout << "[" << tag << "] " << jobs.threadCount() << " threads" << std::endl;
+    int failures = 0;
+    for (const char* asset : benchmarkAssets) {
+        std::vector<unsigned char> file;
+        if (!readWholeFile(assetDirectory + "/" + asset, file)) {
+            std::cout << "[" << tag << "] could not read " << assetDirectory << "/" << asset << std::endl;
+            failures++;
+            continue;
+        }
+        if (!bench(asset, file)) failures++;
+    }
+    return failures;
+}
+
+// the same with every asset decoded to RGBA, `bench(name, image)`
+template <typename F>
+int benchmarkAssetImages(const char* tag, const std::string& assetDirectory, const F& bench) {
+    return benchmarkAssetFiles(tag, assetDirectory, [&](const char* asset, std::vector<unsigned char>& file) {
+        std::vector<std::vector<unsigned char>> files(1);
+        files[0].swap(file);
+        std::vector<DecodedImage> images;
+        decodeImages(files, 4, false, false, images);
+        if (!images[0].ok) {
+            std::cout << "[" << tag << "] could not decode " << assetDirectory << "/" << asset << std::endl;
+            return false;
+        }
+        return bench(asset, images[0]);
+    });
+}
+
+#endif /* assetbench_h */
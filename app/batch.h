@@ -0,0 +1,381 @@
+//
+//  batch.h
+//  app
+//
+
+#ifndef batch_h
+#define batch_h
+
+#include <stdio.h>
+#include <time.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include <GLFW/glfw3.h>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+#include "jobs.h"
+#include "resources.h"
+#include "permutations.h"
+#include "regression.h"
+#include "meshlets.h"
+
+// Batch rendering ("--batch <job file>"): renders stills and turntables offline on several hidden
+// contexts at once, one per worker thread, instead of one window per process.
+//
+// One job per line, # starts a comment:
+//
+//   still <scene> <width> <height> <out.ppm> <x> <y> <z> <yaw> <pitch> [time]
+//   turntable <scene> <width> <height> <prefix> <frames> <target x> <y> <z> <radius> <height> [time]
+//
+// Scenes are "cubes" (the cube field) and "knot" (a torus knot). A turntable expands into one still
+// per frame, <prefix>_NNN.ppm, on a circle around the target looking at it.
+//
+// Textures, vertex and index buffers are made once on the main context and only read by the workers.
+// What a context can't share (vertex arrays, framebuffers) or what the workers would race on
+// (program uniforms) each worker makes on its own context. Workers take the next job from a shared
+// counter, so long and short jobs balance out; finished pixels go to the job system, which writes the
+// files while the workers render on.
+
+enum BatchScene {
+    BatchCubes,
+    BatchKnot
+};
+
+struct BatchJob {
+    BatchScene scene;
+    int width;
+    int height;
+    std::string output;
+    glm::vec3 position;
+    glm::vec3 front;
+    float time;
+};
+
+// direction the camera looks in for yaw and pitch in degrees, like setCameraDirection
+glm::vec3 batchCameraFront(float yaw, float pitch) {
+    glm::vec3 front;
+    front.x = cosf(glm::radians(yaw)) * cosf(glm::radians(pitch));
+    front.y = sinf(glm::radians(pitch));
+    front.z = sinf(glm::radians(yaw)) * cosf(glm::radians(pitch));
+    return glm::normalize(front);
+}
+
+bool parseBatchJobs(const std::string& path, std::vector<BatchJob>& jobs) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cout << "[batch] could not read " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(file, line)) {
+        lineNumber++;
+        line = trim(line.substr(0, line.find('#')));
+        if (line.empty()) continue;
+        std::istringstream fields(line);
+        std::string kind, scene;
+        BatchJob job;
+        fields >> kind >> scene >> job.width >> job.height >> job.output;
+        bool ok = !fields.fail() && job.width > 0 && job.height > 0 && (scene == "cubes" || scene == "knot");
+        job.scene = scene == "knot" ? BatchKnot : BatchCubes;
+        if (ok && kind == "still") {
+            float yaw, pitch;
+            fields >> job.position.x >> job.position.y >> job.position.z >> yaw >> pitch;
+            ok = !fields.fail();
+            if (!(fields >> job.time)) job.time = 0.0f;
+            job.front = batchCameraFront(yaw, pitch);
+            if (ok) jobs.push_back(job);
+        } else if (ok && kind == "turntable") {
+            int frames;
+            glm::vec3 target;
+            float radius, height;
+            fields >> frames >> target.x >> target.y >> target.z >> radius >> height;
+            ok = !fields.fail() && frames > 0;
+            if (!(fields >> job.time)) job.time = 0.0f;
+            std::string prefix = job.output;
+            for (int frame = 0; frame < frames && ok; frame++) {
+                float angle = float(frame) / frames * 6.2831853f;
+                char suffix[16];
+                snprintf(suffix, sizeof(suffix), "_%03d.ppm", frame);
+                job.output = prefix + suffix;
+                job.position = target + glm::vec3(sinf(angle) * radius, height, cosf(angle) * radius);
+                job.front = glm::normalize(target - job.position);
+                jobs.push_back(job);
+            }
+        } else {
+            ok = false;
+        }
+        if (!ok) {
+            std::cout << "[batch] " << path << ":" << lineNumber << ": can't parse \"" << line << "\"" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// read only, shared by every worker context
+struct BatchAssets {
+    ResourceHandle cubeVertices;
+    ResourceHandle knotVertices;
+    ResourceHandle knotIndices;
+    ResourceHandle textures[2];
+    GLsizei knotIndexCount = 0;
+    const glm::vec3* cubePositions = NULL;
+    int cubeCount = 0;
+    std::string vertexSource;
+    std::string fragmentSource;
+};
+
+struct BatchWorker {
+    GLFWwindow* context = NULL;
+    std::thread thread;
+    int rendered = 0;
+    double renderSeconds = 0.0;
+};
+
+struct BatchRun {
+    const BatchAssets* assets;
+    const std::vector<BatchJob>* jobs;
+    std::atomic<size_t> next{ 0 };
+    // rendered images not on disk yet; workers wait above maxPendingWrites so memory stays bounded
+    std::atomic<int> pendingWrites{ 0 };
+    int maxPendingWrites = 16;
+    std::atomic<int> failures{ 0 };
+};
+
+// the cube layout of main.cpp: position, color, tex coord, normal
+void setupBatchVertexArray(unsigned int vao, unsigned int vbo, unsigned int ebo) {
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    GLsizei stride = 11 * sizeof(float);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*) 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*) (3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*) (6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*) (8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    if (ebo != 0) glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+    glBindVertexArray(0);
+}
+
+// Worker thread body. The resource registry belongs to the render thread, the objects made here are
+// plain GL names and deleted before the context is released.
+void renderBatchJobs(BatchWorker& worker, BatchRun& run) {
+    glfwMakeContextCurrent(worker.context);
+    const BatchAssets& assets = *run.assets;
+
+    unsigned int vs = compileShader(GL_VERTEX_SHADER, assets.vertexSource.c_str());
+    unsigned int fs = compileShader(GL_FRAGMENT_SHADER, assets.fragmentSource.c_str());
+    unsigned int program = createProgram(vs, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+    glUseProgram(program);
+    glUniform1i(glGetUniformLocation(program, "texture1"), 0);
+    glUniform1i(glGetUniformLocation(program, "texture2"), 1);
+    int modelLoc = glGetUniformLocation(program, "model");
+    int viewLoc = glGetUniformLocation(program, "view");
+    int projectionLoc = glGetUniformLocation(program, "projection");
+    int colorLoc = glGetUniformLocation(program, "ucolor");
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, gpuResources.name(assets.textures[0]));
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, gpuResources.name(assets.textures[1]));
+
+    unsigned int vaos[2];
+    glGenVertexArrays(2, vaos);
+    setupBatchVertexArray(vaos[BatchCubes], gpuResources.name(assets.cubeVertices), 0);
+    setupBatchVertexArray(vaos[BatchKnot], gpuResources.name(assets.knotVertices), gpuResources.name(assets.knotIndices));
+
+    // one target, reallocated when a job asks for another size
+    unsigned int fbo, renderbuffers[2];
+    glGenFramebuffers(1, &fbo);
+    glGenRenderbuffers(2, renderbuffers);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    int targetWidth = 0, targetHeight = 0;
+    glEnable(GL_DEPTH_TEST);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    while (true) {
+        size_t index = run.next.fetch_add(1);
+        if (index >= run.jobs->size()) break;
+        const BatchJob& job = (*run.jobs)[index];
+        while (run.pendingWrites.load() >= run.maxPendingWrites) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        auto start = std::chrono::steady_clock::now();
+        if (job.width != targetWidth || job.height != targetHeight) {
+            targetWidth = job.width;
+            targetHeight = job.height;
+            glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[0]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, targetWidth, targetHeight);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffers[0]);
+            glBindRenderbuffer(GL_RENDERBUFFER, renderbuffers[1]);
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, targetWidth, targetHeight);
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, renderbuffers[1]);
+            if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+                std::cout << "[batch] " << targetWidth << "x" << targetHeight << " framebuffer incomplete, skipping "
+                          << job.output << std::endl;
+                targetWidth = targetHeight = 0;
+                run.failures++;
+                continue;
+            }
+        }
+        glViewport(0, 0, job.width, job.height);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+        // same camera and animation the interactive scene has at `time`
+        glm::mat4 view = glm::lookAt(job.position, job.position + job.front, glm::vec3(0.0f, 1.0f, 0.0f));
+        glm::mat4 projection = glm::perspective(45.0f, float(job.width) / float(job.height), nearPlane, farPlane);
+        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(projectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform4f(colorLoc, (sinf(job.time) + 1.0f) / 2.0f, (sinf(.6f * job.time) + 1.0f) / 2.0f,
+                    (sinf(.2f * job.time) + 1.0f) / 2.0f, 1.0f);
+        glBindVertexArray(vaos[job.scene]);
+        if (job.scene == BatchCubes) {
+            for (int i = 0; i < assets.cubeCount; i++) {
+                Transform transform;
+                transform.position = assets.cubePositions[i];
+                transform.axis = glm::vec3(cos(1.0f), sin(1.0f), 0.0f);
+                transform.angle = job.time * float(i + 1);
+                glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(localMatrix(transform)));
+                glDrawArrays(GL_TRIANGLES, 0, 36);
+            }
+        } else {
+            glm::mat4 model = glm::rotate(glm::scale(glm::mat4(1.0f), glm::vec3(2.0f)), job.time * 0.5f, glm::vec3(0.0f, 1.0f, 0.0f));
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
+            glDrawElements(GL_TRIANGLES, assets.knotIndexCount, GL_UNSIGNED_INT, 0);
+        }
+
+        // shared: std::function needs a copyable task
+        std::shared_ptr<std::vector<unsigned char>> pixels = std::make_shared<std::vector<unsigned char>>((size_t) job.width * job.height * 4);
+        glReadPixels(0, 0, job.width, job.height, GL_RGBA, GL_UNSIGNED_BYTE, pixels->data());
+        worker.renderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        worker.rendered++;
+        run.pendingWrites++;
+        jobs.submit([pixels, &job, &run]() {
+            if (!writePPM(job.output, *pixels, job.width, job.height)) {
+                std::cout << "[batch] could not write " << job.output << std::endl;
+                run.failures++;
+            }
+            run.pendingWrites--;
+        });
+    }
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteRenderbuffers(2, renderbuffers);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteVertexArrays(2, vaos);
+    glDeleteProgram(program);
+    glFinish();
+    glfwMakeContextCurrent(NULL);
+}
+
+// `window` is the hidden main context the assets are made on; cube positions, texture paths and
+// flips are the cube field's
+int runBatchRendering(GLFWwindow* window, const std::string& jobFile, int workerCount, const glm::vec3* cubePositions,
+                      int cubeCount, const char* const texturePaths[2], const bool textureFlips[2], CompressQuality quality) {
+    std::vector<BatchJob> batchJobs;
+    if (!parseBatchJobs(jobFile, batchJobs)) return 1;
+    if (batchJobs.empty()) {
+        std::cout << "[batch] no jobs in " << jobFile << std::endl;
+        return 0;
+    }
+    workerCount = std::max(1, std::min(workerCount, (int) batchJobs.size()));
+
+    BatchAssets assets;
+    assets.cubePositions = cubePositions;
+    assets.cubeCount = cubeCount;
+    for (int i = 0; i < 2; i++) {
+        assets.textures[i] = GPU_ADOPT(ResourceTexture, createTexture(texturePaths[i], textureFlips[i], quality), "batch");
+    }
+    assets.cubeVertices = GPU_CREATE(ResourceBuffer, "batch");
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(assets.cubeVertices));
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    gpuResources.setBytes(assets.cubeVertices, sizeof(vertices));
+    std::vector<float> knotVertices;
+    std::vector<uint32_t> knotIndices;
+    torusKnotMesh(256, 16, knotVertices, knotIndices);
+    assets.knotVertices = GPU_CREATE(ResourceBuffer, "batch");
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(assets.knotVertices));
+    glBufferData(GL_ARRAY_BUFFER, knotVertices.size() * sizeof(float), knotVertices.data(), GL_STATIC_DRAW);
+    gpuResources.setBytes(assets.knotVertices, knotVertices.size() * sizeof(float));
+    // element buffers bind to a vertex array, upload through the array buffer target instead
+    assets.knotIndices = GPU_CREATE(ResourceBuffer, "batch");
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(assets.knotIndices));
+    glBufferData(GL_ARRAY_BUFFER, knotIndices.size() * sizeof(uint32_t), knotIndices.data(), GL_STATIC_DRAW);
+    gpuResources.setBytes(assets.knotIndices, knotIndices.size() * sizeof(uint32_t));
+    assets.knotIndexCount = (GLsizei) knotIndices.size();
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // the plain textured cube variant, no per frame buffers that would need sharing
+    ShaderFeatures features = { { "TEXTURE_COUNT", 2 }, { "VERTEX_COLOR", 1 } };
+    std::string vertexSource, fragmentSource;
+    bool sourcesRead = readFile(shaderDirectory + "/cube.vert", vertexSource) && readFile(shaderDirectory + "/cube.frag", fragmentSource);
+    assets.vertexSource = specializeShader(vertexSource, features);
+    assets.fragmentSource = specializeShader(fragmentSource, features);
+    // uploads have to be complete before another context reads them
+    glFinish();
+
+    BatchRun run;
+    run.assets = &assets;
+    run.jobs = &batchJobs;
+    run.maxPendingWrites = std::max(run.maxPendingWrites, workerCount * 2);
+    std::vector<BatchWorker> workers(sourcesRead ? workerCount : 0);
+    if (!sourcesRead) std::cout << "[batch] could not read the cube shaders in " << shaderDirectory << std::endl;
+    // windows (and their contexts) can only be created on the main thread
+    glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+    for (BatchWorker& worker : workers) {
+        worker.context = glfwCreateWindow(1, 1, "batch worker", NULL, window);
+        if (worker.context == NULL) {
+            std::cout << "[batch] could not create a worker context" << std::endl;
+            break;
+        }
+    }
+
+    clock_t cpuStart = clock();
+    auto start = std::chrono::steady_clock::now();
+    for (BatchWorker& worker : workers) {
+        if (worker.context) worker.thread = std::thread(renderBatchJobs, std::ref(worker), std::ref(run));
+    }
+    for (BatchWorker& worker : workers) {
+        if (worker.thread.joinable()) worker.thread.join();
+    }
+    jobs.waitIdle();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    double cpuSeconds = double(clock() - cpuStart) / CLOCKS_PER_SEC;
+
+    int rendered = 0, activeWorkers = 0;
+    for (size_t i = 0; i < workers.size(); i++) {
+        if (workers[i].context == NULL) continue;
+        activeWorkers++;
+        rendered += workers[i].rendered;
+        std::cout << "[batch] worker " << i << ": " << workers[i].rendered << " jobs, "
+                  << workers[i].renderSeconds * 1000.0 / std::max(1, workers[i].rendered) << " ms per job" << std::endl;
+        glfwDestroyWindow(workers[i].context);
+    }
+    double jobsPerSecond = rendered / std::max(seconds, 1e-9);
+    std::cout << "[batch] " << rendered << "/" << batchJobs.size() << " jobs in " << seconds << " s on " << activeWorkers
+              << " contexts: " << jobsPerSecond << " jobs/s, " << jobsPerSecond / std::max(1, activeWorkers)
+              << " jobs/s per worker, " << rendered / std::max(cpuSeconds, 1e-9) << " jobs per cpu second ("
+              << cpuSeconds / std::max(seconds, 1e-9) << " cores busy of " << std::thread::hardware_concurrency() << ")" << std::endl;
+
+    gpuResources.release(assets.knotIndices);
+    gpuResources.release(assets.knotVertices);
+    gpuResources.release(assets.cubeVertices);
+    gpuResources.release(assets.textures[1]);
+    gpuResources.release(assets.textures[0]);
+    gpuResources.flush();
+    return rendered == (int) batchJobs.size() && run.failures.load() == 0 ? 0 : 1;
+}
+
+#endif /* batch_h */
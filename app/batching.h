@@ -0,0 +1,499 @@
+//
+//  batching.h
+//  app
+//
+
+#ifndef batching_h
+#define batching_h
+
+#include <stdint.h>
+#include <math.h>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <glad/glad.h>
+#include "ecs.h"
+#include "jobs.h"
+#include "hierarchy.h"
+#include "resources.h"
+
+// Static batching. Entities tagged StaticMesh are expected to stay put, so instead of one draw
+// each they are merged into big pre-transformed vertex and index buffers: one chunk per material and
+// source mesh layout per cell of a world grid, so a chunk still has tight bounds to frustum cull.
+// Static draws go from one per entity to one per visible chunk.
+//
+// Chunk vertices are already in world space; they draw through an identity node in the transform
+// hierarchy, so every shader (and the previous matrices for motion vectors) works unchanged.
+//
+// Rebuilds are incremental and run on the job system. Each frame the batcher looks at the slots
+// the hierarchy reports as changed and, after a structural change to the world, at membership;
+// only chunks that gained, lost or moved a member are rebuilt. Until a rebuild lands the old
+// buffers keep drawing: an entity that left a chunk stays masked as long as buffers with it are
+// drawn, one that joined is drawn individually by the caller until the chunk's new buffers are
+// swapped in (drawn() tells which). Mesh and material are read when an entity joins.
+
+// draws a mesh or a chunk, with the vertex array already bound
+void drawMesh(const Mesh& mesh) {
+    if (mesh.indexed) {
+        glDrawElements(GL_TRIANGLES, mesh.count, GL_UNSIGNED_INT, (const void*) (sizeof(uint32_t) * mesh.first));
+    } else {
+        glDrawArrays(GL_TRIANGLES, mesh.first, mesh.count);
+    }
+}
+
+// Attribute setup of an indexed mesh in the cube's layout (cube.vert, 11 floats per vertex) and
+// of its positions only copy; both arrays use the same index buffer.
+void setupIndexedArrays(ResourceHandle vertexArray, ResourceHandle positionArray, ResourceHandle vertexBuffer,
+                        ResourceHandle positionBuffer, ResourceHandle indexBuffer) {
+    GLsizei stride = 11 * sizeof(float);
+    glBindVertexArray(gpuResources.name(vertexArray));
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(vertexBuffer));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*) 0);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, stride, (void*) (3 * sizeof(float)));
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*) (6 * sizeof(float)));
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*) (8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuResources.name(indexBuffer));
+    glBindVertexArray(gpuResources.name(positionArray));
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(positionBuffer));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*) 0);
+    glEnableVertexAttribArray(0);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuResources.name(indexBuffer));
+    glBindVertexArray(0);
+}
+
+// planes of a view-projection matrix, xyz points inside
+void frustumPlanes(const glm::mat4& viewProjection, glm::vec4 planes[6]) {
+    glm::mat4 m = glm::transpose(viewProjection);
+    planes[0] = m[3] + m[0];
+    planes[1] = m[3] - m[0];
+    planes[2] = m[3] + m[1];
+    planes[3] = m[3] - m[1];
+    planes[4] = m[3] + m[2];
+    planes[5] = m[3] - m[2];
+}
+
+bool boxInFrustum(const glm::vec4 planes[6], const glm::vec3& boxMin, const glm::vec3& boxMax) {
+    for (int i = 0; i < 6; i++) {
+        // corner furthest along the plane normal
+        glm::vec3 corner = glm::vec3(planes[i].x > 0.0f ? boxMax.x : boxMin.x, planes[i].y > 0.0f ? boxMax.y : boxMin.y,
+                                     planes[i].z > 0.0f ? boxMax.z : boxMin.z);
+        if (glm::dot(glm::vec3(planes[i]), corner) + planes[i].w < 0.0f) return false;
+    }
+    return true;
+}
+
+// CPU copy of a mesh's vertices (cube.vert layout, 11 floats), deduplicated and indexed
+struct BatchSource {
+    unsigned int vao = 0;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+};
+
+struct BatchMember {
+    uint32_t node;
+    int source;
+    glm::mat4 world;
+};
+
+// what a worker hands back
+struct BatchBuild {
+    int chunk;
+    uint64_t generation;
+    std::vector<float> vertices;
+    std::vector<float> positions;
+    std::vector<uint32_t> indices;
+    std::vector<uint32_t> nodes;
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    float maxScale;
+};
+
+// material, source mesh and grid cell of a chunk
+struct BatchChunkKey {
+    int material;
+    int source;
+    int32_t x, y, z;
+
+    bool operator==(const BatchChunkKey& other) const {
+        return material == other.material && source == other.source && x == other.x && y == other.y && z == other.z;
+    }
+};
+
+struct BatchChunkKeyHash {
+    size_t operator()(const BatchChunkKey& key) const {
+        // FNV-1a over the fields
+        uint64_t hash = 14695981039346656037ull;
+        const int32_t fields[5] = { key.material, key.source, key.x, key.y, key.z };
+        for (int32_t field : fields) {
+            hash ^= (uint32_t) field;
+            hash *= 1099511628211ull;
+        }
+        return (size_t) (hash ^ (hash >> 32));
+    }
+};
+
+struct BatchChunk {
+    int material = 0;
+    int source = 0;
+    std::vector<BatchMember> members;
+    // bumped on every membership or transform change, a build of an older one is dropped
+    uint64_t generation = 0;
+    bool dirty = false;
+    bool building = false;
+
+    // what's on the GPU
+    ResourceHandle vertexBuffer;
+    ResourceHandle positionBuffer;
+    ResourceHandle indexBuffer;
+    ResourceHandle vertexArray;
+    ResourceHandle positionArray;
+    uint32_t indexCount = 0;
+    glm::vec3 boundsMin = glm::vec3(0.0f);
+    glm::vec3 boundsMax = glm::vec3(0.0f);
+    float maxScale = 1.0f;
+    // members in the buffers above
+    std::vector<uint32_t> builtNodes;
+
+    Mesh mesh() const {
+        Mesh mesh;
+        mesh.vao = gpuResources.name(vertexArray);
+        mesh.positionVao = gpuResources.name(positionArray);
+        mesh.first = 0;
+        mesh.count = (int) indexCount;
+        mesh.indexed = true;
+        return mesh;
+    }
+
+    glm::vec3 center() const {
+        return (boundsMin + boundsMax) * 0.5f;
+    }
+
+    float radius() const {
+        return glm::length(boundsMax - boundsMin) * 0.5f;
+    }
+};
+
+struct StaticBatcher {
+    bool enabled = true;
+    float cellSize = 16.0f;
+    // deque: push_back keeps references valid, build jobs hold a pointer to their chunk's source
+    // (resolved on the main thread) while new ones may be added
+    std::deque<BatchSource> sources;
+    std::vector<BatchChunk> chunks;
+    std::unordered_map<BatchChunkKey, int, BatchChunkKeyHash> chunkOfKey;
+    uint32_t identityNode = noNode;
+
+    // per hierarchy node: chunk and member index, -1 when not batched
+    std::vector<int32_t> chunkOfNode;
+    std::vector<int32_t> memberOfNode;
+    // per hierarchy node: how many chunks' buffers draw it (two while it moves between chunks whose
+    // rebuilds land apart), the caller skips its entity draw while nonzero
+    std::vector<uint8_t> drawnByBatch;
+    std::vector<uint8_t> seen;
+    uint64_t seenStructureVersion = ~0ull;
+
+    std::mutex mutex;
+    std::vector<BatchBuild> completed;
+    int buildsInFlight = 0;
+
+    // world space bounds of chunks whose buffers changed this frame, as spheres (xyz, radius)
+    std::vector<glm::vec4> changedBounds;
+    // for stats
+    uint32_t staticCount = 0;
+    uint64_t rebuilds = 0;
+
+    void init(TransformHierarchy& hierarchy) {
+        identityNode = hierarchy.create(noNode, glm::mat4(1.0f));
+    }
+
+    // registers the vertices behind a mesh's vao, entities with other meshes stay unbatched
+    void addSource(unsigned int vao, const float* vertices, int vertexCount) {
+        BatchSource source;
+        source.vao = vao;
+        std::unordered_map<std::string, uint32_t> unique;
+        for (int i = 0; i < vertexCount; i++) {
+            std::string key((const char*) (vertices + i * 11), sizeof(float) * 11);
+            auto found = unique.find(key);
+            if (found == unique.end()) {
+                found = unique.emplace(key, (uint32_t) (source.vertices.size() / 11)).first;
+                source.vertices.insert(source.vertices.end(), vertices + i * 11, vertices + i * 11 + 11);
+            }
+            source.indices.push_back(found->second);
+        }
+        sources.push_back(std::move(source));
+    }
+
+    int sourceOf(unsigned int vao) const {
+        for (size_t i = 0; i < sources.size(); i++) {
+            if (sources[i].vao == vao) return (int) i;
+        }
+        return -1;
+    }
+
+    uint32_t identitySlot(const TransformHierarchy& hierarchy) const {
+        return hierarchy.slot(identityNode);
+    }
+
+    bool drawn(uint32_t node) const {
+        return node < drawnByBatch.size() && drawnByBatch[node];
+    }
+
+    int chunkFor(int material, int source, const glm::vec3& position) {
+        BatchChunkKey key = { material, source, (int32_t) floorf(position.x / cellSize), (int32_t) floorf(position.y / cellSize),
+                              (int32_t) floorf(position.z / cellSize) };
+        auto found = chunkOfKey.find(key);
+        if (found != chunkOfKey.end()) return found->second;
+        chunks.push_back(BatchChunk());
+        chunks.back().material = material;
+        chunks.back().source = source;
+        chunkOfKey[key] = (int) chunks.size() - 1;
+        return (int) chunks.size() - 1;
+    }
+
+    void growNodeArrays(uint32_t node) {
+        if (node < chunkOfNode.size()) return;
+        size_t size = std::max((size_t) node + 1, chunkOfNode.size() * 2);
+        chunkOfNode.resize(size, -1);
+        memberOfNode.resize(size, -1);
+        drawnByBatch.resize(size, 0);
+        seen.resize(size, 0);
+    }
+
+    void addMember(uint32_t node, int material, int source, const glm::mat4& world) {
+        int c = chunkFor(material, source, glm::vec3(world[3]));
+        BatchChunk& chunk = chunks[c];
+        chunkOfNode[node] = c;
+        memberOfNode[node] = (int32_t) chunk.members.size();
+        chunk.members.push_back({ node, source, world });
+        touch(chunk);
+    }
+
+    void removeMember(uint32_t node) {
+        BatchChunk& chunk = chunks[chunkOfNode[node]];
+        int32_t index = memberOfNode[node];
+        chunk.members[index] = chunk.members.back();
+        memberOfNode[chunk.members[index].node] = index;
+        chunk.members.pop_back();
+        chunkOfNode[node] = -1;
+        memberOfNode[node] = -1;
+        // still masked, the chunk's current buffers draw it until the rebuild without it lands
+        touch(chunk);
+    }
+
+    void touch(BatchChunk& chunk) {
+        chunk.generation++;
+        chunk.dirty = true;
+    }
+
+    // Once per frame after hierarchy.update(): finds changed chunks, starts their rebuilds and
+    // swaps in the ones that finished.
+    void update(World& world, const TransformHierarchy& hierarchy) {
+        changedBounds.clear();
+        if (!enabled) return;
+        if (world.structureVersion != seenStructureVersion) {
+            seenStructureVersion = world.structureVersion;
+            scanMembers(world, hierarchy);
+        }
+        for (const SlotRange& range : hierarchy.changedRanges) {
+            for (uint32_t slot = range.begin; slot < range.end; slot++) {
+                uint32_t node = hierarchy.nodeOfSlot[slot];
+                if (node >= chunkOfNode.size() || chunkOfNode[node] < 0) continue;
+                BatchMember& member = chunks[chunkOfNode[node]].members[memberOfNode[node]];
+                // a layout rebuild reports every slot, most didn't actually move
+                if (member.world == hierarchy.world[slot]) continue;
+                int source = member.source;
+                int material = chunks[chunkOfNode[node]].material;
+                removeMember(node);
+                addMember(node, material, source, hierarchy.world[slot]);
+            }
+        }
+        schedule();
+        collect();
+    }
+
+    // membership after entities were created, destroyed or changed components
+    void scanMembers(World& world, const TransformHierarchy& hierarchy) {
+        staticCount = 0;
+        world.forEachChunk(componentMask<StaticMesh, HierarchyNode, Mesh, MaterialRef>(), [&](Chunk& chunk) {
+            const HierarchyNode* nodes = chunk.array<HierarchyNode>();
+            const Mesh* meshes = chunk.array<Mesh>();
+            const MaterialRef* materialRefs = chunk.array<MaterialRef>();
+            for (uint32_t i = 0; i < chunk.count; i++) {
+                int source = sourceOf(meshes[i].vao);
+                if (source < 0) continue;
+                uint32_t node = nodes[i].node;
+                growNodeArrays(node);
+                seen[node] = 1;
+                staticCount++;
+                int current = chunkOfNode[node];
+                if (current >= 0 && chunks[current].material == materialRefs[i].material && chunks[current].source == source) continue;
+                if (current >= 0) removeMember(node);
+                addMember(node, materialRefs[i].material, source, hierarchy.worldMatrix(node));
+            }
+        });
+        for (BatchChunk& chunk : chunks) {
+            for (size_t i = 0; i < chunk.members.size();) {
+                uint32_t node = chunk.members[i].node;
+                if (seen[node]) {
+                    seen[node] = 0;
+                    i++;
+                } else {
+                    // gone, the last member moved into slot i
+                    removeMember(node);
+                }
+            }
+        }
+    }
+
+    void schedule() {
+        for (size_t c = 0; c < chunks.size(); c++) {
+            BatchChunk& chunk = chunks[c];
+            if (!chunk.dirty || chunk.building) continue;
+            chunk.dirty = false;
+            chunk.building = true;
+            buildsInFlight++;
+            std::vector<BatchMember> members = chunk.members;
+            // every member of a chunk has the chunk's source
+            const BatchSource* source = &sources[chunk.source];
+            int index = (int) c;
+            uint64_t generation = chunk.generation;
+            jobs.submit([this, members, source, index, generation]() { build(members, *source, index, generation); });
+        }
+    }
+
+    // worker side, never indexes `sources`, addSource may be growing it
+    void build(const std::vector<BatchMember>& members, const BatchSource& source, int chunk, uint64_t generation) {
+        BatchBuild result;
+        result.chunk = chunk;
+        result.generation = generation;
+        result.boundsMin = glm::vec3(1e30f);
+        result.boundsMax = glm::vec3(-1e30f);
+        result.maxScale = 0.0f;
+        size_t vertexCount = source.vertices.size() / 11 * members.size();
+        result.vertices.reserve(vertexCount * 11);
+        result.positions.reserve(vertexCount * 3);
+        result.indices.reserve(source.indices.size() * members.size());
+        result.nodes.reserve(members.size());
+        for (const BatchMember& member : members) {
+            glm::mat3 normalMatrix = glm::mat3(member.world);
+            uint32_t base = (uint32_t) (result.vertices.size() / 11);
+            for (size_t v = 0; v < source.vertices.size(); v += 11) {
+                const float* in = &source.vertices[v];
+                // same expressions as cube.vert, so batched and unbatched cubes shade the same
+                glm::vec3 position = glm::vec3(member.world * glm::vec4(in[0], in[1], in[2], 1.0f));
+                glm::vec3 normal = normalMatrix * glm::vec3(in[8], in[9], in[10]);
+                float out[11] = { position.x, position.y, position.z, in[3], in[4], in[5], in[6], in[7], normal.x, normal.y, normal.z };
+                result.vertices.insert(result.vertices.end(), out, out + 11);
+                result.positions.insert(result.positions.end(), out, out + 3);
+                result.boundsMin = glm::min(result.boundsMin, position);
+                result.boundsMax = glm::max(result.boundsMax, position);
+            }
+            for (uint32_t index : source.indices) result.indices.push_back(base + index);
+            float scale = fmaxf(glm::length(glm::vec3(member.world[0])),
+                                fmaxf(glm::length(glm::vec3(member.world[1])), glm::length(glm::vec3(member.world[2]))));
+            result.maxScale = fmaxf(result.maxScale, scale);
+            result.nodes.push_back(member.node);
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        completed.push_back(std::move(result));
+    }
+
+    void collect() {
+        std::vector<BatchBuild> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (completed.empty()) return;
+            ready.swap(completed);
+        }
+        for (BatchBuild& result : ready) {
+            BatchChunk& chunk = chunks[result.chunk];
+            chunk.building = false;
+            buildsInFlight--;
+            // changed again while building, the next build replaces it
+            if (result.generation != chunk.generation) continue;
+            if (chunk.indexCount > 0) changedBounds.push_back(glm::vec4(chunk.center(), chunk.radius()));
+            upload(chunk, result);
+            if (chunk.indexCount > 0) changedBounds.push_back(glm::vec4(chunk.center(), chunk.radius()));
+            rebuilds++;
+        }
+    }
+
+    void upload(BatchChunk& chunk, BatchBuild& result) {
+        for (uint32_t node : chunk.builtNodes) drawnByBatch[node]--;
+        for (uint32_t node : result.nodes) drawnByBatch[node]++;
+        chunk.builtNodes.swap(result.nodes);
+        chunk.indexCount = (uint32_t) result.indices.size();
+        chunk.boundsMin = result.boundsMin;
+        chunk.boundsMax = result.boundsMax;
+        chunk.maxScale = result.maxScale;
+        if (chunk.indexCount == 0) {
+            releaseBuffers(chunk);
+            return;
+        }
+        if (!gpuResources.valid(chunk.vertexArray)) createBuffers(chunk);
+        size_t vertexBytes = result.vertices.size() * sizeof(float);
+        size_t positionBytes = result.positions.size() * sizeof(float);
+        size_t indexBytes = result.indices.size() * sizeof(uint32_t);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(chunk.vertexBuffer));
+        glBufferData(GL_ARRAY_BUFFER, vertexBytes, result.vertices.data(), GL_STATIC_DRAW);
+        gpuResources.setBytes(chunk.vertexBuffer, vertexBytes);
+        glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(chunk.positionBuffer));
+        glBufferData(GL_ARRAY_BUFFER, positionBytes, result.positions.data(), GL_STATIC_DRAW);
+        gpuResources.setBytes(chunk.positionBuffer, positionBytes);
+        // the element binding is vertex array state
+        glBindVertexArray(gpuResources.name(chunk.vertexArray));
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, gpuResources.name(chunk.indexBuffer));
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexBytes, result.indices.data(), GL_STATIC_DRAW);
+        gpuResources.setBytes(chunk.indexBuffer, indexBytes);
+        glBindVertexArray(0);
+    }
+
+    void createBuffers(BatchChunk& chunk) {
+        chunk.vertexBuffer = GPU_CREATE(ResourceBuffer, "static batches");
+        chunk.positionBuffer = GPU_CREATE(ResourceBuffer, "static batches");
+        chunk.indexBuffer = GPU_CREATE(ResourceBuffer, "static batches");
+        chunk.vertexArray = GPU_CREATE(ResourceVertexArray, "static batches");
+        chunk.positionArray = GPU_CREATE(ResourceVertexArray, "static batches");
+        setupIndexedArrays(chunk.vertexArray, chunk.positionArray, chunk.vertexBuffer, chunk.positionBuffer, chunk.indexBuffer);
+    }
+
+    void releaseBuffers(BatchChunk& chunk) {
+        gpuResources.release(chunk.vertexArray);
+        gpuResources.release(chunk.positionArray);
+        gpuResources.release(chunk.vertexBuffer);
+        gpuResources.release(chunk.positionBuffer);
+        gpuResources.release(chunk.indexBuffer);
+    }
+
+    // after update(): waits for the rebuilds it started, so the frame draws fully batched
+    // (regression suite)
+    void settle() {
+        while (buildsInFlight > 0) {
+            jobs.waitIdle();
+            collect();
+            schedule();
+        }
+    }
+
+    int builtChunks() const {
+        int count = 0;
+        for (const BatchChunk& chunk : chunks) {
+            if (chunk.indexCount > 0) count++;
+        }
+        return count;
+    }
+
+    void release() {
+        jobs.waitIdle();
+        collect();
+        for (BatchChunk& chunk : chunks) releaseBuffers(chunk);
+    }
+};
+
+#endif /* batching_h */
@@ -0,0 +1,1401 @@
+//
+//  capture.h
+//  app
+//
+
+#ifndef capture_h
+#define capture_h
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <unordered_map>
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+
+// GL frame capture and replay.
+//
+//   app --capture <file> [--capture-first 60] [--capture-frames 1]   capture, then quit
+//   app --replay <file> [--replay-loops 100]                         replay and time it
+//
+// Capture swaps the glad_gl* pointers gladLoadGL resolved for hooks that serialize each call
+// before forwarding it. Everything that builds state (objects, uploads, bindings, uniforms) is
+// recorded from startup on, so the stream is self contained; draws, clears, readbacks, queries
+// and syncs only in the selected frames. Getters aren't recorded, replay doesn't need them.
+//
+// The stream is a sequence of blobs and calls. A call is an opcode plus the id of the blob holding
+// its arguments; pointer arguments (buffer and texture data, shader sources, uniform arrays) are
+// blobs of their own referenced from the arguments. Blobs are deduplicated (hash, then bytes), so a frame
+// that repeats last frame's calls costs a few bytes per call and data uploaded twice is stored once.
+// Object names are stored as the app saw them, replay maps them to the names its own context hands out.
+//
+// Only the render thread is captured. Calls outside CAPTURE_CALLS pass through unrecorded, add
+// new entry points there when the renderer starts using them.
+//
+// File layout, little endian, counts and ids as LEB128 varints:
+//   "GLCAPTUR" u32 version u32 width u32 height, then records:
+//   RecordBlob size bytes | RecordCall opcode blob | RecordFrame | RecordSetupEnd
+
+const uint32_t captureVersion = 1;
+
+enum CaptureRecord {
+    RecordBlob = 1,
+    RecordCall = 2,
+    // end of a captured frame
+    RecordFrame = 3,
+    // setup done, captured frames follow
+    RecordSetupEnd = 4
+};
+
+// state calls are recorded from startup, work calls only in the captured frames
+enum CaptureKind {
+    CaptureState,
+    CaptureWork
+};
+
+#define CAPTURE_CALLS(X) \
+    X(ActiveTexture) X(BindTexture) X(TexParameteri) X(BindFramebuffer) X(BindBuffer) X(UseProgram) \
+    X(BindVertexArray) X(Uniform1i) X(Uniform3i) X(Uniform1f) X(Uniform2f) X(Uniform3f) X(Uniform4f) \
+    X(UniformMatrix4fv) X(GetUniformLocation) X(Viewport) X(Enable) X(Disable) X(DepthMask) X(DepthFunc) \
+    X(ColorMask) X(PolygonOffset) X(PolygonMode) X(ClearColor) X(PixelStorei) X(DrawBuffer) X(DrawBuffers) \
+    X(ReadBuffer) X(GenTextures) X(GenBuffers) X(GenVertexArrays) X(GenFramebuffers) X(GenRenderbuffers) \
+    X(GenQueries) X(DeleteTextures) X(DeleteBuffers) X(DeleteVertexArrays) X(DeleteFramebuffers) \
+    X(DeleteRenderbuffers) X(DeleteQueries) X(CreateShader) X(ShaderSource) X(CompileShader) X(DeleteShader) \
+    X(CreateProgram) X(AttachShader) X(LinkProgram) X(ValidateProgram) X(DeleteProgram) X(BufferData) \
+    X(BufferSubData) X(CopyBufferSubData) X(TexBuffer) X(TexImage2D) X(TexImage3D) X(TexSubImage2D) \
+    X(TexStorage2D) X(CompressedTexImage2D) X(CompressedTexSubImage2D) X(GenerateMipmap) \
+    X(VertexAttribPointer) X(EnableVertexAttribArray) X(BindRenderbuffer) X(RenderbufferStorage) \
+    X(FramebufferTexture2D) X(FramebufferTextureLayer) X(FramebufferRenderbuffer) X(Clear) X(DrawArrays) \
+    X(DrawElements) X(MultiDrawElements) X(CopyTexSubImage2D) X(ReadPixels) X(BeginQuery) X(EndQuery) X(QueryCounter) \
+    X(FenceSync) X(ClientWaitSync) X(DeleteSync) X(Flush) X(Finish) X(MapBufferRange) X(UnmapBuffer) \
+    X(VertexAttribDivisor) X(DrawArraysInstanced) X(BlendFunc) X(ColorMaski) X(BindBufferBase) \
+    X(TransformFeedbackVaryings) X(BeginTransformFeedback) X(EndTransformFeedback)
+
+enum CaptureCall : uint16_t {
+#define CAPTURE_ENUM(name) Call##name,
+    CAPTURE_CALLS(CAPTURE_ENUM)
+#undef CAPTURE_ENUM
+    CallCount
+};
+
+// what gladLoadGL resolved, the hooks forward here
+#define CAPTURE_REAL(name) static decltype(glad_gl##name) real##name = NULL;
+CAPTURE_CALLS(CAPTURE_REAL)
+#undef CAPTURE_REAL
+
+// bytes glTexImage* / glReadPixels touch in client memory for that format and pixel store
+size_t capturePixelBytes(GLenum format, GLenum type) {
+    size_t components = 4;
+    if (format == GL_RED || format == GL_RED_INTEGER || format == GL_DEPTH_COMPONENT || format == GL_STENCIL_INDEX) components = 1;
+    else if (format == GL_RG || format == GL_RG_INTEGER) components = 2;
+    else if (format == GL_RGB || format == GL_BGR || format == GL_RGB_INTEGER) components = 3;
+    switch (type) {
+        case GL_UNSIGNED_BYTE: case GL_BYTE: return components;
+        case GL_UNSIGNED_SHORT: case GL_SHORT: case GL_HALF_FLOAT: return components * 2;
+        case GL_UNSIGNED_INT: case GL_INT: case GL_FLOAT: return components * 4;
+        case GL_UNSIGNED_SHORT_5_6_5: case GL_UNSIGNED_SHORT_4_4_4_4: case GL_UNSIGNED_SHORT_5_5_5_1: return 2;
+        case GL_FLOAT_32_UNSIGNED_INT_24_8_REV: return 8;
+        default: return 4; // 24_8, 8_8_8_8, 2_10_10_10, 10F_11F_11F, 5_9_9_9
+    }
+}
+
+size_t captureImageBytes(int width, int height, int depth, GLenum format, GLenum type, int alignment, int rowLength) {
+    if (width <= 0 || height <= 0 || depth <= 0) return 0;
+    size_t pixel = capturePixelBytes(format, type);
+    size_t row = (size_t) (rowLength > 0 ? rowLength : width) * pixel;
+    row = (row + alignment - 1) / alignment * alignment;
+    return row * ((size_t) height * depth - 1) + (size_t) width * pixel;
+}
+
+uint64_t captureHash(const void* data, size_t size) {
+    // FNV-1a
+    const unsigned char* bytes = (const unsigned char*) data;
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ull;
+    }
+    return hash ^ (uint64_t) size;
+}
+
+struct GlCapture {
+    // options, set before initOpenGl
+    bool armed = false;
+    std::string path;
+    uint64_t firstFrame = 60;
+    uint64_t frameCount = 1;
+
+    FILE* file = NULL;
+    std::thread::id thread;
+    uint64_t frame = 0;
+    bool capturing = false;
+    bool done = false;
+
+    // hash -> blob ids, with a copy of every blob's bytes to rule out hash collisions
+    std::unordered_multimap<uint64_t, uint32_t> blobs;
+    std::vector<unsigned char> blobStore;
+    std::vector<size_t> blobOffsets;
+    uint32_t blobCount = 0;
+    std::vector<unsigned char> args;
+    CaptureCall call = CallCount;
+
+    // client memory sizes depend on these
+    GLint unpackAlignment = 4;
+    GLint unpackRowLength = 0;
+    GLint packAlignment = 4;
+    GLint packRowLength = 0;
+    GLuint unpackBuffer = 0;
+    GLuint packBuffer = 0;
+
+    // for the report
+    uint64_t calls = 0;
+    uint64_t blobBytes = 0;
+    uint64_t dedupedBytes = 0;
+    uint64_t streamBytes = 0;
+
+    void writeBytes(const void* data, size_t size) {
+        fwrite(data, 1, size, file);
+        streamBytes += size;
+    }
+
+    void writeVarint(uint64_t value) {
+        unsigned char bytes[10];
+        size_t count = 0;
+        do {
+            bytes[count] = (unsigned char) (value & 0x7f);
+            value >>= 7;
+            if (value) bytes[count] |= 0x80;
+            count++;
+        } while (value);
+        writeBytes(bytes, count);
+    }
+
+    // id of a blob with those bytes, written to the stream the first time they're seen
+    uint32_t blob(const void* data, size_t size) {
+        uint64_t hash = captureHash(data, size);
+        auto range = blobs.equal_range(hash);
+        for (auto found = range.first; found != range.second; ++found) {
+            size_t offset = blobOffsets[found->second];
+            size_t end = found->second + 1 < blobOffsets.size() ? blobOffsets[found->second + 1] : blobStore.size();
+            if (end - offset == size && (size == 0 || memcmp(blobStore.data() + offset, data, size) == 0)) {
+                dedupedBytes += size;
+                return found->second;
+            }
+        }
+        unsigned char tag = RecordBlob;
+        writeBytes(&tag, 1);
+        writeVarint(size);
+        writeBytes(data, size);
+        blobBytes += size;
+        blobOffsets.push_back(blobStore.size());
+        blobStore.insert(blobStore.end(), (const unsigned char*) data, (const unsigned char*) data + size);
+        blobs.emplace(hash, blobCount);
+        return blobCount++;
+    }
+
+    // whether the calling hook should record, starts the call's argument list
+    bool begin(CaptureCall id, CaptureKind kind) {
+        if (file == NULL || std::this_thread::get_id() != thread) return false;
+        if (kind == CaptureWork && !capturing) return false;
+        call = id;
+        args.clear();
+        return true;
+    }
+
+    template <typename T>
+    void put(T value) {
+        size_t at = args.size();
+        args.resize(at + sizeof(T));
+        memcpy(&args[at], &value, sizeof(T));
+    }
+
+    void putAll() {}
+
+    template <typename T, typename... Rest>
+    void putAll(T value, Rest... rest) {
+        put(value);
+        putAll(rest...);
+    }
+
+    void putArray(const void* data, size_t size) {
+        size_t at = args.size();
+        args.resize(at + size);
+        if (size) memcpy(&args[at], data, size);
+    }
+
+    // pointer argument: blob id, ~0 for NULL
+    void putData(const void* data, size_t size) {
+        put<uint32_t>(data ? blob(data, size) : ~0u);
+    }
+
+    void end() {
+        uint32_t id = blob(args.data(), args.size());
+        unsigned char tag = RecordCall;
+        writeBytes(&tag, 1);
+        writeVarint(call);
+        writeVarint(id);
+        calls++;
+    }
+
+    void marker(CaptureRecord record) {
+        unsigned char tag = (unsigned char) record;
+        writeBytes(&tag, 1);
+    }
+
+    bool install(GLFWwindow* window);
+    void uninstall();
+
+    // once per frame, after the swap
+    void endFrame(GLFWwindow* window) {
+        if (file == NULL) return;
+        if (capturing) marker(RecordFrame);
+        frame++;
+        if (frame == firstFrame) {
+            marker(RecordSetupEnd);
+            capturing = true;
+        }
+        if (frame == firstFrame + frameCount) {
+            finish();
+            glfwSetWindowShouldClose(window, GLFW_TRUE);
+        }
+    }
+
+    void finish() {
+        if (file == NULL) return;
+        uninstall();
+        fclose(file);
+        file = NULL;
+        done = true;
+        blobs.clear();
+        std::vector<unsigned char>().swap(blobStore);
+        std::vector<size_t>().swap(blobOffsets);
+        uint64_t captured = frame > firstFrame ? std::min(frame - firstFrame, frameCount) : 0;
+        std::cout << "[capture] " << captured << " frames from frame " << firstFrame << " to " << path << ": "
+                  << calls << " calls, " << blobCount << " blobs, " << (streamBytes >> 10) << " KB ("
+                  << (dedupedBytes >> 10) << " KB deduplicated)" << std::endl;
+    }
+};
+
+GlCapture glCapture;
+
+// hook for calls whose arguments are all plain values
+template <typename F>
+struct CaptureScalars;
+
+template <typename... A>
+struct CaptureScalars<void (APIENTRYP)(A...)> {
+    template <CaptureCall id, CaptureKind kind, void (APIENTRYP* real)(A...)>
+    static void APIENTRY hook(A... args) {
+        if (glCapture.begin(id, kind)) {
+            glCapture.putAll(args...);
+            glCapture.end();
+        }
+        (*real)(args...);
+    }
+};
+
+template <CaptureCall id, void (APIENTRYP* real)(GLsizei, GLuint*)>
+void APIENTRY captureGenNames(GLsizei n, GLuint* names) {
+    (*real)(n, names);
+    if (glCapture.begin(id, CaptureState)) {
+        glCapture.put(n);
+        glCapture.putArray(names, sizeof(GLuint) * n);
+        glCapture.end();
+    }
+}
+
+template <CaptureCall id, void (APIENTRYP* real)(GLsizei, const GLuint*)>
+void APIENTRY captureDeleteNames(GLsizei n, const GLuint* names) {
+    if (glCapture.begin(id, CaptureState)) {
+        glCapture.put(n);
+        glCapture.putArray(names, sizeof(GLuint) * n);
+        glCapture.end();
+    }
+    (*real)(n, names);
+}
+
+void APIENTRY captureBindBuffer(GLenum target, GLuint buffer) {
+    if (glCapture.begin(CallBindBuffer, CaptureState)) {
+        glCapture.putAll(target, buffer);
+        glCapture.end();
+    }
+    if (target == GL_PIXEL_UNPACK_BUFFER) glCapture.unpackBuffer = buffer;
+    if (target == GL_PIXEL_PACK_BUFFER) glCapture.packBuffer = buffer;
+    realBindBuffer(target, buffer);
+}
+
+void APIENTRY capturePixelStorei(GLenum name, GLint value) {
+    if (glCapture.begin(CallPixelStorei, CaptureState)) {
+        glCapture.putAll(name, value);
+        glCapture.end();
+    }
+    if (name == GL_UNPACK_ALIGNMENT) glCapture.unpackAlignment = value;
+    if (name == GL_UNPACK_ROW_LENGTH) glCapture.unpackRowLength = value;
+    if (name == GL_PACK_ALIGNMENT) glCapture.packAlignment = value;
+    if (name == GL_PACK_ROW_LENGTH) glCapture.packRowLength = value;
+    realPixelStorei(name, value);
+}
+
+void APIENTRY captureUniformMatrix4fv(GLint location, GLsizei count, GLboolean transpose, const GLfloat* value) {
+    if (glCapture.begin(CallUniformMatrix4fv, CaptureState)) {
+        glCapture.putAll(location, count, transpose);
+        glCapture.putArray(value, sizeof(GLfloat) * 16 * count);
+        glCapture.end();
+    }
+    realUniformMatrix4fv(location, count, transpose, value);
+}
+
+GLint APIENTRY captureGetUniformLocation(GLuint program, const GLchar* name) {
+    GLint location = realGetUniformLocation(program, name);
+    if (glCapture.begin(CallGetUniformLocation, CaptureState)) {
+        glCapture.putAll(program, location);
+        glCapture.putData(name, strlen(name) + 1);
+        glCapture.end();
+    }
+    return location;
+}
+
+void APIENTRY captureDrawBuffers(GLsizei n, const GLenum* buffers) {
+    if (glCapture.begin(CallDrawBuffers, CaptureState)) {
+        glCapture.put(n);
+        glCapture.putArray(buffers, sizeof(GLenum) * n);
+        glCapture.end();
+    }
+    realDrawBuffers(n, buffers);
+}
+
+GLuint APIENTRY captureCreateShader(GLenum type) {
+    GLuint shader = realCreateShader(type);
+    if (glCapture.begin(CallCreateShader, CaptureState)) {
+        glCapture.putAll(type, shader);
+        glCapture.end();
+    }
+    return shader;
+}
+
+GLuint APIENTRY captureCreateProgram() {
+    GLuint program = realCreateProgram();
+    if (glCapture.begin(CallCreateProgram, CaptureState)) {
+        glCapture.put(program);
+        glCapture.end();
+    }
+    return program;
+}
+
+void APIENTRY captureShaderSource(GLuint shader, GLsizei count, const GLchar* const* strings, const GLint* lengths) {
+    if (glCapture.begin(CallShaderSource, CaptureState)) {
+        std::string source;
+        for (GLsizei i = 0; i < count; i++) {
+            if (lengths && lengths[i] >= 0) source.append(strings[i], lengths[i]);
+            else source.append(strings[i]);
+        }
+        glCapture.put(shader);
+        glCapture.putData(source.c_str(), source.size() + 1);
+        glCapture.end();
+    }
+    realShaderSource(shader, count, strings, lengths);
+}
+
+void APIENTRY captureBufferData(GLenum target, GLsizeiptr size, const void* data, GLenum usage) {
+    if (glCapture.begin(CallBufferData, CaptureState)) {
+        glCapture.putAll(target, (int64_t) size, usage);
+        glCapture.putData(data, size);
+        glCapture.end();
+    }
+    realBufferData(target, size, data, usage);
+}
+
+void APIENTRY captureBufferSubData(GLenum target, GLintptr offset, GLsizeiptr size, const void* data) {
+    if (glCapture.begin(CallBufferSubData, CaptureState)) {
+        glCapture.putAll(target, (int64_t) offset, (int64_t) size);
+        glCapture.putData(data, size);
+        glCapture.end();
+    }
+    realBufferSubData(target, offset, size, data);
+}
+
+void APIENTRY captureCopyBufferSubData(GLenum readTarget, GLenum writeTarget, GLintptr readOffset, GLintptr writeOffset, GLsizeiptr size) {
+    if (glCapture.begin(CallCopyBufferSubData, CaptureState)) {
+        glCapture.putAll(readTarget, writeTarget, (int64_t) readOffset, (int64_t) writeOffset, (int64_t) size);
+        glCapture.end();
+    }
+    realCopyBufferSubData(readTarget, writeTarget, readOffset, writeOffset, size);
+}
+
+// pixels of an upload: an offset into the bound unpack buffer or a blob of client memory
+void capturePixels(const void* pixels, int width, int height, int depth, GLenum format, GLenum type) {
+    glCapture.put<uint8_t>(glCapture.unpackBuffer != 0);
+    if (glCapture.unpackBuffer != 0) {
+        glCapture.put((uint64_t) (uintptr_t) pixels);
+    } else {
+        glCapture.putData(pixels, captureImageBytes(width, height, depth, format, type,
+                                                    glCapture.unpackAlignment, glCapture.unpackRowLength));
+    }
+}
+
+void APIENTRY captureTexImage2D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLint border,
+                                GLenum format, GLenum type, const void* pixels) {
+    if (glCapture.begin(CallTexImage2D, CaptureState)) {
+        glCapture.putAll(target, level, internalFormat, width, height, border, format, type);
+        capturePixels(pixels, width, height, 1, format, type);
+        glCapture.end();
+    }
+    realTexImage2D(target, level, internalFormat, width, height, border, format, type, pixels);
+}
+
+void APIENTRY captureTexImage3D(GLenum target, GLint level, GLint internalFormat, GLsizei width, GLsizei height, GLsizei depth,
+                                GLint border, GLenum format, GLenum type, const void* pixels) {
+    if (glCapture.begin(CallTexImage3D, CaptureState)) {
+        glCapture.putAll(target, level, internalFormat, width, height, depth, border, format, type);
+        capturePixels(pixels, width, height, depth, format, type);
+        glCapture.end();
+    }
+    realTexImage3D(target, level, internalFormat, width, height, depth, border, format, type, pixels);
+}
+
+void APIENTRY captureTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+                                   GLenum format, GLenum type, const void* pixels) {
+    if (glCapture.begin(CallTexSubImage2D, CaptureState)) {
+        glCapture.putAll(target, level, x, y, width, height, format, type);
+        capturePixels(pixels, width, height, 1, format, type);
+        glCapture.end();
+    }
+    realTexSubImage2D(target, level, x, y, width, height, format, type, pixels);
+}
+
+void APIENTRY captureCompressedTexImage2D(GLenum target, GLint level, GLenum internalFormat, GLsizei width, GLsizei height,
+                                          GLint border, GLsizei imageSize, const void* data) {
+    if (glCapture.begin(CallCompressedTexImage2D, CaptureState)) {
+        glCapture.putAll(target, level, internalFormat, width, height, border, imageSize);
+        glCapture.put<uint8_t>(glCapture.unpackBuffer != 0);
+        if (glCapture.unpackBuffer != 0) glCapture.put((uint64_t) (uintptr_t) data);
+        else glCapture.putData(data, imageSize);
+        glCapture.end();
+    }
+    realCompressedTexImage2D(target, level, internalFormat, width, height, border, imageSize, data);
+}
+
+void APIENTRY captureCompressedTexSubImage2D(GLenum target, GLint level, GLint x, GLint y, GLsizei width, GLsizei height,
+                                             GLenum format, GLsizei imageSize, const void* data) {
+    if (glCapture.begin(CallCompressedTexSubImage2D, CaptureState)) {
+        glCapture.putAll(target, level, x, y, width, height, format, imageSize);
+        glCapture.put<uint8_t>(glCapture.unpackBuffer != 0);
+        if (glCapture.unpackBuffer != 0) glCapture.put((uint64_t) (uintptr_t) data);
+        else glCapture.putData(data, imageSize);
+        glCapture.end();
+    }
+    realCompressedTexSubImage2D(target, level, x, y, width, height, format, imageSize, data);
+}
+
+// core profile: attribute pointers and element indices are always offsets into bound buffers
+void APIENTRY captureVertexAttribPointer(GLuint index, GLint size, GLenum type, GLboolean normalized, GLsizei stride, const void* pointer) {
+    if (glCapture.begin(CallVertexAttribPointer, CaptureState)) {
+        glCapture.putAll(index, size, type, normalized, stride, (uint64_t) (uintptr_t) pointer);
+        glCapture.end();
+    }
+    realVertexAttribPointer(index, size, type, normalized, stride, pointer);
+}
+
+void APIENTRY captureDrawElements(GLenum mode, GLsizei count, GLenum type, const void* indices) {
+    if (glCapture.begin(CallDrawElements, CaptureWork)) {
+        glCapture.putAll(mode, count, type, (uint64_t) (uintptr_t) indices);
+        glCapture.end();
+    }
+    realDrawElements(mode, count, type, indices);
+}
+
+void APIENTRY captureMultiDrawElements(GLenum mode, const GLsizei* count, GLenum type, const void* const* indices, GLsizei drawcount) {
+    if (glCapture.begin(CallMultiDrawElements, CaptureWork)) {
+        glCapture.putAll(mode, type, drawcount);
+        glCapture.putArray(count, sizeof(GLsizei) * drawcount);
+        for (GLsizei i = 0; i < drawcount; i++) glCapture.put((uint64_t) (uintptr_t) indices[i]);
+        glCapture.end();
+    }
+    realMultiDrawElements(mode, count, type, indices, drawcount);
+}
+
+// replay reads into its own memory when the app read into client memory
+void APIENTRY captureReadPixels(GLint x, GLint y, GLsizei width, GLsizei height, GLenum format, GLenum type, void* pixels) {
+    if (glCapture.begin(CallReadPixels, CaptureWork)) {
+        glCapture.putAll(x, y, width, height, format, type, (uint8_t) (glCapture.packBuffer != 0), (uint64_t) (uintptr_t) pixels);
+        glCapture.end();
+    }
+    realReadPixels(x, y, width, height, format, type, pixels);
+}
+
+GLsync APIENTRY captureFenceSync(GLenum condition, GLbitfield flags) {
+    GLsync sync = realFenceSync(condition, flags);
+    if (glCapture.begin(CallFenceSync, CaptureWork)) {
+        glCapture.putAll(condition, flags, (uint64_t) (uintptr_t) sync);
+        glCapture.end();
+    }
+    return sync;
+}
+
+GLenum APIENTRY captureClientWaitSync(GLsync sync, GLbitfield flags, GLuint64 timeout) {
+    if (glCapture.begin(CallClientWaitSync, CaptureWork)) {
+        glCapture.putAll((uint64_t) (uintptr_t) sync, flags, timeout);
+        glCapture.end();
+    }
+    return realClientWaitSync(sync, flags, timeout);
+}
+
+void APIENTRY captureDeleteSync(GLsync sync) {
+    if (glCapture.begin(CallDeleteSync, CaptureWork)) {
+        glCapture.put((uint64_t) (uintptr_t) sync);
+        glCapture.end();
+    }
+    realDeleteSync(sync);
+}
+
+// replay maps and unmaps the same range, the wait for the GPU a mapping implies is part of the frame
+void* APIENTRY captureMapBufferRange(GLenum target, GLintptr offset, GLsizeiptr length, GLbitfield access) {
+    if (glCapture.begin(CallMapBufferRange, CaptureWork)) {
+        glCapture.putAll(target, (int64_t) offset, (int64_t) length, access);
+        glCapture.end();
+    }
+    return realMapBufferRange(target, offset, length, access);
+}
+
+GLboolean APIENTRY captureUnmapBuffer(GLenum target) {
+    if (glCapture.begin(CallUnmapBuffer, CaptureWork)) {
+        glCapture.put(target);
+        glCapture.end();
+    }
+    return realUnmapBuffer(target);
+}
+
+void APIENTRY captureBindBufferBase(GLenum target, GLuint index, GLuint buffer) {
+    if (glCapture.begin(CallBindBufferBase, CaptureState)) {
+        glCapture.putAll(target, index, buffer);
+        glCapture.end();
+    }
+    realBindBufferBase(target, index, buffer);
+}
+
+// names joined with \0 into one blob
+void APIENTRY captureTransformFeedbackVaryings(GLuint program, GLsizei count, const GLchar* const* varyings, GLenum bufferMode) {
+    if (glCapture.begin(CallTransformFeedbackVaryings, CaptureState)) {
+        std::string names;
+        for (GLsizei i = 0; i < count; i++) names.append(varyings[i]).push_back('\0');
+        glCapture.putAll(program, count, bufferMode);
+        glCapture.putData(names.data(), names.size());
+        glCapture.end();
+    }
+    realTransformFeedbackVaryings(program, count, varyings, bufferMode);
+}
+
+#define CAPTURE_SAVE(name) real##name = glad_gl##name;
+#define CAPTURE_RESTORE(name) glad_gl##name = real##name;
+#define CAPTURE_HOOK_SCALARS(name, kind) \
+    glad_gl##name = &CaptureScalars<decltype(glad_gl##name)>::hook<Call##name, kind, &real##name>;
+#define CAPTURE_HOOK(name) glad_gl##name = capture##name;
+
+// Call right after gladLoadGL, before any other GL call, on the render thread.
+bool GlCapture::install(GLFWwindow* window) {
+    file = fopen(path.c_str(), "wb");
+    if (file == NULL) {
+        std::cout << "[capture] can't write " << path << std::endl;
+        return false;
+    }
+    thread = std::this_thread::get_id();
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    writeBytes("GLCAPTUR", 8);
+    uint32_t header[3] = { captureVersion, (uint32_t) width, (uint32_t) height };
+    writeBytes(header, sizeof(header));
+    if (firstFrame == 0) {
+        marker(RecordSetupEnd);
+        capturing = true;
+    }
+
+    CAPTURE_CALLS(CAPTURE_SAVE)
+    CAPTURE_HOOK_SCALARS(ActiveTexture, CaptureState)
+    CAPTURE_HOOK_SCALARS(BindTexture, CaptureState)
+    CAPTURE_HOOK_SCALARS(TexParameteri, CaptureState)
+    CAPTURE_HOOK_SCALARS(BindFramebuffer, CaptureState)
+    CAPTURE_HOOK(BindBuffer)
+    CAPTURE_HOOK_SCALARS(UseProgram, CaptureState)
+    CAPTURE_HOOK_SCALARS(BindVertexArray, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform1i, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform3i, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform1f, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform2f, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform3f, CaptureState)
+    CAPTURE_HOOK_SCALARS(Uniform4f, CaptureState)
+    CAPTURE_HOOK(UniformMatrix4fv)
+    CAPTURE_HOOK(GetUniformLocation)
+    CAPTURE_HOOK_SCALARS(Viewport, CaptureState)
+    CAPTURE_HOOK_SCALARS(Enable, CaptureState)
+    CAPTURE_HOOK_SCALARS(Disable, CaptureState)
+    CAPTURE_HOOK_SCALARS(DepthMask, CaptureState)
+    CAPTURE_HOOK_SCALARS(DepthFunc, CaptureState)
+    CAPTURE_HOOK_SCALARS(ColorMask, CaptureState)
+    CAPTURE_HOOK_SCALARS(PolygonOffset, CaptureState)
+    CAPTURE_HOOK_SCALARS(PolygonMode, CaptureState)
+    CAPTURE_HOOK_SCALARS(ClearColor, CaptureState)
+    CAPTURE_HOOK(PixelStorei)
+    CAPTURE_HOOK_SCALARS(DrawBuffer, CaptureState)
+    CAPTURE_HOOK(DrawBuffers)
+    CAPTURE_HOOK_SCALARS(ReadBuffer, CaptureState)
+    glad_glGenTextures = &captureGenNames<CallGenTextures, &realGenTextures>;
+    glad_glGenBuffers = &captureGenNames<CallGenBuffers, &realGenBuffers>;
+    glad_glGenVertexArrays = &captureGenNames<CallGenVertexArrays, &realGenVertexArrays>;
+    glad_glGenFramebuffers = &captureGenNames<CallGenFramebuffers, &realGenFramebuffers>;
+    glad_glGenRenderbuffers = &captureGenNames<CallGenRenderbuffers, &realGenRenderbuffers>;
+    glad_glGenQueries = &captureGenNames<CallGenQueries, &realGenQueries>;
+    glad_glDeleteTextures = &captureDeleteNames<CallDeleteTextures, &realDeleteTextures>;
+    glad_glDeleteBuffers = &captureDeleteNames<CallDeleteBuffers, &realDeleteBuffers>;
+    glad_glDeleteVertexArrays = &captureDeleteNames<CallDeleteVertexArrays, &realDeleteVertexArrays>;
+    glad_glDeleteFramebuffers = &captureDeleteNames<CallDeleteFramebuffers, &realDeleteFramebuffers>;
+    glad_glDeleteRenderbuffers = &captureDeleteNames<CallDeleteRenderbuffers, &realDeleteRenderbuffers>;
+    glad_glDeleteQueries = &captureDeleteNames<CallDeleteQueries, &realDeleteQueries>;
+    CAPTURE_HOOK(CreateShader)
+    CAPTURE_HOOK(ShaderSource)
+    CAPTURE_HOOK_SCALARS(CompileShader, CaptureState)
+    CAPTURE_HOOK_SCALARS(DeleteShader, CaptureState)
+    CAPTURE_HOOK(CreateProgram)
+    CAPTURE_HOOK_SCALARS(AttachShader, CaptureState)
+    CAPTURE_HOOK_SCALARS(LinkProgram, CaptureState)
+    CAPTURE_HOOK_SCALARS(ValidateProgram, CaptureState)
+    CAPTURE_HOOK_SCALARS(DeleteProgram, CaptureState)
+    CAPTURE_HOOK(BufferData)
+    CAPTURE_HOOK(BufferSubData)
+    CAPTURE_HOOK(CopyBufferSubData)
+    CAPTURE_HOOK_SCALARS(TexBuffer, CaptureState)
+    CAPTURE_HOOK(TexImage2D)
+    CAPTURE_HOOK(TexImage3D)
+    CAPTURE_HOOK(TexSubImage2D)
+    CAPTURE_HOOK_SCALARS(TexStorage2D, CaptureState)
+    CAPTURE_HOOK(CompressedTexImage2D)
+    CAPTURE_HOOK(CompressedTexSubImage2D)
+    CAPTURE_HOOK_SCALARS(GenerateMipmap, CaptureState)
+    CAPTURE_HOOK(VertexAttribPointer)
+    CAPTURE_HOOK_SCALARS(EnableVertexAttribArray, CaptureState)
+    CAPTURE_HOOK_SCALARS(BindRenderbuffer, CaptureState)
+    CAPTURE_HOOK_SCALARS(RenderbufferStorage, CaptureState)
+    CAPTURE_HOOK_SCALARS(FramebufferTexture2D, CaptureState)
+    CAPTURE_HOOK_SCALARS(FramebufferTextureLayer, CaptureState)
+    CAPTURE_HOOK_SCALARS(FramebufferRenderbuffer, CaptureState)
+    CAPTURE_HOOK_SCALARS(Clear, CaptureWork)
+    CAPTURE_HOOK_SCALARS(DrawArrays, CaptureWork)
+    CAPTURE_HOOK(DrawElements)
+    CAPTURE_HOOK(MultiDrawElements)
+    CAPTURE_HOOK_SCALARS(CopyTexSubImage2D, CaptureWork)
+    CAPTURE_HOOK(ReadPixels)
+    CAPTURE_HOOK_SCALARS(BeginQuery, CaptureWork)
+    CAPTURE_HOOK_SCALARS(EndQuery, CaptureWork)
+    CAPTURE_HOOK_SCALARS(QueryCounter, CaptureWork)
+    CAPTURE_HOOK(FenceSync)
+    CAPTURE_HOOK(ClientWaitSync)
+    CAPTURE_HOOK(DeleteSync)
+    CAPTURE_HOOK_SCALARS(Flush, CaptureWork)
+    CAPTURE_HOOK_SCALARS(Finish, CaptureWork)
+    CAPTURE_HOOK(MapBufferRange)
+    CAPTURE_HOOK(UnmapBuffer)
+    CAPTURE_HOOK_SCALARS(VertexAttribDivisor, CaptureState)
+    CAPTURE_HOOK_SCALARS(DrawArraysInstanced, CaptureWork)
+    CAPTURE_HOOK_SCALARS(BlendFunc, CaptureState)
+    CAPTURE_HOOK_SCALARS(ColorMaski, CaptureState)
+    CAPTURE_HOOK(BindBufferBase)
+    CAPTURE_HOOK(TransformFeedbackVaryings)
+    CAPTURE_HOOK_SCALARS(BeginTransformFeedback, CaptureWork)
+    CAPTURE_HOOK_SCALARS(EndTransformFeedback, CaptureWork)
+    std::cout << "[capture] recording to " << path << ", frames " << firstFrame << " to "
+              << firstFrame + frameCount - 1 << std::endl;
+    return true;
+}
+
+void GlCapture::uninstall() {
+    CAPTURE_CALLS(CAPTURE_RESTORE)
+}
+
+#undef CAPTURE_SAVE
+#undef CAPTURE_RESTORE
+#undef CAPTURE_HOOK_SCALARS
+#undef CAPTURE_HOOK
+
+// Replays a capture: the setup once, then the captured frames in a loop.
+struct GlReplay {
+    std::vector<char> data;
+    uint32_t width = 0;
+    uint32_t height = 0;
+
+    struct Blob {
+        size_t offset;
+        size_t size;
+    };
+    struct Call {
+        CaptureCall id;
+        uint32_t args;
+    };
+    std::vector<Blob> blobs;
+    std::vector<Call> calls;
+    // calls before the captured frames, and where each captured frame ends
+    size_t setupEnd = 0;
+    std::vector<size_t> frameEnds;
+
+    // captured name -> replay name, per object type
+    std::unordered_map<GLuint, GLuint> textures, buffers, vertexArrays, framebuffers, renderbuffers, queries, shaders, programs;
+    std::unordered_map<uint64_t, GLsync> syncs;
+    // (captured program, captured location) -> replay location
+    std::unordered_map<uint64_t, GLint> locations;
+    GLuint currentProgram = 0;
+    // scratch for array arguments and client memory readbacks
+    std::vector<GLfloat> floats;
+    std::vector<GLenum> enums;
+    std::vector<GLsizei> counts;
+    std::vector<const void*> offsets;
+    std::vector<unsigned char> readback;
+    // references to objects the stream didn't create (or already deleted)
+    uint64_t unknownNames = 0;
+
+    bool readVarint(size_t& at, uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            if (at >= data.size()) return false;
+            unsigned char byte = (unsigned char) data[at++];
+            value |= (uint64_t) (byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    bool load(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == NULL) {
+            std::cout << "[replay] can't read " << path << std::endl;
+            return false;
+        }
+        fseek(file, 0, SEEK_END);
+        long size = ftell(file);
+        fseek(file, 0, SEEK_SET);
+        data.resize(size > 0 ? size : 0);
+        size_t read = fread(data.data(), 1, data.size(), file);
+        fclose(file);
+        uint32_t header[3];
+        if (read != data.size() || data.size() < 8 + sizeof(header) || memcmp(data.data(), "GLCAPTUR", 8) != 0) {
+            std::cout << "[replay] " << path << " is not a capture" << std::endl;
+            return false;
+        }
+        memcpy(header, data.data() + 8, sizeof(header));
+        if (header[0] != captureVersion) {
+            std::cout << "[replay] " << path << " has version " << header[0] << ", expected " << captureVersion << std::endl;
+            return false;
+        }
+        width = header[1];
+        height = header[2];
+        bool framesStarted = false;
+        size_t at = 8 + sizeof(header);
+        while (at < data.size()) {
+            unsigned char tag = (unsigned char) data[at++];
+            uint64_t a = 0, b = 0;
+            if (tag == RecordBlob) {
+                if (!readVarint(at, a) || at + a > data.size()) break;
+                blobs.push_back({ at, (size_t) a });
+                at += a;
+            } else if (tag == RecordCall) {
+                if (!readVarint(at, a) || !readVarint(at, b) || a >= CallCount || b >= blobs.size()) break;
+                calls.push_back({ (CaptureCall) a, (uint32_t) b });
+            } else if (tag == RecordFrame) {
+                frameEnds.push_back(calls.size());
+            } else if (tag == RecordSetupEnd) {
+                setupEnd = calls.size();
+                framesStarted = true;
+            } else {
+                break;
+            }
+        }
+        if (at != data.size() || !framesStarted || frameEnds.empty()) {
+            std::cout << "[replay] " << path << " is truncated or has no frames" << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    const void* blobData(uint32_t id) {
+        return id < blobs.size() ? data.data() + blobs[id].offset : NULL;
+    }
+
+    GLuint map(std::unordered_map<GLuint, GLuint>& names, GLuint name) {
+        if (name == 0) return 0;
+        auto found = names.find(name);
+        if (found != names.end()) return found->second;
+        unknownNames++;
+        return 0;
+    }
+
+    // reads a call's arguments in the order the hook wrote them
+    struct Reader {
+        const unsigned char* at;
+        template <typename T>
+        T get() {
+            T value;
+            memcpy(&value, at, sizeof(T));
+            at += sizeof(T);
+            return value;
+        }
+    };
+
+    const void* pointerArgument(Reader& in) {
+        uint32_t id = in.get<uint32_t>();
+        return id == ~0u ? NULL : blobData(id);
+    }
+
+    const void* pixelArgument(Reader& in) {
+        if (in.get<uint8_t>()) return (const void*) (uintptr_t) in.get<uint64_t>();
+        return pointerArgument(in);
+    }
+
+    void genNames(Reader& in, std::unordered_map<GLuint, GLuint>& names, void (APIENTRYP gen)(GLsizei, GLuint*),
+                  void (APIENTRYP remove)(GLsizei, const GLuint*)) {
+        GLsizei n = in.get<GLsizei>();
+        for (GLsizei i = 0; i < n; i++) {
+            GLuint captured = in.get<GLuint>();
+            // created again by the next loop over the frames
+            auto found = names.find(captured);
+            if (found != names.end()) remove(1, &found->second);
+            GLuint name = 0;
+            gen(1, &name);
+            names[captured] = name;
+        }
+    }
+
+    void deleteNames(Reader& in, std::unordered_map<GLuint, GLuint>& names, void (APIENTRYP remove)(GLsizei, const GLuint*)) {
+        GLsizei n = in.get<GLsizei>();
+        for (GLsizei i = 0; i < n; i++) {
+            GLuint captured = in.get<GLuint>();
+            auto found = names.find(captured);
+            if (found == names.end()) continue;
+            remove(1, &found->second);
+            names.erase(found);
+        }
+    }
+
+    void execute(const Call& call) {
+        Reader in = { (const unsigned char*) blobData(call.args) };
+        switch (call.id) {
+            case CallActiveTexture: glActiveTexture(in.get<GLenum>()); break;
+            case CallBindTexture: {
+                GLenum target = in.get<GLenum>();
+                glBindTexture(target, map(textures, in.get<GLuint>()));
+                break;
+            }
+            case CallTexParameteri: {
+                GLenum target = in.get<GLenum>();
+                GLenum name = in.get<GLenum>();
+                glTexParameteri(target, name, in.get<GLint>());
+                break;
+            }
+            case CallBindFramebuffer: {
+                GLenum target = in.get<GLenum>();
+                glBindFramebuffer(target, map(framebuffers, in.get<GLuint>()));
+                break;
+            }
+            case CallBindBuffer: {
+                GLenum target = in.get<GLenum>();
+                glBindBuffer(target, map(buffers, in.get<GLuint>()));
+                break;
+            }
+            case CallUseProgram:
+                currentProgram = in.get<GLuint>();
+                glUseProgram(map(programs, currentProgram));
+                break;
+            case CallBindVertexArray: glBindVertexArray(map(vertexArrays, in.get<GLuint>())); break;
+            case CallUniform1i: {
+                GLint location = uniform(in.get<GLint>());
+                glUniform1i(location, in.get<GLint>());
+                break;
+            }
+            case CallUniform3i: {
+                GLint location = uniform(in.get<GLint>());
+                GLint x = in.get<GLint>(), y = in.get<GLint>(), z = in.get<GLint>();
+                glUniform3i(location, x, y, z);
+                break;
+            }
+            case CallUniform1f: {
+                GLint location = uniform(in.get<GLint>());
+                glUniform1f(location, in.get<GLfloat>());
+                break;
+            }
+            case CallUniform2f: {
+                GLint location = uniform(in.get<GLint>());
+                GLfloat x = in.get<GLfloat>(), y = in.get<GLfloat>();
+                glUniform2f(location, x, y);
+                break;
+            }
+            case CallUniform3f: {
+                GLint location = uniform(in.get<GLint>());
+                GLfloat x = in.get<GLfloat>(), y = in.get<GLfloat>(), z = in.get<GLfloat>();
+                glUniform3f(location, x, y, z);
+                break;
+            }
+            case CallUniform4f: {
+                GLint location = uniform(in.get<GLint>());
+                GLfloat x = in.get<GLfloat>(), y = in.get<GLfloat>(), z = in.get<GLfloat>(), w = in.get<GLfloat>();
+                glUniform4f(location, x, y, z, w);
+                break;
+            }
+            case CallUniformMatrix4fv: {
+                GLint location = uniform(in.get<GLint>());
+                GLsizei count = in.get<GLsizei>();
+                GLboolean transpose = in.get<GLboolean>();
+                // the arguments blob is byte aligned
+                floats.resize(16 * count);
+                memcpy(floats.data(), in.at, floats.size() * sizeof(GLfloat));
+                glUniformMatrix4fv(location, count, transpose, floats.data());
+                break;
+            }
+            case CallGetUniformLocation: {
+                GLuint program = in.get<GLuint>();
+                GLint location = in.get<GLint>();
+                GLint replayed = glGetUniformLocation(map(programs, program), (const GLchar*) pointerArgument(in));
+                locations[((uint64_t) program << 32) | (uint32_t) location] = replayed;
+                break;
+            }
+            case CallViewport: {
+                GLint x = in.get<GLint>(), y = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                glViewport(x, y, w, h);
+                break;
+            }
+            case CallEnable: glEnable(in.get<GLenum>()); break;
+            case CallDisable: glDisable(in.get<GLenum>()); break;
+            case CallDepthMask: glDepthMask(in.get<GLboolean>()); break;
+            case CallDepthFunc: glDepthFunc(in.get<GLenum>()); break;
+            case CallColorMask: {
+                GLboolean r = in.get<GLboolean>(), g = in.get<GLboolean>(), b = in.get<GLboolean>(), a = in.get<GLboolean>();
+                glColorMask(r, g, b, a);
+                break;
+            }
+            case CallPolygonOffset: {
+                GLfloat factor = in.get<GLfloat>();
+                glPolygonOffset(factor, in.get<GLfloat>());
+                break;
+            }
+            case CallPolygonMode: {
+                GLenum face = in.get<GLenum>();
+                glPolygonMode(face, in.get<GLenum>());
+                break;
+            }
+            case CallClearColor: {
+                GLfloat r = in.get<GLfloat>(), g = in.get<GLfloat>(), b = in.get<GLfloat>(), a = in.get<GLfloat>();
+                glClearColor(r, g, b, a);
+                break;
+            }
+            case CallPixelStorei: {
+                GLenum name = in.get<GLenum>();
+                glPixelStorei(name, in.get<GLint>());
+                break;
+            }
+            case CallDrawBuffer: glDrawBuffer(in.get<GLenum>()); break;
+            case CallDrawBuffers: {
+                GLsizei n = in.get<GLsizei>();
+                enums.resize(n);
+                memcpy(enums.data(), in.at, n * sizeof(GLenum));
+                glDrawBuffers(n, enums.data());
+                break;
+            }
+            case CallReadBuffer: glReadBuffer(in.get<GLenum>()); break;
+            case CallGenTextures: genNames(in, textures, glGenTextures, glDeleteTextures); break;
+            case CallGenBuffers: genNames(in, buffers, glGenBuffers, glDeleteBuffers); break;
+            case CallGenVertexArrays: genNames(in, vertexArrays, glGenVertexArrays, glDeleteVertexArrays); break;
+            case CallGenFramebuffers: genNames(in, framebuffers, glGenFramebuffers, glDeleteFramebuffers); break;
+            case CallGenRenderbuffers: genNames(in, renderbuffers, glGenRenderbuffers, glDeleteRenderbuffers); break;
+            case CallGenQueries: genNames(in, queries, glGenQueries, glDeleteQueries); break;
+            case CallDeleteTextures: deleteNames(in, textures, glDeleteTextures); break;
+            case CallDeleteBuffers: deleteNames(in, buffers, glDeleteBuffers); break;
+            case CallDeleteVertexArrays: deleteNames(in, vertexArrays, glDeleteVertexArrays); break;
+            case CallDeleteFramebuffers: deleteNames(in, framebuffers, glDeleteFramebuffers); break;
+            case CallDeleteRenderbuffers: deleteNames(in, renderbuffers, glDeleteRenderbuffers); break;
+            case CallDeleteQueries: deleteNames(in, queries, glDeleteQueries); break;
+            case CallCreateShader: {
+                GLenum type = in.get<GLenum>();
+                GLuint captured = in.get<GLuint>();
+                auto found = shaders.find(captured);
+                if (found != shaders.end()) glDeleteShader(found->second);
+                shaders[captured] = glCreateShader(type);
+                break;
+            }
+            case CallShaderSource: {
+                GLuint shader = map(shaders, in.get<GLuint>());
+                const GLchar* source = (const GLchar*) pointerArgument(in);
+                glShaderSource(shader, 1, &source, NULL);
+                break;
+            }
+            case CallCompileShader: glCompileShader(map(shaders, in.get<GLuint>())); break;
+            case CallDeleteShader: {
+                GLuint captured = in.get<GLuint>();
+                glDeleteShader(map(shaders, captured));
+                shaders.erase(captured);
+                break;
+            }
+            case CallCreateProgram: {
+                GLuint captured = in.get<GLuint>();
+                auto found = programs.find(captured);
+                if (found != programs.end()) glDeleteProgram(found->second);
+                programs[captured] = glCreateProgram();
+                break;
+            }
+            case CallAttachShader: {
+                GLuint program = map(programs, in.get<GLuint>());
+                glAttachShader(program, map(shaders, in.get<GLuint>()));
+                break;
+            }
+            case CallLinkProgram: glLinkProgram(map(programs, in.get<GLuint>())); break;
+            case CallValidateProgram: glValidateProgram(map(programs, in.get<GLuint>())); break;
+            case CallDeleteProgram: {
+                GLuint captured = in.get<GLuint>();
+                glDeleteProgram(map(programs, captured));
+                programs.erase(captured);
+                break;
+            }
+            case CallBufferData: {
+                GLenum target = in.get<GLenum>();
+                GLsizeiptr size = (GLsizeiptr) in.get<int64_t>();
+                GLenum usage = in.get<GLenum>();
+                glBufferData(target, size, pointerArgument(in), usage);
+                break;
+            }
+            case CallBufferSubData: {
+                GLenum target = in.get<GLenum>();
+                GLintptr offset = (GLintptr) in.get<int64_t>();
+                GLsizeiptr size = (GLsizeiptr) in.get<int64_t>();
+                glBufferSubData(target, offset, size, pointerArgument(in));
+                break;
+            }
+            case CallCopyBufferSubData: {
+                GLenum readTarget = in.get<GLenum>(), writeTarget = in.get<GLenum>();
+                GLintptr readOffset = (GLintptr) in.get<int64_t>(), writeOffset = (GLintptr) in.get<int64_t>();
+                GLsizeiptr size = (GLsizeiptr) in.get<int64_t>();
+                glCopyBufferSubData(readTarget, writeTarget, readOffset, writeOffset, size);
+                break;
+            }
+            case CallTexBuffer: {
+                GLenum target = in.get<GLenum>(), format = in.get<GLenum>();
+                glTexBuffer(target, format, map(buffers, in.get<GLuint>()));
+                break;
+            }
+            case CallTexImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>(), internalFormat = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                GLint border = in.get<GLint>();
+                GLenum format = in.get<GLenum>(), type = in.get<GLenum>();
+                glTexImage2D(target, level, internalFormat, w, h, border, format, type, pixelArgument(in));
+                break;
+            }
+            case CallTexImage3D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>(), internalFormat = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>(), d = in.get<GLsizei>();
+                GLint border = in.get<GLint>();
+                GLenum format = in.get<GLenum>(), type = in.get<GLenum>();
+                glTexImage3D(target, level, internalFormat, w, h, d, border, format, type, pixelArgument(in));
+                break;
+            }
+            case CallTexSubImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>(), x = in.get<GLint>(), y = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>(), type = in.get<GLenum>();
+                glTexSubImage2D(target, level, x, y, w, h, format, type, pixelArgument(in));
+                break;
+            }
+            case CallTexStorage2D: {
+                GLenum target = in.get<GLenum>();
+                GLsizei levels = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                glTexStorage2D(target, levels, format, w, h);
+                break;
+            }
+            case CallCompressedTexImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>();
+                GLenum format = in.get<GLenum>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                GLint border = in.get<GLint>();
+                GLsizei size = in.get<GLsizei>();
+                glCompressedTexImage2D(target, level, format, w, h, border, size, pixelArgument(in));
+                break;
+            }
+            case CallCompressedTexSubImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>(), x = in.get<GLint>(), y = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>();
+                GLsizei size = in.get<GLsizei>();
+                glCompressedTexSubImage2D(target, level, x, y, w, h, format, size, pixelArgument(in));
+                break;
+            }
+            case CallGenerateMipmap: glGenerateMipmap(in.get<GLenum>()); break;
+            case CallVertexAttribPointer: {
+                GLuint index = in.get<GLuint>();
+                GLint size = in.get<GLint>();
+                GLenum type = in.get<GLenum>();
+                GLboolean normalized = in.get<GLboolean>();
+                GLsizei stride = in.get<GLsizei>();
+                glVertexAttribPointer(index, size, type, normalized, stride, (const void*) (uintptr_t) in.get<uint64_t>());
+                break;
+            }
+            case CallEnableVertexAttribArray: glEnableVertexAttribArray(in.get<GLuint>()); break;
+            case CallBindRenderbuffer: {
+                GLenum target = in.get<GLenum>();
+                glBindRenderbuffer(target, map(renderbuffers, in.get<GLuint>()));
+                break;
+            }
+            case CallRenderbufferStorage: {
+                GLenum target = in.get<GLenum>(), format = in.get<GLenum>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                glRenderbufferStorage(target, format, w, h);
+                break;
+            }
+            case CallFramebufferTexture2D: {
+                GLenum target = in.get<GLenum>(), attachment = in.get<GLenum>(), textureTarget = in.get<GLenum>();
+                GLuint texture = map(textures, in.get<GLuint>());
+                glFramebufferTexture2D(target, attachment, textureTarget, texture, in.get<GLint>());
+                break;
+            }
+            case CallFramebufferTextureLayer: {
+                GLenum target = in.get<GLenum>(), attachment = in.get<GLenum>();
+                GLuint texture = map(textures, in.get<GLuint>());
+                GLint level = in.get<GLint>();
+                glFramebufferTextureLayer(target, attachment, texture, level, in.get<GLint>());
+                break;
+            }
+            case CallFramebufferRenderbuffer: {
+                GLenum target = in.get<GLenum>(), attachment = in.get<GLenum>(), renderbufferTarget = in.get<GLenum>();
+                glFramebufferRenderbuffer(target, attachment, renderbufferTarget, map(renderbuffers, in.get<GLuint>()));
+                break;
+            }
+            case CallClear: glClear(in.get<GLbitfield>()); break;
+            case CallDrawArrays: {
+                GLenum mode = in.get<GLenum>();
+                GLint first = in.get<GLint>();
+                glDrawArrays(mode, first, in.get<GLsizei>());
+                break;
+            }
+            case CallDrawElements: {
+                GLenum mode = in.get<GLenum>();
+                GLsizei count = in.get<GLsizei>();
+                GLenum type = in.get<GLenum>();
+                glDrawElements(mode, count, type, (const void*) (uintptr_t) in.get<uint64_t>());
+                break;
+            }
+            case CallMultiDrawElements: {
+                GLenum mode = in.get<GLenum>();
+                GLenum type = in.get<GLenum>();
+                GLsizei drawcount = in.get<GLsizei>();
+                counts.resize(drawcount);
+                offsets.resize(drawcount);
+                for (GLsizei i = 0; i < drawcount; i++) counts[i] = in.get<GLsizei>();
+                for (GLsizei i = 0; i < drawcount; i++) offsets[i] = (const void*) (uintptr_t) in.get<uint64_t>();
+                glMultiDrawElements(mode, counts.data(), type, offsets.data(), drawcount);
+                break;
+            }
+            case CallCopyTexSubImage2D: {
+                GLenum target = in.get<GLenum>();
+                GLint level = in.get<GLint>(), xoffset = in.get<GLint>(), yoffset = in.get<GLint>();
+                GLint x = in.get<GLint>(), y = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                glCopyTexSubImage2D(target, level, xoffset, yoffset, x, y, w, h);
+                break;
+            }
+            case CallReadPixels: {
+                GLint x = in.get<GLint>(), y = in.get<GLint>();
+                GLsizei w = in.get<GLsizei>(), h = in.get<GLsizei>();
+                GLenum format = in.get<GLenum>(), type = in.get<GLenum>();
+                bool packBuffer = in.get<uint8_t>() != 0;
+                uint64_t pointer = in.get<uint64_t>();
+                if (packBuffer) {
+                    glReadPixels(x, y, w, h, format, type, (void*) (uintptr_t) pointer);
+                } else {
+                    GLint alignment = 4, rowLength = 0;
+                    glGetIntegerv(GL_PACK_ALIGNMENT, &alignment);
+                    glGetIntegerv(GL_PACK_ROW_LENGTH, &rowLength);
+                    readback.resize(captureImageBytes(w, h, 1, format, type, alignment, rowLength));
+                    glReadPixels(x, y, w, h, format, type, readback.data());
+                }
+                break;
+            }
+            case CallBeginQuery: {
+                GLenum target = in.get<GLenum>();
+                glBeginQuery(target, map(queries, in.get<GLuint>()));
+                break;
+            }
+            case CallEndQuery: glEndQuery(in.get<GLenum>()); break;
+            case CallQueryCounter: {
+                GLuint query = map(queries, in.get<GLuint>());
+                glQueryCounter(query, in.get<GLenum>());
+                break;
+            }
+            case CallFenceSync: {
+                GLenum condition = in.get<GLenum>();
+                GLbitfield flags = in.get<GLbitfield>();
+                uint64_t captured = in.get<uint64_t>();
+                auto found = syncs.find(captured);
+                if (found != syncs.end()) glDeleteSync(found->second);
+                syncs[captured] = glFenceSync(condition, flags);
+                break;
+            }
+            case CallClientWaitSync: {
+                auto found = syncs.find(in.get<uint64_t>());
+                GLbitfield flags = in.get<GLbitfield>();
+                GLuint64 timeout = in.get<GLuint64>();
+                if (found != syncs.end()) glClientWaitSync(found->second, flags, timeout);
+                break;
+            }
+            case CallDeleteSync: {
+                auto found = syncs.find(in.get<uint64_t>());
+                if (found == syncs.end()) break;
+                glDeleteSync(found->second);
+                syncs.erase(found);
+                break;
+            }
+            case CallFlush: glFlush(); break;
+            case CallFinish: glFinish(); break;
+            case CallMapBufferRange: {
+                GLenum target = in.get<GLenum>();
+                GLintptr offset = (GLintptr) in.get<int64_t>();
+                GLsizeiptr length = (GLsizeiptr) in.get<int64_t>();
+                glMapBufferRange(target, offset, length, in.get<GLbitfield>());
+                break;
+            }
+            case CallUnmapBuffer: glUnmapBuffer(in.get<GLenum>()); break;
+            case CallVertexAttribDivisor: {
+                GLuint index = in.get<GLuint>();
+                glVertexAttribDivisor(index, in.get<GLuint>());
+                break;
+            }
+            case CallDrawArraysInstanced: {
+                GLenum mode = in.get<GLenum>();
+                GLint first = in.get<GLint>();
+                GLsizei count = in.get<GLsizei>();
+                glDrawArraysInstanced(mode, first, count, in.get<GLsizei>());
+                break;
+            }
+            case CallBlendFunc: {
+                GLenum source = in.get<GLenum>();
+                glBlendFunc(source, in.get<GLenum>());
+                break;
+            }
+            case CallColorMaski: {
+                GLuint index = in.get<GLuint>();
+                GLboolean r = in.get<GLboolean>(), g = in.get<GLboolean>(), b = in.get<GLboolean>(), a = in.get<GLboolean>();
+                glColorMaski(index, r, g, b, a);
+                break;
+            }
+            case CallBindBufferBase: {
+                GLenum target = in.get<GLenum>();
+                GLuint index = in.get<GLuint>();
+                glBindBufferBase(target, index, map(buffers, in.get<GLuint>()));
+                break;
+            }
+            case CallTransformFeedbackVaryings: {
+                GLuint program = map(programs, in.get<GLuint>());
+                GLsizei count = in.get<GLsizei>();
+                GLenum bufferMode = in.get<GLenum>();
+                const GLchar* names = (const GLchar*) pointerArgument(in);
+                std::vector<const GLchar*> varyings;
+                for (GLsizei i = 0; i < count && names; i++) {
+                    varyings.push_back(names);
+                    names += strlen(names) + 1;
+                }
+                glTransformFeedbackVaryings(program, (GLsizei) varyings.size(), varyings.data(), bufferMode);
+                break;
+            }
+            case CallBeginTransformFeedback: glBeginTransformFeedback(in.get<GLenum>()); break;
+            case CallEndTransformFeedback: glEndTransformFeedback(); break;
+            case CallCount: break;
+        }
+    }
+
+    // uniform location in the replayed program for a location the app got for its program
+    GLint uniform(GLint location) {
+        if (location < 0) return location;
+        auto found = locations.find(((uint64_t) currentProgram << 32) | (uint32_t) location);
+        return found != locations.end() ? found->second : -1;
+    }
+
+    // releases whatever the stream left alive
+    void release() {
+        for (auto& name : textures) glDeleteTextures(1, &name.second);
+        for (auto& name : buffers) glDeleteBuffers(1, &name.second);
+        for (auto& name : vertexArrays) glDeleteVertexArrays(1, &name.second);
+        for (auto& name : framebuffers) glDeleteFramebuffers(1, &name.second);
+        for (auto& name : renderbuffers) glDeleteRenderbuffers(1, &name.second);
+        for (auto& name : queries) glDeleteQueries(1, &name.second);
+        for (auto& name : shaders) glDeleteShader(name.second);
+        for (auto& name : programs) glDeleteProgram(name.second);
+        for (auto& sync : syncs) glDeleteSync(sync.second);
+    }
+};
+
+// "--replay <file>": runs the setup once, then times `loops` passes over the captured frames.
+// Reports the CPU time spent submitting each frame and its GPU time from timestamp queries (the
+// stream may hold GL_TIME_ELAPSED queries of its own, those can't nest).
+int runReplay(GLFWwindow* window, const char* path, int loops) {
+    GlReplay replay;
+    if (!replay.load(path)) return 1;
+    int width = 0, height = 0;
+    glfwGetFramebufferSize(window, &width, &height);
+    if ((uint32_t) width != replay.width || (uint32_t) height != replay.height) {
+        std::cout << "[replay] captured at " << replay.width << "x" << replay.height << ", window is " << width << "x" << height << std::endl;
+    }
+    glfwSwapInterval(0);
+    for (size_t i = 0; i < replay.setupEnd; i++) replay.execute(replay.calls[i]);
+    glFinish();
+
+    size_t frameCount = replay.frameEnds.size();
+    std::vector<double> cpu, gpu;
+    GLuint timers[2];
+    glGenQueries(2, timers);
+    for (int loop = 0; loop < std::max(loops, 1); loop++) {
+        size_t first = replay.setupEnd;
+        for (size_t frame = 0; frame < frameCount; frame++) {
+            glQueryCounter(timers[0], GL_TIMESTAMP);
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = first; i < replay.frameEnds[frame]; i++) replay.execute(replay.calls[i]);
+            auto end = std::chrono::steady_clock::now();
+            glQueryCounter(timers[1], GL_TIMESTAMP);
+            first = replay.frameEnds[frame];
+            glfwSwapBuffers(window);
+            glfwPollEvents();
+            // waits for the frame, keeps frames from overlapping in the GPU numbers
+            GLuint64 gpuStart = 0, gpuEnd = 0;
+            glGetQueryObjectui64v(timers[0], GL_QUERY_RESULT, &gpuStart);
+            glGetQueryObjectui64v(timers[1], GL_QUERY_RESULT, &gpuEnd);
+            cpu.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            gpu.push_back((gpuEnd - gpuStart) / 1e6);
+        }
+    }
+    glDeleteQueries(2, timers);
+    replay.release();
+
+    auto summary = [](std::vector<double>& samples, const char* name) {
+        std::sort(samples.begin(), samples.end());
+        double sum = 0.0;
+        for (double sample : samples) sum += sample;
+        std::cout << "[replay] " << name << " min " << samples.front() << " ms, median " << samples[samples.size() / 2]
+                  << " ms, mean " << sum / samples.size() << " ms, max " << samples.back() << " ms" << std::endl;
+    };
+    std::cout << "[replay] " << path << ": " << replay.setupEnd << " setup calls, " << frameCount << " frames of "
+              << (replay.calls.size() - replay.setupEnd) / frameCount << " calls, " << std::max(loops, 1) << " loops, "
+              << replay.blobs.size() << " blobs, " << (replay.data.size() >> 10) << " KB" << std::endl;
+    summary(cpu, "cpu submit");
+    summary(gpu, "gpu");
+    if (replay.unknownNames > 0) {
+        std::cout << "[replay] " << replay.unknownNames << " references to objects the stream didn't create, "
+                  << "later loops may differ from the first" << std::endl;
+    }
+    return 0;
+}
+
+#endif /* capture_h */
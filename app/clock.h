@@ -0,0 +1,45 @@
+//
+//  clock.h
+//  app
+//
+
+#ifndef clock_h
+#define clock_h
+
+#include <GLFW/glfw3.h>
+
+// Every time-dependent value in a frame (deltaTime, the ucolor animation, cube rotations)
+// reads the clock exactly once per frame through this interface, so a run can be pinned
+// to a fixed time sequence by swapping the implementation.
+struct Clock {
+    virtual ~Clock() {}
+    // seconds since the clock started, sampled once at the start of every frame
+    virtual double tick() = 0;
+};
+
+// wall clock, what the interactive loop uses
+struct SystemClock : Clock {
+    double tick() override {
+        return glfwGetTime();
+    }
+};
+
+// advances by a fixed step on every tick, independent of how long frames actually take
+struct FixedStepClock : Clock {
+    double time;
+    double step;
+
+    FixedStepClock(double start, double step) : time(start - step), step(step) {}
+
+    double tick() override {
+        time += step;
+        return time;
+    }
+
+    // jump to an explicit time, the next tick returns exactly `t`
+    void set(double t) {
+        time = t - step;
+    }
+};
+
+#endif /* clock_h */
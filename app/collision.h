@@ -0,0 +1,813 @@
+//
+//  collision.h
+//  app
+//
+
+#ifndef collision_h
+#define collision_h
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "jobs.h"
+#include "ecs.h"
+#include "hierarchy.h"
+#include <glm/glm.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Collision queries for the scene.
+//
+// Every body is a box (the entity's Bounds) that follows a world matrix. Its world space shape is
+// an oriented box, and the broadphase keeps an axis aligned "fat" box around it (tight box plus
+// `margin`) in a dynamic AABB tree. Moving a body only touches the tree when the tight box left
+// its fat one, then the leaf is taken out and reinserted where it grows the tree's surface area
+// least; rotations keep the tree balanced.
+//
+// findPairs walks the tree against itself in parallel and keeps the pairs of overlapping fat
+// boxes. narrowPhase tests them exactly, with SSE: tight boxes first, then the separating
+// axis test of the two oriented boxes, four pairs at a time.
+//
+// In the scene the bodies follow the transform hierarchy: after hierarchy.update() only the
+// slots it reported changed are placed again. The camera is a sphere pushed out of the boxes it
+// ends up in ("--camera-collision off" flies through them).
+
+const uint32_t noBody = 0xFFFFFFFF;
+
+struct Aabb {
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+inline bool aabbOverlap(const Aabb& a, const Aabb& b) {
+    return a.min.x <= b.max.x && a.max.x >= b.min.x && a.min.y <= b.max.y && a.max.y >= b.min.y &&
+           a.min.z <= b.max.z && a.max.z >= b.min.z;
+}
+
+inline bool aabbContains(const Aabb& outer, const Aabb& inner) {
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z &&
+           outer.max.x >= inner.max.x && outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+inline Aabb aabbMerge(const Aabb& a, const Aabb& b) {
+    return { glm::min(a.min, b.min), glm::max(a.max, b.max) };
+}
+
+inline float aabbArea(const Aabb& box) {
+    glm::vec3 size = box.max - box.min;
+    return 2.0f * (size.x * size.y + size.y * size.z + size.z * size.x);
+}
+
+// Dynamic bounding volume tree over fat boxes. Leaves hold a body, inner nodes always have two
+// children. Node indices stay valid until the node is removed; freed nodes are reused.
+struct AabbTree {
+    struct Node {
+        Aabb box;
+        // next free node while on the free list
+        int32_t parent = -1;
+        int32_t left = -1;
+        int32_t right = -1;
+        // leaves are 0, free nodes -1
+        int32_t height = 0;
+        uint32_t body = noBody;
+
+        bool leaf() const {
+            return left < 0;
+        }
+    };
+    std::vector<Node> nodes;
+    int32_t root = -1;
+    int32_t freeList = -1;
+    size_t leafCount = 0;
+
+    void clear() {
+        nodes.clear();
+        root = -1;
+        freeList = -1;
+        leafCount = 0;
+    }
+
+    int height() const {
+        return root < 0 ? 0 : nodes[root].height;
+    }
+
+    int32_t allocate() {
+        if (freeList < 0) {
+            nodes.push_back(Node());
+            return (int32_t) nodes.size() - 1;
+        }
+        int32_t node = freeList;
+        freeList = nodes[node].parent;
+        nodes[node] = Node();
+        return node;
+    }
+
+    void free(int32_t node) {
+        nodes[node].height = -1;
+        nodes[node].parent = freeList;
+        freeList = node;
+    }
+
+    int32_t insert(const Aabb& box, uint32_t body) {
+        int32_t leaf = allocate();
+        nodes[leaf].box = box;
+        nodes[leaf].body = body;
+        insertLeaf(leaf);
+        leafCount++;
+        return leaf;
+    }
+
+    void remove(int32_t leaf) {
+        removeLeaf(leaf);
+        free(leaf);
+        leafCount--;
+    }
+
+    // new fat box when `tight` left the old one; true when the leaf was reinserted
+    bool move(int32_t leaf, const Aabb& tight, float margin) {
+        if (aabbContains(nodes[leaf].box, tight)) return false;
+        removeLeaf(leaf);
+        nodes[leaf].box = { tight.min - glm::vec3(margin), tight.max + glm::vec3(margin) };
+        insertLeaf(leaf);
+        return true;
+    }
+
+    // visit(body) for every leaf whose fat box overlaps `box`
+    template <typename F>
+    void query(const Aabb& box, const F& visit) const {
+        if (root < 0) return;
+        // the tree stays balanced, its height is far below this for anything that fits in memory
+        int32_t stack[256];
+        int top = 0;
+        stack[top++] = root;
+        while (top > 0) {
+            const Node& node = nodes[stack[--top]];
+            if (!aabbOverlap(node.box, box)) continue;
+            if (node.leaf()) {
+                visit(node.body);
+            } else {
+                stack[top++] = node.left;
+                stack[top++] = node.right;
+            }
+        }
+    }
+
+    // emit(bodyA, bodyB) for every pair of leaves below `a` and `b` whose boxes overlap; descends
+    // into the bigger node first so both sides shrink at about the same rate
+    template <typename F>
+    void crossPairs(int32_t a, int32_t b, const F& emit) const {
+        const Node& nodeA = nodes[a];
+        const Node& nodeB = nodes[b];
+        if (!aabbOverlap(nodeA.box, nodeB.box)) return;
+        if (nodeA.leaf() && nodeB.leaf()) {
+            emit(std::min(nodeA.body, nodeB.body), std::max(nodeA.body, nodeB.body));
+        } else if (nodeB.leaf() || (!nodeA.leaf() && aabbArea(nodeA.box) > aabbArea(nodeB.box))) {
+            crossPairs(nodeA.left, b, emit);
+            crossPairs(nodeA.right, b, emit);
+        } else {
+            crossPairs(a, nodeB.left, emit);
+            crossPairs(a, nodeB.right, emit);
+        }
+    }
+
+    // every overlapping pair of leaves below `node`, once
+    template <typename F>
+    void selfPairs(int32_t node, const F& emit) const {
+        if (node < 0 || nodes[node].leaf()) return;
+        selfPairs(nodes[node].left, emit);
+        selfPairs(nodes[node].right, emit);
+        crossPairs(nodes[node].left, nodes[node].right, emit);
+    }
+
+    void insertLeaf(int32_t leaf) {
+        if (root < 0) {
+            root = leaf;
+            nodes[leaf].parent = -1;
+            return;
+        }
+        // walk down to the sibling that costs the least new surface area, stop early once
+        // pairing up with the current node beats going deeper
+        Aabb box = nodes[leaf].box;
+        int32_t index = root;
+        while (!nodes[index].leaf()) {
+            const Node& node = nodes[index];
+            float area = aabbArea(node.box);
+            float combinedArea = aabbArea(aabbMerge(node.box, box));
+            float cost = 2.0f * combinedArea;
+            float inheritance = 2.0f * (combinedArea - area);
+            float childCost[2];
+            int32_t children[2] = { node.left, node.right };
+            for (int c = 0; c < 2; c++) {
+                const Node& child = nodes[children[c]];
+                float merged = aabbArea(aabbMerge(child.box, box));
+                childCost[c] = (child.leaf() ? merged : merged - aabbArea(child.box)) + inheritance;
+            }
+            if (cost < childCost[0] && cost < childCost[1]) break;
+            index = childCost[0] < childCost[1] ? children[0] : children[1];
+        }
+
+        int32_t sibling = index;
+        int32_t oldParent = nodes[sibling].parent;
+        int32_t newParent = allocate();
+        nodes[newParent].parent = oldParent;
+        nodes[newParent].box = aabbMerge(box, nodes[sibling].box);
+        nodes[newParent].height = nodes[sibling].height + 1;
+        if (oldParent >= 0) {
+            if (nodes[oldParent].left == sibling) {
+                nodes[oldParent].left = newParent;
+            } else {
+                nodes[oldParent].right = newParent;
+            }
+        } else {
+            root = newParent;
+        }
+        nodes[newParent].left = sibling;
+        nodes[newParent].right = leaf;
+        nodes[sibling].parent = newParent;
+        nodes[leaf].parent = newParent;
+        refitUpwards(newParent);
+    }
+
+    void removeLeaf(int32_t leaf) {
+        if (leaf == root) {
+            root = -1;
+            return;
+        }
+        int32_t parent = nodes[leaf].parent;
+        int32_t grandParent = nodes[parent].parent;
+        int32_t sibling = nodes[parent].left == leaf ? nodes[parent].right : nodes[parent].left;
+        if (grandParent >= 0) {
+            if (nodes[grandParent].left == parent) {
+                nodes[grandParent].left = sibling;
+            } else {
+                nodes[grandParent].right = sibling;
+            }
+            nodes[sibling].parent = grandParent;
+            free(parent);
+            refitUpwards(grandParent);
+        } else {
+            root = sibling;
+            nodes[sibling].parent = -1;
+            free(parent);
+        }
+    }
+
+    // heights and boxes from `index` up to the root, rebalancing on the way
+    void refitUpwards(int32_t index) {
+        while (index >= 0) {
+            index = balance(index);
+            Node& node = nodes[index];
+            node.height = 1 + std::max(nodes[node.left].height, nodes[node.right].height);
+            node.box = aabbMerge(nodes[node.left].box, nodes[node.right].box);
+            index = node.parent;
+        }
+    }
+
+    // rotates the taller grandchild up when the children's heights differ by more than one;
+    // returns the node now at a's place
+    int32_t balance(int32_t a) {
+        Node& nodeA = nodes[a];
+        if (nodeA.leaf() || nodeA.height < 2) return a;
+        int32_t b = nodeA.left, c = nodeA.right;
+        int difference = nodes[c].height - nodes[b].height;
+        if (difference > 1) return rotateUp(a, c, b, false);
+        if (difference < -1) return rotateUp(a, b, c, true);
+        return a;
+    }
+
+    // `up` (a child of a on the `fromLeft` side) takes a's place, a keeps `other` and the shorter
+    // of up's children, up keeps a and its taller child
+    int32_t rotateUp(int32_t a, int32_t up, int32_t other, bool fromLeft) {
+        Node& nodeA = nodes[a];
+        Node& nodeUp = nodes[up];
+        int32_t f = nodeUp.left, g = nodeUp.right;
+        nodeUp.left = a;
+        nodeUp.parent = nodeA.parent;
+        nodeA.parent = up;
+        if (nodeUp.parent >= 0) {
+            if (nodes[nodeUp.parent].left == a) {
+                nodes[nodeUp.parent].left = up;
+            } else {
+                nodes[nodeUp.parent].right = up;
+            }
+        } else {
+            root = up;
+        }
+        int32_t taller = nodes[f].height > nodes[g].height ? f : g;
+        int32_t shorter = taller == f ? g : f;
+        nodeUp.right = taller;
+        if (fromLeft) {
+            nodeA.left = shorter;
+        } else {
+            nodeA.right = shorter;
+        }
+        nodes[shorter].parent = a;
+        nodeA.box = aabbMerge(nodes[other].box, nodes[shorter].box);
+        nodeUp.box = aabbMerge(nodeA.box, nodes[taller].box);
+        nodeA.height = 1 + std::max(nodes[other].height, nodes[shorter].height);
+        nodeUp.height = 1 + std::max(nodeA.height, nodes[taller].height);
+        return up;
+    }
+};
+
+// world space oriented box, 64 bytes so a pair of them is two cache lines
+struct CollisionShape {
+    float center[3];
+    // half sizes along the unit axes
+    float extent[3];
+    float axis[3][3];
+    float pad;
+};
+
+// --- separating axis test ---
+//
+// One routine for a single pair (float lanes, bool masks) and four pairs (__m128 lanes and masks).
+// `a(k)` and `b(k)` load float k of the two shapes: center 0-2, extent 3-5, axes 6-14.
+
+inline float laneAdd(float a, float b) { return a + b; }
+inline float laneSub(float a, float b) { return a - b; }
+inline float laneMul(float a, float b) { return a * b; }
+inline float laneAbs(float x) { return fabsf(x); }
+inline bool laneGreater(float a, float b) { return a > b; }
+inline bool laneOr(bool a, bool b) { return a || b; }
+
+#if defined(__SSE2__)
+inline __m128 laneSet4(float x) { return _mm_set1_ps(x); }
+inline __m128 laneAdd(__m128 a, __m128 b) { return _mm_add_ps(a, b); }
+inline __m128 laneSub(__m128 a, __m128 b) { return _mm_sub_ps(a, b); }
+inline __m128 laneMul(__m128 a, __m128 b) { return _mm_mul_ps(a, b); }
+inline __m128 laneAbs(__m128 x) { return _mm_andnot_ps(_mm_set1_ps(-0.0f), x); }
+inline __m128 laneGreater(__m128 a, __m128 b) { return _mm_cmpgt_ps(a, b); }
+inline __m128 laneOr(__m128 a, __m128 b) { return _mm_or_ps(a, b); }
+#endif
+
+// set where some axis separates the boxes (Gottschalk's 15 axis test, in a's frame)
+template <typename Lane, typename Mask, typename LoadA, typename LoadB>
+Mask boxesSeparated(const LoadA& a, const LoadB& b, Lane epsilon) {
+    Lane r[3][3], absR[3][3], t[3];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            r[i][j] = laneAdd(laneAdd(laneMul(a(6 + i * 3), b(6 + j * 3)), laneMul(a(7 + i * 3), b(7 + j * 3))),
+                              laneMul(a(8 + i * 3), b(8 + j * 3)));
+            // keeps near parallel edges from producing a zero cross product axis that separates anything
+            absR[i][j] = laneAdd(laneAbs(r[i][j]), epsilon);
+        }
+    }
+    Lane d[3] = { laneSub(b(0), a(0)), laneSub(b(1), a(1)), laneSub(b(2), a(2)) };
+    for (int i = 0; i < 3; i++) {
+        t[i] = laneAdd(laneAdd(laneMul(d[0], a(6 + i * 3)), laneMul(d[1], a(7 + i * 3))), laneMul(d[2], a(8 + i * 3)));
+    }
+    Mask separated = laneGreater(laneAbs(t[0]), laneAdd(a(3), laneAdd(laneAdd(laneMul(b(3), absR[0][0]), laneMul(b(4), absR[0][1])), laneMul(b(5), absR[0][2]))));
+    for (int i = 1; i < 3; i++) {
+        Lane rb = laneAdd(laneAdd(laneMul(b(3), absR[i][0]), laneMul(b(4), absR[i][1])), laneMul(b(5), absR[i][2]));
+        separated = laneOr(separated, laneGreater(laneAbs(t[i]), laneAdd(a(3 + i), rb)));
+    }
+    // b's axes
+    for (int j = 0; j < 3; j++) {
+        Lane ra = laneAdd(laneAdd(laneMul(a(3), absR[0][j]), laneMul(a(4), absR[1][j])), laneMul(a(5), absR[2][j]));
+        Lane distance = laneAdd(laneAdd(laneMul(t[0], r[0][j]), laneMul(t[1], r[1][j])), laneMul(t[2], r[2][j]));
+        separated = laneOr(separated, laneGreater(laneAbs(distance), laneAdd(ra, b(3 + j))));
+    }
+    // cross products of an axis of a and an axis of b
+    for (int i = 0; i < 3; i++) {
+        int i1 = (i + 1) % 3, i2 = (i + 2) % 3;
+        for (int j = 0; j < 3; j++) {
+            int j1 = (j + 1) % 3, j2 = (j + 2) % 3;
+            Lane ra = laneAdd(laneMul(a(3 + i1), absR[i2][j]), laneMul(a(3 + i2), absR[i1][j]));
+            Lane rb = laneAdd(laneMul(b(3 + j1), absR[i][j2]), laneMul(b(3 + j2), absR[i][j1]));
+            Lane distance = laneSub(laneMul(t[i2], r[i1][j]), laneMul(t[i1], r[i2][j]));
+            separated = laneOr(separated, laneGreater(laneAbs(distance), laneAdd(ra, rb)));
+        }
+    }
+    return separated;
+}
+
+const float separatingEpsilon = 1e-6f;
+
+inline bool shapesOverlap(const CollisionShape& a, const CollisionShape& b) {
+    const float* fa = a.center;
+    const float* fb = b.center;
+    return !boxesSeparated<float, bool>([fa](int k) { return fa[k]; }, [fb](int k) { return fb[k]; }, separatingEpsilon);
+}
+
+struct CollisionPair {
+    uint32_t a;
+    uint32_t b;
+};
+
+struct CollisionWorld {
+    float margin = 0.1f;
+    // narrow phase with SSE, the scalar path stays for comparison
+    bool simd = true;
+
+    // per body
+    std::vector<glm::vec3> localMin;
+    std::vector<glm::vec3> localMax;
+    std::vector<CollisionShape> shapes;
+    // tight world boxes as vec4 so one unaligned load gets a corner
+    std::vector<glm::vec4> tightMin;
+    std::vector<glm::vec4> tightMax;
+    std::vector<int32_t> proxies;
+    std::vector<uint32_t> nodeOfBody;
+    std::vector<uint8_t> moved;
+    // hierarchy node id -> body
+    std::vector<uint32_t> bodyOfNode;
+    AabbTree tree;
+
+    // what the scene bodies were synced with, and per hierarchy node whether the last sync saw it
+    uint64_t sceneVersion = ~0ull;
+    std::vector<uint8_t> seenNodes;
+    // bumped by every refit that moved something
+    uint64_t moveVersion = 0;
+
+    // broadphase work: a subtree against itself (b < 0) or two subtrees against each other, each
+    // task collects its pairs on its own before they are merged
+    struct PairTask {
+        int32_t a;
+        int32_t b;
+    };
+    std::vector<PairTask> pairTasks;
+    std::vector<std::vector<CollisionPair>> pairBlocks;
+    std::vector<CollisionPair> candidates;
+    std::vector<uint8_t> touching;
+    std::vector<CollisionPair> contacts;
+
+    // last step
+    size_t movedBodies = 0;
+    size_t reinsertedBodies = 0;
+    double placeMilliseconds = 0.0;
+    double refitMilliseconds = 0.0;
+    double pairMilliseconds = 0.0;
+    double narrowMilliseconds = 0.0;
+    // camera queries since the last report
+    size_t cameraPushes = 0;
+    double cameraMilliseconds = 0.0;
+
+    size_t size() const {
+        return shapes.size();
+    }
+
+    void clear() {
+        localMin.clear();
+        localMax.clear();
+        shapes.clear();
+        tightMin.clear();
+        tightMax.clear();
+        proxies.clear();
+        nodeOfBody.clear();
+        moved.clear();
+        bodyOfNode.clear();
+        tree.clear();
+        candidates.clear();
+        contacts.clear();
+    }
+
+    Aabb tightBox(uint32_t body) const {
+        return { glm::vec3(tightMin[body]), glm::vec3(tightMax[body]) };
+    }
+
+    // a box from min to max in local space, following `matrix`
+    uint32_t add(const glm::vec3& min, const glm::vec3& max, const glm::mat4& matrix, uint32_t node = noNode) {
+        uint32_t body = (uint32_t) shapes.size();
+        localMin.push_back(min);
+        localMax.push_back(max);
+        shapes.push_back(CollisionShape());
+        tightMin.push_back(glm::vec4(0.0f));
+        tightMax.push_back(glm::vec4(0.0f));
+        nodeOfBody.push_back(node);
+        moved.push_back(0);
+        if (node != noNode) {
+            if (bodyOfNode.size() <= node) bodyOfNode.resize(node + 1, noBody);
+            bodyOfNode[node] = body;
+        }
+        place(body, matrix);
+        moved[body] = 0;
+        Aabb tight = tightBox(body);
+        proxies.push_back(tree.insert({ tight.min - glm::vec3(margin), tight.max + glm::vec3(margin) }, body));
+        return body;
+    }
+
+    // takes a body out, the last one moves into its index; pairs found before refer to old indices
+    void remove(uint32_t body) {
+        tree.remove(proxies[body]);
+        if (nodeOfBody[body] != noNode) bodyOfNode[nodeOfBody[body]] = noBody;
+        uint32_t last = (uint32_t) shapes.size() - 1;
+        if (body != last) {
+            localMin[body] = localMin[last];
+            localMax[body] = localMax[last];
+            shapes[body] = shapes[last];
+            tightMin[body] = tightMin[last];
+            tightMax[body] = tightMax[last];
+            proxies[body] = proxies[last];
+            nodeOfBody[body] = nodeOfBody[last];
+            moved[body] = moved[last];
+            tree.nodes[proxies[body]].body = body;
+            if (nodeOfBody[body] != noNode) bodyOfNode[nodeOfBody[body]] = body;
+        }
+        localMin.pop_back();
+        localMax.pop_back();
+        shapes.pop_back();
+        tightMin.pop_back();
+        tightMax.pop_back();
+        proxies.pop_back();
+        nodeOfBody.pop_back();
+        moved.pop_back();
+        candidates.clear();
+        contacts.clear();
+    }
+
+    // New world matrix for a body, without touching the tree. Safe from parallel jobs as long as
+    // each call places a different body; refit() picks the moved ones up.
+    void place(uint32_t body, const glm::mat4& matrix) {
+        glm::vec3 half = (localMax[body] - localMin[body]) * 0.5f;
+        glm::vec3 center = glm::vec3(matrix * glm::vec4((localMin[body] + localMax[body]) * 0.5f, 1.0f));
+        CollisionShape& shape = shapes[body];
+        glm::vec3 reach = glm::vec3(0.0f);
+        for (int i = 0; i < 3; i++) {
+            glm::vec3 column = glm::vec3(matrix[i]);
+            float length = glm::length(column);
+            glm::vec3 axis = length > 0.0f ? column / length : glm::vec3(i == 0, i == 1, i == 2);
+            shape.center[i] = center[i];
+            shape.extent[i] = length * half[i];
+            for (int k = 0; k < 3; k++) shape.axis[i][k] = axis[k];
+            reach += glm::abs(column) * half[i];
+        }
+        tightMin[body] = glm::vec4(center - reach, 0.0f);
+        tightMax[body] = glm::vec4(center + reach, 0.0f);
+        moved[body] = 1;
+    }
+
+    // moves the tree leaves of placed bodies whose tight box left the fat one
+    void refit() {
+        auto start = std::chrono::high_resolution_clock::now();
+        movedBodies = 0;
+        reinsertedBodies = 0;
+        uint32_t count = (uint32_t) moved.size();
+        uint32_t body = 0;
+        while (body < count) {
+            // skip bodies that stayed put eight at a time
+            while (body + 8 <= count) {
+                uint64_t word;
+                memcpy(&word, &moved[body], 8);
+                if (word != 0) break;
+                body += 8;
+            }
+            if (body >= count) break;
+            if (moved[body]) {
+                moved[body] = 0;
+                movedBodies++;
+                if (tree.move(proxies[body], tightBox(body), margin)) reinsertedBodies++;
+            }
+            body++;
+        }
+        if (movedBodies > 0) moveVersion++;
+        refitMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    // Scene bodies after hierarchy.update(): one per entity with Bounds. When entities came or went
+    // the new ones are added and the missing ones removed, the rest keep their tree leaves; then
+    // the slots whose world matrix changed are placed again.
+    void syncScene(World& world, const TransformHierarchy& hierarchy) {
+        auto start = std::chrono::high_resolution_clock::now();
+        if (world.structureVersion != sceneVersion) {
+            sceneVersion = world.structureVersion;
+            world.forEachChunk(componentMask<HierarchyNode, Bounds>(), [&](Chunk& chunk) {
+                const HierarchyNode* nodes = chunk.array<HierarchyNode>();
+                const Bounds* bounds = chunk.array<Bounds>();
+                for (uint32_t i = 0; i < chunk.count; i++) {
+                    uint32_t node = nodes[i].node;
+                    if (seenNodes.size() <= node) seenNodes.resize(node + 1, 0);
+                    seenNodes[node] = 1;
+                    uint32_t body = node < bodyOfNode.size() ? bodyOfNode[node] : noBody;
+                    if (body == noBody) {
+                        add(bounds[i].min, bounds[i].max, hierarchy.worldMatrix(node), node);
+                    } else if (bounds[i].min != localMin[body] || bounds[i].max != localMax[body]) {
+                        // the node went to an entity with other bounds
+                        localMin[body] = bounds[i].min;
+                        localMax[body] = bounds[i].max;
+                        place(body, hierarchy.worldMatrix(node));
+                    }
+                }
+            });
+            for (uint32_t body = 0; body < shapes.size();) {
+                uint32_t node = nodeOfBody[body];
+                if (node == noNode) {
+                    body++;
+                } else if (node < seenNodes.size() && seenNodes[node]) {
+                    seenNodes[node] = 0;
+                    body++;
+                } else {
+                    // gone, the last body moved into this index
+                    remove(body);
+                }
+            }
+        }
+        auto placeSlots = [&](uint32_t begin, uint32_t end) {
+            for (uint32_t slot = begin; slot < end; slot++) {
+                uint32_t node = hierarchy.nodeOfSlot[slot];
+                if (node >= bodyOfNode.size() || bodyOfNode[node] == noBody) continue;
+                place(bodyOfNode[node], hierarchy.world[slot]);
+            }
+        };
+        // short ranges (a spinning entity here and there) are spread over the workers a few at a
+        // time, long ones are split up on their own
+        const uint32_t longRange = 4096;
+        const std::vector<SlotRange>& ranges = hierarchy.changedRanges;
+        jobs.parallelFor(ranges.size(), 32, [&](size_t begin, size_t end) {
+            for (size_t r = begin; r < end; r++) {
+                if (ranges[r].end - ranges[r].begin < longRange) placeSlots(ranges[r].begin, ranges[r].end);
+            }
+        });
+        for (const SlotRange& range : ranges) {
+            if (range.end - range.begin < longRange) continue;
+            jobs.parallelFor(range.end - range.begin, longRange, [&](size_t begin, size_t end) {
+                placeSlots(range.begin + (uint32_t) begin, range.begin + (uint32_t) end);
+            });
+        }
+        placeMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+        refit();
+    }
+
+    // every pair of bodies whose fat boxes overlap, once. The tree is walked against itself: that
+    // visits far fewer nodes than querying it once per body, and nearby nodes are visited together.
+    // The top of the walk is split up into tasks (subtrees on their own, and pairs of overlapping
+    // subtrees) until there are enough to keep every worker busy.
+    void findPairs() {
+        auto start = std::chrono::high_resolution_clock::now();
+        pairTasks.clear();
+        if (tree.root >= 0) pairTasks.push_back({ tree.root, -1 });
+        const size_t wantedTasks = 64 * jobs.threadCount();
+        for (size_t next = 0; next < pairTasks.size() && pairTasks.size() < wantedTasks; ) {
+            PairTask task = pairTasks[next];
+            const AabbTree::Node& a = tree.nodes[task.a];
+            if (task.b < 0) {
+                if (a.leaf()) {
+                    next++;
+                    continue;
+                }
+                pairTasks[next] = { a.left, -1 };
+                pairTasks.push_back({ a.right, -1 });
+                pairTasks.push_back({ a.left, a.right });
+                continue;
+            }
+            const AabbTree::Node& b = tree.nodes[task.b];
+            if (!aabbOverlap(a.box, b.box)) {
+                pairTasks[next] = pairTasks.back();
+                pairTasks.pop_back();
+                continue;
+            }
+            if (a.leaf() && b.leaf()) {
+                next++;
+            } else if (b.leaf() || (!a.leaf() && aabbArea(a.box) > aabbArea(b.box))) {
+                pairTasks[next] = { a.left, task.b };
+                pairTasks.push_back({ a.right, task.b });
+            } else {
+                pairTasks[next] = { task.a, b.left };
+                pairTasks.push_back({ task.a, b.right });
+            }
+        }
+        if (pairBlocks.size() < pairTasks.size()) pairBlocks.resize(pairTasks.size());
+        jobs.parallelFor(pairTasks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t t = begin; t < end; t++) {
+                std::vector<CollisionPair>& pairs = pairBlocks[t];
+                pairs.clear();
+                auto emit = [&pairs](uint32_t a, uint32_t b) { pairs.push_back({ a, b }); };
+                if (pairTasks[t].b < 0) {
+                    tree.selfPairs(pairTasks[t].a, emit);
+                } else {
+                    tree.crossPairs(pairTasks[t].a, pairTasks[t].b, emit);
+                }
+            }
+        });
+        candidates.clear();
+        for (size_t t = 0; t < pairTasks.size(); t++) {
+            candidates.insert(candidates.end(), pairBlocks[t].begin(), pairBlocks[t].end());
+        }
+        pairMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    bool tightOverlap(uint32_t a, uint32_t b) const {
+#if defined(__SSE2__)
+        __m128 minA = _mm_loadu_ps(&tightMin[a].x), maxA = _mm_loadu_ps(&tightMax[a].x);
+        __m128 minB = _mm_loadu_ps(&tightMin[b].x), maxB = _mm_loadu_ps(&tightMax[b].x);
+        int apart = _mm_movemask_ps(_mm_or_ps(_mm_cmpgt_ps(minA, maxB), _mm_cmpgt_ps(minB, maxA)));
+        return (apart & 7) == 0;
+#else
+        return aabbOverlap(tightBox(a), tightBox(b));
+#endif
+    }
+
+    void narrowRange(size_t begin, size_t end) {
+#if defined(__SSE2__)
+        if (simd) {
+            // pairs whose tight boxes touch queue up until four can go through the test together
+            const float* base = reinterpret_cast<const float*>(shapes.data());
+            const int stride = sizeof(CollisionShape) / sizeof(float);
+            int queuedA[4], queuedB[4];
+            size_t queuedPair[4];
+            int queued = 0;
+            for (size_t i = begin; i < end; i++) {
+                const CollisionPair& pair = candidates[i];
+                touching[i] = 0;
+                if (!tightOverlap(pair.a, pair.b)) continue;
+                queuedA[queued] = (int) pair.a * stride;
+                queuedB[queued] = (int) pair.b * stride;
+                queuedPair[queued++] = i;
+                if (queued < 4) continue;
+                __m128 separated = boxesSeparated<__m128, __m128>(
+                    [&](int k) { return _mm_setr_ps(base[queuedA[0] + k], base[queuedA[1] + k], base[queuedA[2] + k], base[queuedA[3] + k]); },
+                    [&](int k) { return _mm_setr_ps(base[queuedB[0] + k], base[queuedB[1] + k], base[queuedB[2] + k], base[queuedB[3] + k]); },
+                    laneSet4(separatingEpsilon));
+                int mask = _mm_movemask_ps(separated);
+                for (int q = 0; q < 4; q++) touching[queuedPair[q]] = (mask & (1 << q)) == 0;
+                queued = 0;
+            }
+            for (int q = 0; q < queued; q++) {
+                const CollisionPair& pair = candidates[queuedPair[q]];
+                touching[queuedPair[q]] = shapesOverlap(shapes[pair.a], shapes[pair.b]);
+            }
+            return;
+        }
+#endif
+        for (size_t i = begin; i < end; i++) {
+            const CollisionPair& pair = candidates[i];
+            touching[i] = aabbOverlap(tightBox(pair.a), tightBox(pair.b)) && shapesOverlap(shapes[pair.a], shapes[pair.b]);
+        }
+    }
+
+    // the candidates whose oriented boxes really overlap, into `contacts`
+    void narrowPhase() {
+        auto start = std::chrono::high_resolution_clock::now();
+        touching.resize(candidates.size());
+        // each range queues its own pairs, so every range ends with up to three going through the scalar test
+        jobs.parallelFor(candidates.size(), 2048, [&](size_t begin, size_t end) { narrowRange(begin, end); });
+        contacts.clear();
+        for (size_t i = 0; i < candidates.size(); i++) {
+            if (touching[i]) contacts.push_back(candidates[i]);
+        }
+        narrowMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    // pushes a sphere out of every box it overlaps, a few rounds since one push can land it in another
+    glm::vec3 pushOut(glm::vec3 position, float radius) {
+        for (int round = 0; round < 4; round++) {
+            bool pushed = false;
+            tree.query({ position - glm::vec3(radius), position + glm::vec3(radius) }, [&](uint32_t body) {
+                // earlier pushes this round may have moved the sphere away already
+                if (!aabbOverlap(tightBox(body), { position - glm::vec3(radius), position + glm::vec3(radius) })) return;
+                const CollisionShape& shape = shapes[body];
+                glm::vec3 center = glm::vec3(shape.center[0], shape.center[1], shape.center[2]);
+                glm::vec3 offset = position - center;
+                glm::vec3 closest = center;
+                bool inside = true;
+                // axis the center is least deep along, for when it is inside the box
+                float shallowest = 1e30f;
+                glm::vec3 exit = glm::vec3(0.0f);
+                for (int i = 0; i < 3; i++) {
+                    glm::vec3 axis = glm::vec3(shape.axis[i][0], shape.axis[i][1], shape.axis[i][2]);
+                    float along = glm::dot(offset, axis);
+                    float extent = shape.extent[i];
+                    if (fabsf(along) > extent) inside = false;
+                    closest += axis * std::max(-extent, std::min(along, extent));
+                    if (extent - fabsf(along) < shallowest) {
+                        shallowest = extent - fabsf(along);
+                        exit = axis * (along < 0.0f ? -1.0f : 1.0f);
+                    }
+                }
+                if (inside) {
+                    position += exit * (shallowest + radius);
+                } else {
+                    glm::vec3 away = position - closest;
+                    float distance = glm::length(away);
+                    if (distance >= radius || distance <= 0.0f) return;
+                    position += away * ((radius - distance) / distance);
+                }
+                pushed = true;
+                cameraPushes++;
+            });
+            if (!pushed) break;
+        }
+        return position;
+    }
+
+    // Moves a sphere from `from` to `to` and returns where it ends up outside every body. Long moves
+    // go in steps of at most the radius, so a fast camera can't skip through a thin box.
+    glm::vec3 slideSphere(const glm::vec3& from, const glm::vec3& to, float radius) {
+        if (tree.root < 0) return to;
+        auto start = std::chrono::high_resolution_clock::now();
+        glm::vec3 delta = to - from;
+        int steps = std::max(1, std::min(16, (int) ceilf(glm::length(delta) / radius)));
+        glm::vec3 position = from;
+        for (int step = 0; step < steps; step++) {
+            position = pushOut(position + delta / float(steps), radius);
+        }
+        cameraMilliseconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+        return position;
+    }
+};
+
+#endif /* collision_h */
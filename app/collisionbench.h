@@ -0,0 +1,212 @@
+//
+//  collisionbench.h
+//  app
+//
+
+#ifndef collisionbench_h
+#define collisionbench_h
+
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "collision.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+// Collision benchmark ("--collision-bench [N]"), no window needed.
+//
+// N boxes (100k by default) of mixed sizes fly around a closed volume, spinning and bouncing off
+// its walls. Every step places them, refits the tree, finds the broadphase pairs and runs the
+// narrow phase; the report has the time of each stage per step. The narrow phase runs once more
+// scalar on one thread, and pairs plus narrow phase again on 1, 2, 4... threads up to the pool
+// size for the scaling.
+//
+// First a smaller set is checked against brute force: the tree has to find every overlapping
+// pair, and the SSE and scalar tests have to agree on each of them.
+
+struct CollisionBenchScene {
+    CollisionWorld world;
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec3> velocities;
+    std::vector<glm::vec3> axes;
+    std::vector<float> spins;
+    std::vector<glm::vec3> scales;
+    float halfSize = 0.0f;
+    uint32_t random = 0x2545F491u;
+
+    float randomFloat() {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return float(random >> 8) * (1.0f / 16777216.0f);
+    }
+
+    glm::mat4 matrix(size_t body, float time) const {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[body]);
+        model = glm::rotate(model, spins[body] * time, axes[body]);
+        return glm::scale(model, scales[body]);
+    }
+
+    // about one body per `spacing`^3 of volume
+    void spawn(size_t count, float spacing) {
+        halfSize = 0.5f * spacing * cbrtf(float(count));
+        for (size_t i = 0; i < count; i++) {
+            positions.push_back((glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - glm::vec3(1.0f)) * halfSize);
+            glm::vec3 direction = glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - glm::vec3(1.0f);
+            velocities.push_back(glm::normalize(direction + glm::vec3(0.0f, 0.001f, 0.0f)) * (0.5f + 1.5f * randomFloat()));
+            axes.push_back(glm::normalize(glm::vec3(randomFloat(), randomFloat(), randomFloat()) + glm::vec3(0.1f)));
+            spins.push_back(0.5f + 1.5f * randomFloat());
+            scales.push_back(glm::vec3(0.3f + 0.7f * randomFloat(), 0.3f + 0.7f * randomFloat(), 0.3f + 0.7f * randomFloat()));
+            world.add(glm::vec3(-0.5f), glm::vec3(0.5f), matrix(i, 0.0f));
+        }
+    }
+
+    // moves and places every body, in parallel
+    void integrate(float dt, float time) {
+        auto start = std::chrono::high_resolution_clock::now();
+        jobs.parallelFor(positions.size(), 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                glm::vec3& position = positions[i];
+                glm::vec3& velocity = velocities[i];
+                position += velocity * dt;
+                for (int k = 0; k < 3; k++) {
+                    if ((position[k] > halfSize && velocity[k] > 0.0f) || (position[k] < -halfSize && velocity[k] < 0.0f)) {
+                        velocity[k] = -velocity[k];
+                    }
+                }
+                world.place((uint32_t) i, matrix(i, time));
+            }
+        });
+        world.placeMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    void step(float dt, float time) {
+        integrate(dt, time);
+        world.refit();
+        world.findPairs();
+        world.narrowPhase();
+    }
+};
+
+// pairs as sorted 64 bit keys, for comparing two sets
+std::vector<uint64_t> collisionPairKeys(const std::vector<CollisionPair>& pairs) {
+    std::vector<uint64_t> keys;
+    keys.reserve(pairs.size());
+    for (const CollisionPair& pair : pairs) {
+        uint32_t a = std::min(pair.a, pair.b), b = std::max(pair.a, pair.b);
+        keys.push_back((uint64_t) a << 32 | b);
+    }
+    std::sort(keys.begin(), keys.end());
+    return keys;
+}
+
+int checkCollisionWorld(size_t count) {
+    int failures = 0;
+    CollisionBenchScene scene;
+    // denser than the timed run, so plenty of boxes touch
+    scene.spawn(count, 1.2f);
+    for (int step = 0; step < 30; step++) scene.step(1.0f / 60.0f, step / 60.0f);
+    std::vector<CollisionPair> expected;
+    const CollisionWorld& world = scene.world;
+    for (uint32_t a = 0; a < count; a++) {
+        for (uint32_t b = a + 1; b < count; b++) {
+            if (aabbOverlap(world.tightBox(a), world.tightBox(b)) && shapesOverlap(world.shapes[a], world.shapes[b])) {
+                expected.push_back({ a, b });
+            }
+        }
+    }
+    std::vector<uint64_t> simdKeys = collisionPairKeys(world.contacts);
+    scene.world.simd = false;
+    scene.world.narrowPhase();
+    std::vector<uint64_t> scalarKeys = collisionPairKeys(scene.world.contacts);
+    std::vector<uint64_t> expectedKeys = collisionPairKeys(expected);
+    if (scalarKeys != expectedKeys) {
+        std::cout << "[collision] FAILED: tree found " << scalarKeys.size() << " contacts, brute force " << expectedKeys.size() << std::endl;
+        failures++;
+    }
+    if (simdKeys != scalarKeys) {
+        std::cout << "[collision] FAILED: sse narrow phase found " << simdKeys.size() << " contacts, scalar " << scalarKeys.size() << std::endl;
+        failures++;
+    }
+    std::cout << "[collision] check: " << count << " bodies, " << expectedKeys.size() << " contacts, tree height "
+              << world.tree.height() << std::endl;
+    return failures;
+}
+
+int runCollisionBenchmark(size_t count) {
+    int failures = checkCollisionWorld(2000);
+
+    const int steps = 60;
+    const float dt = 1.0f / 60.0f;
+    CollisionBenchScene scene;
+    // these move up to two units a second, a wider margin halves the reinserts for a few more candidates
+    scene.world.margin = 0.2f;
+    auto start = std::chrono::high_resolution_clock::now();
+    scene.spawn(count, 2.0f);
+    double buildMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    std::cout << "[collision] " << count << " bodies, tree built in " << buildMilliseconds << " ms, " << jobs.threadCount()
+              << " threads" << std::endl;
+
+    double place = 0.0, refit = 0.0, pairs = 0.0, narrow = 0.0;
+    size_t reinserted = 0, candidates = 0, contacts = 0;
+    float time = 0.0f;
+    for (int step = 0; step < steps; step++, time += dt) {
+        scene.step(dt, time);
+        const CollisionWorld& world = scene.world;
+        place += world.placeMilliseconds;
+        refit += world.refitMilliseconds;
+        pairs += world.pairMilliseconds;
+        narrow += world.narrowMilliseconds;
+        reinserted += world.reinsertedBodies;
+        candidates += world.candidates.size();
+        contacts += world.contacts.size();
+    }
+    double total = (place + refit + pairs + narrow) / steps;
+    std::cout << "[collision] per step: place " << place / steps << " ms, refit " << refit / steps << " ms ("
+              << reinserted / steps << " reinserted), pairs " << pairs / steps << " ms (" << candidates / steps
+              << " candidates), narrow " << narrow / steps << " ms (" << contacts / steps << " contacts), "
+              << total << " ms in all, " << (total <= 16.0 ? "fits" : "over") << " a 16 ms frame, tree height "
+              << scene.world.tree.height() << std::endl;
+
+    // narrow phase only, one thread, sse against scalar on the same candidates
+    size_t poolWorkers = jobs.threadCount() - 1;
+    jobs.stop();
+    for (int simd = 1; simd >= 0; simd--) {
+        scene.world.simd = simd != 0;
+        double milliseconds = 0.0;
+        for (int run = 0; run < 10; run++) {
+            scene.world.narrowPhase();
+            milliseconds += scene.world.narrowMilliseconds;
+        }
+        std::cout << "[collision] narrow phase, " << (simd ? "sse" : "scalar") << ", 1 thread: " << milliseconds / 10
+                  << " ms for " << scene.world.candidates.size() << " candidates" << std::endl;
+    }
+    scene.world.simd = true;
+
+    // thread scaling of the parallel stages
+    std::vector<size_t> threadCounts;
+    for (size_t threads = 1; threads < poolWorkers + 1; threads *= 2) threadCounts.push_back(threads);
+    threadCounts.push_back(poolWorkers + 1);
+    double single = 0.0;
+    for (size_t threads : threadCounts) {
+        jobs.stop();
+        if (threads > 1) jobs.start((unsigned int) threads - 1);
+        double pairMilliseconds = 0.0, narrowMilliseconds = 0.0;
+        for (int step = 0; step < 10; step++, time += dt) {
+            scene.step(dt, time);
+            pairMilliseconds += scene.world.pairMilliseconds;
+            narrowMilliseconds += scene.world.narrowMilliseconds;
+        }
+        double stepMilliseconds = (pairMilliseconds + narrowMilliseconds) / 10;
+        if (threads == 1) single = stepMilliseconds;
+        std::cout << "[collision] " << threads << " threads: pairs " << pairMilliseconds / 10 << " ms, narrow "
+                  << narrowMilliseconds / 10 << " ms, " << single / stepMilliseconds << "x" << std::endl;
+    }
+    jobs.stop();
+    if (poolWorkers > 0) jobs.start((unsigned int) poolWorkers);
+    return failures > 0 ? 1 : 0;
+}
+
+#endif /* collisionbench_h */
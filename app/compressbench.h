@@ -0,0 +1,191 @@
+//
+//  compressbench.h
+//  app
+//
+
+#ifndef compressbench_h
+#define compressbench_h
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "jobs.h"
+#include "decode.h"
+#include "decodebench.h"
+#include "mipbench.h"
+#include "assetbench.h"
+#include "texcompress.h"
+
+// Texture compression benchmark ("--compress-bench <asset dir>").
+//
+// Encodes the asset textures and two synthetic ones (a cut-out fence and an image with blended
+// alpha) with the format chooseTextureFormat() picks for them plus BC7, at every quality. Prints
+// encode throughput, size against RGBA8 and PSNR of (premultiplied) color and alpha, decoded with
+// the reference decoders below. Fails when parallel and serial output differ or a block doesn't
+// decode.
+
+// BC1 color block; BC3 color blocks always use 4 colors
+void decodeColorBlock(const uint8_t* in, bool alwaysFourColors, uint8_t* out) {
+    uint16_t color0 = (uint16_t) (in[0] | (in[1] << 8)), color1 = (uint16_t) (in[2] | (in[3] << 8));
+    float c0[3], c1[3];
+    unpackColor565(color0, c0);
+    unpackColor565(color1, c1);
+    uint8_t palette[4][4];
+    for (int ch = 0; ch < 3; ch++) {
+        int a = (int) c0[ch], b = (int) c1[ch];
+        palette[0][ch] = (uint8_t) a;
+        palette[1][ch] = (uint8_t) b;
+        if (color0 > color1 || alwaysFourColors) {
+            palette[2][ch] = (uint8_t) ((2 * a + b + 1) / 3);
+            palette[3][ch] = (uint8_t) ((a + 2 * b + 1) / 3);
+        } else {
+            palette[2][ch] = (uint8_t) ((a + b + 1) / 2);
+            palette[3][ch] = 0;
+        }
+    }
+    palette[0][3] = palette[1][3] = palette[2][3] = 255;
+    palette[3][3] = color0 > color1 || alwaysFourColors ? 255 : 0;
+    uint32_t bits;
+    memcpy(&bits, in + 4, 4);
+    for (int i = 0; i < 16; i++) memcpy(out + i * 4, palette[(bits >> (i * 2)) & 3], 4);
+}
+
+void decodeAlphaBlock(const uint8_t* in, uint8_t* out) {
+    int alpha0 = in[0], alpha1 = in[1];
+    int palette[8] = { alpha0, alpha1 };
+    if (alpha0 > alpha1) {
+        for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * alpha0 + (i - 1) * alpha1 + 3) / 7;
+    } else {
+        for (int i = 2; i < 6; i++) palette[i] = ((6 - i) * alpha0 + (i - 1) * alpha1 + 2) / 5;
+        palette[6] = 0;
+        palette[7] = 255;
+    }
+    uint64_t bits = 0;
+    for (int i = 0; i < 6; i++) bits |= (uint64_t) in[2 + i] << (i * 8);
+    for (int i = 0; i < 16; i++) out[i * 4 + 3] = (uint8_t) palette[(bits >> (i * 3)) & 7];
+}
+
+// mode 6 only, false for anything else
+bool decodeBc7Block(const uint8_t* in, uint8_t* out) {
+    int position = 0;
+    auto take = [&](int bits) {
+        uint32_t value = 0;
+        for (int i = 0; i < bits; i++, position++) value |= (uint32_t) ((in[position >> 3] >> (position & 7)) & 1) << i;
+        return value;
+    };
+    if (take(7) != (1u << 6)) return false;
+    int endpoint[2][4];
+    for (int ch = 0; ch < 4; ch++) {
+        endpoint[0][ch] = (int) take(7);
+        endpoint[1][ch] = (int) take(7);
+    }
+    int p0 = (int) take(1), p1 = (int) take(1);
+    for (int i = 0; i < 16; i++) {
+        int index = (int) take(i == 0 ? 3 : 4);
+        for (int ch = 0; ch < 4; ch++) {
+            int e0 = (endpoint[0][ch] << 1) | p0, e1 = (endpoint[1][ch] << 1) | p1;
+            out[i * 4 + ch] = (uint8_t) (((64 - bc7Weights[index]) * e0 + bc7Weights[index] * e1 + 32) >> 6);
+        }
+    }
+    return true;
+}
+
+bool decompressImage(const std::vector<uint8_t>& data, int width, int height, TextureFormat format,
+                     std::vector<uint8_t>& rgba) {
+    rgba.resize((size_t) width * height * 4);
+    if (format == TextureRGBA8) {
+        rgba = data;
+        return true;
+    }
+    int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    int blockBytes = textureFormatInfo(format).blockBytes;
+    bool ok = true;
+    uint8_t texels[64];
+    for (int by = 0; by < blocksHigh; by++) {
+        for (int bx = 0; bx < blocksWide; bx++) {
+            const uint8_t* block = &data[((size_t) by * blocksWide + bx) * blockBytes];
+            if (format == TextureBC7) {
+                ok = decodeBc7Block(block, texels) && ok;
+            } else if (format == TextureBC3) {
+                decodeColorBlock(block + 8, true, texels);
+                decodeAlphaBlock(block, texels);
+            } else {
+                decodeColorBlock(block, false, texels);
+            }
+            for (int y = 0; y < 4 && by * 4 + y < height; y++) {
+                for (int x = 0; x < 4 && bx * 4 + x < width; x++) {
+                    memcpy(&rgba[((size_t) (by * 4 + y) * width + bx * 4 + x) * 4], texels + (y * 4 + x) * 4, 4);
+                }
+            }
+        }
+    }
+    return ok;
+}
+
+// PSNR over channels [first, first + count), color premultiplied (what a transparent texel holds
+// doesn't matter), 99 for an exact match
+double imagePsnr(const std::vector<uint8_t>& a, const std::vector<uint8_t>& b, int first, int count) {
+    double sum = 0.0;
+    size_t samples = 0;
+    for (size_t i = 0; i < a.size(); i += 4) {
+        for (int ch = first; ch < first + count; ch++) {
+            double d = ch == 3 ? (double) a[i + 3] - b[i + 3] : (a[i + ch] * a[i + 3] - b[i + ch] * b[i + 3]) / 255.0;
+            sum += d * d;
+            samples++;
+        }
+    }
+    if (sum == 0.0) return 99.0;
+    return 10.0 * log10(255.0 * 255.0 / (sum / samples));
+}
+
+// one image; false when parallel and serial output differ or the output doesn't decode
+bool benchmarkCompressImage(const char* name, const std::vector<uint8_t>& rgba, int width, int height) {
+    AlphaUsage usage = alphaUsage(rgba.data(), (size_t) width * height);
+    CompressedFormatSupport s3tc;
+    s3tc.supported[TextureBC1] = s3tc.supported[TextureBC1A] = s3tc.supported[TextureBC3] = true;
+    TextureFormat formats[2] = { chooseTextureFormat(usage, CompressNormal, s3tc), TextureBC7 };
+    const char* usages[] = { "opaque", "cut-out", "blended alpha" };
+    const char* qualities[] = { "fast", "normal", "high" };
+    std::cout << "[compress] " << name << ": " << width << "x" << height << ", " << usages[usage] << std::endl;
+    bool ok = true;
+    double megapixels = width * height / 1e6;
+    for (TextureFormat format : formats) {
+        for (int quality = CompressFast; quality <= CompressHigh; quality++) {
+            std::vector<uint8_t> serial, parallel, decoded;
+            double serialSeconds = timeRuns([&]() {
+                compressImage(rgba.data(), width, height, format, (CompressQuality) quality, false, serial);
+            });
+            double parallelSeconds = timeRuns([&]() {
+                compressImage(rgba.data(), width, height, format, (CompressQuality) quality, true, parallel);
+            });
+            bool decodes = decompressImage(serial, width, height, format, decoded);
+            std::cout << "[compress]   " << textureFormatInfo(format).name << " " << qualities[quality] << ": "
+                      << megapixels / serialSeconds << " MP/s serial, " << megapixels / parallelSeconds
+                      << " MP/s parallel, " << (rgba.size() >> 10) << " -> " << (serial.size() >> 10) << " KB, PSNR rgb "
+                      << imagePsnr(rgba, decoded, 0, 3) << " dB";
+            if (usage != AlphaOpaque) std::cout << ", alpha " << imagePsnr(rgba, decoded, 3, 1) << " dB";
+            std::cout << std::endl;
+            if (serial != parallel) std::cout << "[compress]   FAILED: parallel output differs from serial" << std::endl;
+            if (!decodes) std::cout << "[compress]   FAILED: blocks don't decode" << std::endl;
+            ok = ok && serial == parallel && decodes;
+        }
+    }
+    return ok;
+}
+
+int runCompressBenchmark(const std::string& assetDirectory) {
+    int failures = benchmarkAssetImages("compress", assetDirectory, [](const char* asset, const DecodedImage& image) {
+        return benchmarkCompressImage(asset, image.pixels, image.width, image.height);
+    });
+    std::vector<uint8_t> pixels;
+    fencePixels(1024, 1024, pixels);
+    if (!benchmarkCompressImage("synthetic fence", pixels, 1024, 1024)) failures++;
+    syntheticPixels(1024, 1024, 4, 11u, pixels);
+    if (!benchmarkCompressImage("synthetic blended", pixels, 1024, 1024)) failures++;
+    return failures == 0 ? 0 : 1;
+}
+
+#endif /* compressbench_h */
@@ -0,0 +1,1044 @@
+//
+//  decode.h
+//  app
+//
+
+#ifndef decode_h
+#define decode_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include "jobs.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Image decoding for textures.
+//
+// Baseline JPEG (grey, 4:4:4, 4:2:2, 4:2:0) and 8 bit non interlaced PNG are decoded here.
+// Everything else (progressive JPEG, 16 bit or interlaced PNG, other formats) goes through
+// stb_image, which stays the reference the decode benchmark compares against.
+//
+// decodeImages() runs a batch in three passes: every file is parsed (PNGs are decoded whole right
+// there, their rows depend on each other), then the entropy coded data of every JPEG is cut at its
+// restart markers and the intervals of all files are decoded together, then upsampling and color
+// conversion of all files runs in bands of rows. A big JPEG with restart markers spreads over every
+// core and many small files decode side by side. Without restart markers a JPEG's entropy decoding
+// is one task, only its color conversion is split.
+//
+// IDCT, YCbCr -> RGB and PNG unfiltering have SSE2 paths. Only the main thread may decode in
+// parallel (see parallelFor), jobs pass parallel = false.
+
+struct DecodedImage {
+    std::vector<unsigned char> pixels;
+    int width = 0;
+    int height = 0;
+    // channels in the file, pixels holds the requested count
+    int channels = 0;
+    // "jpeg", "png" or "stb"
+    const char* decoder = "";
+    bool ok = false;
+};
+
+const int jpegFastBits = 9;
+
+// zigzag position -> natural (row major) position
+const uint8_t jpegZigzag[64] = {
+    0, 1, 8, 16, 9, 2, 3, 10, 17, 24, 32, 25, 18, 11, 4, 5,
+    12, 19, 26, 33, 40, 48, 41, 34, 27, 20, 13, 6, 7, 14, 21, 28,
+    35, 42, 49, 56, 57, 50, 43, 36, 29, 22, 15, 23, 30, 37, 44, 51,
+    58, 59, 52, 45, 38, 31, 39, 46, 53, 60, 61, 54, 47, 55, 62, 63
+};
+
+struct JpegHuffman {
+    // code index for every jpegFastBits long prefix, 255 for longer codes
+    uint8_t fast[1 << jpegFastBits];
+    uint8_t size[257];
+    uint8_t values[256];
+    uint16_t code[256];
+    uint32_t maxcode[18];
+    int delta[17];
+};
+
+bool buildJpegHuffman(JpegHuffman& table, const uint8_t* counts, const uint8_t* values, int total) {
+    int k = 0;
+    for (int i = 0; i < 16; i++) {
+        for (int j = 0; j < counts[i]; j++) table.size[k++] = (uint8_t) (i + 1);
+    }
+    table.size[k] = 0;
+    int code = 0;
+    k = 0;
+    for (int length = 1; length <= 16; length++) {
+        table.delta[length] = k - code;
+        while (table.size[k] == length) table.code[k++] = (uint16_t) code++;
+        if (code - 1 >= (1 << length)) return false;
+        table.maxcode[length] = (uint32_t) code << (16 - length);
+        code <<= 1;
+    }
+    table.maxcode[17] = 0xffffffff;
+    memset(table.fast, 255, sizeof(table.fast));
+    for (int i = 0; i < k; i++) {
+        int length = table.size[i];
+        if (length > jpegFastBits) continue;
+        int first = table.code[i] << (jpegFastBits - length);
+        for (int j = 0; j < (1 << (jpegFastBits - length)); j++) table.fast[first + j] = (uint8_t) i;
+    }
+    memcpy(table.values, values, total);
+    return true;
+}
+
+// bit reader over one restart interval, feeds zeros past its end
+struct JpegBits {
+    const uint8_t* p;
+    const uint8_t* end;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    void fill() {
+        while (count <= 24) {
+            uint32_t byte = 0;
+            if (p < end) {
+                byte = *p++;
+                // 0xFF in entropy data is always followed by a stuffed 0
+                if (byte == 0xFF && p < end && *p == 0) p++;
+            }
+            buffer |= byte << (24 - count);
+            count += 8;
+        }
+    }
+
+    int decode(const JpegHuffman& table) {
+        if (count < 16) fill();
+        int k = table.fast[buffer >> (32 - jpegFastBits)];
+        if (k < 255) {
+            int length = table.size[k];
+            buffer <<= length;
+            count -= length;
+            return table.values[k];
+        }
+        uint32_t prefix = buffer >> 16;
+        int length = jpegFastBits + 1;
+        while (prefix >= table.maxcode[length]) length++;
+        if (length == 17) return -1;
+        int index = (int) (buffer >> (32 - length)) + table.delta[length];
+        if (index < 0 || index > 255) return -1;
+        buffer <<= length;
+        count -= length;
+        return table.values[index];
+    }
+
+    // `length` bits as a signed coefficient, 1 <= length <= 16
+    int receive(int length) {
+        if (count < length) fill();
+        int value = (int) (buffer >> (32 - length));
+        buffer <<= length;
+        count -= length;
+        if (value < (1 << (length - 1))) value -= (1 << length) - 1;
+        return value;
+    }
+};
+
+struct JpegComponent {
+    int id = 0;
+    int h = 1, v = 1;
+    int quant = 0;
+    int dcTable = 0, acTable = 0;
+    // samples covered by the image
+    int width = 0, height = 0;
+    int blocksWide = 0, blocksHigh = 0;
+    // blocksWide * 8 samples per row
+    std::vector<uint8_t> plane;
+};
+
+// entropy coded data of one restart interval, markers excluded
+struct JpegSegment {
+    const uint8_t* begin;
+    const uint8_t* end;
+};
+
+struct JpegImage {
+    bool active = false;
+    bool failed = false;
+    int width = 0, height = 0;
+    int componentCount = 0;
+    JpegComponent components[3];
+    uint16_t quant[4][64] = {};
+    float dequant[4][64];
+    JpegHuffman dc[4], ac[4];
+    bool hasDc[4] = {}, hasAc[4] = {};
+    int hmax = 1, vmax = 1;
+    int mcusWide = 0, mcusHigh = 0;
+    int restartInterval = 0;
+    int adobeTransform = -1;
+    std::vector<JpegSegment> segments;
+};
+
+// AAN scaled IDCT (the float one from libjpeg). The per coefficient scale factors and the final
+// divide by 8 are folded into jpeg.dequant, so a block goes straight through two butterfly passes.
+const float aanScale[8] = { 1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+                            1.0f, 0.785694958f, 0.541196100f, 0.275899379f };
+
+// dequantization multipliers in zigzag order
+void buildDequant(const uint16_t* quant, float* dequant) {
+    for (int k = 0; k < 64; k++) {
+        int position = jpegZigzag[k];
+        dequant[k] = quant[k] * aanScale[position >> 3] * aanScale[position & 7] * 0.125f;
+    }
+}
+
+#if defined(__SSE2__)
+// one 1D pass over 8 vectors, each holding 4 independent lanes
+inline void idctPass(__m128* v) {
+    const __m128 sqrt2 = _mm_set1_ps(1.414213562f);
+    __m128 tmp10 = _mm_add_ps(v[0], v[4]), tmp11 = _mm_sub_ps(v[0], v[4]);
+    __m128 tmp13 = _mm_add_ps(v[2], v[6]);
+    __m128 tmp12 = _mm_sub_ps(_mm_mul_ps(_mm_sub_ps(v[2], v[6]), sqrt2), tmp13);
+    __m128 tmp0 = _mm_add_ps(tmp10, tmp13), tmp3 = _mm_sub_ps(tmp10, tmp13);
+    __m128 tmp1 = _mm_add_ps(tmp11, tmp12), tmp2 = _mm_sub_ps(tmp11, tmp12);
+    __m128 z13 = _mm_add_ps(v[5], v[3]), z10 = _mm_sub_ps(v[5], v[3]);
+    __m128 z11 = _mm_add_ps(v[1], v[7]), z12 = _mm_sub_ps(v[1], v[7]);
+    __m128 tmp7 = _mm_add_ps(z11, z13);
+    tmp11 = _mm_mul_ps(_mm_sub_ps(z11, z13), sqrt2);
+    __m128 z5 = _mm_mul_ps(_mm_add_ps(z10, z12), _mm_set1_ps(1.847759065f));
+    tmp10 = _mm_sub_ps(_mm_mul_ps(z12, _mm_set1_ps(1.082392200f)), z5);
+    tmp12 = _mm_add_ps(_mm_mul_ps(z10, _mm_set1_ps(-2.613125930f)), z5);
+    __m128 tmp6 = _mm_sub_ps(tmp12, tmp7);
+    __m128 tmp5 = _mm_sub_ps(tmp11, tmp6);
+    __m128 tmp4 = _mm_add_ps(tmp10, tmp5);
+    v[0] = _mm_add_ps(tmp0, tmp7);
+    v[7] = _mm_sub_ps(tmp0, tmp7);
+    v[1] = _mm_add_ps(tmp1, tmp6);
+    v[6] = _mm_sub_ps(tmp1, tmp6);
+    v[2] = _mm_add_ps(tmp2, tmp5);
+    v[5] = _mm_sub_ps(tmp2, tmp5);
+    v[4] = _mm_add_ps(tmp3, tmp4);
+    v[3] = _mm_sub_ps(tmp3, tmp4);
+}
+
+// 8x8 transpose of left (columns 0-3) and right (columns 4-7) halves
+inline void transposeBlock(__m128* left, __m128* right) {
+    _MM_TRANSPOSE4_PS(left[0], left[1], left[2], left[3]);
+    _MM_TRANSPOSE4_PS(left[4], left[5], left[6], left[7]);
+    _MM_TRANSPOSE4_PS(right[0], right[1], right[2], right[3]);
+    _MM_TRANSPOSE4_PS(right[4], right[5], right[6], right[7]);
+    for (int i = 0; i < 4; i++) {
+        __m128 swap = left[i + 4];
+        left[i + 4] = right[i];
+        right[i] = swap;
+    }
+}
+
+// scaled coefficients (natural order) -> 8x8 samples
+void idctBlock(const float* block, uint8_t* out, int stride) {
+    __m128 left[8], right[8];
+    for (int i = 0; i < 8; i++) {
+        left[i] = _mm_load_ps(block + i * 8);
+        right[i] = _mm_load_ps(block + i * 8 + 4);
+    }
+    // columns, then rows
+    idctPass(left);
+    idctPass(right);
+    transposeBlock(left, right);
+    idctPass(left);
+    idctPass(right);
+    transposeBlock(left, right);
+    const __m128 bias = _mm_set1_ps(128.0f);
+    for (int y = 0; y < 8; y++) {
+        __m128i lo = _mm_cvtps_epi32(_mm_add_ps(left[y], bias));
+        __m128i hi = _mm_cvtps_epi32(_mm_add_ps(right[y], bias));
+        __m128i words = _mm_packs_epi32(lo, hi);
+        _mm_storel_epi64((__m128i*) (out + y * stride), _mm_packus_epi16(words, words));
+    }
+}
+#else
+// one 1D pass over 8 values `step` apart
+inline void idctPass(float* v, int step) {
+    float tmp10 = v[0] + v[4 * step], tmp11 = v[0] - v[4 * step];
+    float tmp13 = v[2 * step] + v[6 * step];
+    float tmp12 = (v[2 * step] - v[6 * step]) * 1.414213562f - tmp13;
+    float tmp0 = tmp10 + tmp13, tmp3 = tmp10 - tmp13;
+    float tmp1 = tmp11 + tmp12, tmp2 = tmp11 - tmp12;
+    float z13 = v[5 * step] + v[3 * step], z10 = v[5 * step] - v[3 * step];
+    float z11 = v[step] + v[7 * step], z12 = v[step] - v[7 * step];
+    float tmp7 = z11 + z13;
+    tmp11 = (z11 - z13) * 1.414213562f;
+    float z5 = (z10 + z12) * 1.847759065f;
+    tmp10 = z12 * 1.082392200f - z5;
+    tmp12 = z10 * -2.613125930f + z5;
+    float tmp6 = tmp12 - tmp7;
+    float tmp5 = tmp11 - tmp6;
+    float tmp4 = tmp10 + tmp5;
+    v[0] = tmp0 + tmp7;
+    v[7 * step] = tmp0 - tmp7;
+    v[step] = tmp1 + tmp6;
+    v[6 * step] = tmp1 - tmp6;
+    v[2 * step] = tmp2 + tmp5;
+    v[5 * step] = tmp2 - tmp5;
+    v[4 * step] = tmp3 + tmp4;
+    v[3 * step] = tmp3 - tmp4;
+}
+
+void idctBlock(const float* block, uint8_t* out, int stride) {
+    float work[64];
+    memcpy(work, block, sizeof(work));
+    for (int x = 0; x < 8; x++) idctPass(work + x, 8);
+    for (int y = 0; y < 8; y++) idctPass(work + y * 8, 1);
+    for (int y = 0; y < 8; y++) {
+        for (int x = 0; x < 8; x++) {
+            long value = lrintf(work[y * 8 + x] + 128.0f);
+            out[y * stride + x] = (uint8_t) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+}
+#endif
+
+// Huffman decodes one block and writes its samples, false on corrupt data
+bool decodeJpegBlock(JpegImage& jpeg, JpegComponent& component, JpegBits& bits, int& predictor, uint8_t* out) {
+    alignas(16) float block[64];
+    const float* dequant = jpeg.dequant[component.quant];
+    int t = bits.decode(jpeg.dc[component.dcTable]);
+    if (t < 0 || t > 16) return false;
+    if (t) predictor += bits.receive(t);
+    float dc = predictor * dequant[0];
+    const JpegHuffman& ac = jpeg.ac[component.acTable];
+    int k = 1;
+    int rs = bits.decode(ac);
+    if (rs == 0) {
+        // flat block, common in smooth areas
+        long value = lrintf(dc + 128.0f);
+        uint8_t sample = (uint8_t) (value < 0 ? 0 : (value > 255 ? 255 : value));
+        int stride = component.blocksWide * 8;
+        for (int y = 0; y < 8; y++) memset(out + y * stride, sample, 8);
+        return true;
+    }
+    memset(block, 0, sizeof(block));
+    block[0] = dc;
+    while (true) {
+        if (rs < 0) return false;
+        int run = rs >> 4, length = rs & 15;
+        if (length == 0) {
+            if (rs != 0xF0) break;
+            k += 16;
+        } else {
+            k += run;
+            if (k > 63) return false;
+            block[jpegZigzag[k]] = bits.receive(length) * dequant[k];
+            k++;
+        }
+        if (k >= 64) break;
+        rs = bits.decode(ac);
+    }
+    idctBlock(block, out, component.blocksWide * 8);
+    return true;
+}
+
+// decodes restart intervals [first, last) into the component planes
+bool decodeJpegIntervals(JpegImage& jpeg, int first, int last) {
+    int mcuCount = jpeg.componentCount == 1 ? jpeg.components[0].blocksWide * jpeg.components[0].blocksHigh
+                                            : jpeg.mcusWide * jpeg.mcusHigh;
+    int interval = jpeg.restartInterval ? jpeg.restartInterval : mcuCount;
+    for (int s = first; s < last; s++) {
+        JpegBits bits;
+        bits.p = jpeg.segments[s].begin;
+        bits.end = jpeg.segments[s].end;
+        int predictors[3] = { 0, 0, 0 };
+        int mcuEnd = (s + 1) * interval < mcuCount ? (s + 1) * interval : mcuCount;
+        for (int mcu = s * interval; mcu < mcuEnd; mcu++) {
+            if (jpeg.componentCount == 1) {
+                // single component scans aren't interleaved, an MCU is one block
+                JpegComponent& component = jpeg.components[0];
+                int bx = mcu % component.blocksWide, by = mcu / component.blocksWide;
+                uint8_t* out = component.plane.data() + (size_t) by * 8 * component.blocksWide * 8 + bx * 8;
+                if (!decodeJpegBlock(jpeg, component, bits, predictors[0], out)) return false;
+                continue;
+            }
+            int mx = mcu % jpeg.mcusWide, my = mcu / jpeg.mcusWide;
+            for (int c = 0; c < jpeg.componentCount; c++) {
+                JpegComponent& component = jpeg.components[c];
+                for (int by = 0; by < component.v; by++) {
+                    for (int bx = 0; bx < component.h; bx++) {
+                        int x = (mx * component.h + bx) * 8, y = (my * component.v + by) * 8;
+                        uint8_t* out = component.plane.data() + (size_t) y * component.blocksWide * 8 + x;
+                        if (!decodeJpegBlock(jpeg, component, bits, predictors[c], out)) return false;
+                    }
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// Reads the headers up to the scan and indexes its restart intervals. False for anything this
+// decoder doesn't handle, the caller falls back to stb_image.
+bool parseJpeg(const uint8_t* data, size_t size, JpegImage& jpeg) {
+    const uint8_t* p = data + 2;
+    const uint8_t* end = data + size;
+    bool frame = false;
+    while (true) {
+        if (p >= end || *p != 0xFF) return false;
+        while (p < end && *p == 0xFF) p++;
+        if (p >= end) return false;
+        int marker = *p++;
+        if (marker == 0xD8 || marker == 0x01 || (marker >= 0xD0 && marker <= 0xD7)) continue;
+        if (marker == 0xD9 || end - p < 2) return false;
+        int length = (p[0] << 8) | p[1];
+        if (length < 2 || end - p < length) return false;
+        const uint8_t* segment = p + 2;
+        const uint8_t* next = p + length;
+        if (marker == 0xDB) {
+            while (segment < next) {
+                int precision = *segment >> 4, table = *segment & 15;
+                segment++;
+                if (precision > 1 || table > 3 || next - segment < 64 * (precision + 1)) return false;
+                for (int k = 0; k < 64; k++) {
+                    jpeg.quant[table][k] = precision ? (uint16_t) ((segment[k * 2] << 8) | segment[k * 2 + 1]) : segment[k];
+                }
+                segment += 64 * (precision + 1);
+            }
+        } else if (marker == 0xC4) {
+            while (segment < next) {
+                if (next - segment < 17) return false;
+                int tableClass = *segment >> 4, table = *segment & 15;
+                if (tableClass > 1 || table > 3) return false;
+                int total = 0;
+                for (int i = 0; i < 16; i++) total += segment[1 + i];
+                if (total > 256 || next - segment - 17 < total) return false;
+                JpegHuffman& huffman = tableClass ? jpeg.ac[table] : jpeg.dc[table];
+                if (!buildJpegHuffman(huffman, segment + 1, segment + 17, total)) return false;
+                (tableClass ? jpeg.hasAc : jpeg.hasDc)[table] = true;
+                segment += 17 + total;
+            }
+        } else if (marker == 0xC0 || marker == 0xC1) {
+            if (length < 8 || segment[0] != 8) return false;
+            jpeg.height = (segment[1] << 8) | segment[2];
+            jpeg.width = (segment[3] << 8) | segment[4];
+            jpeg.componentCount = segment[5];
+            // height 0 means a DNL marker follows the scan
+            if (jpeg.width == 0 || jpeg.height == 0) return false;
+            if (jpeg.componentCount != 1 && jpeg.componentCount != 3) return false;
+            if (length != 8 + 3 * jpeg.componentCount) return false;
+            for (int c = 0; c < jpeg.componentCount; c++) {
+                JpegComponent& component = jpeg.components[c];
+                component.id = segment[6 + c * 3];
+                component.h = segment[7 + c * 3] >> 4;
+                component.v = segment[7 + c * 3] & 15;
+                component.quant = segment[8 + c * 3];
+                if (component.h < 1 || component.h > 4 || component.v < 1 || component.v > 4 || component.quant > 3) return false;
+            }
+            frame = true;
+        } else if (marker >= 0xC2 && marker <= 0xCF) {
+            // progressive, lossless, hierarchical, arithmetic coded
+            return false;
+        } else if (marker == 0xDD) {
+            if (length != 4) return false;
+            jpeg.restartInterval = (segment[0] << 8) | segment[1];
+        } else if (marker == 0xEE) {
+            if (length >= 14 && memcmp(segment, "Adobe", 5) == 0) jpeg.adobeTransform = segment[11];
+        } else if (marker == 0xDA) {
+            if (!frame || length < 6) return false;
+            int scanComponents = segment[0];
+            // one interleaved scan with every component, baseline files are written like that
+            if (scanComponents != jpeg.componentCount || length != 6 + 2 * scanComponents) return false;
+            for (int i = 0; i < scanComponents; i++) {
+                JpegComponent& component = jpeg.components[i];
+                if (segment[1 + i * 2] != component.id) return false;
+                component.dcTable = segment[2 + i * 2] >> 4;
+                component.acTable = segment[2 + i * 2] & 15;
+                if (component.dcTable > 3 || component.acTable > 3) return false;
+                if (!jpeg.hasDc[component.dcTable] || !jpeg.hasAc[component.acTable]) return false;
+            }
+            const uint8_t* spectral = segment + 1 + scanComponents * 2;
+            if (spectral[0] != 0 || spectral[1] != 63 || spectral[2] != 0) return false;
+            p = next;
+            break;
+        }
+        p = next;
+    }
+    for (int table = 0; table < 4; table++) buildDequant(jpeg.quant[table], jpeg.dequant[table]);
+
+    // RGB stored as is (Adobe transform 0 or components named R G B) and odd sampling go to stb
+    if (jpeg.componentCount == 3) {
+        if (jpeg.adobeTransform == 0) return false;
+        if (jpeg.components[0].id == 'R' && jpeg.components[1].id == 'G' && jpeg.components[2].id == 'B') return false;
+        JpegComponent* components = jpeg.components;
+        if (components[0].h > 2 || components[0].v > 2) return false;
+        for (int c = 1; c < 3; c++) {
+            if (components[c].h != 1 || components[c].v != 1) return false;
+        }
+        jpeg.hmax = components[0].h;
+        jpeg.vmax = components[0].v;
+    } else {
+        jpeg.components[0].h = jpeg.components[0].v = 1;
+    }
+    jpeg.mcusWide = (jpeg.width + jpeg.hmax * 8 - 1) / (jpeg.hmax * 8);
+    jpeg.mcusHigh = (jpeg.height + jpeg.vmax * 8 - 1) / (jpeg.vmax * 8);
+    for (int c = 0; c < jpeg.componentCount; c++) {
+        JpegComponent& component = jpeg.components[c];
+        component.width = (jpeg.width * component.h + jpeg.hmax - 1) / jpeg.hmax;
+        component.height = (jpeg.height * component.v + jpeg.vmax - 1) / jpeg.vmax;
+        if (jpeg.componentCount == 1) {
+            component.blocksWide = (component.width + 7) / 8;
+            component.blocksHigh = (component.height + 7) / 8;
+        } else {
+            component.blocksWide = jpeg.mcusWide * component.h;
+            component.blocksHigh = jpeg.mcusHigh * component.v;
+        }
+    }
+
+    // entropy coded data, cut at restart markers
+    const uint8_t* begin = p;
+    while (true) {
+        const uint8_t* marker = (const uint8_t*) memchr(p, 0xFF, end - p);
+        if (marker == NULL || marker + 1 >= end) {
+            // truncated file, the missing tail decodes as zeros
+            jpeg.segments.push_back({ begin, end });
+            break;
+        }
+        int code = marker[1];
+        if (code == 0x00 || code == 0xFF) {
+            p = marker + (code == 0x00 ? 2 : 1);
+            continue;
+        }
+        jpeg.segments.push_back({ begin, marker });
+        if (code < 0xD0 || code > 0xD7) break;
+        begin = p = marker + 2;
+    }
+    int mcuCount = jpeg.componentCount == 1 ? jpeg.components[0].blocksWide * jpeg.components[0].blocksHigh
+                                            : jpeg.mcusWide * jpeg.mcusHigh;
+    size_t intervals = jpeg.restartInterval ? (mcuCount + jpeg.restartInterval - 1) / jpeg.restartInterval : 1;
+    if (jpeg.segments.size() != intervals) return false;
+
+    for (int c = 0; c < jpeg.componentCount; c++) {
+        JpegComponent& component = jpeg.components[c];
+        component.plane.resize((size_t) component.blocksWide * 8 * component.blocksHigh * 8);
+    }
+    return true;
+}
+
+// stb_image's "fancy" chroma upsampling (triangle filter), so both decoders agree
+
+// output row `y` of a component subsampled 2x vertically and/or horizontally, `row` has room for
+// width * 2 samples; returns the row to read
+const uint8_t* upsampleJpegRow(const JpegImage& jpeg, const JpegComponent& component, int y, uint8_t* row) {
+    int stride = component.blocksWide * 8;
+    bool horizontal = jpeg.hmax > component.h, vertical = jpeg.vmax > component.v;
+    int w = component.width;
+    const uint8_t* near = component.plane.data() + (size_t) (vertical ? y >> 1 : y) * stride;
+    if (!vertical) {
+        if (!horizontal) return near;
+        if (w == 1) {
+            row[0] = row[1] = near[0];
+            return row;
+        }
+        row[0] = near[0];
+        row[1] = (uint8_t) ((near[0] * 3 + near[1] + 2) >> 2);
+        int i;
+        for (i = 1; i < w - 1; i++) {
+            int n = 3 * near[i] + 2;
+            row[i * 2] = (uint8_t) ((n + near[i - 1]) >> 2);
+            row[i * 2 + 1] = (uint8_t) ((n + near[i + 1]) >> 2);
+        }
+        row[i * 2] = (uint8_t) ((near[w - 2] * 3 + near[w - 1] + 2) >> 2);
+        row[i * 2 + 1] = near[w - 1];
+        return row;
+    }
+    int nearRow = y >> 1;
+    int farRow = (y & 1) ? (nearRow + 1 < component.height ? nearRow + 1 : component.height - 1)
+                         : (nearRow > 0 ? nearRow - 1 : 0);
+    const uint8_t* far = component.plane.data() + (size_t) farRow * stride;
+    if (!horizontal) {
+        for (int i = 0; i < w; i++) row[i] = (uint8_t) ((3 * near[i] + far[i] + 2) >> 2);
+        return row;
+    }
+    if (w == 1) {
+        row[0] = row[1] = (uint8_t) ((3 * near[0] + far[0] + 2) >> 2);
+        return row;
+    }
+    int t1 = 3 * near[0] + far[0];
+    row[0] = (uint8_t) ((t1 + 2) >> 2);
+    for (int i = 1; i < w; i++) {
+        int t0 = t1;
+        t1 = 3 * near[i] + far[i];
+        row[i * 2 - 1] = (uint8_t) ((3 * t0 + t1 + 8) >> 4);
+        row[i * 2] = (uint8_t) ((3 * t1 + t0 + 8) >> 4);
+    }
+    row[w * 2 - 1] = (uint8_t) ((t1 + 2) >> 2);
+    return row;
+}
+
+inline uint8_t clampByte(int value) {
+    return (uint8_t) (value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+// YCbCr -> RGB(A) for `count` pixels, `channels` 3 or 4
+void yCbCrToRgbRow(const uint8_t* y, const uint8_t* cb, const uint8_t* cr, uint8_t* out, int count, int channels) {
+    int i = 0;
+#if defined(__SSE2__)
+    // 16 bit fixed point, 4 fractional bits after the multiplies
+    const __m128i signFlip = _mm_set1_epi8((char) 0x80);
+    const __m128i crToR = _mm_set1_epi16((short) (1.40200f * 4096.0f + 0.5f));
+    const __m128i crToG = _mm_set1_epi16((short) -(0.71414f * 4096.0f + 0.5f));
+    const __m128i cbToG = _mm_set1_epi16((short) -(0.34414f * 4096.0f + 0.5f));
+    const __m128i cbToB = _mm_set1_epi16((short) (1.77200f * 4096.0f + 0.5f));
+    const __m128i yBias = _mm_set1_epi8((char) 128);
+    const __m128i alpha = _mm_set1_epi16(255);
+    alignas(16) uint8_t r8[16], g8[16], b8[16];
+    for (; i + 8 <= count; i += 8) {
+        __m128i yBytes = _mm_loadl_epi64((const __m128i*) (y + i));
+        __m128i cbBytes = _mm_xor_si128(_mm_loadl_epi64((const __m128i*) (cb + i)), signFlip);
+        __m128i crBytes = _mm_xor_si128(_mm_loadl_epi64((const __m128i*) (cr + i)), signFlip);
+        // y * 16 + 8, chroma - 128 scaled by 256
+        __m128i yw = _mm_srli_epi16(_mm_unpacklo_epi8(yBias, yBytes), 4);
+        __m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), cbBytes);
+        __m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), crBytes);
+        __m128i r = _mm_srai_epi16(_mm_add_epi16(yw, _mm_mulhi_epi16(crToR, crw)), 4);
+        __m128i g = _mm_srai_epi16(_mm_add_epi16(_mm_add_epi16(yw, _mm_mulhi_epi16(cbToG, cbw)), _mm_mulhi_epi16(crToG, crw)), 4);
+        __m128i b = _mm_srai_epi16(_mm_add_epi16(yw, _mm_mulhi_epi16(cbToB, cbw)), 4);
+        if (channels == 4) {
+            __m128i rb = _mm_packus_epi16(r, b);
+            __m128i ga = _mm_packus_epi16(g, alpha);
+            // r0 g0 r1 g1 ... and b0 a0 b1 a1 ...
+            __m128i rg = _mm_unpacklo_epi8(rb, ga);
+            __m128i ba = _mm_unpackhi_epi8(rb, ga);
+            _mm_storeu_si128((__m128i*) (out + i * 4), _mm_unpacklo_epi16(rg, ba));
+            _mm_storeu_si128((__m128i*) (out + i * 4 + 16), _mm_unpackhi_epi16(rg, ba));
+        } else {
+            _mm_store_si128((__m128i*) r8, _mm_packus_epi16(r, r));
+            _mm_store_si128((__m128i*) g8, _mm_packus_epi16(g, g));
+            _mm_store_si128((__m128i*) b8, _mm_packus_epi16(b, b));
+            for (int j = 0; j < 8; j++) {
+                out[(i + j) * 3] = r8[j];
+                out[(i + j) * 3 + 1] = g8[j];
+                out[(i + j) * 3 + 2] = b8[j];
+            }
+        }
+    }
+#endif
+    for (; i < count; i++) {
+        int yFixed = (y[i] << 20) + (1 << 19);
+        int crValue = cr[i] - 128, cbValue = cb[i] - 128;
+        int r = yFixed + crValue * ((int) (1.40200f * 4096.0f + 0.5f) << 8);
+        int g = yFixed + crValue * -((int) (0.71414f * 4096.0f + 0.5f) << 8) +
+                ((cbValue * -((int) (0.34414f * 4096.0f + 0.5f) << 8)) & 0xffff0000);
+        int b = yFixed + cbValue * ((int) (1.77200f * 4096.0f + 0.5f) << 8);
+        uint8_t* pixel = out + i * channels;
+        pixel[0] = clampByte(r >> 20);
+        pixel[1] = clampByte(g >> 20);
+        pixel[2] = clampByte(b >> 20);
+        if (channels == 4) pixel[3] = 255;
+    }
+}
+
+// upsamples and color converts output rows [first, last) into image.pixels
+void convertJpegRows(const JpegImage& jpeg, DecodedImage& image, int channels, bool flip, int first, int last) {
+    std::vector<uint8_t> cbRow(jpeg.width + 16), crRow(jpeg.width + 16);
+    for (int y = first; y < last; y++) {
+        uint8_t* out = image.pixels.data() + (size_t) (flip ? jpeg.height - 1 - y : y) * jpeg.width * channels;
+        const uint8_t* luma = jpeg.components[0].plane.data() + (size_t) y * jpeg.components[0].blocksWide * 8;
+        if (jpeg.componentCount == 3 && channels >= 3) {
+            const uint8_t* cb = upsampleJpegRow(jpeg, jpeg.components[1], y, cbRow.data());
+            const uint8_t* cr = upsampleJpegRow(jpeg, jpeg.components[2], y, crRow.data());
+            yCbCrToRgbRow(luma, cb, cr, out, jpeg.width, channels);
+        } else if (channels == 1) {
+            memcpy(out, luma, jpeg.width);
+        } else {
+            // grey expanded, or luma alone like stb does for grey requests of color files
+            for (int x = 0; x < jpeg.width; x++) {
+                uint8_t* pixel = out + x * channels;
+                if (channels == 2) {
+                    pixel[0] = luma[x];
+                    pixel[1] = 255;
+                } else {
+                    pixel[0] = pixel[1] = pixel[2] = luma[x];
+                    if (channels == 4) pixel[3] = 255;
+                }
+            }
+        }
+    }
+}
+
+// PNG
+
+#if defined(__SSE2__)
+inline __m128i loadPixel(const uint8_t* p, int bpp) {
+    uint32_t value = 0;
+    memcpy(&value, p, bpp);
+    return _mm_cvtsi32_si128((int) value);
+}
+
+inline void storePixel(uint8_t* p, __m128i pixel, int bpp) {
+    uint32_t value = (uint32_t) _mm_cvtsi128_si32(pixel);
+    memcpy(p, &value, bpp);
+}
+
+inline __m128i selectBytes(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+inline __m128i absWords(__m128i x) {
+    return _mm_max_epi16(x, _mm_sub_epi16(_mm_setzero_si128(), x));
+}
+#endif
+
+inline int paethPredictor(int a, int b, int c) {
+    int pa = abs(b - c), pb = abs(a - c), pc = abs(a + b - 2 * c);
+    if (pa <= pb && pa <= pc) return a;
+    return pb <= pc ? b : c;
+}
+
+// reverses one row's filter in place, `prior` is the previous unfiltered row (zeros for the first)
+void unfilterPngRow(int filter, uint8_t* row, const uint8_t* prior, size_t length, int bpp) {
+    size_t i = 0;
+    switch (filter) {
+        case 1:
+#if defined(__SSE2__)
+            if (bpp >= 3) {
+                // each pixel depends on the previous one, SIMD works a pixel at a time
+                __m128i left = _mm_setzero_si128();
+                for (; i + bpp <= length; i += bpp) {
+                    left = _mm_add_epi8(left, loadPixel(row + i, bpp));
+                    storePixel(row + i, left, bpp);
+                }
+                break;
+            }
+#endif
+            for (i = bpp; i < length; i++) row[i] = (uint8_t) (row[i] + row[i - bpp]);
+            break;
+        case 2:
+#if defined(__SSE2__)
+            for (; i + 16 <= length; i += 16) {
+                __m128i sum = _mm_add_epi8(_mm_loadu_si128((const __m128i*) (row + i)),
+                                           _mm_loadu_si128((const __m128i*) (prior + i)));
+                _mm_storeu_si128((__m128i*) (row + i), sum);
+            }
+#endif
+            for (; i < length; i++) row[i] = (uint8_t) (row[i] + prior[i]);
+            break;
+        case 3:
+#if defined(__SSE2__)
+            if (bpp >= 3) {
+                __m128i left = _mm_setzero_si128();
+                const __m128i one = _mm_set1_epi8(1);
+                for (; i + bpp <= length; i += bpp) {
+                    __m128i up = loadPixel(prior + i, bpp);
+                    // avg_epu8 rounds up, PNG's average rounds down
+                    __m128i average = _mm_sub_epi8(_mm_avg_epu8(left, up), _mm_and_si128(_mm_xor_si128(left, up), one));
+                    left = _mm_add_epi8(loadPixel(row + i, bpp), average);
+                    storePixel(row + i, left, bpp);
+                }
+                break;
+            }
+#endif
+            for (; i < (size_t) bpp; i++) row[i] = (uint8_t) (row[i] + (prior[i] >> 1));
+            for (; i < length; i++) row[i] = (uint8_t) (row[i] + ((row[i - bpp] + prior[i]) >> 1));
+            break;
+        case 4:
+#if defined(__SSE2__)
+            if (bpp >= 3) {
+                const __m128i zero = _mm_setzero_si128();
+                __m128i a = zero, c = zero;
+                for (; i + bpp <= length; i += bpp) {
+                    __m128i b = _mm_unpacklo_epi8(loadPixel(prior + i, bpp), zero);
+                    __m128i pa = _mm_sub_epi16(b, c);
+                    __m128i pb = _mm_sub_epi16(a, c);
+                    __m128i pc = absWords(_mm_add_epi16(pa, pb));
+                    pa = absWords(pa);
+                    pb = absWords(pb);
+                    __m128i smallest = _mm_min_epi16(pc, _mm_min_epi16(pa, pb));
+                    // ties prefer a, then b
+                    __m128i nearest = selectBytes(_mm_cmpeq_epi16(smallest, pa), a,
+                                                  selectBytes(_mm_cmpeq_epi16(smallest, pb), b, c));
+                    __m128i pixel = _mm_add_epi8(loadPixel(row + i, bpp), _mm_packus_epi16(nearest, nearest));
+                    storePixel(row + i, pixel, bpp);
+                    c = b;
+                    a = _mm_unpacklo_epi8(pixel, zero);
+                }
+                break;
+            }
+#endif
+            for (; i < (size_t) bpp; i++) row[i] = (uint8_t) (row[i] + prior[i]);
+            for (; i < length; i++) row[i] = (uint8_t) (row[i] + paethPredictor(row[i - bpp], prior[i], prior[i - bpp]));
+            break;
+        default:
+            break;
+    }
+}
+
+inline uint32_t readBigEndian(const uint8_t* p) {
+    return ((uint32_t) p[0] << 24) | ((uint32_t) p[1] << 16) | ((uint32_t) p[2] << 8) | p[3];
+}
+
+// stb's channel conversion rules: grey replicates, alpha fills with 255, color to grey is luma
+void convertChannels(const uint8_t* in, int inChannels, uint8_t* out, int outChannels, size_t count) {
+    for (size_t i = 0; i < count; i++, in += inChannels, out += outChannels) {
+        int alpha = inChannels == 2 ? in[1] : (inChannels == 4 ? in[3] : 255);
+        if (outChannels >= 3) {
+            out[0] = in[0];
+            out[1] = inChannels >= 3 ? in[1] : in[0];
+            out[2] = inChannels >= 3 ? in[2] : in[0];
+            if (outChannels == 4) out[3] = (uint8_t) alpha;
+        } else {
+            out[0] = inChannels >= 3 ? (uint8_t) ((in[0] * 77 + in[1] * 150 + in[2] * 29) >> 8) : in[0];
+            if (outChannels == 2) out[1] = (uint8_t) alpha;
+        }
+    }
+}
+
+void flipRows(std::vector<unsigned char>& pixels, size_t rowBytes, int height) {
+    std::vector<unsigned char> row(rowBytes);
+    for (int y = 0; y < height / 2; y++) {
+        unsigned char* top = pixels.data() + (size_t) y * rowBytes;
+        unsigned char* bottom = pixels.data() + (size_t) (height - 1 - y) * rowBytes;
+        memcpy(row.data(), top, rowBytes);
+        memcpy(top, bottom, rowBytes);
+        memcpy(bottom, row.data(), rowBytes);
+    }
+}
+
+// 8 bit non interlaced PNG; false for anything else, the caller falls back to stb_image
+bool decodePng(const uint8_t* data, size_t size, int requiredChannels, bool flip, DecodedImage& image) {
+    const uint8_t* p = data + 8;
+    const uint8_t* end = data + size;
+    int width = 0, height = 0, colorType = -1;
+    uint8_t palette[256 * 4];
+    int paletteSize = 0;
+    bool paletteAlpha = false;
+    std::vector<uint8_t> compressed;
+    while (end - p >= 12) {
+        uint32_t length = readBigEndian(p);
+        const uint8_t* type = p + 4;
+        const uint8_t* chunk = p + 8;
+        if (length > (uint32_t) (end - chunk) - 4) return false;
+        if (memcmp(type, "IHDR", 4) == 0) {
+            if (length != 13) return false;
+            width = (int) readBigEndian(chunk);
+            height = (int) readBigEndian(chunk + 4);
+            colorType = chunk[9];
+            // bit depth 8, no interlacing
+            if (chunk[8] != 8 || chunk[12] != 0 || width <= 0 || height <= 0) return false;
+            if (colorType != 0 && colorType != 2 && colorType != 3 && colorType != 4 && colorType != 6) return false;
+            if ((size_t) width * height > (1u << 28)) return false;
+        } else if (memcmp(type, "PLTE", 4) == 0) {
+            paletteSize = (int) length / 3;
+            if (paletteSize > 256 || paletteSize * 3 != (int) length) return false;
+            for (int i = 0; i < paletteSize; i++) {
+                memcpy(palette + i * 4, chunk + i * 3, 3);
+                palette[i * 4 + 3] = 255;
+            }
+        } else if (memcmp(type, "tRNS", 4) == 0) {
+            // color keyed transparency of non palette images is left to stb
+            if (colorType != 3 || (int) length > paletteSize) return false;
+            for (uint32_t i = 0; i < length; i++) palette[i * 4 + 3] = chunk[i];
+            paletteAlpha = true;
+        } else if (memcmp(type, "IDAT", 4) == 0) {
+            compressed.insert(compressed.end(), chunk, chunk + length);
+        } else if (memcmp(type, "CgBI", 4) == 0) {
+            return false;
+        } else if (memcmp(type, "IEND", 4) == 0) {
+            break;
+        }
+        p = chunk + length + 4;
+    }
+    if (colorType < 0 || compressed.empty() || (colorType == 3 && paletteSize == 0)) return false;
+
+    static const int colorTypeChannels[7] = { 1, 0, 3, 1, 2, 0, 4 };
+    int bpp = colorTypeChannels[colorType];
+    size_t rowBytes = (size_t) width * bpp;
+    size_t expected = (rowBytes + 1) * height;
+    int inflatedSize = 0;
+    char* inflated = stbi_zlib_decode_malloc_guesssize_headerflag((const char*) compressed.data(), (int) compressed.size(),
+                                                                  (int) expected, &inflatedSize, 1);
+    if (inflated == NULL) return false;
+    if ((size_t) inflatedSize < expected) {
+        stbi_image_free(inflated);
+        return false;
+    }
+
+    std::vector<uint8_t> raw((size_t) rowBytes * height);
+    std::vector<uint8_t> zeros(rowBytes);
+    bool valid = true;
+    for (int y = 0; y < height && valid; y++) {
+        const uint8_t* source = (const uint8_t*) inflated + (size_t) y * (rowBytes + 1);
+        uint8_t* row = raw.data() + (size_t) y * rowBytes;
+        memcpy(row, source + 1, rowBytes);
+        if (source[0] > 4) valid = false;
+        unfilterPngRow(source[0], row, y ? row - rowBytes : zeros.data(), rowBytes, bpp);
+    }
+    stbi_image_free(inflated);
+    if (!valid) return false;
+
+    int channels = bpp;
+    if (colorType == 3) {
+        // palette indices -> colors
+        channels = paletteAlpha ? 4 : 3;
+        std::vector<uint8_t> expanded((size_t) width * height * channels);
+        for (size_t i = 0; i < (size_t) width * height; i++) {
+            memcpy(expanded.data() + i * channels, palette + raw[i] * 4, channels);
+        }
+        raw.swap(expanded);
+    }
+    int outChannels = requiredChannels ? requiredChannels : channels;
+    if (outChannels == channels) {
+        image.pixels.swap(raw);
+    } else {
+        image.pixels.resize((size_t) width * height * outChannels);
+        convertChannels(raw.data(), channels, image.pixels.data(), outChannels, (size_t) width * height);
+    }
+    if (flip) flipRows(image.pixels, (size_t) width * outChannels, height);
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.decoder = "png";
+    image.ok = true;
+    return true;
+}
+
+void decodeWithStb(const std::vector<unsigned char>& file, int requiredChannels, bool flip, DecodedImage& image) {
+    int width, height, channels;
+    unsigned char* data = stbi_load_from_memory(file.data(), (int) file.size(), &width, &height, &channels, requiredChannels);
+    image.decoder = "stb";
+    if (data == NULL) return;
+    int outChannels = requiredChannels ? requiredChannels : channels;
+    image.pixels.assign(data, data + (size_t) width * height * outChannels);
+    stbi_image_free(data);
+    if (flip) flipRows(image.pixels, (size_t) width * outChannels, height);
+    image.width = width;
+    image.height = height;
+    image.channels = channels;
+    image.ok = true;
+}
+
+template <typename F>
+void decodeRange(bool parallel, size_t count, size_t grain, const F& fn) {
+    if (parallel) {
+        jobs.parallelFor(count, grain, fn);
+    } else if (count > 0) {
+        fn((size_t) 0, count);
+    }
+}
+
+// Decodes every file in `files`, `requiredChannels` 0 keeps the file's. `flip` puts the last row
+// first (GL's texture origin). Failed images come back with ok = false.
+void decodeImages(const std::vector<std::vector<unsigned char>>& files, int requiredChannels, bool flip, bool parallel,
+                  std::vector<DecodedImage>& images) {
+    images.clear();
+    images.resize(files.size());
+    std::vector<JpegImage> jpegs(files.size());
+
+    decodeRange(parallel, files.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const std::vector<unsigned char>& file = files[i];
+            DecodedImage& image = images[i];
+            JpegImage& jpeg = jpegs[i];
+            if (file.size() > 4 && file[0] == 0xFF && file[1] == 0xD8 && parseJpeg(file.data(), file.size(), jpeg)) {
+                jpeg.active = true;
+                image.width = jpeg.width;
+                image.height = jpeg.height;
+                image.channels = jpeg.componentCount;
+                image.decoder = "jpeg";
+                int channels = requiredChannels ? requiredChannels : jpeg.componentCount;
+                image.pixels.resize((size_t) jpeg.width * jpeg.height * channels);
+                continue;
+            }
+            jpeg = JpegImage();
+            if (file.size() > 8 && memcmp(file.data(), "\x89PNG\r\n\x1a\n", 8) == 0 &&
+                decodePng(file.data(), file.size(), requiredChannels, flip, image)) {
+                continue;
+            }
+            decodeWithStb(file, requiredChannels, flip, image);
+        }
+    });
+
+    // restart intervals of every JPEG, a few tasks per file
+    struct IntervalTask {
+        int image;
+        int first, last;
+    };
+    std::vector<IntervalTask> intervalTasks;
+    size_t tasksPerImage = parallel ? jobs.threadCount() * 2 : 1;
+    for (size_t i = 0; i < jpegs.size(); i++) {
+        if (!jpegs[i].active) continue;
+        size_t segments = jpegs[i].segments.size();
+        size_t tasks = segments < tasksPerImage ? segments : tasksPerImage;
+        for (size_t t = 0; t < tasks; t++) {
+            intervalTasks.push_back({ (int) i, (int) (segments * t / tasks), (int) (segments * (t + 1) / tasks) });
+        }
+    }
+    std::vector<uint8_t> taskFailed(intervalTasks.size(), 0);
+    decodeRange(parallel, intervalTasks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            const IntervalTask& task = intervalTasks[t];
+            taskFailed[t] = !decodeJpegIntervals(jpegs[task.image], task.first, task.last);
+        }
+    });
+    std::vector<int> fallbacks;
+    for (size_t t = 0; t < intervalTasks.size(); t++) {
+        JpegImage& jpeg = jpegs[intervalTasks[t].image];
+        if (taskFailed[t] && !jpeg.failed) {
+            jpeg.failed = true;
+            fallbacks.push_back(intervalTasks[t].image);
+        }
+    }
+    // corrupt entropy data, let stb have a go
+    decodeRange(parallel, fallbacks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            int index = fallbacks[i];
+            images[index] = DecodedImage();
+            decodeWithStb(files[index], requiredChannels, flip, images[index]);
+        }
+    });
+
+    // upsampling and color conversion in bands of rows
+    struct RowTask {
+        int image;
+        int first, last;
+    };
+    std::vector<RowTask> rowTasks;
+    const int bandRows = 64;
+    for (size_t i = 0; i < jpegs.size(); i++) {
+        if (!jpegs[i].active || jpegs[i].failed) continue;
+        for (int y = 0; y < jpegs[i].height; y += bandRows) {
+            rowTasks.push_back({ (int) i, y, y + bandRows < jpegs[i].height ? y + bandRows : jpegs[i].height });
+        }
+    }
+    decodeRange(parallel, rowTasks.size(), 1, [&](size_t begin, size_t end) {
+        for (size_t t = begin; t < end; t++) {
+            const RowTask& task = rowTasks[t];
+            const JpegImage& jpeg = jpegs[task.image];
+            int channels = requiredChannels ? requiredChannels : jpeg.componentCount;
+            convertJpegRows(jpeg, images[task.image], channels, flip, task.first, task.last);
+        }
+    });
+    for (size_t i = 0; i < jpegs.size(); i++) {
+        if (jpegs[i].active && !jpegs[i].failed) images[i].ok = true;
+    }
+}
+
+bool readWholeFile(const std::string& path, std::vector<unsigned char>& contents) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (file == NULL) return false;
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    contents.resize(size > 0 ? size : 0);
+    bool ok = size > 0 && fread(contents.data(), 1, size, file) == (size_t) size;
+    fclose(file);
+    return ok;
+}
+
+// one file on the calling thread, what jobs use
+bool decodeImageFile(const std::string& path, int requiredChannels, bool flip, DecodedImage& image) {
+    std::vector<std::vector<unsigned char>> files(1);
+    std::vector<DecodedImage> images;
+    if (!readWholeFile(path, files[0])) return false;
+    decodeImages(files, requiredChannels, flip, false, images);
+    image = std::move(images[0]);
+    return image.ok;
+}
+
+#endif /* decode_h */
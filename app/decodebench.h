@@ -0,0 +1,686 @@
+//
+//  decodebench.h
+//  app
+//
+
+#ifndef decodebench_h
+#define decodebench_h
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <limits.h>
+#include <string>
+#include <vector>
+#include "jobs.h"
+#include "decode.h"
+#include "assetbench.h"
+
+// Decode benchmark, "--decode-bench <asset dir>".
+//
+// Times container.jpg, awesomeface.png and a synthetic corpus through stb_image (one file after
+// the other, then files spread over the workers) and through decode.h (serial, then parallel),
+// and reports decoded MB/s and images/s for each. Every decode.h result is compared with stb's:
+// PNG must match exactly, JPEG within jpegTolerance per channel (the IDCTs round differently).
+//
+// The corpus is encoded here at startup so it doesn't need files on disk: large 4:2:0 JPEGs with a
+// restart marker every MCU row (what the parallel path is for), 4:4:4 JPEGs without restart
+// markers and RGBA / RGB PNGs. Pixels are noisy gradients and shapes so they compress like photos
+// and UI art rather than flat color.
+
+const int jpegTolerance = 8;
+
+// orthonormal 8 point DCT basis, m[u * 8 + x] = c(u) / 2 * cos((2x + 1) u pi / 16)
+struct DctBasis {
+    float m[64];
+
+    DctBasis() {
+        for (int u = 0; u < 8; u++) {
+            float scale = u == 0 ? sqrtf(0.125f) : 0.5f;
+            for (int x = 0; x < 8; x++) m[u * 8 + x] = scale * cosf((2 * x + 1) * u * 3.14159265358979f / 16.0f);
+        }
+    }
+};
+
+DctBasis dctBasis;
+
+// synthetic corpus encoders
+
+struct JpegBitWriter {
+    std::vector<uint8_t>& out;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    explicit JpegBitWriter(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(uint32_t code, int length) {
+        buffer = (buffer << length) | (code & ((1u << length) - 1));
+        count += length;
+        while (count >= 8) {
+            uint8_t byte = (uint8_t) (buffer >> (count - 8));
+            out.push_back(byte);
+            if (byte == 0xFF) out.push_back(0);
+            count -= 8;
+        }
+    }
+
+    // pads the last byte with ones
+    void flush() {
+        if (count > 0) put((1u << (8 - count)) - 1, 8 - count);
+        buffer = 0;
+    }
+};
+
+// Huffman table with optimal code lengths for `frequencies`, limited to 16 bits (JPEG annex K.2)
+struct JpegCodeTable {
+    uint8_t counts[16];
+    uint8_t values[256];
+    int total = 0;
+    uint16_t code[256];
+    uint8_t length[256];
+
+    void build(const long* symbolFrequencies) {
+        long frequencies[257];
+        memcpy(frequencies, symbolFrequencies, 256 * sizeof(long));
+        // reserved symbol, keeps the all ones code unused
+        frequencies[256] = 1;
+        int codeSize[257] = {};
+        int others[257];
+        for (int i = 0; i < 257; i++) others[i] = -1;
+        while (true) {
+            int c1 = -1, c2 = -1;
+            long v = LONG_MAX;
+            for (int i = 0; i < 257; i++) {
+                if (frequencies[i] && frequencies[i] <= v) {
+                    v = frequencies[i];
+                    c1 = i;
+                }
+            }
+            v = LONG_MAX;
+            for (int i = 0; i < 257; i++) {
+                if (frequencies[i] && frequencies[i] <= v && i != c1) {
+                    v = frequencies[i];
+                    c2 = i;
+                }
+            }
+            if (c2 < 0) break;
+            frequencies[c1] += frequencies[c2];
+            frequencies[c2] = 0;
+            codeSize[c1]++;
+            while (others[c1] >= 0) {
+                c1 = others[c1];
+                codeSize[c1]++;
+            }
+            others[c1] = c2;
+            codeSize[c2]++;
+            while (others[c2] >= 0) {
+                c2 = others[c2];
+                codeSize[c2]++;
+            }
+        }
+        int bits[33] = {};
+        for (int i = 0; i < 257; i++) {
+            if (codeSize[i]) bits[codeSize[i] < 32 ? codeSize[i] : 32]++;
+        }
+        for (int i = 32; i > 16; i--) {
+            while (bits[i] > 0) {
+                int j = i - 2;
+                while (bits[j] == 0) j--;
+                bits[i] -= 2;
+                bits[i - 1]++;
+                bits[j + 1] += 2;
+                bits[j]--;
+            }
+        }
+        int longest = 16;
+        while (bits[longest] == 0) longest--;
+        bits[longest]--;
+        for (int i = 0; i < 16; i++) counts[i] = (uint8_t) bits[i + 1];
+        total = 0;
+        for (int size = 1; size <= 32; size++) {
+            for (int symbol = 0; symbol < 256; symbol++) {
+                if (codeSize[symbol] == size) values[total++] = (uint8_t) symbol;
+            }
+        }
+        memset(length, 0, sizeof(length));
+        int next = 0, k = 0;
+        for (int size = 1; size <= 16; size++) {
+            for (int i = 0; i < counts[size - 1]; i++, k++) {
+                code[values[k]] = (uint16_t) next++;
+                length[values[k]] = (uint8_t) size;
+            }
+            next <<= 1;
+        }
+    }
+};
+
+inline int jpegCategory(int value) {
+    int magnitude = value < 0 ? -value : value;
+    int category = 0;
+    while (magnitude) {
+        category++;
+        magnitude >>= 1;
+    }
+    return category;
+}
+
+// Baseline JPEG of an RGB image: 4:2:0 when `subsample`, 4:4:4 otherwise, a restart marker every
+// `restartInterval` MCUs (0 for none), optimized Huffman tables.
+void encodeJpeg(const uint8_t* rgb, int width, int height, int quality, bool subsample, int restartInterval,
+                std::vector<uint8_t>& out) {
+    static const uint8_t lumaBase[64] = {
+        16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55,
+        14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62,
+        18, 22, 37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92,
+        49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99
+    };
+    static const uint8_t chromaBase[64] = {
+        17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99,
+        24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+    };
+    int scale = quality < 50 ? 5000 / quality : 200 - quality * 2;
+    // zigzag order, as stored in the file
+    uint8_t quant[2][64];
+    for (int k = 0; k < 64; k++) {
+        int luma = (lumaBase[jpegZigzag[k]] * scale + 50) / 100;
+        int chroma = (chromaBase[jpegZigzag[k]] * scale + 50) / 100;
+        quant[0][k] = (uint8_t) (luma < 1 ? 1 : (luma > 255 ? 255 : luma));
+        quant[1][k] = (uint8_t) (chroma < 1 ? 1 : (chroma > 255 ? 255 : chroma));
+    }
+
+    // YCbCr planes padded to whole MCUs by repeating the edge
+    int factor = subsample ? 2 : 1;
+    int mcusWide = (width + factor * 8 - 1) / (factor * 8), mcusHigh = (height + factor * 8 - 1) / (factor * 8);
+    int lumaWidth = mcusWide * factor * 8, lumaHeight = mcusHigh * factor * 8;
+    int chromaWidth = mcusWide * 8, chromaHeight = mcusHigh * 8;
+    std::vector<float> planes[3];
+    planes[0].resize((size_t) lumaWidth * lumaHeight);
+    std::vector<float> cb((size_t) lumaWidth * lumaHeight), cr((size_t) lumaWidth * lumaHeight);
+    for (int y = 0; y < lumaHeight; y++) {
+        for (int x = 0; x < lumaWidth; x++) {
+            const uint8_t* pixel = rgb + ((size_t) (y < height ? y : height - 1) * width + (x < width ? x : width - 1)) * 3;
+            float r = pixel[0], g = pixel[1], b = pixel[2];
+            size_t i = (size_t) y * lumaWidth + x;
+            planes[0][i] = 0.299f * r + 0.587f * g + 0.114f * b;
+            cb[i] = -0.168736f * r - 0.331264f * g + 0.5f * b + 128.0f;
+            cr[i] = 0.5f * r - 0.418688f * g - 0.081312f * b + 128.0f;
+        }
+    }
+    planes[1].resize((size_t) chromaWidth * chromaHeight);
+    planes[2].resize((size_t) chromaWidth * chromaHeight);
+    for (int y = 0; y < chromaHeight; y++) {
+        for (int x = 0; x < chromaWidth; x++) {
+            float sumCb = 0.0f, sumCr = 0.0f;
+            for (int dy = 0; dy < factor; dy++) {
+                for (int dx = 0; dx < factor; dx++) {
+                    size_t i = (size_t) (y * factor + dy) * lumaWidth + x * factor + dx;
+                    sumCb += cb[i];
+                    sumCr += cr[i];
+                }
+            }
+            planes[1][(size_t) y * chromaWidth + x] = sumCb / (factor * factor);
+            planes[2][(size_t) y * chromaWidth + x] = sumCr / (factor * factor);
+        }
+    }
+
+    // forward DCT and quantization of every block, in MCU order
+    int blocksPerMcu = factor * factor + 2;
+    size_t mcuCount = (size_t) mcusWide * mcusHigh;
+    std::vector<int16_t> coefficients(mcuCount * blocksPerMcu * 64);
+    const float* m = dctBasis.m;
+    for (size_t mcu = 0; mcu < mcuCount; mcu++) {
+        int mx = (int) (mcu % mcusWide), my = (int) (mcu / mcusWide);
+        for (int b = 0; b < blocksPerMcu; b++) {
+            int component = b < factor * factor ? 0 : b - factor * factor + 1;
+            int planeWidth = component ? chromaWidth : lumaWidth;
+            int bx = component ? mx : mx * factor + b % factor;
+            int by = component ? my : my * factor + b / factor;
+            float samples[64], rows[64];
+            for (int y = 0; y < 8; y++) {
+                for (int x = 0; x < 8; x++) {
+                    samples[y * 8 + x] = planes[component][(size_t) (by * 8 + y) * planeWidth + bx * 8 + x] - 128.0f;
+                }
+            }
+            // F = M X M^T
+            for (int y = 0; y < 8; y++) {
+                for (int u = 0; u < 8; u++) {
+                    float sum = 0.0f;
+                    for (int x = 0; x < 8; x++) sum += samples[y * 8 + x] * m[u * 8 + x];
+                    rows[y * 8 + u] = sum;
+                }
+            }
+            int16_t* block = coefficients.data() + (mcu * blocksPerMcu + b) * 64;
+            for (int k = 0; k < 64; k++) {
+                int position = jpegZigzag[k];
+                int v = position >> 3, u = position & 7;
+                float sum = 0.0f;
+                for (int y = 0; y < 8; y++) sum += m[v * 8 + y] * rows[y * 8 + u];
+                block[k] = (int16_t) lrintf(sum / quant[component ? 1 : 0][k]);
+            }
+        }
+    }
+
+    // two passes over the blocks: symbol statistics, then the actual bits
+    long frequencies[4][256] = {};
+    JpegCodeTable tables[4];
+    std::vector<uint8_t> entropy;
+    for (int pass = 0; pass < 2; pass++) {
+        JpegBitWriter bits(entropy);
+        int predictors[3] = { 0, 0, 0 };
+        for (size_t mcu = 0; mcu < mcuCount; mcu++) {
+            if (restartInterval && mcu > 0 && mcu % restartInterval == 0) {
+                if (pass == 1) {
+                    bits.flush();
+                    entropy.push_back(0xFF);
+                    entropy.push_back((uint8_t) (0xD0 + (mcu / restartInterval - 1) % 8));
+                }
+                predictors[0] = predictors[1] = predictors[2] = 0;
+            }
+            for (int b = 0; b < blocksPerMcu; b++) {
+                int component = b < factor * factor ? 0 : b - factor * factor + 1;
+                int dcTable = component ? 2 : 0, acTable = component ? 3 : 1;
+                const int16_t* block = coefficients.data() + (mcu * blocksPerMcu + b) * 64;
+                int diff = block[0] - predictors[component];
+                predictors[component] = block[0];
+                int category = jpegCategory(diff);
+                if (pass == 0) {
+                    frequencies[dcTable][category]++;
+                } else {
+                    bits.put(tables[dcTable].code[category], tables[dcTable].length[category]);
+                    if (category) bits.put(diff < 0 ? diff - 1 : diff, category);
+                }
+                int run = 0;
+                for (int k = 1; k < 64; k++) {
+                    int value = block[k];
+                    if (value == 0) {
+                        run++;
+                        continue;
+                    }
+                    while (run > 15) {
+                        if (pass == 0) {
+                            frequencies[acTable][0xF0]++;
+                        } else {
+                            bits.put(tables[acTable].code[0xF0], tables[acTable].length[0xF0]);
+                        }
+                        run -= 16;
+                    }
+                    int size = jpegCategory(value);
+                    int symbol = (run << 4) | size;
+                    if (pass == 0) {
+                        frequencies[acTable][symbol]++;
+                    } else {
+                        bits.put(tables[acTable].code[symbol], tables[acTable].length[symbol]);
+                        bits.put(value < 0 ? value - 1 : value, size);
+                    }
+                    run = 0;
+                }
+                if (run > 0) {
+                    if (pass == 0) {
+                        frequencies[acTable][0]++;
+                    } else {
+                        bits.put(tables[acTable].code[0], tables[acTable].length[0]);
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int t = 0; t < 4; t++) {
+                // every table needs at least one symbol
+                if (frequencies[t][0] == 0) frequencies[t][0] = 1;
+                tables[t].build(frequencies[t]);
+            }
+        } else {
+            bits.flush();
+        }
+    }
+
+    out.clear();
+    auto marker = [&](int code, int length) {
+        out.push_back(0xFF);
+        out.push_back((uint8_t) code);
+        out.push_back((uint8_t) (length >> 8));
+        out.push_back((uint8_t) length);
+    };
+    out.push_back(0xFF);
+    out.push_back(0xD8);
+    for (int t = 0; t < 2; t++) {
+        marker(0xDB, 67);
+        out.push_back((uint8_t) t);
+        out.insert(out.end(), quant[t], quant[t] + 64);
+    }
+    marker(0xC0, 17);
+    out.push_back(8);
+    out.push_back((uint8_t) (height >> 8));
+    out.push_back((uint8_t) height);
+    out.push_back((uint8_t) (width >> 8));
+    out.push_back((uint8_t) width);
+    out.push_back(3);
+    uint8_t components[9] = { 1, (uint8_t) ((factor << 4) | factor), 0, 2, 0x11, 1, 3, 0x11, 1 };
+    out.insert(out.end(), components, components + 9);
+    for (int t = 0; t < 4; t++) {
+        marker(0xC4, 2 + 17 + tables[t].total);
+        // class << 4 | id: luma DC 0, luma AC 0, chroma DC 1, chroma AC 1
+        out.push_back((uint8_t) (((t & 1) << 4) | (t >> 1)));
+        out.insert(out.end(), tables[t].counts, tables[t].counts + 16);
+        out.insert(out.end(), tables[t].values, tables[t].values + tables[t].total);
+    }
+    if (restartInterval) {
+        marker(0xDD, 4);
+        out.push_back((uint8_t) (restartInterval >> 8));
+        out.push_back((uint8_t) restartInterval);
+    }
+    marker(0xDA, 12);
+    uint8_t scan[10] = { 3, 1, 0x00, 2, 0x11, 3, 0x11, 0, 63, 0 };
+    out.insert(out.end(), scan, scan + 10);
+    out.insert(out.end(), entropy.begin(), entropy.end());
+    out.push_back(0xFF);
+    out.push_back(0xD9);
+}
+
+// deflate bit writer, least significant bit first
+struct DeflateBits {
+    std::vector<uint8_t>& out;
+    uint32_t buffer = 0;
+    int count = 0;
+
+    explicit DeflateBits(std::vector<uint8_t>& out) : out(out) {}
+
+    void put(uint32_t value, int length) {
+        buffer |= value << count;
+        count += length;
+        while (count >= 8) {
+            out.push_back((uint8_t) buffer);
+            buffer >>= 8;
+            count -= 8;
+        }
+    }
+
+    // Huffman codes go most significant bit first
+    void putCode(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i = 0; i < length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        put(reversed, length);
+    }
+
+    void flush() {
+        if (count > 0) out.push_back((uint8_t) buffer);
+        buffer = 0;
+        count = 0;
+    }
+};
+
+// zlib stream, one fixed Huffman block with hash chain LZ77 matching
+void zlibCompress(const uint8_t* data, size_t size, std::vector<uint8_t>& out) {
+    static const int lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+                                        35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+    static const int lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+                                         3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+    static const int distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129,
+                                          193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+                                          6145, 8193, 12289, 16385, 24577 };
+    const int window = 32768, hashBits = 15, maxChain = 32;
+    out.push_back(0x78);
+    out.push_back(0x9C);
+    DeflateBits bits(out);
+    // final block, fixed codes
+    bits.put(1, 1);
+    bits.put(1, 2);
+    auto literal = [&](int symbol) {
+        if (symbol < 144) bits.putCode(0x30 + symbol, 8);
+        else if (symbol < 256) bits.putCode(0x190 + symbol - 144, 9);
+        else if (symbol < 280) bits.putCode(symbol - 256, 7);
+        else bits.putCode(0xC0 + symbol - 280, 8);
+    };
+    std::vector<int> head(1 << hashBits, -1), previous(size > 0 ? size : 1, -1);
+    auto hash = [&](size_t i) {
+        return (int) (((data[i] << 10) ^ (data[i + 1] << 5) ^ data[i + 2]) & ((1 << hashBits) - 1));
+    };
+    size_t i = 0;
+    while (i < size) {
+        int bestLength = 0, bestDistance = 0;
+        if (i + 2 < size) {
+            int h = hash(i);
+            int candidate = head[h];
+            for (int chain = 0; candidate >= 0 && (int) i - candidate <= window - 1 && chain < maxChain; chain++) {
+                int length = 0;
+                int limit = size - i < 258 ? (int) (size - i) : 258;
+                while (length < limit && data[candidate + length] == data[i + length]) length++;
+                if (length > bestLength) {
+                    bestLength = length;
+                    bestDistance = (int) i - candidate;
+                    if (length == limit) break;
+                }
+                candidate = previous[candidate];
+            }
+            previous[i] = head[h];
+            head[h] = (int) i;
+        }
+        if (bestLength >= 3) {
+            int code = 0;
+            while (code < 28 && lengthBase[code + 1] <= bestLength) code++;
+            literal(257 + code);
+            if (lengthExtra[code]) bits.put(bestLength - lengthBase[code], lengthExtra[code]);
+            int distanceCode = 0;
+            while (distanceCode < 29 && distanceBase[distanceCode + 1] <= bestDistance) distanceCode++;
+            bits.putCode(distanceCode, 5);
+            int extra = distanceCode < 4 ? 0 : distanceCode / 2 - 1;
+            if (extra) bits.put(bestDistance - distanceBase[distanceCode], extra);
+            // matched bytes still go into the hash chains
+            for (size_t j = i + 1; j < i + bestLength && j + 2 < size; j++) {
+                int h = hash(j);
+                previous[j] = head[h];
+                head[h] = (int) j;
+            }
+            i += bestLength;
+        } else {
+            literal(data[i]);
+            i++;
+        }
+    }
+    literal(256);
+    bits.flush();
+    uint32_t a = 1, b = 0;
+    for (size_t j = 0; j < size; j++) {
+        a = (a + data[j]) % 65521;
+        b = (b + a) % 65521;
+    }
+    uint32_t adler = (b << 16) | a;
+    for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t) (adler >> shift));
+}
+
+uint32_t pngCrc(const uint8_t* data, size_t size, uint32_t crc = 0xFFFFFFFF) {
+    for (size_t i = 0; i < size; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return crc;
+}
+
+// 8 bit RGB or RGBA PNG, every row gets the filter with the smallest sum of residuals
+void encodePng(const uint8_t* pixels, int width, int height, int channels, std::vector<uint8_t>& out) {
+    size_t rowBytes = (size_t) width * channels;
+    std::vector<uint8_t> filtered((rowBytes + 1) * height);
+    std::vector<uint8_t> candidate(rowBytes), zeros(rowBytes);
+    for (int y = 0; y < height; y++) {
+        const uint8_t* row = pixels + y * rowBytes;
+        const uint8_t* prior = y ? row - rowBytes : zeros.data();
+        long bestSum = LONG_MAX;
+        uint8_t* target = filtered.data() + y * (rowBytes + 1);
+        for (int filter = 0; filter < 5; filter++) {
+            long sum = 0;
+            for (size_t i = 0; i < rowBytes; i++) {
+                int a = i >= (size_t) channels ? row[i - channels] : 0;
+                int b = prior[i];
+                int c = i >= (size_t) channels ? prior[i - channels] : 0;
+                int predicted = filter == 0 ? 0 : filter == 1 ? a : filter == 2 ? b : filter == 3 ? (a + b) >> 1
+                                                                                                   : paethPredictor(a, b, c);
+                candidate[i] = (uint8_t) (row[i] - predicted);
+                sum += abs((int8_t) candidate[i]);
+            }
+            if (sum < bestSum) {
+                bestSum = sum;
+                target[0] = (uint8_t) filter;
+                memcpy(target + 1, candidate.data(), rowBytes);
+            }
+        }
+    }
+    std::vector<uint8_t> compressed;
+    zlibCompress(filtered.data(), filtered.size(), compressed);
+
+    out.assign((const uint8_t*) "\x89PNG\r\n\x1a\n", (const uint8_t*) "\x89PNG\r\n\x1a\n" + 8);
+    auto chunk = [&](const char* type, const uint8_t* data, size_t size) {
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t) (size >> shift));
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        uint32_t crc = pngCrc(out.data() + start, size + 4) ^ 0xFFFFFFFF;
+        for (int shift = 24; shift >= 0; shift -= 8) out.push_back((uint8_t) (crc >> shift));
+    };
+    uint8_t header[13] = { (uint8_t) (width >> 24), (uint8_t) (width >> 16), (uint8_t) (width >> 8), (uint8_t) width,
+                           (uint8_t) (height >> 24), (uint8_t) (height >> 16), (uint8_t) (height >> 8), (uint8_t) height,
+                           8, (uint8_t) (channels == 4 ? 6 : 2), 0, 0, 0 };
+    chunk("IHDR", header, 13);
+    chunk("IDAT", compressed.data(), compressed.size());
+    chunk("IEND", NULL, 0);
+}
+
+// noisy gradients with a few discs, so blocks and rows aren't trivially compressible
+void syntheticPixels(int width, int height, int channels, uint32_t seed, std::vector<uint8_t>& pixels) {
+    pixels.resize((size_t) width * height * channels);
+    float cx[4], cy[4], radius[4];
+    for (int i = 0; i < 4; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        cx[i] = (seed >> 8) % width;
+        seed = seed * 1664525u + 1013904223u;
+        cy[i] = (seed >> 8) % height;
+        radius[i] = (width < height ? width : height) * (0.1f + 0.05f * i);
+    }
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            uint32_t noise = (uint32_t) (x * 73856093) ^ (uint32_t) (y * 19349663) ^ seed;
+            noise = (noise ^ (noise >> 13)) * 0x5bd1e995u;
+            int grain = (int) ((noise >> 24) & 15) - 8;
+            int value[4] = { x * 255 / width, y * 255 / height, (x + y) * 127 / (width + height) + 64, 255 };
+            for (int i = 0; i < 4; i++) {
+                float dx = x - cx[i], dy = y - cy[i];
+                if (dx * dx + dy * dy < radius[i] * radius[i]) {
+                    value[i % 3] = 255 - value[i % 3];
+                    value[3] = 160 + i * 20;
+                }
+            }
+            uint8_t* pixel = pixels.data() + ((size_t) y * width + x) * channels;
+            for (int c = 0; c < channels; c++) {
+                int v = value[c] + (c < 3 ? grain : 0);
+                pixel[c] = (uint8_t) (v < 0 ? 0 : (v > 255 ? 255 : v));
+            }
+        }
+    }
+}
+
+// one benchmark set; returns false when decode.h disagrees with stb
+bool benchmarkDecodeSet(const char* name, const std::vector<std::vector<unsigned char>>& files) {
+    const int channels = 4;
+    std::vector<DecodedImage> reference(files.size());
+    size_t decodedBytes = 0, encodedBytes = 0;
+    auto stbSerial = [&]() {
+        for (size_t i = 0; i < files.size(); i++) {
+            reference[i] = DecodedImage();
+            decodeWithStb(files[i], channels, false, reference[i]);
+        }
+    };
+    auto stbParallel = [&]() {
+        jobs.parallelFor(files.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                reference[i] = DecodedImage();
+                decodeWithStb(files[i], channels, false, reference[i]);
+            }
+        });
+    };
+    std::vector<DecodedImage> images;
+    double times[4] = {
+        timeRuns(stbSerial),
+        timeRuns(stbParallel),
+        timeRuns([&]() { decodeImages(files, channels, false, false, images); }),
+        timeRuns([&]() { decodeImages(files, channels, false, true, images); }),
+    };
+    const char* labels[4] = { "stb_image serial", "stb_image parallel", "decode serial", "decode parallel" };
+
+    bool ok = true;
+    int maxDifference = 0;
+    double sumDifference = 0.0;
+    for (size_t i = 0; i < files.size(); i++) {
+        encodedBytes += files[i].size();
+        decodedBytes += reference[i].pixels.size();
+        if (!reference[i].ok || !images[i].ok || reference[i].pixels.size() != images[i].pixels.size()) {
+            std::cout << "[decode] " << name << " image " << i << ": decode failed or sizes differ" << std::endl;
+            ok = false;
+            continue;
+        }
+        int imageMax = 0;
+        for (size_t p = 0; p < images[i].pixels.size(); p++) {
+            int difference = abs((int) images[i].pixels[p] - (int) reference[i].pixels[p]);
+            if (difference > imageMax) imageMax = difference;
+            sumDifference += difference;
+        }
+        int tolerance = strcmp(images[i].decoder, "jpeg") == 0 ? jpegTolerance : 0;
+        if (imageMax > tolerance) {
+            std::cout << "[decode] " << name << " image " << i << " (" << images[i].decoder << "): differs from stb by "
+                      << imageMax << std::endl;
+            ok = false;
+        }
+        if (imageMax > maxDifference) maxDifference = imageMax;
+    }
+
+    std::cout << "[decode] " << name << ": " << files.size() << " images, " << (encodedBytes >> 10) << " KB encoded, "
+              << (decodedBytes >> 10) << " KB decoded" << std::endl;
+    for (int t = 0; t < 4; t++) {
+        std::cout << "[decode]   " << labels[t] << ": " << times[t] * 1000.0 << " ms, "
+                  << decodedBytes / times[t] / (1 << 20) << " MB/s, " << files.size() / times[t] << " images/s"
+                  << (t >= 2 ? ", " : "") << (t >= 2 ? std::to_string(times[0] / times[t]) + "x stb serial" : "")
+                  << std::endl;
+    }
+    std::cout << "[decode]   vs stb: max difference " << maxDifference << ", mean "
+              << (decodedBytes ? sumDifference / decodedBytes : 0.0) << (ok ? "" : " MISMATCH") << std::endl;
+    return ok;
+}
+
+int runDecodeBenchmark(const std::string& assetDirectory, int corpusSize) {
+    int failures = benchmarkAssetFiles("decode", assetDirectory, [](const char* asset, std::vector<unsigned char>& file) {
+        std::vector<std::vector<unsigned char>> files(1);
+        files[0].swap(file);
+        return benchmarkDecodeSet(asset, files);
+    });
+
+    // a quarter each: big 4:2:0 JPEGs with restart markers, 4:4:4 JPEGs without, RGBA and RGB PNGs
+    std::vector<std::vector<unsigned char>> corpus(corpusSize);
+    jobs.parallelFor(corpus.size(), 1, [&](size_t begin, size_t end) {
+        std::vector<uint8_t> pixels;
+        for (size_t i = begin; i < end; i++) {
+            uint32_t seed = (uint32_t) i * 2654435761u;
+            switch (i % 4) {
+                case 0:
+                    syntheticPixels(3072, 2048, 3, seed, pixels);
+                    encodeJpeg(pixels.data(), 3072, 2048, 85, true, 3072 / 16, corpus[i]);
+                    break;
+                case 1:
+                    syntheticPixels(1024, 1024, 3, seed, pixels);
+                    encodeJpeg(pixels.data(), 1024, 1024, 90, false, 0, corpus[i]);
+                    break;
+                case 2:
+                    syntheticPixels(1024, 1024, 4, seed, pixels);
+                    encodePng(pixels.data(), 1024, 1024, 4, corpus[i]);
+                    break;
+                default:
+                    syntheticPixels(512, 512, 3, seed, pixels);
+                    encodePng(pixels.data(), 512, 512, 3, corpus[i]);
+                    break;
+            }
+        }
+    });
+    if (!corpus.empty() && !benchmarkDecodeSet("synthetic corpus", corpus)) failures++;
+    return failures == 0 ? 0 : 1;
+}
+
+#endif /* decodebench_h */
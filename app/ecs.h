@@ -0,0 +1,421 @@
+//
+//  ecs.h
+//  app
+//
+
+#ifndef ecs_h
+#define ecs_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include "jobs.h"
+#include "memory.h"
+
+// Archetype entity component system.
+//
+// Entities with the same set of components share an archetype. An archetype stores its entities in
+// fixed size chunks, and inside a chunk every component is its own contiguous array (SoA), so a
+// system that only reads transforms streams through transforms and nothing else. Components are
+// plain data, moved around with memcpy.
+//
+// Systems declare what they read and write. runSystems() packs consecutive systems without
+// conflicting access into one phase and runs every (system, chunk) pair of a phase in parallel.
+
+typedef uint32_t ComponentMask;
+const int maxComponentTypes = 32;
+// bytes of component data per chunk
+const size_t chunkBytes = 64 * 1024;
+
+struct ComponentInfo {
+    size_t size;
+    size_t alignment;
+};
+
+std::vector<ComponentInfo>& componentRegistry() {
+    static std::vector<ComponentInfo> registry;
+    return registry;
+}
+
+template <typename T>
+int componentId() {
+    static int id = [] {
+        componentRegistry().push_back({ sizeof(T), alignof(T) });
+        return (int) componentRegistry().size() - 1;
+    }();
+    return id;
+}
+
+template <typename T>
+ComponentMask componentBit() {
+    return 1u << componentId<T>();
+}
+
+template <typename... Ts>
+ComponentMask componentMask() {
+    ComponentMask mask = 0;
+    int expand[] = { 0, (mask |= componentBit<Ts>(), 0)... };
+    (void) expand;
+    return mask;
+}
+
+// --- components ---
+
+struct Transform {
+    glm::vec3 position = glm::vec3(0.0f);
+    // rotation as axis + angle (radians)
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);
+    float angle = 0.0f;
+    glm::vec3 scale = glm::vec3(1.0f);
+};
+
+// spins the transform around `axis`, angle = radiansPerSecond * time
+struct AngularVelocity {
+    glm::vec3 axis = glm::vec3(0.0f, 1.0f, 0.0f);
+    float radiansPerSecond = 0.0f;
+};
+
+struct Mesh {
+    unsigned int vao = 0;
+    // same vertices, positions only, for depth only passes
+    unsigned int positionVao = 0;
+    int first = 0;
+    int count = 0;
+    // first and count are in indices of the element buffer bound to vao
+    bool indexed = false;
+    // cluster set in the ClusterCuller (meshlets.h), -1 for meshes drawn whole
+    int meshlets = -1;
+};
+
+struct MaterialRef {
+    int material = 0;
+};
+
+// local space box
+struct Bounds {
+    glm::vec3 min = glm::vec3(-0.5f);
+    glm::vec3 max = glm::vec3(0.5f);
+};
+
+// never moves after load, merged into static batches (batching.h)
+struct StaticMesh {
+};
+
+// node in the TransformHierarchy holding this entity's local and world matrices
+struct HierarchyNode {
+    uint32_t node = 0;
+};
+
+glm::mat4 localMatrix(const Transform& transform) {
+    glm::mat4 model = glm::mat4(1.0f);
+    model = glm::translate(model, transform.position);
+    model = glm::rotate(model, transform.angle, transform.axis);
+    model = glm::scale(model, transform.scale);
+    return model;
+}
+
+// --- storage ---
+
+struct Entity {
+    uint32_t index;
+    uint32_t generation;
+};
+
+struct Archetype;
+
+struct Chunk {
+    Archetype* archetype;
+    char* data;
+    uint32_t count;
+
+    template <typename T>
+    T* array();
+    Entity* entities();
+};
+
+struct Archetype {
+    ComponentMask mask;
+    uint32_t capacity;
+    size_t offsets[maxComponentTypes];
+    size_t entityOffset;
+    std::vector<Chunk*> chunks;
+};
+
+template <typename T>
+T* Chunk::array() {
+    return (T*) (data + archetype->offsets[componentId<T>()]);
+}
+
+Entity* Chunk::entities() {
+    return (Entity*) (data + archetype->entityOffset);
+}
+
+struct EntityRecord {
+    Chunk* chunk = NULL;
+    uint32_t row = 0;
+    uint32_t generation = 0;
+};
+
+struct World {
+    std::vector<EntityRecord> records;
+    std::vector<uint32_t> freeIndices;
+    std::vector<Archetype*> archetypes;
+    size_t liveCount = 0;
+    // bumped whenever entities are created, destroyed or change archetype
+    uint64_t structureVersion = 0;
+
+    ~World() {
+        for (Archetype* archetype : archetypes) {
+            for (Chunk* chunk : archetype->chunks) {
+                free(chunk->data);
+                delete chunk;
+            }
+            delete archetype;
+        }
+    }
+
+    Archetype* archetypeFor(ComponentMask mask) {
+        for (Archetype* archetype : archetypes) {
+            if (archetype->mask == mask) return archetype;
+        }
+        Archetype* archetype = new Archetype();
+        archetype->mask = mask;
+        size_t rowBytes = sizeof(Entity);
+        for (int id = 0; id < maxComponentTypes; id++) {
+            if (mask & (1u << id)) rowBytes += componentRegistry()[id].size;
+        }
+        archetype->capacity = (uint32_t) (chunkBytes / rowBytes);
+        // lay the arrays out back to back, each cache line aligned
+        size_t offset = 0;
+        for (int id = 0; id < maxComponentTypes; id++) {
+            if (!(mask & (1u << id))) continue;
+            archetype->offsets[id] = offset;
+            offset += (componentRegistry()[id].size * archetype->capacity + 63) & ~size_t(63);
+        }
+        archetype->entityOffset = offset;
+        archetypes.push_back(archetype);
+        return archetype;
+    }
+
+    size_t chunkAllocationSize(Archetype* archetype) {
+        return archetype->entityOffset + sizeof(Entity) * archetype->capacity;
+    }
+
+    // returns a row in a chunk with free space, components zeroed
+    Chunk* reserveRow(Archetype* archetype, uint32_t& row) {
+        Chunk* chunk = archetype->chunks.empty() ? NULL : archetype->chunks.back();
+        if (chunk == NULL || chunk->count == archetype->capacity) {
+            chunk = new Chunk();
+            chunk->archetype = archetype;
+            chunk->count = 0;
+            void* data = NULL;
+            if (posix_memalign(&data, 64, chunkAllocationSize(archetype)) != 0) abort();
+            chunk->data = (char*) data;
+            archetype->chunks.push_back(chunk);
+        }
+        row = chunk->count++;
+        for (int id = 0; id < maxComponentTypes; id++) {
+            if (!(archetype->mask & (1u << id))) continue;
+            size_t size = componentRegistry()[id].size;
+            memset(chunk->data + archetype->offsets[id] + size * row, 0, size);
+        }
+        return chunk;
+    }
+
+    Entity createWithMask(ComponentMask mask) {
+        uint32_t index;
+        if (!freeIndices.empty()) {
+            index = freeIndices.back();
+            freeIndices.pop_back();
+        } else {
+            index = (uint32_t) records.size();
+            records.push_back(EntityRecord());
+        }
+        EntityRecord& record = records[index];
+        record.chunk = reserveRow(archetypeFor(mask), record.row);
+        Entity entity = { index, record.generation };
+        record.chunk->entities()[record.row] = entity;
+        liveCount++;
+        structureVersion++;
+        return entity;
+    }
+
+    // world.create(Transform{...}, Mesh{...}, ...)
+    template <typename... Ts>
+    Entity create(const Ts&... components) {
+        Entity entity = createWithMask(componentMask<Ts...>());
+        int expand[] = { 0, (get<Ts>(entity) = components, 0)... };
+        (void) expand;
+        return entity;
+    }
+
+    bool alive(Entity entity) const {
+        return entity.index < records.size() && records[entity.index].generation == entity.generation &&
+               records[entity.index].chunk != NULL;
+    }
+
+    template <typename T>
+    bool has(Entity entity) const {
+        return alive(entity) && (records[entity.index].chunk->archetype->mask & componentBit<T>());
+    }
+
+    template <typename T>
+    T& get(Entity entity) {
+        EntityRecord& record = records[entity.index];
+        return record.chunk->array<T>()[record.row];
+    }
+
+    // removes the row by moving the chunk's last row into it
+    void removeRow(Chunk* chunk, uint32_t row) {
+        Archetype* archetype = chunk->archetype;
+        uint32_t last = chunk->count - 1;
+        if (row != last) {
+            for (int id = 0; id < maxComponentTypes; id++) {
+                if (!(archetype->mask & (1u << id))) continue;
+                size_t size = componentRegistry()[id].size;
+                char* base = chunk->data + archetype->offsets[id];
+                memcpy(base + size * row, base + size * last, size);
+            }
+            Entity moved = chunk->entities()[last];
+            chunk->entities()[row] = moved;
+            records[moved.index].row = row;
+        }
+        chunk->count--;
+        // keep only the last chunk partially filled: refill this one from the last chunk
+        Chunk* tail = archetype->chunks.back();
+        if (tail != chunk && tail->count > 0) {
+            uint32_t tailRow = tail->count - 1;
+            Entity moved = tail->entities()[tailRow];
+            uint32_t newRow = chunk->count++;
+            for (int id = 0; id < maxComponentTypes; id++) {
+                if (!(archetype->mask & (1u << id))) continue;
+                size_t size = componentRegistry()[id].size;
+                memcpy(chunk->data + archetype->offsets[id] + size * newRow,
+                       tail->data + archetype->offsets[id] + size * tailRow, size);
+            }
+            chunk->entities()[newRow] = moved;
+            records[moved.index].chunk = chunk;
+            records[moved.index].row = newRow;
+            tail->count--;
+        }
+        if (tail->count == 0) {
+            free(tail->data);
+            delete tail;
+            archetype->chunks.pop_back();
+        }
+    }
+
+    void destroy(Entity entity) {
+        if (!alive(entity)) return;
+        EntityRecord& record = records[entity.index];
+        removeRow(record.chunk, record.row);
+        record.chunk = NULL;
+        record.generation++;
+        freeIndices.push_back(entity.index);
+        liveCount--;
+        structureVersion++;
+    }
+
+    // moves the entity to the archetype with `mask`, keeping the components both have
+    void changeArchetype(Entity entity, ComponentMask mask) {
+        EntityRecord& record = records[entity.index];
+        Chunk* from = record.chunk;
+        uint32_t fromRow = record.row;
+        Archetype* target = archetypeFor(mask);
+        uint32_t row;
+        Chunk* to = reserveRow(target, row);
+        for (int id = 0; id < maxComponentTypes; id++) {
+            if (!(mask & from->archetype->mask & (1u << id))) continue;
+            size_t size = componentRegistry()[id].size;
+            memcpy(to->data + target->offsets[id] + size * row,
+                   from->data + from->archetype->offsets[id] + size * fromRow, size);
+        }
+        to->entities()[row] = entity;
+        removeRow(from, fromRow);
+        record.chunk = to;
+        record.row = row;
+        structureVersion++;
+    }
+
+    template <typename T>
+    void add(Entity entity, const T& component) {
+        EntityRecord& record = records[entity.index];
+        if (!(record.chunk->archetype->mask & componentBit<T>())) {
+            changeArchetype(entity, record.chunk->archetype->mask | componentBit<T>());
+        }
+        get<T>(entity) = component;
+    }
+
+    template <typename T>
+    void remove(Entity entity) {
+        EntityRecord& record = records[entity.index];
+        if (record.chunk->archetype->mask & componentBit<T>()) {
+            changeArchetype(entity, record.chunk->archetype->mask & ~componentBit<T>());
+        }
+    }
+
+    // serial iteration over every non empty chunk whose archetype has all of `required`
+    template <typename F>
+    void forEachChunk(ComponentMask required, const F& fn) {
+        for (Archetype* archetype : archetypes) {
+            if ((archetype->mask & required) != required) continue;
+            for (Chunk* chunk : archetype->chunks) {
+                if (chunk->count > 0) fn(*chunk);
+            }
+        }
+    }
+};
+
+// --- systems ---
+
+struct System {
+    const char* name;
+    ComponentMask reads;
+    ComponentMask writes;
+    // called once per matching chunk, possibly on several threads at once
+    std::function<void(Chunk&)> update;
+};
+
+bool systemsConflict(const System& a, const System& b) {
+    return (a.writes & (b.reads | b.writes)) || (b.writes & a.reads);
+}
+
+struct SystemTask {
+    const System* system;
+    Chunk* chunk;
+};
+
+// Runs `systems` in order. Consecutive systems that don't touch each other's writes form a phase,
+// all chunks of all systems in a phase are processed in parallel.
+void runSystems(World& world, const std::vector<System>& systems) {
+    size_t phaseStart = 0;
+    while (phaseStart < systems.size()) {
+        size_t phaseEnd = phaseStart + 1;
+        while (phaseEnd < systems.size()) {
+            bool conflict = false;
+            for (size_t i = phaseStart; i < phaseEnd && !conflict; i++) {
+                conflict = systemsConflict(systems[i], systems[phaseEnd]);
+            }
+            if (conflict) break;
+            phaseEnd++;
+        }
+
+        ArenaVector<SystemTask> tasks(frameArena);
+        for (size_t i = phaseStart; i < phaseEnd; i++) {
+            const System* system = &systems[i];
+            world.forEachChunk(system->reads | system->writes, [&](Chunk& chunk) {
+                tasks.push_back({ system, &chunk });
+            });
+        }
+        jobs.parallelFor(tasks.size(), 1, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) tasks[i].system->update(*tasks[i].chunk);
+        });
+        phaseStart = phaseEnd;
+    }
+}
+
+#endif /* ecs_h */
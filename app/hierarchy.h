@@ -0,0 +1,315 @@
+//
+//  hierarchy.h
+//  app
+//
+
+#ifndef hierarchy_h
+#define hierarchy_h
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include "jobs.h"
+#include "resources.h"
+
+// Parent/child transforms in linear arrays sorted by depth, so every parent sits before its
+// children and world matrices resolve in one forward pass.
+//
+// Nodes are addressed by stable ids, the arrays are indexed by slot. Changing a local matrix only
+// sets a dirty byte; update() recomputes world matrices for dirty nodes and everything below them,
+// and reports the slot ranges that changed so the GPU copy only re-uploads those bytes. When
+// nothing was touched update() returns right away.
+
+const uint32_t noNode = 0xFFFFFFFF;
+
+struct SlotRange {
+    uint32_t begin;
+    uint32_t end;
+};
+
+struct TransformHierarchy {
+    // per slot, depth sorted
+    std::vector<uint32_t> parentSlot;
+    std::vector<uint32_t> depth;
+    std::vector<glm::mat4> local;
+    std::vector<glm::mat4> world;
+    std::vector<uint8_t> dirty;
+    std::vector<uint32_t> nodeOfSlot;
+    // start slot of every depth level, levelStart[d + 1] is one past its end
+    std::vector<uint32_t> levelStart;
+
+    // per node id
+    std::vector<uint32_t> slotOfNode;
+    std::vector<uint32_t> parentNode;
+    std::vector<uint32_t> freeNodes;
+
+    std::atomic<bool> anyDirty;
+    // nodes were added or removed, slots get re-sorted on the next update
+    bool layoutChanged = false;
+    // slot ranges whose world matrix changed in the last update
+    std::vector<SlotRange> changedRanges;
+    uint32_t lastUpdatedNodes = 0;
+
+    TransformHierarchy() : anyDirty(false) {}
+
+    uint32_t create(uint32_t parent, const glm::mat4& matrix) {
+        uint32_t node;
+        if (!freeNodes.empty()) {
+            node = freeNodes.back();
+            freeNodes.pop_back();
+        } else {
+            node = (uint32_t) slotOfNode.size();
+            slotOfNode.push_back(noNode);
+            parentNode.push_back(noNode);
+        }
+        parentNode[node] = parent;
+        uint32_t slot = (uint32_t) nodeOfSlot.size();
+        slotOfNode[node] = slot;
+        nodeOfSlot.push_back(node);
+        parentSlot.push_back(parent == noNode ? noNode : slotOfNode[parent]);
+        depth.push_back(parent == noNode ? 0 : depth[slotOfNode[parent]] + 1);
+        local.push_back(matrix);
+        world.push_back(matrix);
+        dirty.push_back(1);
+        anyDirty = true;
+        // appending keeps the depth order unless something deeper already sits at the end
+        uint32_t d = depth[slot];
+        if (!layoutChanged && (slot == 0 || d >= depth[slot - 1])) {
+            if (levelStart.empty()) levelStart.push_back(0);
+            while (levelStart.size() < d + 2) levelStart.push_back(levelStart.back());
+            levelStart[d + 1] = slot + 1;
+        } else {
+            layoutChanged = true;
+        }
+        return node;
+    }
+
+    // removes the node and its whole subtree
+    void destroy(uint32_t node) {
+        if (node >= slotOfNode.size() || slotOfNode[node] == noNode) return;
+        for (uint32_t child = 0; child < parentNode.size(); child++) {
+            if (parentNode[child] == node && slotOfNode[child] != noNode) destroy(child);
+        }
+        nodeOfSlot[slotOfNode[node]] = noNode;
+        slotOfNode[node] = noNode;
+        parentNode[node] = noNode;
+        freeNodes.push_back(node);
+        layoutChanged = true;
+    }
+
+    // safe to call from parallel systems as long as each call touches a different node
+    void setLocal(uint32_t node, const glm::mat4& matrix) {
+        uint32_t slot = slotOfNode[node];
+        local[slot] = matrix;
+        dirty[slot] = 1;
+        if (!anyDirty.load(std::memory_order_relaxed)) anyDirty.store(true, std::memory_order_relaxed);
+    }
+
+    const glm::mat4& worldMatrix(uint32_t node) const {
+        return world[slotOfNode[node]];
+    }
+
+    uint32_t slot(uint32_t node) const {
+        return slotOfNode[node];
+    }
+
+    size_t size() const {
+        return nodeOfSlot.size();
+    }
+
+    // counting sort by depth, drops destroyed slots; every world matrix gets recomputed after
+    void rebuildLayout() {
+        uint32_t maxDepth = 0;
+        std::vector<uint32_t> nodeDepth(slotOfNode.size(), 0);
+        for (uint32_t node = 0; node < slotOfNode.size(); node++) {
+            if (slotOfNode[node] == noNode) continue;
+            uint32_t d = 0;
+            for (uint32_t p = parentNode[node]; p != noNode; p = parentNode[p]) d++;
+            nodeDepth[node] = d;
+            if (d > maxDepth) maxDepth = d;
+        }
+        std::vector<uint32_t> counts(maxDepth + 2, 0);
+        for (uint32_t node = 0; node < slotOfNode.size(); node++) {
+            if (slotOfNode[node] != noNode) counts[nodeDepth[node] + 1]++;
+        }
+        for (size_t d = 1; d < counts.size(); d++) counts[d] += counts[d - 1];
+        levelStart = counts;
+
+        std::vector<glm::mat4> oldLocal;
+        oldLocal.swap(local);
+        std::vector<uint32_t> oldSlotOfNode = slotOfNode;
+        size_t liveCount = counts.back();
+        nodeOfSlot.assign(liveCount, noNode);
+        local.assign(liveCount, glm::mat4(1.0f));
+        depth.assign(liveCount, 0);
+        // keep the previous relative order within a level, that's usually creation order
+        std::vector<uint32_t> order;
+        order.reserve(liveCount);
+        for (uint32_t node = 0; node < slotOfNode.size(); node++) {
+            if (slotOfNode[node] != noNode) order.push_back(node);
+        }
+        std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return oldSlotOfNode[a] < oldSlotOfNode[b]; });
+        std::vector<uint32_t> cursor(counts.begin(), counts.end() - 1);
+        for (uint32_t node : order) {
+            uint32_t slot = cursor[nodeDepth[node]]++;
+            nodeOfSlot[slot] = node;
+            local[slot] = oldLocal[oldSlotOfNode[node]];
+            depth[slot] = nodeDepth[node];
+            slotOfNode[node] = slot;
+        }
+        parentSlot.assign(liveCount, noNode);
+        for (uint32_t slot = 0; slot < liveCount; slot++) {
+            uint32_t parent = parentNode[nodeOfSlot[slot]];
+            parentSlot[slot] = parent == noNode ? noNode : slotOfNode[parent];
+        }
+        world.assign(liveCount, glm::mat4(1.0f));
+        dirty.assign(liveCount, 1);
+        layoutChanged = false;
+        anyDirty = true;
+    }
+
+    // Recomputes dirty subtrees. Levels run one after the other (a level only reads the one above
+    // it); big levels are split across the job system.
+    void update() {
+        changedRanges.clear();
+        lastUpdatedNodes = 0;
+        if (layoutChanged) rebuildLayout();
+        if (!anyDirty.load()) return;
+        anyDirty = false;
+
+        for (size_t level = 0; level + 1 < levelStart.size(); level++) {
+            uint32_t begin = levelStart[level], end = levelStart[level + 1];
+            jobs.parallelFor(end - begin, 4096, [&](size_t first, size_t last) {
+                for (size_t slot = begin + first; slot < begin + last; slot++) {
+                    uint32_t parent = parentSlot[slot];
+                    if (parent != noNode && dirty[parent]) dirty[slot] = 1;
+                    if (!dirty[slot]) continue;
+                    world[slot] = parent == noNode ? local[slot] : world[parent] * local[slot];
+                }
+            });
+        }
+
+        // collect changed ranges and clear the flags; gaps shorter than a few matrices are merged,
+        // one bigger upload beats several tiny ones
+        const uint32_t mergeGap = 4;
+        uint32_t count = (uint32_t) dirty.size();
+        uint32_t slot = 0;
+        while (slot < count) {
+            // skip clean slots eight at a time
+            while (slot + 8 <= count) {
+                uint64_t word;
+                memcpy(&word, &dirty[slot], 8);
+                if (word != 0) break;
+                slot += 8;
+            }
+            if (slot >= count) break;
+            if (!dirty[slot]) {
+                slot++;
+                continue;
+            }
+            dirty[slot] = 0;
+            lastUpdatedNodes++;
+            if (!changedRanges.empty() && slot - changedRanges.back().end <= mergeGap) {
+                changedRanges.back().end = slot + 1;
+            } else {
+                changedRanges.push_back({ slot, slot + 1 });
+            }
+            slot++;
+        }
+    }
+};
+
+// GPU copy of the world matrices, a texture buffer the vertex shader fetches with the node's
+// slot (MODEL_BUFFER feature). Only the ranges reported by the hierarchy are uploaded.
+//
+// With keepPrevious a second buffer holds last frame's matrices for motion vectors. It is kept
+// in sync on the GPU: before this frame's upload, the ranges changed this frame and last frame
+// are copied over from the current buffer, everything else already matches.
+struct ModelMatrixBuffer {
+    ResourceHandle buffer;
+    ResourceHandle texture;
+    size_t capacity = 0;
+    size_t lastUploadBytes = 0;
+    bool keepPrevious = false;
+    ResourceHandle previousBuffer;
+    ResourceHandle previousTexture;
+    std::vector<SlotRange> lastChangedRanges;
+
+    // set keepPrevious before
+    void init() {
+        buffer = GPU_CREATE(ResourceBuffer, "hierarchy");
+        texture = GPU_CREATE(ResourceTexture, "hierarchy");
+        if (keepPrevious) {
+            previousBuffer = GPU_CREATE(ResourceBuffer, "hierarchy");
+            previousTexture = GPU_CREATE(ResourceTexture, "hierarchy");
+        }
+    }
+
+    void release() {
+        gpuResources.release(texture);
+        gpuResources.release(buffer);
+        gpuResources.release(previousTexture);
+        gpuResources.release(previousBuffer);
+    }
+
+    void copyToPrevious(const std::vector<SlotRange>& ranges) {
+        for (const SlotRange& range : ranges) {
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.begin * sizeof(glm::mat4),
+                                range.begin * sizeof(glm::mat4), (range.end - range.begin) * sizeof(glm::mat4));
+        }
+    }
+
+    void upload(const TransformHierarchy& hierarchy) {
+        lastUploadBytes = 0;
+        size_t needed = hierarchy.size() * sizeof(glm::mat4);
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(buffer));
+        if (needed > capacity) {
+            // grow with headroom and upload everything
+            capacity = needed + needed / 2 + sizeof(glm::mat4) * 64;
+            glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+            gpuResources.setBytes(buffer, capacity);
+            glBufferSubData(GL_TEXTURE_BUFFER, 0, needed, hierarchy.world.data());
+            glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(texture));
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gpuResources.name(buffer));
+            lastUploadBytes = needed;
+            if (keepPrevious) {
+                // no history across a reallocation, this frame has no motion
+                glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(previousBuffer));
+                glBufferData(GL_TEXTURE_BUFFER, capacity, NULL, GL_DYNAMIC_DRAW);
+                gpuResources.setBytes(previousBuffer, capacity);
+                glBufferSubData(GL_TEXTURE_BUFFER, 0, needed, hierarchy.world.data());
+                glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(previousTexture));
+                glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gpuResources.name(previousBuffer));
+                lastChangedRanges.clear();
+            }
+            return;
+        }
+        if (keepPrevious) {
+            glBindBuffer(GL_COPY_READ_BUFFER, gpuResources.name(buffer));
+            glBindBuffer(GL_COPY_WRITE_BUFFER, gpuResources.name(previousBuffer));
+            copyToPrevious(lastChangedRanges);
+            copyToPrevious(hierarchy.changedRanges);
+            lastChangedRanges.assign(hierarchy.changedRanges.begin(), hierarchy.changedRanges.end());
+        }
+        for (const SlotRange& range : hierarchy.changedRanges) {
+            size_t offset = range.begin * sizeof(glm::mat4);
+            size_t bytes = (range.end - range.begin) * sizeof(glm::mat4);
+            glBufferSubData(GL_TEXTURE_BUFFER, offset, bytes, &hierarchy.world[range.begin]);
+            lastUploadBytes += bytes;
+        }
+    }
+
+    void bind(int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(texture));
+    }
+
+    void bindPrevious(int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(previousTexture));
+    }
+};
+
+#endif /* hierarchy_h */
@@ -0,0 +1,164 @@
+//
+//  jobs.h
+//  app
+//
+
+#ifndef jobs_h
+#define jobs_h
+
+#include <stddef.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+// Worker pool shared by everything that runs on more than one core.
+//
+// parallelFor splits an index range into grains that the workers and the calling thread pull from
+// until it's exhausted, then returns. It type erases through a plain function pointer so a call
+// never allocates. Only the main thread may call it, and never from inside a job.
+//
+// submit queues fire and forget work (background rebuilds, file writes) that workers pick up
+// whenever no parallelFor is running.
+struct JobSystem {
+    typedef void (*RangeFunction)(void* context, size_t begin, size_t end);
+
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    bool stopping = false;
+
+    // current parallelFor
+    RangeFunction rangeFunction = NULL;
+    void* rangeContext = NULL;
+    size_t rangeCount = 0;
+    size_t rangeGrain = 1;
+    std::atomic<size_t> nextIndex;
+    std::atomic<int> busyWorkers;
+    uint64_t batch = 0;
+
+    std::deque<std::function<void()>> queue;
+    std::atomic<int> runningTasks;
+
+    JobSystem() : nextIndex(0), busyWorkers(0), runningTasks(0) {}
+    ~JobSystem() { stop(); }
+
+    // 0 picks one worker per hardware thread, minus the main thread
+    void start(unsigned int threads = 0) {
+        // also after stop(), the benchmarks restart the pool with fewer workers
+        stopping = false;
+        if (threads == 0) {
+            unsigned int hardware = std::thread::hardware_concurrency();
+            threads = hardware > 1 ? hardware - 1 : 1;
+        }
+        for (unsigned int i = 0; i < threads; i++) {
+            workers.emplace_back([this]() { workerLoop(); });
+        }
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers) worker.join();
+        workers.clear();
+    }
+
+    size_t threadCount() const {
+        return workers.size() + 1;
+    }
+
+    // fn(begin, end) over [0, count) in chunks of `grain`
+    template <typename F>
+    void parallelFor(size_t count, size_t grain, const F& fn) {
+        if (count == 0) return;
+        if (workers.empty() || count <= grain) {
+            fn((size_t) 0, count);
+            return;
+        }
+        run(count, grain, [](void* context, size_t begin, size_t end) { (*(const F*) context)(begin, end); },
+            (void*) &fn);
+    }
+
+    void run(size_t count, size_t grain, RangeFunction function, void* context) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            rangeFunction = function;
+            rangeContext = context;
+            rangeCount = count;
+            rangeGrain = grain > 0 ? grain : 1;
+            nextIndex.store(0);
+            batch++;
+        }
+        wake.notify_all();
+        drainRange(function, context, count, rangeGrain);
+        // workers join under the lock, so once none is busy nobody can still pick up this range
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return busyWorkers.load() == 0; });
+        rangeFunction = NULL;
+    }
+
+    void drainRange(RangeFunction function, void* context, size_t count, size_t grain) {
+        while (true) {
+            size_t begin = nextIndex.fetch_add(grain);
+            if (begin >= count) break;
+            size_t end = begin + grain < count ? begin + grain : count;
+            function(context, begin, end);
+        }
+    }
+
+    void submit(std::function<void()> task) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(std::move(task));
+        }
+        wake.notify_one();
+    }
+
+    // blocks until every submitted task ran
+    void waitIdle() {
+        std::unique_lock<std::mutex> lock(mutex);
+        finished.wait(lock, [this]() { return queue.empty() && runningTasks.load() == 0; });
+    }
+
+    void workerLoop() {
+        uint64_t seenBatch = 0;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            wake.wait(lock, [&]() { return stopping || batch != seenBatch || !queue.empty(); });
+            if (stopping) return;
+            if (batch != seenBatch) {
+                // a worker busy with a submitted task joins late or not at all, never holding up the range
+                seenBatch = batch;
+                if (rangeFunction == NULL) continue;
+                RangeFunction function = rangeFunction;
+                void* context = rangeContext;
+                size_t count = rangeCount, grain = rangeGrain;
+                busyWorkers++;
+                lock.unlock();
+                drainRange(function, context, count, grain);
+                lock.lock();
+                if (--busyWorkers == 0) finished.notify_all();
+                continue;
+            }
+            std::function<void()> task = std::move(queue.front());
+            queue.pop_front();
+            runningTasks++;
+            lock.unlock();
+            task();
+            lock.lock();
+            runningTasks--;
+            finished.notify_all();
+        }
+    }
+};
+
+JobSystem jobs;
+
+#endif /* jobs_h */
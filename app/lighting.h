@@ -0,0 +1,348 @@
+//
+//  lighting.h
+//  app
+//
+
+#ifndef lighting_h
+#define lighting_h
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include "jobs.h"
+#include "resources.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Clustered forward lighting.
+//
+// The view frustum is cut into clusterCountX * clusterCountY screen tiles and clusterCountZ
+// exponential depth slices. Every frame each light's bounding sphere is assigned to the clusters
+// it touches, and the result is flattened into one compact index list plus an (offset, count)
+// pair per cluster. The fragment shader (LIGHTING feature) finds its cluster from gl_FragCoord
+// and its view depth and only loops over the lights listed there, so per pixel cost follows the
+// local light count instead of the scene's.
+//
+// Everything reaches the shader through texture buffers, GL 3.3 has no storage buffers.
+
+const int clusterCountX = 16;
+const int clusterCountY = 9;
+const int clusterCountZ = 24;
+const int clusterCount = clusterCountX * clusterCountY * clusterCountZ;
+// indices are 16 bit
+const size_t maxLights = 65535;
+
+// A point light is a spot light with a cone that covers everything. Lights fade to exactly zero
+// at `radius`, which is what gets culled against the clusters.
+struct Light {
+    glm::vec3 position = glm::vec3(0.0f);
+    float radius = 1.0f;
+    glm::vec3 color = glm::vec3(1.0f);
+    glm::vec3 direction = glm::vec3(0.0f, -1.0f, 0.0f);
+    float cosInner = -1.0f;
+    float cosOuter = -2.0f;
+};
+
+Light pointLight(const glm::vec3& position, float radius, const glm::vec3& color) {
+    Light light;
+    light.position = position;
+    light.radius = radius;
+    light.color = color;
+    return light;
+}
+
+// angles in radians, measured from the cone axis
+Light spotLight(const glm::vec3& position, const glm::vec3& direction, float radius, const glm::vec3& color,
+                float innerAngle, float outerAngle) {
+    Light light = pointLight(position, radius, color);
+    light.direction = glm::normalize(direction);
+    light.cosInner = cosf(innerAngle);
+    light.cosOuter = cosf(outerAngle);
+    return light;
+}
+
+// cluster range touched by a light, inclusive; z0 > z1 when the light is outside the frustum
+struct ClusterRange {
+    uint8_t x0, x1, y0, y1, z0, z1;
+};
+
+struct ClusteredLighting {
+    std::vector<Light> lights;
+    glm::vec3 ambient = glm::vec3(0.15f);
+
+    // per light, view space sphere and the clusters it covers
+    std::vector<float> viewX, viewY, viewZ, viewRadius;
+    std::vector<ClusterRange> ranges;
+    // per cluster (offset, count) into indices
+    std::vector<uint32_t> grid;
+    std::vector<uint16_t> indices;
+    std::vector<float> packedLights;
+    size_t indexCount = 0;
+    float sliceScale = 0.0f;
+    float sliceBias = 0.0f;
+
+    ResourceHandle lightBuffer, lightTexture;
+    ResourceHandle gridBuffer, gridTexture;
+    ResourceHandle indexBuffer, indexTexture;
+    size_t indexCapacity = 0;
+    size_t lightCapacity = 0;
+
+    // stats of the last bin()
+    uint32_t maxLightsPerCluster = 0;
+    double lastBinMilliseconds = 0.0;
+
+    void init() {
+        lightBuffer = GPU_CREATE(ResourceBuffer, "lighting");
+        lightTexture = GPU_CREATE(ResourceTexture, "lighting");
+        gridBuffer = GPU_CREATE(ResourceBuffer, "lighting");
+        gridTexture = GPU_CREATE(ResourceTexture, "lighting");
+        indexBuffer = GPU_CREATE(ResourceBuffer, "lighting");
+        indexTexture = GPU_CREATE(ResourceTexture, "lighting");
+        grid.assign(clusterCount * 2, 0);
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(gridBuffer));
+        glBufferData(GL_TEXTURE_BUFFER, grid.size() * sizeof(uint32_t), NULL, GL_STREAM_DRAW);
+        gpuResources.setBytes(gridBuffer, grid.size() * sizeof(uint32_t));
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(gridTexture));
+        glTexBuffer(GL_TEXTURE_BUFFER, GL_RG32UI, gpuResources.name(gridBuffer));
+    }
+
+    void release() {
+        gpuResources.release(lightTexture);
+        gpuResources.release(lightBuffer);
+        gpuResources.release(gridTexture);
+        gpuResources.release(gridBuffer);
+        gpuResources.release(indexTexture);
+        gpuResources.release(indexBuffer);
+    }
+
+    int slice(float depth) const {
+        int s = (int) floorf(logf(depth) * sliceScale + sliceBias);
+        return s < 0 ? 0 : (s >= clusterCountZ ? clusterCountZ - 1 : s);
+    }
+
+    // view space spheres to cluster ranges for lights [begin, end)
+    void computeRanges(const glm::mat4& view, const glm::mat4& projection, float near, float far, size_t begin,
+                       size_t end) {
+        float scaleX = projection[0][0] * 0.5f * clusterCountX;
+        float scaleY = projection[1][1] * 0.5f * clusterCountY;
+        std::vector<float>& x = viewX;
+        std::vector<float>& y = viewY;
+        std::vector<float>& z = viewZ;
+        size_t i = begin;
+#if defined(__SSE2__)
+        // four lights at a time: view transform and the screen bounds of each sphere
+        for (; i + 4 <= end; i += 4) {
+            __m128 px = _mm_setr_ps(lights[i].position.x, lights[i + 1].position.x, lights[i + 2].position.x, lights[i + 3].position.x);
+            __m128 py = _mm_setr_ps(lights[i].position.y, lights[i + 1].position.y, lights[i + 2].position.y, lights[i + 3].position.y);
+            __m128 pz = _mm_setr_ps(lights[i].position.z, lights[i + 1].position.z, lights[i + 2].position.z, lights[i + 3].position.z);
+            __m128 r = _mm_setr_ps(lights[i].radius, lights[i + 1].radius, lights[i + 2].radius, lights[i + 3].radius);
+            __m128 vx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][0]), px), _mm_mul_ps(_mm_set1_ps(view[1][0]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][0]), pz), _mm_set1_ps(view[3][0])));
+            __m128 vy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][1]), px), _mm_mul_ps(_mm_set1_ps(view[1][1]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][1]), pz), _mm_set1_ps(view[3][1])));
+            __m128 vz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[0][2]), px), _mm_mul_ps(_mm_set1_ps(view[1][2]), py)),
+                                   _mm_add_ps(_mm_mul_ps(_mm_set1_ps(view[2][2]), pz), _mm_set1_ps(view[3][2])));
+            _mm_storeu_ps(&x[i], vx);
+            _mm_storeu_ps(&y[i], vy);
+            _mm_storeu_ps(&z[i], vz);
+            _mm_storeu_ps(&viewRadius[i], r);
+
+            // depth range of the sphere, clamped to the near plane
+            __m128 depth = _mm_sub_ps(_mm_setzero_ps(), vz);
+            __m128 nearDepth = _mm_max_ps(_mm_sub_ps(depth, r), _mm_set1_ps(near));
+            __m128 farDepth = _mm_max_ps(_mm_add_ps(depth, r), _mm_set1_ps(near));
+            __m128 invNear = _mm_div_ps(_mm_set1_ps(1.0f), nearDepth);
+            __m128 invFar = _mm_div_ps(_mm_set1_ps(1.0f), farDepth);
+            // the box [x - r, x + r] * [nearDepth, farDepth] projects inside its corners
+            __m128 left = _mm_sub_ps(vx, r), right = _mm_add_ps(vx, r);
+            __m128 bottom = _mm_sub_ps(vy, r), top = _mm_add_ps(vy, r);
+            __m128 minX = _mm_min_ps(_mm_mul_ps(left, invNear), _mm_mul_ps(left, invFar));
+            __m128 maxX = _mm_max_ps(_mm_mul_ps(right, invNear), _mm_mul_ps(right, invFar));
+            __m128 minY = _mm_min_ps(_mm_mul_ps(bottom, invNear), _mm_mul_ps(bottom, invFar));
+            __m128 maxY = _mm_max_ps(_mm_mul_ps(top, invNear), _mm_mul_ps(top, invFar));
+            // to cluster coordinates
+            __m128 sx = _mm_set1_ps(scaleX), hx = _mm_set1_ps(0.5f * clusterCountX);
+            __m128 sy = _mm_set1_ps(scaleY), hy = _mm_set1_ps(0.5f * clusterCountY);
+            __m128 zero = _mm_setzero_ps();
+            __m128 lastX = _mm_set1_ps(clusterCountX - 1.0f), lastY = _mm_set1_ps(clusterCountY - 1.0f);
+            __m128i x0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(minX, sx), hx), zero), lastX));
+            __m128i x1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(maxX, sx), hx), zero), lastX));
+            __m128i y0 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(minY, sy), hy), zero), lastY));
+            __m128i y1 = _mm_cvttps_epi32(_mm_min_ps(_mm_max_ps(_mm_add_ps(_mm_mul_ps(maxY, sy), hy), zero), lastY));
+            int32_t lx0[4], lx1[4], ly0[4], ly1[4];
+            float nearLanes[4], farLanes[4];
+            _mm_storeu_si128((__m128i*) lx0, x0);
+            _mm_storeu_si128((__m128i*) lx1, x1);
+            _mm_storeu_si128((__m128i*) ly0, y0);
+            _mm_storeu_si128((__m128i*) ly1, y1);
+            _mm_storeu_ps(nearLanes, _mm_sub_ps(_mm_sub_ps(zero, vz), r));
+            _mm_storeu_ps(farLanes, _mm_add_ps(_mm_sub_ps(zero, vz), r));
+            for (int lane = 0; lane < 4; lane++) {
+                ClusterRange& range = ranges[i + lane];
+                range.x0 = (uint8_t) lx0[lane];
+                range.x1 = (uint8_t) lx1[lane];
+                range.y0 = (uint8_t) ly0[lane];
+                range.y1 = (uint8_t) ly1[lane];
+                setDepthRange(range, nearLanes[lane], farLanes[lane], near, far);
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            glm::vec4 position = view * glm::vec4(lights[i].position, 1.0f);
+            float r = lights[i].radius;
+            x[i] = position.x;
+            y[i] = position.y;
+            z[i] = position.z;
+            viewRadius[i] = r;
+            float nearDepth = fmaxf(-position.z - r, near), farDepth = fmaxf(-position.z + r, near);
+            float minX = fminf((position.x - r) / nearDepth, (position.x - r) / farDepth);
+            float maxX = fmaxf((position.x + r) / nearDepth, (position.x + r) / farDepth);
+            float minY = fminf((position.y - r) / nearDepth, (position.y - r) / farDepth);
+            float maxY = fmaxf((position.y + r) / nearDepth, (position.y + r) / farDepth);
+            ClusterRange& range = ranges[i];
+            range.x0 = (uint8_t) fminf(fmaxf(minX * scaleX + 0.5f * clusterCountX, 0.0f), clusterCountX - 1.0f);
+            range.x1 = (uint8_t) fminf(fmaxf(maxX * scaleX + 0.5f * clusterCountX, 0.0f), clusterCountX - 1.0f);
+            range.y0 = (uint8_t) fminf(fmaxf(minY * scaleY + 0.5f * clusterCountY, 0.0f), clusterCountY - 1.0f);
+            range.y1 = (uint8_t) fminf(fmaxf(maxY * scaleY + 0.5f * clusterCountY, 0.0f), clusterCountY - 1.0f);
+            setDepthRange(range, -position.z - r, -position.z + r, near, far);
+        }
+    }
+
+    void setDepthRange(ClusterRange& range, float nearDepth, float farDepth, float near, float far) const {
+        if (farDepth < near || nearDepth > far) {
+            range.z0 = 1;
+            range.z1 = 0;
+            return;
+        }
+        range.z0 = (uint8_t) slice(fmaxf(nearDepth, near));
+        range.z1 = (uint8_t) slice(fminf(farDepth, far));
+    }
+
+    // Assigns lights to clusters for this view. Three parallel passes: light ranges, per slice
+    // counts, then per slice index writes into the offsets of a prefix sum. Each slice is owned
+    // by one job, so no atomics, and lights stay in index order within a cluster.
+    void bin(const glm::mat4& view, const glm::mat4& projection, float near, float far) {
+        double start = glfwGetTime();
+        size_t count = lights.size() < maxLights ? lights.size() : maxLights;
+        if (viewX.size() < count) {
+            viewX.resize(count);
+            viewY.resize(count);
+            viewZ.resize(count);
+            viewRadius.resize(count);
+            ranges.resize(count);
+        }
+        sliceScale = clusterCountZ / logf(far / near);
+        sliceBias = -clusterCountZ * logf(near) / logf(far / near);
+
+        jobs.parallelFor(count, 1024, [&](size_t begin, size_t end) {
+            computeRanges(view, projection, near, far, begin, end);
+        });
+
+        const int sliceClusters = clusterCountX * clusterCountY;
+        jobs.parallelFor(clusterCountZ, 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) {
+                uint32_t* cells = &grid[s * sliceClusters * 2];
+                for (int c = 0; c < sliceClusters; c++) cells[c * 2 + 1] = 0;
+                for (size_t i = 0; i < count; i++) {
+                    const ClusterRange& range = ranges[i];
+                    if (s < range.z0 || s > range.z1) continue;
+                    for (int y = range.y0; y <= range.y1; y++) {
+                        for (int x = range.x0; x <= range.x1; x++) cells[(y * clusterCountX + x) * 2 + 1]++;
+                    }
+                }
+            }
+        });
+
+        uint32_t offset = 0;
+        maxLightsPerCluster = 0;
+        for (int c = 0; c < clusterCount; c++) {
+            grid[c * 2] = offset;
+            offset += grid[c * 2 + 1];
+            if (grid[c * 2 + 1] > maxLightsPerCluster) maxLightsPerCluster = grid[c * 2 + 1];
+        }
+        indexCount = offset;
+        if (indices.size() < indexCount) indices.resize(indexCount + indexCount / 2);
+
+        jobs.parallelFor(clusterCountZ, 1, [&](size_t begin, size_t end) {
+            for (size_t s = begin; s < end; s++) {
+                const uint32_t* cells = &grid[s * sliceClusters * 2];
+                uint32_t cursor[clusterCountX * clusterCountY];
+                for (int c = 0; c < sliceClusters; c++) cursor[c] = cells[c * 2];
+                for (size_t i = 0; i < count; i++) {
+                    const ClusterRange& range = ranges[i];
+                    if (s < range.z0 || s > range.z1) continue;
+                    for (int y = range.y0; y <= range.y1; y++) {
+                        for (int x = range.x0; x <= range.x1; x++) indices[cursor[y * clusterCountX + x]++] = (uint16_t) i;
+                    }
+                }
+            }
+        });
+        lastBinMilliseconds = (glfwGetTime() - start) * 1000.0;
+    }
+
+    // lights as 3 RGBA32F texels: (position, radius) (color, cosOuter) (direction, cosInner)
+    void upload() {
+        size_t count = lights.size() < maxLights ? lights.size() : maxLights;
+        if (packedLights.size() < count * 12) packedLights.resize(count * 12);
+        for (size_t i = 0; i < count; i++) {
+            const Light& light = lights[i];
+            float* texels = &packedLights[i * 12];
+            texels[0] = light.position.x;
+            texels[1] = light.position.y;
+            texels[2] = light.position.z;
+            texels[3] = light.radius;
+            texels[4] = light.color.x;
+            texels[5] = light.color.y;
+            texels[6] = light.color.z;
+            texels[7] = light.cosOuter;
+            texels[8] = light.direction.x;
+            texels[9] = light.direction.y;
+            texels[10] = light.direction.z;
+            texels[11] = light.cosInner;
+        }
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(lightBuffer));
+        if (count * 12 * sizeof(float) > lightCapacity || lightCapacity == 0) {
+            lightCapacity = (count + count / 2 + 16) * 12 * sizeof(float);
+            glBufferData(GL_TEXTURE_BUFFER, lightCapacity, NULL, GL_STREAM_DRAW);
+            gpuResources.setBytes(lightBuffer, lightCapacity);
+            glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(lightTexture));
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, gpuResources.name(lightBuffer));
+        }
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, count * 12 * sizeof(float), packedLights.data());
+
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(gridBuffer));
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, grid.size() * sizeof(uint32_t), grid.data());
+
+        glBindBuffer(GL_TEXTURE_BUFFER, gpuResources.name(indexBuffer));
+        if (indexCount * sizeof(uint16_t) > indexCapacity || indexCapacity == 0) {
+            indexCapacity = (indexCount + indexCount / 2 + 1024) * sizeof(uint16_t);
+            glBufferData(GL_TEXTURE_BUFFER, indexCapacity, NULL, GL_STREAM_DRAW);
+            gpuResources.setBytes(indexBuffer, indexCapacity);
+            glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(indexTexture));
+            glTexBuffer(GL_TEXTURE_BUFFER, GL_R16UI, gpuResources.name(indexBuffer));
+        }
+        glBufferSubData(GL_TEXTURE_BUFFER, 0, indexCount * sizeof(uint16_t), indices.data());
+    }
+
+    // textures on units `unit`, `unit + 1` and `unit + 2`; samplers are set once per program
+    void bind(unsigned int program, int unit, const glm::vec3& viewPosition) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(lightTexture));
+        glActiveTexture(GL_TEXTURE0 + unit + 1);
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(gridTexture));
+        glActiveTexture(GL_TEXTURE0 + unit + 2);
+        glBindTexture(GL_TEXTURE_BUFFER, gpuResources.name(indexTexture));
+
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glUniform3i(glGetUniformLocation(program, "clusterDims"), clusterCountX, clusterCountY, clusterCountZ);
+        glUniform4f(glGetUniformLocation(program, "clusterViewport"), (float) viewport[0], (float) viewport[1],
+                    (float) viewport[2], (float) viewport[3]);
+        glUniform2f(glGetUniformLocation(program, "clusterDepth"), sliceScale, sliceBias);
+        glUniform3f(glGetUniformLocation(program, "ambient"), ambient.x, ambient.y, ambient.z);
+        glUniform3f(glGetUniformLocation(program, "viewPosition"), viewPosition.x, viewPosition.y, viewPosition.z);
+    }
+};
+
+#endif /* lighting_h */
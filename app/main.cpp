@@ -1,31 +1,548 @@
 #include <iostream>
 #include "main.h"
+#include "clock.h"
+#include "regression.h"
+#include "shaders.h"
+#include "permutations.h"
+#include "memory.h"
+#include "jobs.h"
+#include "ecs.h"
+#include "hierarchy.h"
+#include "lighting.h"
+#include "shadows.h"
+#include "prepass.h"
+#include "streaming.h"
+#include "resolution.h"
+#include "batching.h"
+#include "ondemand.h"
+#include "batch.h"
+#include "readback.h"
+#include "meshlets.h"
+#include "meshletbench.h"
+#include "particles.h"
+#include "particlebench.h"
+#include "collision.h"
+#include "collisionbench.h"
+#include "raycast.h"
+#include "raycastbench.h"
+#include "assetbench.h"
+#include "decodebench.h"
+#include "mipbench.h"
+#include "compressbench.h"
+#include "resources.h"
+#include <algorithm>
 #include <glm/gtc/type_ptr.hpp>
 
-int main() {
-    GLFWwindow* window = initOpenGl();
+// where the cube field spawns
+const glm::vec3 cubePositions[] = {
+    glm::vec3(0.0f, 0.0f, 0.0f),
+    glm::vec3( 2.0f,  5.0f, -15.0f),
+    glm::vec3(-1.5f, -2.2f, -2.5f),
+    glm::vec3(-3.8f, -2.0f, -12.3f),
+    glm::vec3( 2.4f, -0.4f, -3.5f),
+    glm::vec3(-1.7f,  3.0f, -7.5f),
+    glm::vec3( 1.3f, -2.0f, -2.5f),
+    glm::vec3( 1.5f,  2.0f, -2.5f),
+    glm::vec3( 1.5f,  0.2f, -1.5f),
+    glm::vec3(-1.3f,  1.0f, -1.5f)
+};
+// the cube material's textures; OpenGL expects the 0.0 coordinate on the y-axis to be on the bottom
+// side, images usually have 0.0 at the top of the y-axis
+const char* const cubeTexturePaths[] = { "/Users/feresr/Workspace/learnOpenGL/app/container.jpg",
+                                         "/Users/feresr/Workspace/learnOpenGL/app/awesomeface.png" };
+const bool cubeTextureFlips[] = { false, true };
+
+// materials used by entities, MaterialRef indexes into it
+std::vector<Material> materials;
+
+World world;
+std::vector<System> systems;
+TransformHierarchy hierarchy;
+ModelMatrixBuffer modelMatrices;
+ClusteredLighting lighting;
+CascadedShadows shadows;
+DepthPrepass prepass;
+TextureStreamer textureStreamer;
+DynamicResolution dynamicResolution;
+StaticBatcher staticBatcher;
+ClusterCuller clusterCuller;
+RenderOnDemand renderOnDemand;
+FrameReadback frameDump;
+ParticleSystem particles;
+CollisionWorld sceneCollision;
+// built or refitted lazily, when something is picked
+RayBvh sceneBvh;
+bool cameraCollision = true;
+// what the spin system reads, set once per frame before the systems run
+float sceneTime = 0.0f;
+
+void spawnCubeField(World& world, const Mesh& cube, int material) {
+    for (unsigned int i = 0; i < 10; i++) {
+        Transform transform;
+        transform.position = cubePositions[i];
+        transform.axis = glm::vec3(cos(1.0f), sin(1.0f), 0.0f);
+        AngularVelocity spin;
+        spin.axis = transform.axis;
+        spin.radiansPerSecond = float(i + 1);
+        MaterialRef materialRef;
+        materialRef.material = material;
+        HierarchyNode node;
+        node.node = hierarchy.create(noNode, localMatrix(transform));
+        world.create(transform, spin, cube, materialRef, Bounds(), node);
+    }
+}
+
+// Extra cubes on a grid behind the field for stress testing ("--entities N"). Each grid slice
+// hangs off a pivot node; one cube in sixteen spins, the rest are static and get merged into
+// static batches.
+void spawnEntityGrid(World& world, const Mesh& cube, int material, int count) {
+    int side = (int) ceil(cbrt((double) count));
+    uint32_t pivot = noNode;
+    for (int i = 0; i < count; i++) {
+        int slice = i / (side * side);
+        if (i % (side * side) == 0) {
+            pivot = hierarchy.create(noNode, glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -20.0f - slice * 2.0f)));
+        }
+        Transform transform;
+        transform.position = glm::vec3(float(i % side) * 2.0f - side, float((i / side) % side) * 2.0f - side, 0.0f);
+        transform.axis = glm::normalize(glm::vec3(1.0f, float(i % 7) + 1.0f, float(i % 3)));
+        MaterialRef materialRef;
+        materialRef.material = material;
+        HierarchyNode node;
+        node.node = hierarchy.create(pivot, localMatrix(transform));
+        if (i % 16 == 0) {
+            AngularVelocity spin;
+            spin.axis = transform.axis;
+            spin.radiansPerSecond = 0.5f + float(i % 11) * 0.25f;
+            world.create(transform, spin, cube, materialRef, Bounds(), node);
+        } else {
+            world.create(transform, cube, materialRef, Bounds(), node, StaticMesh());
+        }
+    }
+}
+
+// High-poly meshes in a row under the cube field ("--high-poly N"), turning slowly so their
+// clusters keep changing sides.
+void spawnHighPoly(World& world, const Mesh& mesh, int material, int count) {
+    for (int i = 0; i < count; i++) {
+        Transform transform;
+        transform.position = glm::vec3((float(i) - 0.5f * float(count - 1)) * 2.5f, -4.0f, -8.0f - float(i % 3) * 2.0f);
+        transform.axis = glm::vec3(0.0f, 1.0f, 0.0f);
+        transform.scale = glm::vec3(2.0f);
+        AngularVelocity spin;
+        spin.axis = transform.axis;
+        spin.radiansPerSecond = 0.2f + float(i % 5) * 0.1f;
+        MaterialRef materialRef;
+        materialRef.material = material;
+        HierarchyNode node;
+        node.node = hierarchy.create(noNode, localMatrix(transform));
+        world.create(transform, spin, mesh, materialRef, Bounds(), node);
+    }
+}
+
+void registerSystems() {
+    // writes go to the hierarchy's local matrices too, one distinct node per entity
+    System spin;
+    spin.name = "spin";
+    spin.reads = componentMask<AngularVelocity, HierarchyNode>();
+    spin.writes = componentMask<Transform>();
+    spin.update = [](Chunk& chunk) {
+        const AngularVelocity* velocities = chunk.array<AngularVelocity>();
+        const HierarchyNode* nodes = chunk.array<HierarchyNode>();
+        Transform* transforms = chunk.array<Transform>();
+        for (uint32_t i = 0; i < chunk.count; i++) {
+            float angle = sceneTime * velocities[i].radiansPerSecond;
+            if (angle == transforms[i].angle && transforms[i].axis == velocities[i].axis) continue;
+            transforms[i].axis = velocities[i].axis;
+            transforms[i].angle = angle;
+            hierarchy.setLocal(nodes[i].node, localMatrix(transforms[i]));
+        }
+    };
+    systems.push_back(spin);
+}
+
+// Lights wander around the cube field on circles: a few spot lights pointing down at it and
+// any number of small point lights ("--lights N").
+struct LightOrbit {
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+    float speed;
+    float phase;
+};
+std::vector<LightOrbit> lightOrbits;
+
+void spawnLights(int count) {
+    for (int i = 0; i < count; i++) {
+        LightOrbit orbit;
+        // deterministic spread, the regression suite renders this scene too
+        float a = float(i) * 2.39996f;
+        orbit.center = glm::vec3(cosf(a) * 0.3f * sqrtf(float(i)), sinf(a * 1.7f) * 3.0f, -2.0f - float(i % 37) * 0.5f);
+        orbit.radius = 0.5f + float(i % 5) * 0.4f;
+        orbit.speed = 0.3f + float(i % 7) * 0.15f;
+        orbit.phase = a;
+        glm::vec3 color = glm::vec3(0.5f + 0.5f * cosf(a), 0.5f + 0.5f * cosf(a + 2.1f), 0.5f + 0.5f * cosf(a + 4.2f));
+        if (i < 4) {
+            lighting.lights.push_back(spotLight(orbit.center + glm::vec3(0.0f, 6.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+                                                 12.0f, color * 6.0f, 0.3f, 0.5f));
+        } else {
+            lighting.lights.push_back(pointLight(orbit.center, 2.0f, color * 2.0f));
+        }
+        lightOrbits.push_back(orbit);
+    }
+}
+
+void animateLights(float time) {
+    jobs.parallelFor(lighting.lights.size(), 2048, [time](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            const LightOrbit& orbit = lightOrbits[i];
+            float angle = orbit.phase + time * orbit.speed;
+            glm::vec3 offset = glm::vec3(cosf(angle), 0.0f, sinf(angle)) * orbit.radius;
+            Light& light = lighting.lights[i];
+            if (light.cosOuter > -1.0f) {
+                light.position = orbit.center + glm::vec3(0.0f, 6.0f, 0.0f) + offset;
+            } else {
+                light.position = orbit.center + offset;
+            }
+        }
+    });
+}
+
+// Whether the picture changes with time alone, for rendering on demand: entities spinning at a
+// nonzero rate, orbiting lights, particles, or materials blending two different textures (the
+// ucolor blend cycles with time).
+uint64_t spinCheckVersion = ~0ull;
+bool spinningEntities = false;
+
+bool sceneAnimated() {
+    // rates are only set when entities are created, so this rescans on structural changes only
+    if (spinCheckVersion != world.structureVersion) {
+        spinCheckVersion = world.structureVersion;
+        spinningEntities = false;
+        world.forEachChunk(componentMask<AngularVelocity>(), [](Chunk& chunk) {
+            const AngularVelocity* velocities = chunk.array<AngularVelocity>();
+            for (uint32_t i = 0; i < chunk.count && !spinningEntities; i++) {
+                spinningEntities = velocities[i].radiansPerSecond != 0.0f;
+            }
+        });
+    }
+    if (spinningEntities || !lightOrbits.empty() || particles.capacity > 0) return true;
+    for (const Material& material : materials) {
+        auto textureCount = material.features.find("TEXTURE_COUNT");
+        if (textureCount != material.features.end() && textureCount->second >= 2 && material.textures[0] != material.textures[1]) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// systems, then world matrices of whatever moved, then only the changed bytes to the GPU
+void updateScene(float time) {
+    sceneTime = time;
+    runSystems(world, systems);
+    animateLights(time);
+    hierarchy.update();
+    sceneCollision.syncScene(world, hierarchy);
+    staticBatcher.update(world, hierarchy);
+    modelMatrices.upload(hierarchy);
+    if (particles.capacity > 0) particles.update(time);
+}
+
+struct DrawItem {
+    int material;
+    uint32_t order;
+    Mesh mesh;
+    uint32_t slot;
+    // world space bounding sphere of a static batch, radius 0 for entities
+    glm::vec3 center = glm::vec3(0.0f);
+    float radius = 0.0f;
+    // clusters that survived culling in the camera passes, NULL draws the whole mesh
+    const ClusterDraws* clusters = NULL;
+};
+
+// binds the material's shader variant, per frame uniforms and textures; false while the variant
+// isn't built yet
+bool bindMaterial(ShaderPermutations& shaders, const Material& material, const glm::mat4& view,
+                  const glm::mat4& projection, float time, int& modelLoc, int& modelIndexLoc) {
+    ShaderVariant* variant = shaders.lookup(material.key);
+    if (variant == NULL || variant->hot.program == 0) return false;
+    unsigned int shaderProgram = variant->hot.program;
+    glUseProgram(shaderProgram);
+    
+    unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
+    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
+    
+    unsigned int proyectionLoc = glGetUniformLocation(shaderProgram, "projection");
+    glUniformMatrix4fv(proyectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    
+    int colorUniform = glGetUniformLocation(shaderProgram, "ucolor");
+    glUniform4f(
+                colorUniform,
+                (sin(time) + 1.0f) / 2.0f,
+                (sin(.6f * time) + 1.0f) / 2.0f,
+                (sin(.2f * time) + 1.0f) / 2.0f,
+                1.0f);
+    
+    textureStreamer.bind(0, material.textures[0]);
+    textureStreamer.bind(1, material.textures[1]);
+    
+    // MODEL_BUFFER variants fetch their matrix from the hierarchy's buffer, the others take a uniform
+    modelMatrices.bind(2);
+    if (dynamicResolution.temporal.enabled()) {
+        modelMatrices.bindPrevious(7);
+        dynamicResolution.temporal.bindUniforms(shaderProgram);
+    }
+    lighting.bind(shaderProgram, 3, cameraPos);
+    shadows.bind(shaderProgram, 6);
+    modelLoc = glGetUniformLocation(shaderProgram, "model");
+    modelIndexLoc = glGetUniformLocation(shaderProgram, "modelIndex");
+    return true;
+}
+
+// everything time dependent reads `time`, sampled once per frame from the clock
+void renderScene(ShaderPermutations& shaders, float time) {
+    glm::mat4 view = glm::lookAt(cameraPos,
+                                 cameraPos + cameraFront, // (target)
+                                 cameraUp);
+    // jittered when upsampling temporally, culling and shadow fitting keep the plain one
+    glm::mat4 sceneProjection = dynamicResolution.sceneProjection(projection, view);
+
+    //rendering
+    //glClearColor(.2f, .3f, .4f, 1.0f); //sets a color
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    
+    lighting.bin(view, projection, nearPlane, farPlane);
+    lighting.upload();
+    
+    // draw list lives in the frame arena, sorted by material so each shader variant is bound once;
+    // entities inside a built static batch are drawn by the batch
+    ArenaVector<DrawItem> draws(frameArena);
+    draws.reserve(world.liveCount + staticBatcher.chunks.size());
+    world.forEachChunk(componentMask<HierarchyNode, Mesh, MaterialRef>(), [&](Chunk& chunk) {
+        const HierarchyNode* nodes = chunk.array<HierarchyNode>();
+        const Mesh* meshes = chunk.array<Mesh>();
+        const MaterialRef* materialRefs = chunk.array<MaterialRef>();
+        const Entity* entities = chunk.entities();
+        for (uint32_t i = 0; i < chunk.count; i++) {
+            if (staticBatcher.drawn(nodes[i].node)) continue;
+            draws.push_back({ materialRefs[i].material, entities[i].index, meshes[i], hierarchy.slot(nodes[i].node) });
+        }
+    });
+    uint32_t batchSlot = staticBatcher.enabled ? staticBatcher.identitySlot(hierarchy) : 0;
+    for (size_t c = 0; c < staticBatcher.chunks.size() && staticBatcher.enabled; c++) {
+        const BatchChunk& chunk = staticBatcher.chunks[c];
+        if (chunk.indexCount == 0) continue;
+        draws.push_back({ chunk.material, (uint32_t) c, chunk.mesh(), batchSlot, chunk.center(), chunk.radius() });
+    }
+    std::sort(draws.begin(), draws.end(), [](const DrawItem& a, const DrawItem& b) {
+        if (a.material != b.material) return a.material < b.material;
+        if (a.mesh.vao != b.mesh.vao) return a.mesh.vao < b.mesh.vao;
+        return a.order < b.order;
+    });
+    
+    // on screen size of every material's textures picks the mip levels the streamer keeps resident;
+    // a cube face spans the whole texture, at output resolution when upsampling
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    float pixelsPerUnit = viewport[3] * dynamicResolution.textureScale() * projection[1][1] * 0.5f;
+    float* materialPixels = frameArena.allocateArray<float>(materials.size());
+    for (size_t i = 0; i < materials.size(); i++) materialPixels[i] = 0.0f;
+    for (const DrawItem& draw : draws) {
+        float pixels;
+        if (draw.radius > 0.0f) {
+            // nearest point of a batch, at the scale of its largest member
+            float distance = fmaxf(glm::length(draw.center - cameraPos) - draw.radius, nearPlane);
+            pixels = pixelsPerUnit * staticBatcher.chunks[draw.order].maxScale / distance;
+        } else {
+            const glm::mat4& model = hierarchy.world[draw.slot];
+            float distance = fmaxf(glm::length(glm::vec3(model[3]) - cameraPos), nearPlane);
+            pixels = pixelsPerUnit * glm::length(glm::vec3(model[0])) / distance;
+        }
+        if (pixels > materialPixels[draw.material]) materialPixels[draw.material] = pixels;
+    }
+    for (size_t i = 0; i < materials.size(); i++) {
+        textureStreamer.request(materials[i].textures[0], materialPixels[i]);
+        textureStreamer.request(materials[i].textures[1], materialPixels[i]);
+    }
+    
+    shadows.fit(view, projection, nearPlane);
+    shadows.checkCasters(hierarchy);
+    for (const glm::vec4& bounds : staticBatcher.changedBounds) shadows.markCaster(glm::vec3(bounds), bounds.w);
+    shadows.render(draws, hierarchy, gpuResources.name(modelMatrices.texture));
+    
+    // static batches off screen are left out of the camera passes, shadows still need them;
+    // meshes with meshlets only keep the clusters the camera can see
+    glm::vec4 planes[6];
+    frustumPlanes(projection * view, planes);
+    ArenaVector<DrawItem> cameraDraws(frameArena);
+    cameraDraws.reserve(draws.size());
+    clusterCuller.beginFrame();
+    for (const DrawItem& draw : draws) {
+        if (draw.radius > 0.0f) {
+            const BatchChunk& chunk = staticBatcher.chunks[draw.order];
+            if (!boxInFrustum(planes, chunk.boundsMin, chunk.boundsMax)) continue;
+        }
+        cameraDraws.push_back(draw);
+        if (draw.mesh.meshlets >= 0) {
+            cameraDraws.back().clusters = clusterCuller.cull(draw.mesh, hierarchy.world[draw.slot], sceneProjection * view, cameraPos);
+        }
+    }
+    
+    // alpha tested materials can't go into the depth prepass, they shade with a normal depth test
+    prepass.beginFrame();
+    auto occluder = [](const DrawItem& draw) { return !materials[draw.material].alphaTested; };
+    prepass.render(cameraDraws, occluder, view, sceneProjection);
+    prepass.beginShading();
+    
+    int boundMaterial = -1;
+    unsigned int boundVao = 0;
+    bool bound = false;
+    int modelLoc = -1;
+    int modelIndexLoc = -1;
+    for (const DrawItem& draw : cameraDraws) {
+        if (draw.material != boundMaterial) {
+            boundMaterial = draw.material;
+            bound = bindMaterial(shaders, materials[draw.material], view, sceneProjection, time, modelLoc, modelIndexLoc);
+            prepass.setDepthState(occluder(draw));
+        }
+        if (!bound) continue;
+        if (draw.mesh.vao != boundVao) {
+            boundVao = draw.mesh.vao;
+            glBindVertexArray(boundVao);
+        }
+        if (modelIndexLoc >= 0) {
+            glUniform1i(modelIndexLoc, (int) draw.slot);
+        } else {
+            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(hierarchy.world[draw.slot]));
+        }
+        
+        // glDrawElements for indexed meshes and static batches, glMultiDrawElements for culled clusters
+        drawVisible(draw);
+    }
+    prepass.endShading();
+    
+    // transparent, after everything opaque
+    particles.render(view, sceneProjection, cameraPos, dynamicResolution.temporal.enabled());
+}
+
+// the texture pipeline benchmarks (assetbench.h): workers from "--threads", assets from the
+// directory after `flag`, no window needed
+template <typename F>
+int runAssetBenchmark(int argc, char** argv, const char* flag, const F& run) {
+    jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+    return run(std::string(argValue(argc, argv, flag, ".")));
+}
+
+int main(int argc, char** argv) {
+    // "--decode-bench <asset dir>" times image decoding against stb_image, on the assets and
+    // "--decode-corpus N" synthetic images
+    if (hasArg(argc, argv, "--decode-bench")) {
+        int corpusSize = atoi(argValue(argc, argv, "--decode-corpus", "16"));
+        return runAssetBenchmark(argc, argv, "--decode-bench", [corpusSize](const std::string& assetDirectory) {
+            return runDecodeBenchmark(assetDirectory, corpusSize);
+        });
+    }
+    // "--mip-bench <asset dir>" times mip chain generation and checks alpha test coverage
+    if (hasArg(argc, argv, "--mip-bench")) return runAssetBenchmark(argc, argv, "--mip-bench", runMipBenchmark);
+    // "--meshlet-bench" builds and culls meshlets of test meshes and checks the culling is conservative
+    if (hasArg(argc, argv, "--meshlet-bench")) {
+        return runMeshletBenchmark();
+    }
+    // "--particle-bench [N]" times N particles on every simulation backend
+    if (hasArg(argc, argv, "--particle-bench")) {
+        jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+        shaderDirectory = argValue(argc, argv, "--shaders", shaderDirectory.c_str());
+        GLFWwindow* window = initOpenGl(false);
+        int result = runParticleBenchmark(window, atoi(argValue(argc, argv, "--particle-bench", "1000000")));
+        glfwTerminate();
+        return result;
+    }
+    // "--collision-bench [N]" moves N boxes through the broadphase and narrow phase and times each step
+    if (hasArg(argc, argv, "--collision-bench")) {
+        jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+        int count = atoi(argValue(argc, argv, "--collision-bench", "100000"));
+        return runCollisionBenchmark(count > 0 ? count : 100000);
+    }
+    // "--raycast-bench [N]" traces views of N boxes through the BVH and reports rays per second
+    if (hasArg(argc, argv, "--raycast-bench")) {
+        jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+        int count = atoi(argValue(argc, argv, "--raycast-bench", "100000"));
+        return runRaycastBenchmark(count > 0 ? count : 100000);
+    }
+    // "--compression fast|normal|high" picks the block compression tier for textures
+    std::string compression = argValue(argc, argv, "--compression", "normal");
+    CompressQuality compressQuality = compression == "fast" ? CompressFast : (compression == "high" ? CompressHigh : CompressNormal);
+    // "--compress-bench <asset dir>" times the block compressors and reports their error
+    if (hasArg(argc, argv, "--compress-bench")) return runAssetBenchmark(argc, argv, "--compress-bench", runCompressBenchmark);
+    // "--compress <image> <out.dds>" compresses a texture with its mip chain offline
+    for (int i = 1; i + 2 < argc; i++) {
+        if (strcmp(argv[i], "--compress") != 0) continue;
+        jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+        return compressTextureFile(argv[i + 1], argv[i + 2], compressQuality);
+    }
+    
+    // "--replay <capture>" re-executes frames written by "--capture" "--replay-loops <n>" times
+    if (hasArg(argc, argv, "--replay")) {
+        GLFWwindow* window = initOpenGl(false);
+        if (window == NULL) return -1;
+        int result = runReplay(window, argValue(argc, argv, "--replay", ""), atoi(argValue(argc, argv, "--replay-loops", "100")));
+        glfwTerminate();
+        return result;
+    }
+    
+    // "--batch <job file>" renders the stills and turntables listed in it on "--batch-workers <n>"
+    // hidden contexts, "--threads" write the images
+    if (hasArg(argc, argv, "--batch")) {
+        jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+        GLFWwindow* window = initOpenGl(false);
+        if (window == NULL) return -1;
+        shaderDirectory = argValue(argc, argv, "--shaders", shaderDirectory.c_str());
+        int result = runBatchRendering(window, argValue(argc, argv, "--batch", ""), atoi(argValue(argc, argv, "--batch-workers", "4")),
+                                       cubePositions, (int) (sizeof(cubePositions) / sizeof(cubePositions[0])), cubeTexturePaths, cubeTextureFlips, compressQuality);
+        glfwTerminate();
+        return result;
+    }
+    
+    const char* regressionDir = argValue(argc, argv, "--regression");
+    // "--capture <file>" records frames "--capture-first <n>" to n + "--capture-frames <count>" - 1, then quits
+    if (regressionDir == NULL && hasArg(argc, argv, "--capture")) {
+        glCapture.armed = true;
+        glCapture.path = argValue(argc, argv, "--capture", "capture.glcap");
+        glCapture.firstFrame = atoi(argValue(argc, argv, "--capture-first", "60"));
+        glCapture.frameCount = std::max(1, atoi(argValue(argc, argv, "--capture-frames", "1")));
+    }
+    GLFWwindow* window = initOpenGl(regressionDir == NULL);
     if (window == NULL) return -1;
     
-    int vs = compileShader(GL_VERTEX_SHADER, vertexShaderSource);
-    int fs = compileShader(GL_FRAGMENT_SHADER, fragmentShaderSource);
-    int shaderProgram = createProgram(vs, fs);
-    glUseProgram(shaderProgram);
-    glDeleteShader(fs);
-    glDeleteShader(vs);
+    shaderDirectory = argValue(argc, argv, "--shaders", shaderDirectory.c_str());
+    ShaderReloader shaderReloader;
+    shaderReloader.useWorkerContext = !glCapture.armed;
+    shaderReloader.init(window);
+    
+    ShaderPermutations cubeShaders("cube", &shaderReloader);
+    cubeShaders.onSwap = [](unsigned int program) {
+        glUniform1i(glGetUniformLocation(program, "texture1"), 0); // 0 refers to texture unit (GL_TEXTURE0)
+        glUniform1i(glGetUniformLocation(program, "texture2"), 1); // 1 refers to texture unit (GL_TEXTURE1)
+        glUniform1i(glGetUniformLocation(program, "modelMatrices"), 2); // world matrix buffer on unit 2
+        glUniform1i(glGetUniformLocation(program, "lightData"), 3); // clustered lights on units 3 to 5
+        glUniform1i(glGetUniformLocation(program, "lightGrid"), 4);
+        glUniform1i(glGetUniformLocation(program, "lightIndices"), 5);
+        glUniform1i(glGetUniformLocation(program, "shadowMap"), 6); // sun shadow cascades
+        glUniform1i(glGetUniformLocation(program, "previousModelMatrices"), 7); // last frame's, motion vectors
+    };
+    cubeShaders.prewarm(shaderDirectory + "/variants.txt");
     
     // CREATE A VBO (Vertex Buffer Object)
-    unsigned int VBO;
-    glGenBuffers(1, &VBO);
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
+    ResourceHandle VBO = GPU_CREATE(ResourceBuffer, "meshes");
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(VBO));
     glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    gpuResources.setBytes(VBO, sizeof(vertices));
     
     // CREATE A Vertex Array Object
-    unsigned int VAO;
-    glGenVertexArrays(1, &VAO);
-    glBindVertexArray(VAO);
+    ResourceHandle VAO = GPU_CREATE(ResourceVertexArray, "meshes");
+    glBindVertexArray(gpuResources.name(VAO));
     
     //how much to move to get to the next vertex
-    float stride = 8 * sizeof(float);
+    float stride = 11 * sizeof(float);
     
     // positions
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, stride, (void*)0);
@@ -39,6 +556,27 @@ int main() {
     glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, stride, (void*) (6 * sizeof(float)));
     glEnableVertexAttribArray(2);
     
+    // normals
+    glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, stride, (void*) (8 * sizeof(float)));
+    glEnableVertexAttribArray(3);
+    
+    // positions only copy of the same vertices for depth only passes (prepass, shadows)
+    const int vertexCount = sizeof(vertices) / (11 * sizeof(float));
+    float positions[vertexCount * 3];
+    for (int i = 0; i < vertexCount; i++) {
+        positions[i * 3] = vertices[i * 11];
+        positions[i * 3 + 1] = vertices[i * 11 + 1];
+        positions[i * 3 + 2] = vertices[i * 11 + 2];
+    }
+    ResourceHandle positionVBO = GPU_CREATE(ResourceBuffer, "meshes");
+    glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(positionVBO));
+    glBufferData(GL_ARRAY_BUFFER, sizeof(positions), positions, GL_STATIC_DRAW);
+    gpuResources.setBytes(positionVBO, sizeof(positions));
+    ResourceHandle positionVAO = GPU_CREATE(ResourceVertexArray, "meshes");
+    glBindVertexArray(gpuResources.name(positionVAO));
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
+    glEnableVertexAttribArray(0);
+    
     //    IBO (index buffer object) not needed (using glDrawElements, not glDrawArrays)
     
     //    unsigned int indices[] = { 0, 1, 2, 2, 3, 0 };
@@ -49,94 +587,292 @@ int main() {
     
     checkForErrors();
     
-    //Textures
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
-    
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-    
-    unsigned int texture1 = createTexture("/Users/feresr/Workspace/learnOpenGL/app/container.jpg", GL_RGB);
-    // OpenGL expects the 0.0 coordinate on the y-axis to be on the bottom side,
-    // images usually have 0.0 at the top of the y-axis
-    stbi_set_flip_vertically_on_load(true);
-    unsigned int texture2 = createTexture("/Users/feresr/Workspace/learnOpenGL/app/awesomeface.png", GL_RGBA);
+    //Textures, streamed in by mip level under "--texture-budget <MB>"
+    textureStreamer.init();
+    textureStreamer.budget = (size_t) atoi(argValue(argc, argv, "--texture-budget", "256")) << 20;
+    // "--compression off" keeps textures RGBA8
+    textureStreamer.compress = compression != "off";
+    textureStreamer.compressQuality = compressQuality;
+    int texture1 = textureStreamer.add(cubeTexturePaths[0], cubeTextureFlips[0]);
+    int texture2 = textureStreamer.add(cubeTexturePaths[1], cubeTextureFlips[1]);
     
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, texture1);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture1"), 0); // 0 refers to texture unit (GL_TEXTURE0)
+    // "--temporal native|quality|balanced|performance" upsamples temporally from that render scale
+    TemporalPreset temporalPreset = parseTemporalPreset(argValue(argc, argv, "--temporal", "off"));
+    ShaderFeatures crateFeatures = { { "TEXTURE_COUNT", 2 }, { "MODEL_BUFFER", 1 }, { "LIGHTING", 1 }, { "SHADOWS", 1 } };
+    if (temporalPreset != TemporalOff) crateFeatures["MOTION_VECTORS"] = 1;
+    Material crate(crateFeatures);
+    crate.textures[0] = texture1;
+    crate.textures[1] = texture2;
+    materials.push_back(crate);
+    for (Material& material : materials) {
+        if (cubeShaders.get(material.features) == NULL) return -1;
+    }
     
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, texture2);
-    glUniform1i(glGetUniformLocation(shaderProgram, "texture2"), 1); // 1 refers to texture unit (GL_TEXTURE1)
+    // scene: the cube field plus optional stress entities, updated by systems on all cores
+    jobs.start(atoi(argValue(argc, argv, "--threads", "0")));
+    Mesh cube;
+    cube.vao = gpuResources.name(VAO);
+    cube.positionVao = gpuResources.name(positionVAO);
+    cube.first = 0;
+    cube.count = 36;
+    spawnCubeField(world, cube, 0);
+    // "--static-batching off" draws static entities one by one
+    staticBatcher.enabled = std::string(argValue(argc, argv, "--static-batching", "on")) != "off";
+    staticBatcher.init(hierarchy);
+    staticBatcher.addSource(cube.vao, vertices, vertexCount);
+    spawnEntityGrid(world, cube, 0, atoi(argValue(argc, argv, "--entities", "0")));
+    // "--high-poly N" adds N torus knots cut into meshlets, "--cluster-culling off" draws them whole
+    clusterCuller.enabled = std::string(argValue(argc, argv, "--cluster-culling", "on")) != "off";
+    int highPolyCount = atoi(argValue(argc, argv, "--high-poly", "0"));
+    if (highPolyCount > 0) {
+        std::vector<float> knotVertices;
+        std::vector<uint32_t> knotIndices;
+        torusKnotMesh(1024, 32, knotVertices, knotIndices);
+        Mesh knot = clusterCuller.add(knotVertices.data(), knotVertices.size() / 11, knotIndices);
+        spawnHighPoly(world, knot, 0, highPolyCount);
+    }
+    registerSystems();
+    modelMatrices.keepPrevious = temporalPreset != TemporalOff;
+    modelMatrices.init();
+    lighting.init();
+    if (!shadows.init(shaderReloader)) return -1;
+    if (!prepass.init(shaderReloader)) return -1;
+    // "--prepass on|off|auto", auto measures overdraw and decides by itself
+    std::string prepassMode = argValue(argc, argv, "--prepass", "auto");
+    prepass.mode = prepassMode == "on" ? PrepassOn : (prepassMode == "off" ? PrepassOff : PrepassAuto);
+    spawnLights(atoi(argValue(argc, argv, "--lights", "64")));
+    // "--camera-collision off" lets the camera fly through the scene
+    cameraCollision = std::string(argValue(argc, argv, "--camera-collision", "on")) != "off";
+    // "--particles N" adds a fountain of about N live particles, simulated by "--particle-backend cpu|gpu"
+    // and blended "--particle-blend additive|alpha" (alpha sorts, cpu backend only)
+    int particleCount = atoi(argValue(argc, argv, "--particles", "0"));
+    if (particleCount > 0) {
+        bool gpuParticles = std::string(argValue(argc, argv, "--particle-backend", "cpu")) == "gpu";
+        particles.backend = gpuParticles ? ParticleGpu : ParticleCpu;
+        particles.blend = std::string(argValue(argc, argv, "--particle-blend", "additive")) == "alpha" ? ParticleAlpha : ParticleAdditive;
+        particleFountain(particles, particleCount);
+        if (!particles.init(shaderReloader, gpuParticles ? particleCount : particleCapacity(particleCount))) return -1;
+        particles.prewarm();
+    }
+    // "--dynamic-resolution off" renders at window size, otherwise the render scale follows
+    // "--frame-budget <ms>" of GPU time and the upscale sharpens by "--sharpness <0..1>"
+    dynamicResolution.setTemporalPreset(temporalPreset);
+    if (!dynamicResolution.init(shaderReloader)) return -1;
+    dynamicResolution.enabled = std::string(argValue(argc, argv, "--dynamic-resolution", "on")) != "off";
+    dynamicResolution.controller.budgetMilliseconds = atof(argValue(argc, argv, "--frame-budget", "16.6"));
+    dynamicResolution.sharpness = atof(argValue(argc, argv, "--sharpness", "0.5"));
     
     //glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 
-    glm::vec3 cubePositions[] = {
-        glm::vec3(0.0f, 0.0f, 0.0f),
-        glm::vec3( 2.0f,  5.0f, -15.0f),
-        glm::vec3(-1.5f, -2.2f, -2.5f),
-        glm::vec3(-3.8f, -2.0f, -12.3f),
-        glm::vec3( 2.4f, -0.4f, -3.5f),
-        glm::vec3(-1.7f,  3.0f, -7.5f),
-        glm::vec3( 1.3f, -2.0f, -2.5f),
-        glm::vec3( 1.5f,  2.0f, -2.5f),
-        glm::vec3( 1.5f,  0.2f, -1.5f),
-        glm::vec3(-1.3f,  1.0f, -1.5f)
+    // "--fixed-step <seconds>" pins the run to a fixed time sequence instead of the wall clock
+    SystemClock systemClock;
+    FixedStepClock fixedClock(0.0, atof(argValue(argc, argv, "--fixed-step", "0.0166667")));
+    Clock* clock = hasArg(argc, argv, "--fixed-step") ? (Clock*) &fixedClock : &systemClock;
+    
+    // everything the registry holds should be released by its owner here, the rest is reported as leaked
+    auto releaseGpuResources = [&]() {
+        shaderReloader.release();
+        frameDump.release();
+        staticBatcher.release();
+        clusterCuller.release();
+        particles.release();
+        textureStreamer.release();
+        dynamicResolution.release();
+        prepass.release();
+        shadows.release();
+        lighting.release();
+        modelMatrices.release();
+        gpuResources.release(positionVAO);
+        gpuResources.release(positionVBO);
+        gpuResources.release(VAO);
+        gpuResources.release(VBO);
+        gpuResources.flush();
+        return gpuResources.leakReport();
     };
     
+    if (regressionDir != NULL) {
+        RegressionOptions options;
+        options.dir = regressionDir;
+        options.record = hasArg(argc, argv, "--record");
+        options.timeThreshold = atof(argValue(argc, argv, "--threshold", "0.15"));
+        // with "--temporal <preset>" the output is compared against goldens recorded natively: it
+        // converges over the repeated renders of a frame and antialiased edges differ a little
+        bool temporal = temporalPreset != TemporalOff;
+        options.compareLastIteration = temporal;
+        options.maxDifferentPixels = atof(argValue(argc, argv, "--max-different", temporal ? "0.03" : "0.001"));
+        dynamicResolution.enabled = false;
+        textureStreamer.pinFullResolution = true;
+        textureStreamer.settle();
+        int result = runRegressionSuite(options, fixedClock, [&](float time) {
+            frameArena.reset();
+            updateScene(time);
+            // static batches built before the frame renders, not whenever the workers get to it
+            staticBatcher.settle();
+            if (temporal) dynamicResolution.beginFrame(regressionWidth, regressionHeight);
+            renderScene(cubeShaders, time);
+            if (temporal) dynamicResolution.endFrame();
+            gpuResources.endFrame();
+        });
+        shaderReloader.shutdown();
+        if (releaseGpuResources() > 0 && result == 0) result = 1;
+        glfwTerminate();
+        return result;
+    }
+    
+    // "--assert-no-alloc" aborts on any heap allocation of the main thread once the loop reached steady state,
+    // "--stats" prints per frame counters once a second
+    FrameAllocationGuard allocationGuard;
+    allocationGuard.strict = hasArg(argc, argv, "--assert-no-alloc");
+    bool printStats = hasArg(argc, argv, "--stats");
+    float lastStatsReport = 0.0f;
+    // "--on-demand" only renders when something changed, animations at "--animation-rate <fps>" (0 freezes them)
+    renderOnDemand.enabled = hasArg(argc, argv, "--on-demand");
+    renderOnDemand.animationRate = atof(argValue(argc, argv, "--animation-rate", "30"));
+    // "--idle-bench [seconds]" leaves the scene alone that long in the continuous loop, then as long
+    // on demand, reports the CPU time of both and quits
+    IdleBenchmark idleBenchmark;
+    if (hasArg(argc, argv, "--idle-bench")) {
+        idleBenchmark.seconds = atof(argValue(argc, argv, "--idle-bench", "10"));
+        if (idleBenchmark.seconds <= 0.0) idleBenchmark.seconds = 10.0;
+    }
+    // "--dump-frames <dir>" writes every rendered frame there, "--dump-format ppm|raw", "--dump-sync"
+    // reads back synchronously for comparison
+    frameDump.directory = argValue(argc, argv, "--dump-frames", "");
+    frameDump.format = std::string(argValue(argc, argv, "--dump-format", "ppm")) == "raw" ? DumpRaw : DumpPPM;
+    frameDump.synchronous = hasArg(argc, argv, "--dump-sync");
+    
     //render loop
     while(!glfwWindowShouldClose(window)) {
-        float currentFrame = glfwGetTime();
+        allocationGuard.beginFrame();
+        float currentFrame = clock->tick();
         deltaTime = currentFrame - lastTime;
+        // the first key press after sleeping shouldn't move the camera by the whole wait
+        if (renderOnDemand.enabled) deltaTime = std::min(deltaTime, 0.1f);
         lastTime = currentFrame;
         
-        processKeyboardInputs(window);
-        
-        glm::mat4 view = glm::lookAt(cameraPos,
-                                     cameraPos + cameraFront, // (target)
-                                     cameraUp);
-        
-        unsigned int viewLoc = glGetUniformLocation(shaderProgram, "view");
-        glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-        
-        unsigned int proyectionLoc = glGetUniformLocation(shaderProgram, "projection");
-        glUniformMatrix4fv(proyectionLoc, 1, GL_FALSE, glm::value_ptr(projection));
-        
-        int colorUniform = glGetUniformLocation(shaderProgram, "ucolor");
-        glUniform4f(
-                    colorUniform,
-                    (sin((float) glfwGetTime()) + 1.0f) / 2.0f,
-                    (sin(.6f * (float) glfwGetTime()) + 1.0f) / 2.0f,
-                    (sin(.2f * (float) glfwGetTime()) + 1.0f) / 2.0f,
-                    1.0f);
-    
-        //rendering
-        //glClearColor(.2f, .3f, .4f, 1.0f); //sets a color
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+        glm::vec3 previousCameraPos = cameraPos;
+        bool keysHeld = processKeyboardInputs(window);
+        // against last frame's boxes, the scene moves on in updateScene
+        if (cameraCollision) cameraPos = sceneCollision.slideSphere(previousCameraPos, cameraPos, cameraRadius);
+        if (pickRequested) {
+            pickRequested = false;
+            sceneBvh.update(sceneCollision);
+            RayHit hit = sceneBvh.trace({ cameraPos, cameraFront, farPlane }, false);
+            if (hit.body == noBody) {
+                std::cout << "[picking] nothing under the crosshair" << std::endl;
+            } else {
+                const CollisionShape& shape = sceneCollision.shapes[hit.body];
+                std::cout << "[picking] node " << sceneCollision.nodeOfBody[hit.body] << " at (" << shape.center[0] << ", "
+                          << shape.center[1] << ", " << shape.center[2] << "), " << hit.t << " away" << std::endl;
+            }
+        }
+        shaderReloader.update();
+        cubeShaders.update();
+        int windowWidth, windowHeight;
+        glfwGetFramebufferSize(window, &windowWidth, &windowHeight);
         
-        for (unsigned int i = 0; i < 10; i++) {
-            //model
-            glm::mat4 model = glm::mat4(1.0f);
+        // background work lands in later frames, keep rendering until it did
+        bool backgroundWork = textureStreamer.loadsInFlight > 0 || staticBatcher.buildsInFlight > 0 || shaderReloader.building();
+        bool rendered = renderOnDemand.shouldRender(glfwGetTime(), cameraPos, cameraFront, windowWidth, windowHeight,
+                                                    shaderReloader.swaps, windowNeedsRefresh, keysHeld, sceneAnimated(), backgroundWork);
+        if (rendered) {
+            windowNeedsRefresh = false;
+            // only on rendered frames, it sizes the streaming requests by what the last frame drew
+            textureStreamer.update();
+            updateScene(currentFrame);
+            dynamicResolution.beginFrame(windowWidth, windowHeight);
+            renderScene(cubeShaders, currentFrame);
+            dynamicResolution.endFrame();
+            frameDump.capture(windowWidth, windowHeight);
             
-            //model = glm::scale(model, glm::vec3(0.5, 0.5, 0.5));
-            model = glm::translate(model, cubePositions[i]);
-            model = glm::rotate(model, (float) glfwGetTime() * (i + 1), glm::vec3(cos(1.0f), sin(1.0f), 0.0f));
-            unsigned int modelLoc = glGetUniformLocation(shaderProgram, "model");
-            glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-            
-            //glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0); // needs an indexBuffer
-            glDrawArrays(GL_TRIANGLES, 0, 36); //glDrawArrays:: does not need an index buffer to be uploaded to the GPU
+            //openGL primitives  GL_POINTS, GL_TRIANGLES and GL_LINE_STRIP.
+            //swap the color buffer (a large buffer that contains color values for each pixel in GLFW's window)
+            glfwSwapBuffers(window);
+            gpuResources.endFrame();
+            glCapture.endFrame(window);
+        }
+        //any events are triggered (like keyboard input or mouse movement events), on demand this sleeps until one is
+        renderOnDemand.waitEvents(glfwGetTime());
+        if (idleBenchmark.seconds > 0.0 && idleBenchmark.update(glfwGetTime(), rendered, renderOnDemand)) {
+            glfwSetWindowShouldClose(window, true);
         }
         
-        //openGL primitives  GL_POINTS, GL_TRIANGLES and GL_LINE_STRIP.
-        //swap the color buffer (a large buffer that contains color values for each pixel in GLFW's window)
-        glfwSwapBuffers(window);
-        //any events are triggered (like keyboard input or mouse movement events)
-        glfwPollEvents();
+        allocationGuard.endFrame();
+        if (printStats && currentFrame - lastStatsReport >= 1.0f) {
+            lastStatsReport = currentFrame;
+            std::cout << "[memory] main thread heap allocations last frame: " << allocationGuard.lastFrameCount
+                      << " (" << allocationGuard.lastFrameBytes << " bytes), total " << heapAllocationCount.load()
+                      << ", frame arena " << frameArena.highWater << "/" << frameArena.capacity << " bytes" << std::endl;
+            std::cout << "[hierarchy] " << hierarchy.lastUpdatedNodes << "/" << hierarchy.size() << " world matrices updated, "
+                      << hierarchy.changedRanges.size() << " ranges, " << modelMatrices.lastUploadBytes << " bytes uploaded" << std::endl;
+            std::cout << "[lighting] " << lighting.lights.size() << " lights, " << lighting.indexCount << " cluster entries, max "
+                      << lighting.maxLightsPerCluster << " per cluster, binned in " << lighting.lastBinMilliseconds << " ms" << std::endl;
+            std::cout << "[textures] " << (textureStreamer.residentBytes >> 20) << "/" << (textureStreamer.budget >> 20)
+                      << " MB resident (" << (textureStreamer.uncompressedBytes >> 20) << " MB as RGBA8), peak "
+                      << (textureStreamer.peakResidentBytes >> 20) << " MB, " << (textureStreamer.cachedBytes >> 20) << " MB cached, "
+                      << textureStreamer.levelsStreamed << " levels streamed, " << textureStreamer.levelsEvicted << " evicted" << std::endl;
+            const RenderTarget* sceneTarget = dynamicResolution.target >= 0 ? &dynamicResolution.pool.target(dynamicResolution.target) : NULL;
+            std::cout << "[resolution] temporal " << temporalPresetName(temporalPreset) << ", scale " << dynamicResolution.scale << " (" << (sceneTarget ? sceneTarget->width : windowWidth) << "x"
+                      << (sceneTarget ? sceneTarget->height : windowHeight) << "), gpu " << dynamicResolution.gpuMilliseconds << " ms of "
+                      << dynamicResolution.controller.budgetMilliseconds << " ms budget, " << dynamicResolution.pool.pooledCount()
+                      << " targets pooled (" << (dynamicResolution.pool.pooledBytes() >> 10) << " KB), "
+                      << dynamicResolution.pool.allocations << " allocated so far" << std::endl;
+            std::cout << "[batching] " << staticBatcher.staticCount << " static entities in " << staticBatcher.builtChunks()
+                      << " chunks, " << staticBatcher.buildsInFlight << " rebuilds in flight, " << staticBatcher.rebuilds
+                      << " done so far" << std::endl;
+            std::cout << "[meshlets] " << clusterCuller.visibleClusters << "/" << clusterCuller.totalClusters << " clusters visible, "
+                      << clusterCuller.submittedTriangles << "/" << clusterCuller.totalTriangles << " triangles submitted in "
+                      << clusterCuller.ranges << " ranges" << std::endl;
+            if (particles.capacity > 0) {
+                std::cout << "[particles] " << particles.count << " live on the " << (particles.backend == ParticleGpu ? "gpu" : "cpu");
+                if (particles.backend == ParticleGpu) {
+                    std::cout << ", submitted in " << particles.simulateMilliseconds << " ms, simulated in "
+                              << particles.gpuSimulateMilliseconds << " ms on the gpu";
+                } else {
+                    std::cout << ", simulated in " << particles.simulateMilliseconds << " ms";
+                }
+                std::cout << ", sorted in "
+                          << (particles.blend == ParticleAlpha ? particles.sortMilliseconds : 0.0) << " ms, "
+                          << (particles.uploadBytes >> 10) << " KB uploaded" << std::endl;
+            }
+            std::cout << "[collision] " << sceneCollision.size() << " bodies, " << sceneCollision.movedBodies << " moved, "
+                      << sceneCollision.reinsertedBodies << " reinserted, synced in " << sceneCollision.placeMilliseconds + sceneCollision.refitMilliseconds
+                      << " ms, tree height " << sceneCollision.tree.height() << ", camera pushed out " << sceneCollision.cameraPushes
+                      << " times in " << sceneCollision.cameraMilliseconds << " ms" << std::endl;
+            sceneCollision.cameraPushes = 0;
+            sceneCollision.cameraMilliseconds = 0.0;
+            if (sceneBvh.builds > 0) {
+                std::cout << "[picking] bvh " << sceneBvh.nodeCount.load() << " nodes, SAH cost " << sceneBvh.cost << " (" << sceneBvh.builtCost
+                          << " when built), " << sceneBvh.builds << " builds (last " << sceneBvh.buildMilliseconds << " ms), "
+                          << sceneBvh.refits << " refits (last " << sceneBvh.refitMilliseconds << " ms)" << std::endl;
+            }
+            std::cout << "[prepass] overdraw " << prepass.overdraw << ", prepass " << (prepass.enabled || prepass.mode == PrepassOn ? "on" : "off") << std::endl;
+            for (int c = 0; c < cascadeCount; c++) {
+                const CascadeStats& cascade = shadows.cascades[c].stats;
+                std::cout << "[shadows] cascade " << c << ": " << cascade.casterDraws << " caster draws, "
+                          << cascade.cpuMilliseconds << " ms cpu, " << cascade.gpuMilliseconds << " ms gpu, cached for "
+                          << cascade.cachedFrames << " frames" << std::endl;
+            }
+            if (frameDump.enabled()) {
+                frameDump.report();
+                std::cout << "[readback] " << (frameDump.synchronous ? "sync" : "pbo ring") << ", " << frameDump.frame << " frames read, "
+                          << frameDump.written.load() << " written, " << frameDump.stalls << " stalls, overhead "
+                          << frameDump.lastAverageMilliseconds << " ms per frame (max " << frameDump.lastMaxMilliseconds << ")" << std::endl;
+            }
+            renderOnDemand.report(glfwGetTime());
+            std::cout << "[loop] " << (renderOnDemand.enabled ? "on demand" : "continuous") << ", "
+                      << renderOnDemand.framesPerSecond << " frames rendered per second in " << renderOnDemand.wakeupsPerSecond
+                      << " wakeups, cpu " << renderOnDemand.cpuUsage * 100.0f << "% of a core" << std::endl;
+            gpuResources.report();
+        }
     }
     
     checkForErrors();
+    // window closed before the last captured frame
+    glCapture.finish();
+    frameDump.finish();
+    shaderReloader.shutdown();
+    releaseGpuResources();
     glfwTerminate();
     return 0;
 }
@@ -10,14 +10,39 @@
 #define main_h
 
 #include <math.h>
+#include <string.h>
+#include <string>
+#include <fstream>
+#include <sstream>
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
 #include <glm/glm.hpp>
 #include "STBIMAGE/stb_image.h"
+#include "decode.h"
+#include "mipmap.h"
+#include "texcompress.h"
+#include "capture.h"
 #include <glm/gtc/matrix_transform.hpp>
 
+//command line: "--name value" pairs and plain "--flag" switches
+const char* argValue(int argc, char** argv, const char* name, const char* fallback = NULL) {
+    for (int i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], name) == 0) return argv[i + 1];
+    }
+    return fallback;
+}
+
+bool hasArg(int argc, char** argv, const char* name) {
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], name) == 0) return true;
+    }
+    return false;
+}
+
 // projection
-glm::mat4 projection = glm::perspective(45.0f, float(800.0f/600.0f), .1f, 100.0f);
+const float nearPlane = .1f;
+const float farPlane = 100.0f;
+glm::mat4 projection = glm::perspective(45.0f, float(800.0f/600.0f), nearPlane, farPlane);
 
 void checkForErrors() {
     while (GLenum error = glGetError()) {
@@ -26,70 +51,87 @@ void checkForErrors() {
     std::cout << std::endl;
 }
 
-unsigned int createTexture(const char* path, GLenum format) {
-    int width, height, nrChannels;
-    unsigned char *data = stbi_load(path, &width, &height, &nrChannels, 0);
+// loads an image with its whole mip chain, filtered on the CPU (mipmap.h) and block compressed
+// (texcompress.h) when the driver takes the format; the texture is left bound. Wrap and filter
+// modes are the streamed textures' (streaming.h), so both sample the same.
+unsigned int createTexture(const char* path, bool flip, CompressQuality quality = CompressNormal) {
+    DecodedImage image;
     
     unsigned int texture;
     glGenTextures(1, &texture);
     glBindTexture(GL_TEXTURE_2D, texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
     
-    if (data)
+    if (decodeImageFile(path, 4, flip, image))
     {
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, format, GL_UNSIGNED_BYTE, data);
-        glGenerateMipmap(GL_TEXTURE_2D);
+        size_t texels = (size_t) image.width * image.height;
+        std::vector<std::vector<unsigned char>> chain;
+        generateMipChain(image.pixels.data(), image.width, image.height, mipSettingsFor(image.pixels.data(), texels),
+                         mipLevelCount(image.width, image.height) - 1, true, chain);
+        CompressedFormatSupport support;
+        support.query();
+        TextureFormat format = chooseTextureFormat(alphaUsage(image.pixels.data(), texels), quality, support);
+        std::vector<unsigned char> level;
+        for (int i = 0; i <= (int) chain.size(); i++) {
+            int width = mipDimension(image.width, i), height = mipDimension(image.height, i);
+            compressImage(i == 0 ? image.pixels.data() : chain[i - 1].data(), width, height, format, quality, true, level);
+            uploadTextureLevel(i, format, width, height, level);
+        }
     }
     else
     {
         std::cout << "Failed to load texture: " << path << std::endl;
     }
     
-    stbi_image_free(data);
     return texture;
 }
 
+// position, color, tex coord, normal
 float vertices[] = {
-    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f,  0.0f, 0.0f,
-    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f,  1.0f, 0.0f,
-    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f,  0.0f, 0.0f,  0.0f, 0.0f, -1.0f,
+    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f,  1.0f, 0.0f,  0.0f, 0.0f, -1.0f,
+    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, 0.0f, -1.0f,
+    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, 0.0f, -1.0f,
+    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, 0.0f, -1.0f,
+    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  0.0f, 0.0f, -1.0f,
     
-    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
-    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
+    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  0.0f, 0.0f, 1.0f,
+    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  0.0f, 0.0f, 1.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, 0.0f, 1.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, 0.0f, 1.0f,
+    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, 0.0f, 1.0f,
+    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  0.0f, 0.0f, 1.0f,
     
-    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f,.0f, .4f, 0.2f,  0.0f, 1.0f,
-    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f,.0f, .4f, 0.2f,  1.0f, 0.0f,
+    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  -1.0f, 0.0f, 0.0f,
+    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  -1.0f, 0.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f,.0f, .4f, 0.2f,  0.0f, 1.0f,  -1.0f, 0.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  -1.0f, 0.0f, 0.0f,
+    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  -1.0f, 0.0f, 0.0f,
+    -0.5f,  0.5f,  0.5f,.0f, .4f, 0.2f,  1.0f, 0.0f,  -1.0f, 0.0f, 0.0f,
     
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    0.5f, -0.5f, -0.5f,.0f, .4f, 0.2f,  0.0f, 1.0f,
-    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  1.0f, 0.0f, 0.0f,
+    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f, -0.5f,.0f, .4f, 0.2f,  0.0f, 1.0f,  1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  1.0f, 0.0f, 0.0f,
+    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  1.0f, 0.0f, 0.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  1.0f, 0.0f, 0.0f,
     
-    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
-    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
+    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, -1.0f, 0.0f,
+    0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, -1.0f, 0.0f,
+    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  0.0f, -1.0f, 0.0f,
+    0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  0.0f, -1.0f, 0.0f,
+    -0.5f, -0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  0.0f, -1.0f, 0.0f,
+    -0.5f, -0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, -1.0f, 0.0f,
     
-    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,
-    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,
-    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,
-    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f
+    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, 1.0f, 0.0f,
+    0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 1.0f, 1.0f,  0.0f, 1.0f, 0.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+    0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 1.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+    -0.5f,  0.5f,  0.5f, .0f, .4f, 0.2f, 0.0f, 0.0f,  0.0f, 1.0f, 0.0f,
+    -0.5f,  0.5f, -0.5f, .0f, .4f, 0.2f, 0.0f, 1.0f,  0.0f, 1.0f, 0.0f
 };
 
 float texCoords[] = {
@@ -100,47 +142,13 @@ float texCoords[] = {
 
 
 /**
+ Shaders live in app/shaders (cube.vert, cube.frag) and are read at startup and on every change.
+
  uniform: are per-primitive parameters (constant during an entire draw call) ;
  attribute: are per-vertex parameters (typically : positions, normals, colors, UVs, ...) ;
  varying: are per-fragment (or per-pixel) parameters : they vary from pixels to pixels.
  **/
 
-const char *vertexShaderSource = "#version 330 core\n"
-
-"layout (location = 0) in vec3 aPos;\n"
-"layout (location = 1) in vec3 aColor;\n"
-"layout (location = 2) in vec2 aTexCoord;\n"
-
-"uniform mat4 model;\n"
-"uniform mat4 view;\n"
-"uniform mat4 projection;\n"
-
-"out vec3 incolor;\n"
-"out vec2 texCoord;\n"
-
-"void main()\n"
-"{\n"
-"   gl_Position = projection * view * model * vec4(aPos.x, aPos.y, aPos.z, 1.0);\n"
-"   texCoord = aTexCoord;"
-"   incolor = aColor;\n"
-"}\0";
-
-const char *fragmentShaderSource = "#version 330 core\n"
-
-"uniform vec4 ucolor;\n"
-"uniform sampler2D texture1;\n"
-"uniform sampler2D texture2;\n"
-
-"in vec3 incolor;\n"
-"in vec2 texCoord;\n"
-
-"out vec4 fragmentColor;\n"
-
-"void main()\n"
-"{\n"
-"   fragmentColor = mix(texture(texture1, texCoord), texture(texture2, texCoord), ucolor.x);\n"
-"}\n\0";
-
 bool firstMouse = true;
 float lastX = 400.0f;
 float lastY = 300.0f;
@@ -151,6 +159,23 @@ float pitch = 0.0f;
 glm::vec3 cameraPos = glm::vec3(0, 0.0f, 3.0f);
 glm::vec3 cameraUp = glm::vec3(0.0f, 1.0f, 0.0f);
 glm::vec3 cameraFront = glm::vec3(0.0f, 0.0f, -1.0f);
+// the camera collides as a sphere this big, wide enough to keep the near plane out of the boxes
+const float cameraRadius = 0.25f;
+
+void setCameraDirection(float newYaw, float newPitch) {
+    yaw = newYaw;
+    pitch = newPitch;
+    if(pitch > 89.0f)
+        pitch = 89.0f;
+    if(pitch < -89.0f)
+        pitch = -89.0f;
+    
+    glm::vec3 front;
+    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
+    front.y = sin(glm::radians(pitch));
+    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
+    cameraFront = glm::normalize(front);
+}
 
 void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     if(firstMouse)
@@ -172,16 +197,14 @@ void mouse_callback(GLFWwindow* window, double xpos, double ypos) {
     yaw   += xoffset;
     pitch += yoffset;
     
-    if(pitch > 89.0f)
-        pitch = 89.0f;
-    if(pitch < -89.0f)
-        pitch = -89.0f;
-    
-    glm::vec3 front;
-    front.x = cos(glm::radians(yaw)) * cos(glm::radians(pitch));
-    front.y = sin(glm::radians(pitch));
-    front.z = sin(glm::radians(yaw)) * cos(glm::radians(pitch));
-    cameraFront = glm::normalize(front);
+    setCameraDirection(yaw, pitch);
+}
+
+// a left click picks whatever is under the crosshair, the loop handles it
+bool pickRequested = false;
+
+void mouseButtonCallback(GLFWwindow*, int button, int action, int) {
+    if (button == GLFW_MOUSE_BUTTON_LEFT && action == GLFW_PRESS) pickRequested = true;
 }
 
 void resizeCallback(GLFWwindow* window, int width, int height) {
@@ -189,7 +212,15 @@ void resizeCallback(GLFWwindow* window, int width, int height) {
     glViewport(0, 0, width, height);
 }
 
-GLFWwindow* initOpenGl() {
+// the window system lost the window's contents (uncovered, restored), render on demand redraws
+bool windowNeedsRefresh = true;
+
+void refreshCallback(GLFWwindow*) {
+    windowNeedsRefresh = true;
+}
+
+// headless runs (regression suite) get a hidden window and render offscreen
+GLFWwindow* initOpenGl(bool visible = true) {
     // Initialize GLFW
     glfwInit();
     glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
@@ -197,24 +228,31 @@ GLFWwindow* initOpenGl() {
     glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
     //ios
     glfwWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
     
     //Crete a window, fail fast if this cannot be done
     GLFWwindow* window = glfwCreateWindow(800, 600, "Learn OpenGL", NULL, NULL);
     if (window == NULL) {
         std::cout << "Failed to crete GLFW window" << std::endl;
         glfwTerminate();
+        return NULL;
     }
     glfwMakeContextCurrent(window);
     if (!gladLoadGLLoader((GLADloadproc)  glfwGetProcAddress)) {
         std::cout << "Failed to initialize GLAD" << std::endl;
     }
+    if (glCapture.armed) glCapture.install(window);
     
     //register window resize callback
     glfwSetFramebufferSizeCallback(window, resizeCallback);
+    glfwSetWindowRefreshCallback(window, refreshCallback);
     glfwSwapInterval(1);
     
-    glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); //capture mouse events
-    glfwSetCursorPosCallback(window, mouse_callback);
+    if (visible) {
+        glfwSetInputMode(window, GLFW_CURSOR, GLFW_CURSOR_DISABLED); //capture mouse events
+        glfwSetCursorPosCallback(window, mouse_callback);
+        glfwSetMouseButtonCallback(window, mouseButtonCallback);
+    }
     
     glEnable(GL_DEPTH_TEST);
     return window;
@@ -247,14 +285,30 @@ unsigned int createProgram(unsigned int vs, unsigned int fs) {
     
     glLinkProgram(shaderProgram);
     
-    //TODO: check if linking was ok?
+    int success;
+    char infoLog[512];
+    glGetProgramiv(shaderProgram, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(shaderProgram, 512, NULL, infoLog);
+        std::cout << "ERROR::PROGRAM::LINKING_FAILED\n" << infoLog << std::endl;
+    }
     return shaderProgram;
 }
 
+bool readFile(const std::string& path, std::string& contents) {
+    std::ifstream file(path, std::ios::in | std::ios::binary);
+    if (!file) return false;
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    contents = buffer.str();
+    return true;
+}
+
 float deltaTime = 0.0f;
 float lastTime = 0.0f;
 
-void processKeyboardInputs(GLFWwindow* window) {
+// true while a movement key is held
+bool processKeyboardInputs(GLFWwindow* window) {
     
     if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS) {
         glfwSetWindowShouldClose(window, true);
@@ -269,6 +323,8 @@ void processKeyboardInputs(GLFWwindow* window) {
         cameraPos -= glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
         cameraPos += glm::normalize(glm::cross(cameraFront, cameraUp)) * cameraSpeed;
+    return glfwGetKey(window, GLFW_KEY_W) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_S) == GLFW_PRESS ||
+           glfwGetKey(window, GLFW_KEY_A) == GLFW_PRESS || glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS;
 }
 
 #endif /* main_h */
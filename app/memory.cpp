@@ -0,0 +1,82 @@
+//
+//  memory.cpp
+//  app
+//
+
+// Global operator new/delete replacements feeding the heap counters declared in memory.h.
+// Kept in their own translation unit: replacements must be defined exactly once.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <atomic>
+#include <new>
+
+std::atomic<uint64_t> heapAllocationCount(0);
+std::atomic<uint64_t> heapAllocatedBytes(0);
+std::atomic<uint64_t> heapFreeCount(0);
+thread_local uint64_t threadAllocationCount = 0;
+thread_local uint64_t threadAllocatedBytes = 0;
+
+static void* trackedAllocate(size_t size) {
+    heapAllocationCount.fetch_add(1, std::memory_order_relaxed);
+    heapAllocatedBytes.fetch_add(size, std::memory_order_relaxed);
+    threadAllocationCount++;
+    threadAllocatedBytes += size;
+    void* p = malloc(size ? size : 1);
+    if (!p) throw std::bad_alloc();
+    return p;
+}
+
+static void trackedFree(void* p) {
+    if (!p) return;
+    heapFreeCount.fetch_add(1, std::memory_order_relaxed);
+    free(p);
+}
+
+void* operator new(size_t size) {
+    return trackedAllocate(size);
+}
+
+void* operator new[](size_t size) {
+    return trackedAllocate(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return trackedAllocate(size);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    try {
+        return trackedAllocate(size);
+    } catch (...) {
+        return NULL;
+    }
+}
+
+void operator delete(void* p) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    trackedFree(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    trackedFree(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    trackedFree(p);
+}
@@ -0,0 +1,200 @@
+//
+//  memory.h
+//  app
+//
+
+#ifndef memory_h
+#define memory_h
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <new>
+
+// Heap allocation tracking. memory.cpp replaces the global operator new/delete with versions that
+// bump these counters (relaxed atomics, cheap enough to leave on in production). Only C++
+// allocations are seen, malloc calls made by drivers or GLFW are not.
+extern std::atomic<uint64_t> heapAllocationCount;
+extern std::atomic<uint64_t> heapAllocatedBytes;
+extern std::atomic<uint64_t> heapFreeCount;
+// the same for the calling thread only
+extern thread_local uint64_t threadAllocationCount;
+extern thread_local uint64_t threadAllocatedBytes;
+
+struct AllocationSnapshot {
+    uint64_t count;
+    uint64_t bytes;
+};
+
+inline AllocationSnapshot allocationSnapshot() {
+    return { heapAllocationCount.load(std::memory_order_relaxed), heapAllocatedBytes.load(std::memory_order_relaxed) };
+}
+
+inline AllocationSnapshot threadAllocationSnapshot() {
+    return { threadAllocationCount, threadAllocatedBytes };
+}
+
+// Bump allocator. Everything allocated from it is released at once by reset() (or by rewinding to
+// a marker), individual frees are no-ops. When the block runs out, allocations spill to malloc and
+// the block grows to the high water mark on the next reset, so after a few frames a steady scene
+// stops touching the heap.
+struct LinearArena {
+    struct Overflow {
+        Overflow* next;
+    };
+
+    char* base = NULL;
+    size_t capacity = 0;
+    size_t offset = 0;
+    size_t highWater = 0;
+    size_t overflowBytes = 0;
+    Overflow* overflow = NULL;
+
+    LinearArena() {}
+    explicit LinearArena(size_t capacity) { init(capacity); }
+    ~LinearArena() {
+        releaseOverflow();
+        free(base);
+    }
+    LinearArena(const LinearArena&) = delete;
+    LinearArena& operator=(const LinearArena&) = delete;
+
+    void init(size_t bytes) {
+        free(base);
+        base = (char*) malloc(bytes);
+        capacity = base ? bytes : 0;
+        offset = 0;
+    }
+
+    void* allocate(size_t size, size_t alignment = alignof(max_align_t)) {
+        size_t aligned = (offset + alignment - 1) & ~(alignment - 1);
+        if (aligned + size <= capacity) {
+            offset = aligned + size;
+            if (offset > highWater) highWater = offset;
+            return base + aligned;
+        }
+        // spill, remembered so reset() can free it and grow the block
+        size_t header = (sizeof(Overflow) + alignment - 1) & ~(alignment - 1);
+        char* block = (char*) malloc(header + size);
+        if (!block) throw std::bad_alloc();
+        Overflow* node = (Overflow*) block;
+        node->next = overflow;
+        overflow = node;
+        overflowBytes += size + alignment;
+        return block + header;
+    }
+
+    template <typename T>
+    T* allocateArray(size_t count) {
+        return (T*) allocate(sizeof(T) * count, alignof(T));
+    }
+
+    size_t mark() const {
+        return offset;
+    }
+
+    void rewind(size_t marker) {
+        offset = marker;
+    }
+
+    void reset() {
+        if (overflow) {
+            size_t needed = highWater + overflowBytes;
+            releaseOverflow();
+            init(needed + needed / 2);
+        }
+        offset = 0;
+        highWater = 0;
+    }
+
+    void releaseOverflow() {
+        while (overflow) {
+            Overflow* next = overflow->next;
+            free(overflow);
+            overflow = next;
+        }
+        overflowBytes = 0;
+    }
+};
+
+// Reset at the top of every frame: draw lists, visible sets, transient matrices.
+LinearArena frameArena(1 << 20);
+
+// Per thread scratch memory for worker jobs, scoped with ScratchScope.
+inline LinearArena& scratchArena() {
+    thread_local LinearArena arena(256 << 10);
+    return arena;
+}
+
+// rewinds the thread's scratch arena to where it was when the scope opened
+struct ScratchScope {
+    LinearArena& arena;
+    size_t marker;
+
+    ScratchScope() : arena(scratchArena()), marker(arena.mark()) {}
+    ~ScratchScope() { arena.rewind(marker); }
+};
+
+// STL adapter so standard containers can live in an arena: std::vector<T, ArenaAllocator<T>>.
+template <typename T>
+struct ArenaAllocator {
+    typedef T value_type;
+    LinearArena* arena;
+
+    ArenaAllocator(LinearArena& arena) : arena(&arena) {}
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) : arena(other.arena) {}
+
+    T* allocate(size_t count) {
+        return arena->allocateArray<T>(count);
+    }
+    void deallocate(T*, size_t) {}
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena == b.arena;
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+    return a.arena != b.arena;
+}
+
+template <typename T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+// Per frame heap accounting for the main loop. After `warmupFrames` every frame must be
+// allocation free when `strict` is on, otherwise the process aborts with the offending count.
+// Only the thread calling beginFrame/endFrame is counted: workers allocate on their own schedule
+// (texture decodes, static batch rebuilds, shader builds) and would land in whichever frame is open.
+struct FrameAllocationGuard {
+    bool strict = false;
+    int warmupFrames = 120;
+    int frame = 0;
+    AllocationSnapshot start = { 0, 0 };
+    uint64_t lastFrameCount = 0;
+    uint64_t lastFrameBytes = 0;
+
+    void beginFrame() {
+        frameArena.reset();
+        start = threadAllocationSnapshot();
+    }
+
+    void endFrame() {
+        AllocationSnapshot end = threadAllocationSnapshot();
+        lastFrameCount = end.count - start.count;
+        lastFrameBytes = end.bytes - start.bytes;
+        frame++;
+        if (strict && frame > warmupFrames && lastFrameCount != 0) {
+            std::cout << "[memory] frame " << frame << " made " << lastFrameCount << " heap allocations ("
+                      << lastFrameBytes << " bytes) in steady state" << std::endl;
+            abort();
+        }
+    }
+};
+
+#endif /* memory_h */
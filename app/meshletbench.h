@@ -0,0 +1,142 @@
+//
+//  meshletbench.h
+//  app
+//
+
+#ifndef meshletbench_h
+#define meshletbench_h
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <chrono>
+#include <iostream>
+#include <algorithm>
+#include "memory.h"
+#include "meshlets.h"
+#include <glm/gtc/matrix_transform.hpp>
+
+// Meshlet benchmark ("--meshlet-bench"), no window needed.
+//
+// Builds meshlets for torus knots of a few sizes and reports build time, cluster fill and how many
+// triangles cluster culling keeps, from cameras orbiting the mesh and from close ups that only see
+// part of it. Fails when a meshlet breaks the size limits, triangles get lost, or a culled cluster
+// had a triangle that faces the camera inside the frustum.
+
+// true when culling `meshlet` was wrong: some front facing triangle isn't outside a frustum plane
+bool meshletWronglyCulled(const std::vector<float>& vertices, const std::vector<uint32_t>& indices, const Meshlet& meshlet,
+                          const glm::vec4 planes[6], const glm::vec3& camera) {
+    for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3) {
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; k++) {
+            p[k] = glm::vec3(vertices[indices[i + k] * 11], vertices[indices[i + k] * 11 + 1], vertices[indices[i + k] * 11 + 2]);
+        }
+        if (glm::dot(glm::cross(p[1] - p[0], p[2] - p[0]), p[0] - camera) >= 0.0f) continue;
+        bool outside = false;
+        for (int plane = 0; plane < 6 && !outside; plane++) {
+            outside = true;
+            for (int k = 0; k < 3; k++) {
+                if (glm::dot(glm::vec3(planes[plane]), p[k]) + planes[plane].w >= 0.0f) outside = false;
+            }
+        }
+        if (!outside) return true;
+    }
+    return false;
+}
+
+int runMeshletBenchmark() {
+    int failures = 0;
+    const int sizes[][2] = { { 256, 16 }, { 1024, 32 }, { 2048, 64 } };
+    for (const auto& size : sizes) {
+        std::vector<float> vertices;
+        std::vector<uint32_t> indices;
+        torusKnotMesh(size[0], size[1], vertices, indices);
+        size_t vertexCount = vertices.size() / 11;
+        ClusterCuller culler;
+        auto start = std::chrono::high_resolution_clock::now();
+        // same build the loader runs, keeping the reordered indices for the checks below
+        std::vector<uint32_t> ordered = indices;
+        std::vector<Meshlet> meshlets = buildMeshlets(vertices.data(), vertexCount, ordered);
+        double buildMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+        Mesh mesh = culler.add(vertices.data(), vertexCount, indices, false);
+        const MeshletMesh& built = culler.meshes[mesh.meshlets];
+
+        // limits, and every triangle exactly once
+        size_t uniqueVertices = 0, maxVertices = 0, maxTriangles = 0, indexSum = 0;
+        std::vector<uint32_t> seen(vertexCount, ~0u);
+        for (size_t m = 0; m < meshlets.size(); m++) {
+            size_t count = 0;
+            for (uint32_t i = meshlets[m].firstIndex; i < meshlets[m].firstIndex + meshlets[m].indexCount; i++) {
+                if (seen[ordered[i]] != m) {
+                    seen[ordered[i]] = (uint32_t) m;
+                    count++;
+                }
+            }
+            uniqueVertices += count;
+            maxVertices = count > maxVertices ? count : maxVertices;
+            maxTriangles = meshlets[m].indexCount / 3 > maxTriangles ? meshlets[m].indexCount / 3 : maxTriangles;
+            indexSum += meshlets[m].indexCount;
+        }
+        std::vector<uint64_t> before, after;
+        for (size_t i = 0; i < indices.size(); i += 3) {
+            before.push_back(((uint64_t) indices[i] << 42) ^ ((uint64_t) indices[i + 1] << 21) ^ indices[i + 2]);
+            after.push_back(((uint64_t) ordered[i] << 42) ^ ((uint64_t) ordered[i + 1] << 21) ^ ordered[i + 2]);
+        }
+        std::sort(before.begin(), before.end());
+        std::sort(after.begin(), after.end());
+        bool complete = indexSum == indices.size() && before == after;
+        bool limits = maxVertices <= (size_t) meshletMaxVertices && maxTriangles <= (size_t) meshletMaxTriangles;
+        std::cout << "[meshlets] knot " << size[0] << "x" << size[1] << ": " << indices.size() / 3 << " triangles, "
+                  << meshlets.size() << " meshlets in " << buildMilliseconds << " ms, average "
+                  << (double) uniqueVertices / meshlets.size() << " vertices / " << (double) indices.size() / 3 / meshlets.size()
+                  << " triangles, max " << maxVertices << " / " << maxTriangles << std::endl;
+        if (!limits) std::cout << "[meshlets]   FAILED: meshlet over the size limits" << std::endl;
+        if (!complete) std::cout << "[meshlets]   FAILED: triangles lost or duplicated" << std::endl;
+        failures += !limits + !complete;
+
+        // orbit: the whole knot on screen; close: a corner of it fills the view
+        glm::mat4 projection = glm::perspective(glm::radians(45.0f), 16.0f / 9.0f, 0.05f, 100.0f);
+        const char* names[] = { "orbit", "close" };
+        for (int setup = 0; setup < 2; setup++) {
+            uint64_t visible = 0, submitted = 0, ranges = 0, total = 0, wrong = 0;
+            double cullSeconds = 0.0;
+            const int views = 32;
+            for (int v = 0; v < views; v++) {
+                float angle = float(v) / views * 6.2831853f;
+                float elevation = sinf(angle * 3.0f) * 0.6f;
+                glm::vec3 direction = glm::normalize(glm::vec3(cosf(angle), elevation, sinf(angle)));
+                glm::vec3 eye = setup == 0 ? direction * 2.0f : direction * 0.55f;
+                glm::vec3 target = setup == 0 ? glm::vec3(0.0f) : direction * 0.35f + glm::vec3(0.0f, 0.0f, 0.1f);
+                glm::mat4 viewProjection = projection * glm::lookAt(eye, target, glm::vec3(0.0f, 1.0f, 0.0f));
+                frameArena.reset();
+                culler.beginFrame();
+                auto cullStart = std::chrono::high_resolution_clock::now();
+                const ClusterDraws* draws = culler.cull(mesh, glm::mat4(1.0f), viewProjection, eye);
+                cullSeconds += std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - cullStart).count();
+                visible += culler.visibleClusters;
+                submitted += culler.submittedTriangles;
+                ranges += draws->count;
+                total += culler.totalTriangles;
+
+                // every cluster not inside a kept range must be invisible
+                glm::vec4 planes[6];
+                frustumPlanes(viewProjection, planes);
+                int range = 0;
+                for (const Meshlet& meshlet : built.meshlets) {
+                    uint32_t offset = meshlet.firstIndex * sizeof(uint32_t);
+                    while (range < draws->count && (uintptr_t) draws->offsets[range] + draws->counts[range] * sizeof(uint32_t) <= offset) range++;
+                    bool kept = range < draws->count && (uintptr_t) draws->offsets[range] <= offset;
+                    if (!kept && meshletWronglyCulled(vertices, ordered, meshlet, planes, eye)) wrong++;
+                }
+            }
+            std::cout << "[meshlets]   " << names[setup] << ": " << (double) visible / views << "/" << meshlets.size()
+                      << " clusters kept, " << 100.0 * submitted / total << "% of triangles submitted in "
+                      << (double) ranges / views << " ranges, cull " << cullSeconds / views * 1e6 << " us" << std::endl;
+            if (wrong > 0) std::cout << "[meshlets]   FAILED: " << wrong << " visible clusters culled" << std::endl;
+            failures += wrong > 0;
+        }
+    }
+    return failures == 0 ? 0 : 1;
+}
+
+#endif /* meshletbench_h */
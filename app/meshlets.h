@@ -0,0 +1,403 @@
+//
+//  meshlets.h
+//  app
+//
+
+#ifndef meshlets_h
+#define meshlets_h
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include <glad/glad.h>
+#include "ecs.h"
+#include "memory.h"
+#include "resources.h"
+#include "batching.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Meshlets. Whole object culling keeps every triangle of a large mesh as long as any part of it is
+// on screen, so high-poly meshes are cut into clusters of at most meshletMaxVertices vertices and
+// meshletMaxTriangles triangles when they are loaded. Every cluster keeps a bounding sphere and a
+// cone around its face normals, and its triangles are contiguous in the mesh's index buffer.
+//
+// Each frame the camera passes test every cluster (four at a time with SSE): outside a frustum
+// plane, or facing away from the camera as a whole, and it is dropped. What survives becomes a
+// list of index ranges, neighbouring clusters merged into one, drawn with a single
+// glMultiDrawElements (GL 3.3 has neither compute nor indirect draws, the CPU list is the nearest).
+// Tests run in the mesh's local space: planes come out of viewProjection * world and the camera
+// goes through the inverse world matrix, so any affine transform works.
+//
+// There is no GL face culling in this renderer; back facing clusters of a closed mesh are only
+// ever hidden behind its front faces, dropping them just skips the rasterizer work. Depth only
+// passes from other viewpoints (shadows) draw the whole mesh.
+
+const int meshletMaxVertices = 64;
+const int meshletMaxTriangles = 124;
+
+struct Meshlet {
+    uint32_t firstIndex;
+    uint32_t indexCount;
+    glm::vec3 center;
+    float radius;
+    glm::vec3 coneAxis;
+    // sine of the cone's half angle, 1 when the normals spread too much to ever cull
+    float coneCutoff;
+};
+
+// Partitions `indices` (triangles over `vertices` in the cube layout, 11 floats each) into meshlets
+// and reorders them so every meshlet's triangles are contiguous. Greedy: a meshlet starts at the
+// first free triangle and keeps taking the free neighbour that adds the fewest new vertices, so
+// meshlets grow as compact patches.
+std::vector<Meshlet> buildMeshlets(const float* vertices, size_t vertexCount, std::vector<uint32_t>& indices) {
+    size_t triangleCount = indices.size() / 3;
+    // triangles around every vertex
+    std::vector<uint32_t> adjacencyStart(vertexCount + 1, 0);
+    for (uint32_t index : indices) adjacencyStart[index + 1]++;
+    for (size_t v = 0; v < vertexCount; v++) adjacencyStart[v + 1] += adjacencyStart[v];
+    std::vector<uint32_t> adjacency(indices.size());
+    std::vector<uint32_t> cursor(adjacencyStart.begin(), adjacencyStart.end() - 1);
+    for (size_t i = 0; i < indices.size(); i++) adjacency[cursor[indices[i]]++] = (uint32_t) (i / 3);
+
+    // face normals from the winding
+    std::vector<glm::vec3> faceNormals(triangleCount);
+    for (size_t t = 0; t < triangleCount; t++) {
+        const float* a = vertices + indices[t * 3] * 11;
+        const float* b = vertices + indices[t * 3 + 1] * 11;
+        const float* c = vertices + indices[t * 3 + 2] * 11;
+        glm::vec3 normal = glm::cross(glm::vec3(b[0] - a[0], b[1] - a[1], b[2] - a[2]), glm::vec3(c[0] - a[0], c[1] - a[1], c[2] - a[2]));
+        faceNormals[t] = glm::length(normal) > 0.0f ? glm::normalize(normal) : glm::vec3(0.0f);
+    }
+
+    std::vector<uint8_t> used(triangleCount, 0);
+    // meshlet that last took a vertex
+    std::vector<uint32_t> owner(vertexCount, ~0u);
+    std::vector<uint32_t> candidates;
+    std::vector<uint32_t> ordered;
+    ordered.reserve(indices.size());
+    std::vector<Meshlet> meshlets;
+    size_t seed = 0;
+    while (true) {
+        while (seed < triangleCount && used[seed]) seed++;
+        if (seed == triangleCount) break;
+        uint32_t id = (uint32_t) meshlets.size();
+        Meshlet meshlet;
+        meshlet.firstIndex = (uint32_t) ordered.size();
+        int meshletVertices = 0;
+        int meshletTriangles = 0;
+        candidates.clear();
+        glm::vec3 normalSum = glm::vec3(0.0f);
+        uint32_t next = (uint32_t) seed;
+        while (true) {
+            used[next] = 1;
+            meshletTriangles++;
+            normalSum += faceNormals[next];
+            for (int k = 0; k < 3; k++) {
+                uint32_t v = indices[next * 3 + k];
+                ordered.push_back(v);
+                if (owner[v] == id) continue;
+                owner[v] = id;
+                meshletVertices++;
+                for (uint32_t a = adjacencyStart[v]; a < adjacencyStart[v + 1]; a++) {
+                    if (!used[adjacency[a]]) candidates.push_back(adjacency[a]);
+                }
+            }
+            if (meshletTriangles == meshletMaxTriangles) break;
+            // ties go to the normal closest to the meshlet's average: a narrow cone is what lets the
+            // meshlet be culled as back facing. Used ones are dropped on the way.
+            glm::vec3 axis = glm::length(normalSum) > 0.0f ? glm::normalize(normalSum) : glm::vec3(0.0f);
+            int best = -1;
+            int bestNew = 4;
+            float bestDot = -2.0f;
+            size_t kept = 0;
+            for (size_t c = 0; c < candidates.size(); c++) {
+                uint32_t t = candidates[c];
+                if (used[t]) continue;
+                candidates[kept] = t;
+                int fresh = (owner[indices[t * 3]] != id) + (owner[indices[t * 3 + 1]] != id) + (owner[indices[t * 3 + 2]] != id);
+                float dot = glm::dot(axis, faceNormals[t]);
+                if (fresh < bestNew || (fresh == bestNew && dot > bestDot)) {
+                    bestNew = fresh;
+                    bestDot = dot;
+                    best = (int) kept;
+                }
+                kept++;
+            }
+            candidates.resize(kept);
+            if (best < 0 || meshletVertices + bestNew > meshletMaxVertices) break;
+            next = candidates[best];
+        }
+        meshlet.indexCount = (uint32_t) ordered.size() - meshlet.firstIndex;
+
+        // sphere around the box center
+        glm::vec3 boxMin = glm::vec3(1e30f), boxMax = glm::vec3(-1e30f);
+        for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++) {
+            glm::vec3 p = glm::vec3(vertices[ordered[i] * 11], vertices[ordered[i] * 11 + 1], vertices[ordered[i] * 11 + 2]);
+            boxMin = glm::min(boxMin, p);
+            boxMax = glm::max(boxMax, p);
+        }
+        meshlet.center = (boxMin + boxMax) * 0.5f;
+        meshlet.radius = 0.0f;
+        for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i++) {
+            glm::vec3 p = glm::vec3(vertices[ordered[i] * 11], vertices[ordered[i] * 11 + 1], vertices[ordered[i] * 11 + 2]);
+            meshlet.radius = fmaxf(meshlet.radius, glm::length(p - meshlet.center));
+        }
+        // cone from the winding's face normals, what decides back facing
+        meshlet.coneAxis = glm::vec3(0.0f, 0.0f, 1.0f);
+        meshlet.coneCutoff = 1.0f;
+        if (glm::length(normalSum) > 1e-3f) {
+            meshlet.coneAxis = glm::normalize(normalSum);
+            float minDot = 1.0f;
+            for (uint32_t i = meshlet.firstIndex; i < meshlet.firstIndex + meshlet.indexCount; i += 3) {
+                glm::vec3 p[3];
+                for (int k = 0; k < 3; k++) {
+                    p[k] = glm::vec3(vertices[ordered[i + k] * 11], vertices[ordered[i + k] * 11 + 1], vertices[ordered[i + k] * 11 + 2]);
+                }
+                glm::vec3 normal = glm::cross(p[1] - p[0], p[2] - p[0]);
+                if (glm::length(normal) > 0.0f) minDot = fminf(minDot, glm::dot(meshlet.coneAxis, glm::normalize(normal)));
+            }
+            // wider than a hemisphere (or close): some face always points at the camera
+            if (minDot > 0.05f) meshlet.coneCutoff = sqrtf(1.0f - minDot * minDot);
+        }
+        meshlets.push_back(meshlet);
+    }
+    indices.swap(ordered);
+    return meshlets;
+}
+
+// A high-poly test mesh in the cube layout: a (2, 3) torus knot that fits the unit cube, closed and
+// wound counter clockwise from outside.
+void torusKnotMesh(int tubularSegments, int radialSegments, std::vector<float>& vertices, std::vector<uint32_t>& indices) {
+    const float pi = 3.14159265f;
+    const float tube = 0.3f;
+    const float scale = 0.25f;
+    auto curve = [](float u) {
+        float quOverP = 1.5f * u;
+        float r = (2.0f + cosf(quOverP)) * 0.5f;
+        return glm::vec3(r * cosf(u), r * sinf(u), sinf(quOverP) * 0.5f);
+    };
+    for (int j = 0; j <= tubularSegments; j++) {
+        float u = float(j) / tubularSegments * 2.0f * 2.0f * pi;
+        glm::vec3 p1 = curve(u);
+        glm::vec3 p2 = curve(u + 0.01f);
+        glm::vec3 t = p2 - p1;
+        glm::vec3 n = p2 + p1;
+        glm::vec3 b = glm::normalize(glm::cross(t, n));
+        n = glm::normalize(glm::cross(b, t));
+        for (int i = 0; i <= radialSegments; i++) {
+            float v = float(i) / radialSegments * 2.0f * pi;
+            glm::vec3 position = p1 - tube * cosf(v) * n + tube * sinf(v) * b;
+            glm::vec3 normal = glm::normalize(position - p1);
+            position *= scale;
+            float vertex[11] = { position.x, position.y, position.z, 0.8f, 0.5f, 0.2f,
+                                 float(j) / tubularSegments * 16.0f, float(i) / radialSegments, normal.x, normal.y, normal.z };
+            vertices.insert(vertices.end(), vertex, vertex + 11);
+        }
+    }
+    for (int j = 1; j <= tubularSegments; j++) {
+        for (int i = 1; i <= radialSegments; i++) {
+            uint32_t a = (radialSegments + 1) * (j - 1) + (i - 1);
+            uint32_t b = (radialSegments + 1) * j + (i - 1);
+            uint32_t c = (radialSegments + 1) * j + i;
+            uint32_t d = (radialSegments + 1) * (j - 1) + i;
+            uint32_t quad[6] = { a, b, d, b, c, d };
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+    }
+}
+
+// what survived culling for one draw, as index ranges for glMultiDrawElements
+struct ClusterDraws {
+    const GLsizei* counts;
+    const void* const* offsets;
+    int count;
+};
+
+// draws the clusters a draw list entry kept, or its whole mesh when it wasn't cluster culled
+template <typename Draw>
+void drawVisible(const Draw& draw) {
+    if (draw.clusters == NULL) {
+        drawMesh(draw.mesh);
+    } else if (draw.clusters->count > 0) {
+        glMultiDrawElements(GL_TRIANGLES, draw.clusters->counts, GL_UNSIGNED_INT, draw.clusters->offsets, draw.clusters->count);
+    }
+}
+
+struct MeshletMesh {
+    std::vector<Meshlet> meshlets;
+    // cull data again, one array per field for the SSE loop
+    std::vector<float> centerX, centerY, centerZ, radius;
+    std::vector<float> axisX, axisY, axisZ, cutoff;
+    uint32_t indexCount = 0;
+
+    ResourceHandle vertexBuffer;
+    ResourceHandle positionBuffer;
+    ResourceHandle indexBuffer;
+    ResourceHandle vertexArray;
+    ResourceHandle positionArray;
+};
+
+struct ClusterCuller {
+    bool enabled = true;
+    std::vector<MeshletMesh> meshes;
+    // this frame, for stats
+    uint64_t totalClusters = 0;
+    uint64_t visibleClusters = 0;
+    uint64_t totalTriangles = 0;
+    uint64_t submittedTriangles = 0;
+    uint64_t ranges = 0;
+
+    // builds the meshlets of an indexed mesh and uploads it; without GL (benchmarks) only builds
+    Mesh add(const float* vertices, size_t vertexCount, std::vector<uint32_t> indices, bool upload = true) {
+        MeshletMesh mesh;
+        mesh.meshlets = buildMeshlets(vertices, vertexCount, indices);
+        mesh.indexCount = (uint32_t) indices.size();
+        for (const Meshlet& meshlet : mesh.meshlets) {
+            mesh.centerX.push_back(meshlet.center.x);
+            mesh.centerY.push_back(meshlet.center.y);
+            mesh.centerZ.push_back(meshlet.center.z);
+            mesh.radius.push_back(meshlet.radius);
+            mesh.axisX.push_back(meshlet.coneAxis.x);
+            mesh.axisY.push_back(meshlet.coneAxis.y);
+            mesh.axisZ.push_back(meshlet.coneAxis.z);
+            mesh.cutoff.push_back(meshlet.coneCutoff);
+        }
+        if (upload) {
+            std::vector<float> positions(vertexCount * 3);
+            for (size_t v = 0; v < vertexCount; v++) {
+                positions[v * 3] = vertices[v * 11];
+                positions[v * 3 + 1] = vertices[v * 11 + 1];
+                positions[v * 3 + 2] = vertices[v * 11 + 2];
+            }
+            mesh.vertexBuffer = GPU_CREATE(ResourceBuffer, "meshes");
+            mesh.positionBuffer = GPU_CREATE(ResourceBuffer, "meshes");
+            mesh.indexBuffer = GPU_CREATE(ResourceBuffer, "meshes");
+            mesh.vertexArray = GPU_CREATE(ResourceVertexArray, "meshes");
+            mesh.positionArray = GPU_CREATE(ResourceVertexArray, "meshes");
+            glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(mesh.vertexBuffer));
+            glBufferData(GL_ARRAY_BUFFER, vertexCount * 11 * sizeof(float), vertices, GL_STATIC_DRAW);
+            gpuResources.setBytes(mesh.vertexBuffer, vertexCount * 11 * sizeof(float));
+            glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(mesh.positionBuffer));
+            glBufferData(GL_ARRAY_BUFFER, positions.size() * sizeof(float), positions.data(), GL_STATIC_DRAW);
+            gpuResources.setBytes(mesh.positionBuffer, positions.size() * sizeof(float));
+            setupIndexedArrays(mesh.vertexArray, mesh.positionArray, mesh.vertexBuffer, mesh.positionBuffer, mesh.indexBuffer);
+            glBindVertexArray(gpuResources.name(mesh.vertexArray));
+            glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint32_t), indices.data(), GL_STATIC_DRAW);
+            gpuResources.setBytes(mesh.indexBuffer, indices.size() * sizeof(uint32_t));
+            glBindVertexArray(0);
+        }
+        meshes.push_back(std::move(mesh));
+
+        Mesh result;
+        result.vao = gpuResources.name(meshes.back().vertexArray);
+        result.positionVao = gpuResources.name(meshes.back().positionArray);
+        result.first = 0;
+        result.count = (int) meshes.back().indexCount;
+        result.indexed = true;
+        result.meshlets = (int) meshes.size() - 1;
+        return result;
+    }
+
+    void beginFrame() {
+        totalClusters = visibleClusters = totalTriangles = submittedTriangles = ranges = 0;
+    }
+
+    // Clusters of `mesh` (placed by `world`) that can be visible from cameraPosition through
+    // viewProjection, in the frame arena. NULL draws the whole mesh.
+    const ClusterDraws* cull(const Mesh& mesh, const glm::mat4& world, const glm::mat4& viewProjection, const glm::vec3& cameraPosition) {
+        if (!enabled || mesh.meshlets < 0) return NULL;
+        const MeshletMesh& source = meshes[mesh.meshlets];
+        size_t count = source.meshlets.size();
+        glm::vec4 planes[6];
+        frustumPlanes(viewProjection * world, planes);
+        // planes aren't normalized, a sphere's radius is scaled by the normal's length instead
+        float planeScale[6];
+        for (int p = 0; p < 6; p++) planeScale[p] = glm::length(glm::vec3(planes[p]));
+        glm::vec3 camera = glm::vec3(glm::inverse(world) * glm::vec4(cameraPosition, 1.0f));
+
+        GLsizei* counts = frameArena.allocateArray<GLsizei>(count);
+        const void** offsets = frameArena.allocateArray<const void*>(count);
+        int runs = 0;
+        uint32_t runEnd = ~0u;
+        auto emit = [&](size_t i) {
+            const Meshlet& meshlet = source.meshlets[i];
+            // neighbours in the index buffer join the previous range
+            if (runs > 0 && runEnd == meshlet.firstIndex) {
+                counts[runs - 1] += (GLsizei) meshlet.indexCount;
+            } else {
+                counts[runs] = (GLsizei) meshlet.indexCount;
+                offsets[runs] = (const void*) (uintptr_t) (meshlet.firstIndex * sizeof(uint32_t));
+                runs++;
+            }
+            runEnd = meshlet.firstIndex + meshlet.indexCount;
+            visibleClusters++;
+            submittedTriangles += meshlet.indexCount / 3;
+        };
+
+        size_t i = 0;
+#if defined(__SSE2__)
+        __m128 camX = _mm_set1_ps(camera.x), camY = _mm_set1_ps(camera.y), camZ = _mm_set1_ps(camera.z);
+        __m128 one = _mm_set1_ps(1.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 cx = _mm_loadu_ps(&source.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&source.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&source.centerZ[i]);
+            __m128 r = _mm_loadu_ps(&source.radius[i]);
+            __m128 visible = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++) {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].x), cx), _mm_mul_ps(_mm_set1_ps(planes[p].y), cy)),
+                                             _mm_add_ps(_mm_mul_ps(_mm_set1_ps(planes[p].z), cz), _mm_set1_ps(planes[p].w)));
+                __m128 limit = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(r, _mm_set1_ps(planeScale[p])));
+                visible = _mm_and_ps(visible, _mm_cmpge_ps(distance, limit));
+            }
+            // back facing: the whole sphere sits inside the cone's back side
+            __m128 dx = _mm_sub_ps(cx, camX), dy = _mm_sub_ps(cy, camY), dz = _mm_sub_ps(cz, camZ);
+            __m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz)));
+            __m128 along = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, _mm_loadu_ps(&source.axisX[i])), _mm_mul_ps(dy, _mm_loadu_ps(&source.axisY[i]))),
+                                      _mm_mul_ps(dz, _mm_loadu_ps(&source.axisZ[i])));
+            __m128 cutoff = _mm_loadu_ps(&source.cutoff[i]);
+            __m128 needed = _mm_add_ps(_mm_mul_ps(cutoff, length), _mm_mul_ps(r, _mm_add_ps(one, cutoff)));
+            visible = _mm_andnot_ps(_mm_cmpge_ps(along, needed), visible);
+            int mask = _mm_movemask_ps(visible);
+            for (int lane = 0; lane < 4; lane++) {
+                if (mask & (1 << lane)) emit(i + lane);
+            }
+        }
+#endif
+        for (; i < count; i++) {
+            glm::vec3 center = glm::vec3(source.centerX[i], source.centerY[i], source.centerZ[i]);
+            float r = source.radius[i];
+            bool visible = true;
+            for (int p = 0; p < 6 && visible; p++) {
+                visible = glm::dot(glm::vec3(planes[p]), center) + planes[p].w >= -r * planeScale[p];
+            }
+            glm::vec3 toCenter = center - camera;
+            float along = glm::dot(toCenter, glm::vec3(source.axisX[i], source.axisY[i], source.axisZ[i]));
+            if (along >= source.cutoff[i] * glm::length(toCenter) + r * (1.0f + source.cutoff[i])) visible = false;
+            if (visible) emit(i);
+        }
+        totalClusters += count;
+        totalTriangles += source.indexCount / 3;
+        ranges += runs;
+
+        ClusterDraws* draws = frameArena.allocateArray<ClusterDraws>(1);
+        draws->counts = counts;
+        draws->offsets = offsets;
+        draws->count = runs;
+        return draws;
+    }
+
+    void release() {
+        for (MeshletMesh& mesh : meshes) {
+            gpuResources.release(mesh.vertexArray);
+            gpuResources.release(mesh.positionArray);
+            gpuResources.release(mesh.vertexBuffer);
+            gpuResources.release(mesh.positionBuffer);
+            gpuResources.release(mesh.indexBuffer);
+        }
+    }
+};
+
+#endif /* meshlets_h */
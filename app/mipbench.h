@@ -0,0 +1,89 @@
+//
+//  mipbench.h
+//  app
+//
+
+#ifndef mipbench_h
+#define mipbench_h
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <iostream>
+#include "jobs.h"
+#include "decode.h"
+#include "decodebench.h"
+#include "assetbench.h"
+#include "mipmap.h"
+
+// Mip generation benchmark ("--mip-bench <asset dir>").
+//
+// Times box and Kaiser chains, serial and parallel, over the asset textures and a synthetic 2048x2048
+// chain link fence cut-out. Parallel output must match serial output byte for byte. For cut-outs it
+// also prints the alpha test coverage of every level with and without coverage preservation.
+
+// thin bars of opaque texels over transparent ones, the kind of cut-out that vanishes at a distance
+void fencePixels(int width, int height, std::vector<uint8_t>& pixels) {
+    syntheticPixels(width, height, 4, 7u, pixels);
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            bool bar = (x + y / 2) % 16 < 3 || (y + x / 2) % 16 < 3;
+            pixels[((size_t) y * width + x) * 4 + 3] = bar ? 255 : 0;
+        }
+    }
+}
+
+// one image; returns false when the parallel chain differs from the serial one
+bool benchmarkMipImage(const char* name, const std::vector<uint8_t>& rgba, int width, int height) {
+    int lastLevel = mipLevelCount(width, height) - 1;
+    MipSettings kaiser = mipSettingsFor(rgba.data(), (size_t) width * height, MipFilterKaiser);
+    MipSettings box = kaiser;
+    box.filter = MipFilterBox;
+    std::vector<std::vector<uint8_t>> serial, parallel;
+    double seconds[4] = {
+        timeRuns([&]() { generateMipChain(rgba.data(), width, height, box, lastLevel, false, serial); }),
+        timeRuns([&]() { generateMipChain(rgba.data(), width, height, box, lastLevel, true, parallel); }),
+        timeRuns([&]() { generateMipChain(rgba.data(), width, height, kaiser, lastLevel, false, serial); }),
+        timeRuns([&]() { generateMipChain(rgba.data(), width, height, kaiser, lastLevel, true, parallel); }),
+    };
+    const char* labels[4] = { "box serial", "box parallel", "kaiser serial", "kaiser parallel" };
+    std::cout << "[mip] " << name << ": " << width << "x" << height << ", " << lastLevel << " levels"
+              << (kaiser.alphaCutoff >= 0.0f ? ", alpha tested cut-out" : "") << std::endl;
+    double megapixels = width * height / 1e6;
+    for (int i = 0; i < 4; i++) {
+        std::cout << "[mip]   " << labels[i] << ": " << seconds[i] * 1000.0 << " ms, " << megapixels / seconds[i]
+                  << " MP/s of source, x" << seconds[0] / seconds[i] << " vs box serial" << std::endl;
+    }
+    bool ok = serial == parallel;
+    if (!ok) std::cout << "[mip]   FAILED: parallel output differs from serial" << std::endl;
+
+    if (kaiser.alphaCutoff >= 0.0f) {
+        MipSettings plain = kaiser;
+        plain.alphaCutoff = -1.0f;
+        std::vector<std::vector<uint8_t>> unpreserved;
+        generateMipChain(rgba.data(), width, height, plain, lastLevel, true, unpreserved);
+        std::cout << "[mip]   coverage at " << kaiser.alphaCutoff << ", level 0: "
+                  << alphaCoverage(rgba.data(), (size_t) width * height, kaiser.alphaCutoff) << std::endl;
+        for (int level = 1; level <= lastLevel; level++) {
+            size_t texels = (size_t) mipDimension(width, level) * mipDimension(height, level);
+            std::cout << "[mip]     level " << level << ": "
+                      << alphaCoverage(unpreserved[level - 1].data(), texels, kaiser.alphaCutoff) << " plain, "
+                      << alphaCoverage(parallel[level - 1].data(), texels, kaiser.alphaCutoff) << " preserved"
+                      << std::endl;
+        }
+    }
+    return ok;
+}
+
+int runMipBenchmark(const std::string& assetDirectory) {
+    int failures = benchmarkAssetImages("mip", assetDirectory, [](const char* asset, const DecodedImage& image) {
+        return benchmarkMipImage(asset, image.pixels, image.width, image.height);
+    });
+    std::vector<uint8_t> fence;
+    fencePixels(2048, 2048, fence);
+    if (!benchmarkMipImage("synthetic fence", fence, 2048, 2048)) failures++;
+    return failures == 0 ? 0 : 1;
+}
+
+#endif /* mipbench_h */
@@ -0,0 +1,428 @@
+//
+//  mipmap.h
+//  app
+//
+
+#ifndef mipmap_h
+#define mipmap_h
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include <functional>
+#include "jobs.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Mip chain generation on the CPU, instead of whatever glGenerateMipmap does on the driver.
+//
+// Levels are filtered in linear, premultiplied float RGBA (sRGB decoded through a table), each from
+// the one above it (level 1 converts level 0 rows as it reads them) with a separable box or Kaiser
+// windowed sinc kernel. Each output pixel is one 4 float vector (SSE2, scalar otherwise). Edges
+// mirror, like the GL_MIRRORED_REPEAT the textures sample with. Filtering premultiplied keeps
+// transparent texels' color from bleeding into visible ones.
+//
+// Alpha tested textures (cube.frag discards below 0.5) get thinner with every level of plain
+// filtering. With alphaCutoff set, each level's alpha is scaled so the fraction of texels passing
+// the test matches level 0's. The scale only goes into the 8 bit output, the next level still
+// filters the unscaled values.
+//
+// Work runs in bands of rows. With parallel set, the bands of one level are filtered while the
+// previous level's bands are converted back to 8 bit, so both spread over the job system. Levels
+// depend on each other and otherwise run in order. Only the main thread may pass parallel = true.
+
+enum MipFilter {
+    MipFilterBox,
+    MipFilterKaiser
+};
+
+struct MipSettings {
+    MipFilter filter = MipFilterKaiser;
+    // color channels hold sRGB encoded values, filtered in linear space
+    bool srgb = true;
+    // alpha test threshold whose coverage every level keeps, negative disables
+    float alphaCutoff = -1.0f;
+};
+
+int mipDimension(int size, int level) {
+    int d = size >> level;
+    return d > 0 ? d : 1;
+}
+
+int mipLevelCount(int width, int height) {
+    int largest = width > height ? width : height;
+    int levels = 1;
+    while (largest > 1) {
+        largest >>= 1;
+        levels++;
+    }
+    return levels;
+}
+
+struct SrgbTables {
+    float toLinear[256];
+    // linear value halfway (in encoded space) between code c and c + 1
+    float thresholds[255];
+    // close guess for the code of a linear value, indexed by sqrt(value) * 4095
+    uint8_t guess[4096];
+
+    SrgbTables() {
+        for (int c = 0; c < 256; c++) toLinear[c] = decode(c / 255.0f);
+        for (int c = 0; c < 255; c++) thresholds[c] = decode((c + 0.5f) / 255.0f);
+        int code = 0;
+        for (int i = 0; i < 4096; i++) {
+            float value = (i / 4095.0f) * (i / 4095.0f);
+            while (code < 255 && value >= thresholds[code]) code++;
+            guess[i] = (uint8_t) code;
+        }
+    }
+
+    static float decode(float value) {
+        return value <= 0.04045f ? value / 12.92f : powf((value + 0.055f) / 1.055f, 2.4f);
+    }
+
+    // nearest code, a guess from the table then at most a step or two
+    uint8_t encode(float linear) const {
+        if (!(linear > 0.0f)) return 0;
+        if (linear >= 1.0f) return 255;
+        return encode(linear, (int) (sqrtf(linear) * 4095.0f));
+    }
+
+    // same for a linear value in [0, 1] whose table index is already known
+    uint8_t encode(float linear, int index) const {
+        int code = guess[index];
+        while (code < 255 && linear >= thresholds[code]) code++;
+        while (code > 0 && linear < thresholds[code - 1]) code--;
+        return (uint8_t) code;
+    }
+};
+
+SrgbTables srgbTables;
+
+// Kaiser window I0 (modified Bessel function of the first kind, order 0)
+double besselI0(double x) {
+    double sum = 1.0, term = 1.0;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+        if (term < sum * 1e-12) break;
+    }
+    return sum;
+}
+
+// weights along one axis: every target texel sums `taps` source texels
+struct MipAxis {
+    int taps = 0;
+    std::vector<int> index;
+    std::vector<float> weight;
+
+    void build(MipFilter filter, int sourceSize, int targetSize) {
+        float scale = (float) sourceSize / targetSize;
+        // half width of the kernel in source texels
+        const float kaiserRadius = 2.0f, kaiserBeta = 4.0f;
+        float radius = filter == MipFilterBox ? scale * 0.5f : kaiserRadius * scale;
+        taps = (int) ceilf(radius * 2.0f) + 1;
+        index.assign((size_t) targetSize * taps, 0);
+        weight.assign((size_t) targetSize * taps, 0.0f);
+        double windowNorm = besselI0(kaiserBeta);
+        for (int i = 0; i < targetSize; i++) {
+            float center = (i + 0.5f) * scale;
+            int first = (int) floorf(center - radius);
+            float total = 0.0f;
+            for (int t = 0; t < taps; t++) {
+                int s = first + t;
+                float w;
+                if (filter == MipFilterBox) {
+                    // overlap of source texel [s, s + 1) with the box
+                    float lo = fmaxf((float) s, center - radius), hi = fminf((float) s + 1.0f, center + radius);
+                    w = hi > lo ? hi - lo : 0.0f;
+                } else {
+                    float d = (s + 0.5f - center) / scale;
+                    float r = d / kaiserRadius;
+                    if (r <= -1.0f || r >= 1.0f) {
+                        w = 0.0f;
+                    } else {
+                        float sinc = d == 0.0f ? 1.0f : sinf(3.14159265f * d) / (3.14159265f * d);
+                        w = sinc * (float) (besselI0(kaiserBeta * sqrt(1.0 - r * r)) / windowNorm);
+                    }
+                }
+                // mirrored edges
+                if (s < 0) s = -s - 1;
+                if (s >= sourceSize) s = 2 * sourceSize - s - 1;
+                s = s < 0 ? 0 : (s >= sourceSize ? sourceSize - 1 : s);
+                index[(size_t) i * taps + t] = s;
+                weight[(size_t) i * taps + t] = w;
+                total += w;
+            }
+            for (int t = 0; t < taps; t++) weight[(size_t) i * taps + t] /= total;
+        }
+        // drop trailing taps no target uses (the kernel width is rounded up above)
+        int used = 1;
+        for (int i = 0; i < targetSize; i++) {
+            for (int t = used; t < taps; t++) {
+                if (weight[(size_t) i * taps + t] != 0.0f) used = t + 1;
+            }
+        }
+        if (used < taps) {
+            for (int i = 0; i < targetSize; i++) {
+                for (int t = 0; t < used; t++) {
+                    index[(size_t) i * used + t] = index[(size_t) i * taps + t];
+                    weight[(size_t) i * used + t] = weight[(size_t) i * taps + t];
+                }
+            }
+            taps = used;
+            index.resize((size_t) targetSize * taps);
+            weight.resize((size_t) targetSize * taps);
+        }
+    }
+};
+
+// one linear RGBA texel
+#if defined(__SSE2__)
+typedef __m128 MipPixel;
+
+inline MipPixel mipZero() { return _mm_setzero_ps(); }
+inline MipPixel mipLoad(const float* p) { return _mm_loadu_ps(p); }
+inline void mipStore(float* p, MipPixel v) { _mm_storeu_ps(p, v); }
+inline MipPixel mipMulAdd(MipPixel sum, MipPixel v, float w) { return _mm_add_ps(sum, _mm_mul_ps(v, _mm_set1_ps(w))); }
+#else
+struct MipPixel {
+    float v[4];
+};
+
+inline MipPixel mipZero() { return MipPixel { { 0.0f, 0.0f, 0.0f, 0.0f } }; }
+inline MipPixel mipLoad(const float* p) { return MipPixel { { p[0], p[1], p[2], p[3] } }; }
+inline void mipStore(float* p, MipPixel v) { memcpy(p, v.v, sizeof(v.v)); }
+inline MipPixel mipMulAdd(MipPixel sum, MipPixel v, float w) {
+    for (int c = 0; c < 4; c++) sum.v[c] += v.v[c] * w;
+    return sum;
+}
+#endif
+
+// rows per band of work
+const int mipBandRows = 32;
+const int mipHistogramBins = 4096;
+
+// premultiplied linear floats from 8 bit RGBA rows [y0, y1)
+void loadMipBand(const uint8_t* rgba, int width, float* level, const MipSettings& settings, int y0, int y1) {
+    for (size_t i = (size_t) y0 * width; i < (size_t) y1 * width; i++) {
+        const uint8_t* p = rgba + i * 4;
+        float a = p[3] * (1.0f / 255.0f);
+        for (int c = 0; c < 3; c++) {
+            float value = settings.srgb ? srgbTables.toLinear[p[c]] : p[c] * (1.0f / 255.0f);
+            level[i * 4 + c] = value * a;
+        }
+        level[i * 4 + 3] = a;
+    }
+}
+
+// target rows [y0, y1) of a level from the float level above it, or straight from the 8 bit image
+// for level 1 (`source` NULL); alpha lands in `histogram` when there is one
+void filterMipBand(const float* source, const uint8_t* rgba, const MipSettings& settings, int sourceWidth,
+                   float* target, int targetWidth, const MipAxis& ax, const MipAxis& ay, int y0, int y1,
+                   uint32_t* histogram) {
+    // source rows the band reads, filtered horizontally
+    int rowMin = ay.index[(size_t) y0 * ay.taps], rowMax = rowMin;
+    for (size_t i = (size_t) y0 * ay.taps; i < (size_t) y1 * ay.taps; i++) {
+        rowMin = ay.index[i] < rowMin ? ay.index[i] : rowMin;
+        rowMax = ay.index[i] > rowMax ? ay.index[i] : rowMax;
+    }
+    std::vector<float> rows((size_t) (rowMax - rowMin + 1) * targetWidth * 4), converted(source ? 0 : sourceWidth * 4);
+    for (int row = rowMin; row <= rowMax; row++) {
+        const float* in = source + (size_t) row * sourceWidth * 4;
+        if (!source) {
+            loadMipBand(rgba + (size_t) row * sourceWidth * 4, sourceWidth, converted.data(), settings, 0, 1);
+            in = converted.data();
+        }
+        float* out = &rows[(size_t) (row - rowMin) * targetWidth * 4];
+        for (int x = 0; x < targetWidth; x++) {
+            const int* index = &ax.index[(size_t) x * ax.taps];
+            const float* weight = &ax.weight[(size_t) x * ax.taps];
+            MipPixel sum = mipZero();
+            for (int t = 0; t < ax.taps; t++) sum = mipMulAdd(sum, mipLoad(in + index[t] * 4), weight[t]);
+            mipStore(out + x * 4, sum);
+        }
+    }
+    for (int y = y0; y < y1; y++) {
+        const int* index = &ay.index[(size_t) y * ay.taps];
+        const float* weight = &ay.weight[(size_t) y * ay.taps];
+        float* out = target + (size_t) y * targetWidth * 4;
+        for (int x = 0; x < targetWidth; x++) {
+            MipPixel sum = mipZero();
+            for (int t = 0; t < ay.taps; t++) {
+                sum = mipMulAdd(sum, mipLoad(&rows[((size_t) (index[t] - rowMin) * targetWidth + x) * 4]), weight[t]);
+            }
+            mipStore(out + x * 4, sum);
+        }
+        if (histogram) {
+            for (int x = 0; x < targetWidth; x++) {
+                float a = out[x * 4 + 3];
+                int bin = (int) (a * (mipHistogramBins - 1) + 0.5f);
+                histogram[bin < 0 ? 0 : (bin >= mipHistogramBins ? mipHistogramBins - 1 : bin)]++;
+            }
+        }
+    }
+}
+
+// 8 bit RGBA rows [y0, y1) from premultiplied linear floats, alpha scaled by `alphaScale`
+void storeMipBand(const float* level, int width, uint8_t* out, const MipSettings& settings, float alphaScale, int y0,
+                  int y1) {
+#if defined(__SSE2__)
+    // unpremultiplied color and scaled alpha in one vector, the sRGB table lookups stay scalar
+    const __m128 zero = _mm_setzero_ps(), one = _mm_set1_ps(1.0f), opaqueEnough = _mm_set1_ps(1.0f / 1024.0f);
+    const __m128 colorLanes = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+    const __m128 scale = _mm_set_ps(alphaScale, 0.0f, 0.0f, 0.0f);
+    alignas(16) float values[4];
+    alignas(16) int32_t guesses[4];
+    for (size_t i = (size_t) y0 * width; i < (size_t) y1 * width; i++) {
+        __m128 p = _mm_loadu_ps(level + i * 4);
+        __m128 a = _mm_shuffle_ps(p, p, _MM_SHUFFLE(3, 3, 3, 3));
+        __m128 inverse = _mm_and_ps(_mm_div_ps(one, a), _mm_cmpgt_ps(a, opaqueEnough));
+        __m128 factor = _mm_or_ps(_mm_and_ps(inverse, colorLanes), scale);
+        __m128 v = _mm_min_ps(_mm_max_ps(_mm_mul_ps(p, factor), zero), one);
+        uint8_t* texel = out + i * 4;
+        if (settings.srgb) {
+            _mm_store_ps(values, v);
+            _mm_store_si128((__m128i*) guesses, _mm_cvttps_epi32(_mm_mul_ps(_mm_sqrt_ps(v), _mm_set1_ps(4095.0f))));
+            for (int c = 0; c < 3; c++) texel[c] = srgbTables.encode(values[c], guesses[c]);
+            texel[3] = (uint8_t) (values[3] * 255.0f + 0.5f);
+        } else {
+            __m128i bytes = _mm_cvttps_epi32(_mm_add_ps(_mm_mul_ps(v, _mm_set1_ps(255.0f)), _mm_set1_ps(0.5f)));
+            bytes = _mm_packs_epi32(bytes, bytes);
+            int32_t packed = _mm_cvtsi128_si32(_mm_packus_epi16(bytes, bytes));
+            memcpy(texel, &packed, 4);
+        }
+    }
+#else
+    for (size_t i = (size_t) y0 * width; i < (size_t) y1 * width; i++) {
+        const float* p = level + i * 4;
+        float a = p[3];
+        float inverse = a > 1.0f / 1024.0f ? 1.0f / a : 0.0f;
+        for (int c = 0; c < 3; c++) {
+            float value = p[c] * inverse;
+            value = value < 0.0f ? 0.0f : (value > 1.0f ? 1.0f : value);
+            out[i * 4 + c] = settings.srgb ? srgbTables.encode(value) : (uint8_t) (value * 255.0f + 0.5f);
+        }
+        a *= alphaScale;
+        a = a < 0.0f ? 0.0f : (a > 1.0f ? 1.0f : a);
+        out[i * 4 + 3] = (uint8_t) (a * 255.0f + 0.5f);
+    }
+#endif
+}
+
+// fraction of texels passing an alpha test at `cutoff`
+float alphaCoverage(const uint8_t* rgba, size_t texels, float cutoff) {
+    size_t passing = 0;
+    for (size_t i = 0; i < texels; i++) passing += rgba[i * 4 + 3] >= cutoff * 255.0f;
+    return texels ? (float) passing / texels : 0.0f;
+}
+
+// alpha scale that brings a level's alpha test coverage closest to `coverage`
+float coverageScale(const uint32_t* histogram, size_t texels, float cutoff, float coverage) {
+    // lowest bin that should still pass, walking down from opaque; mipHistogramBins lets none pass
+    size_t wanted = (size_t) (coverage * texels + 0.5f), passing = 0, bestError = wanted;
+    int lowest = mipHistogramBins;
+    for (int bin = mipHistogramBins - 1; bin > 0; bin--) {
+        passing += histogram[bin];
+        size_t error = passing > wanted ? passing - wanted : wanted - passing;
+        if (error < bestError) {
+            bestError = error;
+            lowest = bin;
+        }
+    }
+    // lower edge of that bin lands on the cutoff
+    return cutoff / ((lowest - 0.5f) / (mipHistogramBins - 1));
+}
+
+enum AlphaUsage {
+    AlphaOpaque,
+    // alpha mostly 0 or 255, alpha tested
+    AlphaCutout,
+    AlphaBlended
+};
+
+AlphaUsage alphaUsage(const uint8_t* rgba, size_t texels) {
+    size_t translucent = 0, binary = 0;
+    for (size_t i = 0; i < texels; i++) {
+        uint8_t a = rgba[i * 4 + 3];
+        if (a != 255) translucent++;
+        if (a == 0 || a == 255) binary++;
+    }
+    if (translucent == 0) return AlphaOpaque;
+    return binary >= texels * 9 / 10 ? AlphaCutout : AlphaBlended;
+}
+
+// Picks settings for an 8 bit RGBA image: cut-outs keep their 0.5 alpha test coverage.
+MipSettings mipSettingsFor(const uint8_t* rgba, size_t texels, MipFilter filter = MipFilterKaiser) {
+    MipSettings settings;
+    settings.filter = filter;
+    if (alphaUsage(rgba, texels) == AlphaCutout) settings.alphaCutoff = 0.5f;
+    return settings;
+}
+
+// Generates levels 1 to lastLevel of an 8 bit RGBA image, levels[i] is level i + 1.
+void generateMipChain(const uint8_t* rgba, int width, int height, const MipSettings& settings, int lastLevel,
+                      bool parallel, std::vector<std::vector<uint8_t>>& levels) {
+    levels.resize(lastLevel > 0 ? lastLevel : 0);
+    if (lastLevel <= 0) return;
+    auto run = [parallel](size_t count, const std::function<void(size_t, size_t)>& fn) {
+        if (parallel) {
+            jobs.parallelFor(count, 1, fn);
+        } else if (count > 0) {
+            fn((size_t) 0, count);
+        }
+    };
+    auto bands = [](int rows) { return (size_t) ((rows + mipBandRows - 1) / mipBandRows); };
+
+    std::vector<float> current, next;
+    bool preserve = settings.alphaCutoff >= 0.0f;
+    float coverage = preserve ? alphaCoverage(rgba, (size_t) width * height, settings.alphaCutoff) : 0.0f;
+
+    // level - 1 waits in `current` to be stored while `level` is filtered into `next`
+    float previousScale = 1.0f;
+    std::vector<uint32_t> histograms;
+    MipAxis ax, ay;
+    for (int level = 1; level <= lastLevel + 1; level++) {
+        int sourceWidth = mipDimension(width, level - 1), sourceHeight = mipDimension(height, level - 1);
+        int targetWidth = mipDimension(width, level), targetHeight = mipDimension(height, level);
+        bool filter = level <= lastLevel, store = level > 1;
+        size_t filterBands = filter ? bands(targetHeight) : 0;
+        size_t storeBands = store ? bands(sourceHeight) : 0;
+        if (filter) {
+            ax.build(settings.filter, sourceWidth, targetWidth);
+            ay.build(settings.filter, sourceHeight, targetHeight);
+            next.resize((size_t) targetWidth * targetHeight * 4);
+            levels[level - 1].resize((size_t) targetWidth * targetHeight * 4);
+            histograms.assign(preserve ? filterBands * mipHistogramBins : 0, 0);
+        }
+        run(filterBands + storeBands, [&](size_t begin, size_t end) {
+            for (size_t task = begin; task < end; task++) {
+                if (task < filterBands) {
+                    int y0 = (int) task * mipBandRows;
+                    int y1 = y0 + mipBandRows < targetHeight ? y0 + mipBandRows : targetHeight;
+                    filterMipBand(level > 1 ? current.data() : NULL, rgba, settings, sourceWidth, next.data(),
+                                  targetWidth, ax, ay, y0, y1, preserve ? &histograms[task * mipHistogramBins] : NULL);
+                } else {
+                    int y0 = (int) (task - filterBands) * mipBandRows;
+                    int y1 = y0 + mipBandRows < sourceHeight ? y0 + mipBandRows : sourceHeight;
+                    storeMipBand(current.data(), sourceWidth, levels[level - 2].data(), settings, previousScale, y0, y1);
+                }
+            }
+        });
+        if (!filter) break;
+        if (preserve) {
+            for (size_t band = 1; band < filterBands; band++) {
+                for (int bin = 0; bin < mipHistogramBins; bin++) {
+                    histograms[bin] += histograms[band * mipHistogramBins + bin];
+                }
+            }
+            previousScale = coverageScale(histograms.data(), (size_t) targetWidth * targetHeight,
+                                          settings.alphaCutoff, coverage);
+        }
+        current.swap(next);
+    }
+}
+
+#endif /* mipmap_h */
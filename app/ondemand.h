@@ -0,0 +1,174 @@
+//
+//  ondemand.h
+//  app
+//
+
+#ifndef ondemand_h
+#define ondemand_h
+
+#include <stdint.h>
+#include <time.h>
+#include <math.h>
+#include <iostream>
+#include <GLFW/glfw3.h>
+#include <glm/glm.hpp>
+
+// Render on demand ("--on-demand"). The interactive loop normally renders and swaps every vsync
+// interval. With this on it only renders when something changed since the last frame: the camera
+// (mouse or keys), the window size, a window refresh request, a program swapped in by the shader
+// reloader, or background work (texture loads, static batch rebuilds, shader builds) that will
+// change the picture once it lands. Animated content still gets a frame at animationRate, 0
+// leaves it alone until something else renders. After a change a few more frames render so the
+// temporal history and the far shadow cascades (which update in turns) catch up.
+//
+// Between frames the loop blocks in glfwWaitEventsTimeout instead of polling, until the next
+// event, animation frame or background poll; with nothing going on it still wakes every
+// pollInterval, shader files are checked for edits then.
+//
+// It also measures the process CPU time per wall second for the "[loop]" stats line, in either mode.
+struct RenderOnDemand {
+    bool enabled = false;
+    float animationRate = 30.0f;
+    int settleFrames = 8;
+    // wakeups with nothing else to wait for, and while background work is in flight
+    double pollInterval = 0.5;
+    double workInterval = 1.0 / 30.0;
+
+    // what the last frame was rendered with
+    glm::vec3 lastPosition = glm::vec3(0.0f);
+    glm::vec3 lastFront = glm::vec3(0.0f);
+    int lastWidth = -1;
+    int lastHeight = -1;
+    uint64_t lastContent = 0;
+    double lastRender = -1e9;
+    int framesToSettle = 0;
+    bool inputActive = false;
+    bool animating = false;
+    bool working = false;
+
+    // stats since the last report
+    uint64_t renderedFrames = 0;
+    uint64_t wakeups = 0;
+    clock_t reportCpu = 0;
+    double reportWall = -1.0;
+    // last report: CPU time over wall time (1 is one core busy) and frames per second
+    float cpuUsage = 0.0f;
+    float framesPerSecond = 0.0f;
+    float wakeupsPerSecond = 0.0f;
+
+    // Once per loop iteration with the current state: true when the frame should render. `content`
+    // changes whenever the picture would (shader swaps), `input` while keys are held, `work` while
+    // background work is in flight.
+    bool shouldRender(double now, const glm::vec3& position, const glm::vec3& front, int width, int height, uint64_t content,
+                      bool refresh, bool input, bool animated, bool work) {
+        wakeups++;
+        inputActive = input;
+        animating = animated;
+        working = work;
+        if (!enabled) {
+            renderedFrames++;
+            return true;
+        }
+        bool changed = refresh || input || position != lastPosition || front != lastFront || width != lastWidth ||
+                       height != lastHeight || content != lastContent;
+        lastPosition = position;
+        lastFront = front;
+        lastWidth = width;
+        lastHeight = height;
+        lastContent = content;
+        bool due;
+        if (changed) {
+            framesToSettle = settleFrames;
+            due = true;
+        } else if (framesToSettle > 0) {
+            framesToSettle--;
+            due = true;
+        } else {
+            // a millisecond early still counts, the wait timeout isn't exact
+            due = (work && now - lastRender >= workInterval - 0.001) ||
+                  (animated && animationRate > 0.0f && now - lastRender >= 1.0 / animationRate - 0.001);
+        }
+        if (!due) return false;
+        lastRender = now;
+        renderedFrames++;
+        return true;
+    }
+
+    // end of the iteration: polls events, or sleeps until there's a reason to render again
+    void waitEvents(double now) {
+        if (!enabled || inputActive || framesToSettle > 0) {
+            glfwPollEvents();
+            return;
+        }
+        double timeout = pollInterval;
+        if (working) timeout = fmin(timeout, lastRender + workInterval - now);
+        if (animating && animationRate > 0.0f) timeout = fmin(timeout, lastRender + 1.0 / animationRate - now);
+        if (timeout <= 0.0) {
+            glfwPollEvents();
+        } else {
+            glfwWaitEventsTimeout(timeout);
+        }
+    }
+
+    // refreshes cpuUsage and framesPerSecond, call about once a second
+    void report(double now) {
+        clock_t cpu = clock();
+        if (reportWall >= 0.0 && now > reportWall) {
+            double wall = now - reportWall;
+            cpuUsage = (float) (double(cpu - reportCpu) / CLOCKS_PER_SEC / wall);
+            framesPerSecond = (float) (renderedFrames / wall);
+            wakeupsPerSecond = (float) (wakeups / wall);
+        }
+        reportCpu = cpu;
+        reportWall = now;
+        renderedFrames = 0;
+        wakeups = 0;
+    }
+};
+
+// Idle CPU of both loops ("--idle-bench [seconds]"): nothing touches the window, the loop runs
+// `seconds` continuous and as long on demand, then prints frames and CPU per wall second of each.
+// Whatever the scene animates by itself keeps rendering at animationRate on demand, so
+// "--animation-rate 0" shows the floor.
+struct IdleBenchmark {
+    double seconds = 0.0;
+    // 0 continuous, 1 on demand
+    int phase = -1;
+    double phaseStart = 0.0;
+    clock_t phaseCpu = 0;
+    uint64_t frames = 0;
+    bool animated = false;
+    float cpuUsage[2] = { 0.0f, 0.0f };
+    float framesPerSecond[2] = { 0.0f, 0.0f };
+
+    void startPhase(int next, double now, RenderOnDemand& loop) {
+        phase = next;
+        loop.enabled = next == 1;
+        phaseStart = now;
+        phaseCpu = clock();
+        frames = 0;
+    }
+
+    // once per loop iteration after the wait, true when both phases are done
+    bool update(double now, bool rendered, RenderOnDemand& loop) {
+        if (phase < 0) {
+            startPhase(0, now, loop);
+            return false;
+        }
+        if (rendered) frames++;
+        animated = animated || loop.animating;
+        if (now - phaseStart < seconds) return false;
+        cpuUsage[phase] = (float) (double(clock() - phaseCpu) / CLOCKS_PER_SEC / (now - phaseStart));
+        framesPerSecond[phase] = (float) (frames / (now - phaseStart));
+        if (phase == 0) {
+            startPhase(1, now, loop);
+            return false;
+        }
+        std::cout << "[loop] idle for " << seconds << " s: continuous " << framesPerSecond[0] << " fps, cpu "
+                  << cpuUsage[0] * 100.0f << "% of a core; on demand " << framesPerSecond[1] << " fps, cpu "
+                  << cpuUsage[1] * 100.0f << "% of a core (" << (animated ? "scene animates" : "still scene") << ")" << std::endl;
+        return true;
+    }
+};
+
+#endif /* ondemand_h */
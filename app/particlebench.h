@@ -0,0 +1,71 @@
+//
+//  particlebench.h
+//  app
+//
+
+#ifndef particlebench_h
+#define particlebench_h
+
+#include <chrono>
+#include <iostream>
+#include "particles.h"
+
+// Particle benchmark ("--particle-bench [N]"). Simulates the demo fountain with N particles alive
+// (1M by default) on every backend: scalar and SSE on one thread, SSE on all job threads, and
+// transform feedback on the GPU when a GL context could be created. Reports ms per 60 Hz step,
+// particles per second and whether a step fits a 16 ms frame.
+
+void reportParticleBackend(const char* name, double seconds, int steps, size_t particles) {
+    double milliseconds = seconds * 1000.0 / steps;
+    std::cout << "[particles] " << name << ": " << milliseconds << " ms per step, "
+              << particles * steps / seconds / 1e6 << "M particles/s, "
+              << (milliseconds <= 16.0 ? "fits" : "over") << " a 16 ms frame" << std::endl;
+}
+
+int runParticleBenchmark(GLFWwindow* window, size_t particles) {
+    const int steps = 60;
+    const float dt = 1.0f / 60.0f;
+    struct { const char* name; bool simd; bool parallel; } cpuBackends[] = {
+        { "scalar, 1 thread", false, false },
+        { "sse, 1 thread", true, false },
+        { "sse, all threads", true, true },
+    };
+    std::cout << "[particles] " << particles << " particles, " << jobs.threadCount() << " threads" << std::endl;
+    for (const auto& backend : cpuBackends) {
+        ParticleSystem system;
+        system.simd = backend.simd;
+        system.parallel = backend.parallel;
+        particleFountain(system, particles);
+        system.allocate(particleCapacity(particles));
+        system.prewarm();
+        size_t live = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int step = 0; step < steps; step++) {
+            system.simulate(dt, step * dt);
+            live += system.count;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        reportParticleBackend(backend.name, seconds, steps, live / steps);
+    }
+
+    if (window == NULL) {
+        std::cout << "[particles] no GL context, skipping the transform feedback backend" << std::endl;
+        return 0;
+    }
+    ParticleSystem system;
+    particleFountain(system, particles);
+    if (!system.initSimulation(particles)) return 1;
+    // a few steps first, so driver side setup isn't timed
+    for (int step = 0; step < 5; step++) system.simulate(dt, step * dt);
+    glFinish();
+    auto start = std::chrono::steady_clock::now();
+    for (int step = 0; step < steps; step++) system.simulate(dt, step * dt);
+    glFinish();
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    reportParticleBackend("gpu transform feedback", seconds, steps, particles);
+    system.release();
+    gpuResources.flush();
+    return 0;
+}
+
+#endif /* particlebench_h */
@@ -0,0 +1,616 @@
+//
+//  particles.h
+//  app
+//
+
+#ifndef particles_h
+#define particles_h
+
+#include <stdint.h>
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "jobs.h"
+#include "shaders.h"
+#include "resources.h"
+#include <glm/gtc/type_ptr.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Particles ("--particles N").
+//
+// Emitters spawn particles into structure of arrays storage: position, velocity, age over life and
+// how fast that grows each in their own float array. The CPU backend integrates them four at a time
+// with SSE, split across the job system: gravity, drag, a divergence free swirl field standing in
+// for curl noise (sums of sines, cheap and identical on CPU and GPU) and bounces off collision
+// planes. The same pass writes the instance stream the renderer draws as camera facing quads, dead
+// particles are swapped out of both afterwards.
+//
+// GL 3.3 has no compute shaders (macOS stops at 4.1), so the GPU backend simulates with transform
+// feedback: particlesim.vert runs the same integration over a fixed pool ping-ponged between two
+// buffers and respawns dead particles at the first emitter; the renderer draws straight from the
+// pool, nothing crosses the bus per frame.
+//
+// Additive blending doesn't depend on draw order. Only alpha blending does, then the CPU backend
+// radix sorts the instances back to front each frame; the GPU backend is additive only.
+
+enum ParticleBackend {
+    ParticleCpu,
+    ParticleGpu
+};
+
+enum ParticleBlend {
+    ParticleAdditive,
+    ParticleAlpha
+};
+
+struct ParticleEmitter {
+    glm::vec3 position = glm::vec3(0.0f);
+    glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f);
+    // random offset added to the unit direction before normalizing
+    float spread = 0.35f;
+    float speed = 6.0f;
+    // particles per second and their average life, lives vary by +-25%
+    float rate = 1000.0f;
+    float life = 3.0f;
+    float pending = 0.0f;
+};
+
+// dot(normal, p) + distance >= 0 is the free side
+struct CollisionPlane {
+    glm::vec3 normal;
+    float distance;
+};
+
+const int maxCollisionPlanes = 4;
+
+// sin from a parabola plus one refinement step, about 0.001 off; scalar and SSE round the same way
+inline float particleSin(float x) {
+    x -= 6.2831853f * nearbyintf(x * 0.15915494f);
+    float y = x * (1.2732395f - 0.40528473f * fabsf(x));
+    return y + 0.225f * (y * fabsf(y) - y);
+}
+
+#if defined(__SSE2__)
+inline __m128 particleSin4(__m128 x) {
+    __m128 sign = _mm_set1_ps(-0.0f);
+    x = _mm_sub_ps(x, _mm_mul_ps(_mm_set1_ps(6.2831853f), _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.15915494f))))));
+    __m128 y = _mm_mul_ps(x, _mm_sub_ps(_mm_set1_ps(1.2732395f), _mm_mul_ps(_mm_set1_ps(0.40528473f), _mm_andnot_ps(sign, x))));
+    return _mm_add_ps(y, _mm_mul_ps(_mm_set1_ps(0.225f), _mm_sub_ps(_mm_mul_ps(y, _mm_andnot_ps(sign, y)), y)));
+}
+#endif
+
+struct ParticleSystem {
+    ParticleBackend backend = ParticleCpu;
+    ParticleBlend blend = ParticleAdditive;
+    // off runs the scalar loop, serial runs on the calling thread only (benchmark baselines)
+    bool simd = true;
+    bool parallel = true;
+
+    glm::vec3 gravity = glm::vec3(0.0f, -9.8f, 0.0f);
+    // velocity loses drag * dt of itself per step
+    float drag = 0.3f;
+    float swirlStrength = 3.0f;
+    float swirlFrequency = 0.8f;
+    float swirlSpeed = 1.5f;
+    float restitution = 0.4f;
+    std::vector<ParticleEmitter> emitters;
+    std::vector<CollisionPlane> planes;
+
+    float size = 0.03f;
+    glm::vec3 startColor = glm::vec3(1.0f, 0.7f, 0.3f);
+    glm::vec3 endColor = glm::vec3(0.3f, 0.1f, 0.6f);
+    float opacity = 0.6f;
+
+    // CPU storage
+    size_t capacity = 0;
+    size_t count = 0;
+    std::vector<float> px, py, pz, vx, vy, vz, age, ageRate;
+    // x, y, z, age per particle, what the renderer reads
+    std::vector<float> instances;
+    // back to front order for alpha blending
+    std::vector<uint32_t> sortKeys, sortIndices, sortKeysScratch, sortIndicesScratch;
+    std::vector<float> sortedInstances;
+    uint32_t random = 0x9E3779B9u;
+    float lastTime = -1.0f;
+
+    HotProgram program;
+    ResourceHandle instanceBuffer;
+    ResourceHandle vao;
+    // GPU backend: particle pool (vec4 position and age, vec4 velocity and age rate) read from one
+    // buffer and captured into the other
+    ResourceHandle simProgram;
+    ResourceHandle stateBuffers[2];
+    ResourceHandle simVaos[2];
+    ResourceHandle drawVaos[2];
+    int current = 0;
+    int simSeed = 0;
+    struct {
+        int deltaTime, gravity, dragFactor, swirlStrength, swirlFrequency, phase, planes[maxCollisionPlanes], planeCount,
+            restitution, emitterPosition, emitterDirection, emitterSpread, emitterSpeed, emitterLife, seed;
+    } simUniforms;
+    // looked up again whenever the render program is swapped in
+    struct {
+        int view, projection, size, startColor, endColor, opacity;
+    } renderUniforms;
+    // GPU backend: elapsed time of a simulation step, read once available and never waited on
+    ResourceHandle simTimer;
+    bool simTimerPending = false;
+
+    // stats; on the GPU backend simulateMilliseconds is only the CPU time to submit the step,
+    // gpuSimulateMilliseconds what the GPU took for the last one timed
+    double simulateMilliseconds = 0.0;
+    double gpuSimulateMilliseconds = 0.0;
+    double sortMilliseconds = 0.0;
+    size_t uploadBytes = 0;
+
+    float randomFloat() {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        return float(random >> 8) * (1.0f / 16777216.0f);
+    }
+
+    // CPU arrays only, enough for the benchmark
+    void allocate(size_t particles) {
+        capacity = particles;
+        count = 0;
+        std::vector<float>* arrays[] = { &px, &py, &pz, &vx, &vy, &vz, &age, &ageRate };
+        for (std::vector<float>* array : arrays) array->assign(capacity, 0.0f);
+        instances.assign(capacity * 4, 0.0f);
+        if (blend == ParticleAlpha) {
+            sortKeys.resize(capacity);
+            sortIndices.resize(capacity);
+            sortKeysScratch.resize(capacity);
+            sortIndicesScratch.resize(capacity);
+            sortedInstances.resize(capacity * 4);
+        }
+    }
+
+    bool init(ShaderReloader& reloader, size_t particles) {
+        program.vertexFile = "particle.vert";
+        program.fragmentFile = "particle.frag";
+        program.onSwap = [this](unsigned int shader) {
+            renderUniforms.view = glGetUniformLocation(shader, "view");
+            renderUniforms.projection = glGetUniformLocation(shader, "projection");
+            renderUniforms.size = glGetUniformLocation(shader, "size");
+            renderUniforms.startColor = glGetUniformLocation(shader, "startColor");
+            renderUniforms.endColor = glGetUniformLocation(shader, "endColor");
+            renderUniforms.opacity = glGetUniformLocation(shader, "opacity");
+        };
+        if (!reloader.load(program)) return false;
+        if (backend == ParticleGpu) return initSimulation(particles);
+        allocate(particles);
+        instanceBuffer = GPU_CREATE(ResourceBuffer, "particles");
+        vao = GPU_CREATE(ResourceVertexArray, "particles");
+        glBindVertexArray(gpuResources.name(vao));
+        glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(instanceBuffer));
+        glBufferData(GL_ARRAY_BUFFER, capacity * 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+        gpuResources.setBytes(instanceBuffer, capacity * 4 * sizeof(float));
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(float), (void*) 0);
+        glEnableVertexAttribArray(0);
+        glVertexAttribDivisor(0, 1);
+        glBindVertexArray(0);
+        return true;
+    }
+
+    // Transform feedback program and the pool, started with staggered negative ages so particles
+    // are born evenly over one life instead of all at once. Also used without the render program.
+    bool initSimulation(size_t particles) {
+        backend = ParticleGpu;
+        blend = ParticleAdditive;
+        capacity = particles;
+        count = particles;
+        std::string source;
+        if (emitters.empty() || !readFile(shaderDirectory + "/particlesim.vert", source)) {
+            std::cout << "[particles] no emitter or could not read particlesim.vert" << std::endl;
+            return false;
+        }
+        unsigned int vs = compileShader(GL_VERTEX_SHADER, source.c_str());
+        unsigned int programName = glCreateProgram();
+        glAttachShader(programName, vs);
+        const char* varyings[] = { "outPosition", "outVelocity" };
+        glTransformFeedbackVaryings(programName, 2, varyings, GL_INTERLEAVED_ATTRIBS);
+        glLinkProgram(programName);
+        glDeleteShader(vs);
+        int linked = 0;
+        glGetProgramiv(programName, GL_LINK_STATUS, &linked);
+        if (!linked) {
+            char infoLog[512];
+            glGetProgramInfoLog(programName, 512, NULL, infoLog);
+            std::cout << "[particles] particlesim.vert failed to link\n" << infoLog << std::endl;
+            glDeleteProgram(programName);
+            return false;
+        }
+        simProgram = GPU_ADOPT(ResourceProgram, programName, "particles");
+        simTimer = GPU_CREATE(ResourceQuery, "particles");
+        const char* names[] = { "deltaTime", "gravity", "dragFactor", "swirlStrength", "swirlFrequency", "phase" };
+        int* locations[] = { &simUniforms.deltaTime, &simUniforms.gravity, &simUniforms.dragFactor, &simUniforms.swirlStrength,
+                             &simUniforms.swirlFrequency, &simUniforms.phase };
+        for (int i = 0; i < 6; i++) *locations[i] = glGetUniformLocation(programName, names[i]);
+        for (int i = 0; i < maxCollisionPlanes; i++) {
+            std::string name = "planes[" + std::to_string(i) + "]";
+            simUniforms.planes[i] = glGetUniformLocation(programName, name.c_str());
+        }
+        simUniforms.planeCount = glGetUniformLocation(programName, "planeCount");
+        simUniforms.restitution = glGetUniformLocation(programName, "restitution");
+        simUniforms.emitterPosition = glGetUniformLocation(programName, "emitterPosition");
+        simUniforms.emitterDirection = glGetUniformLocation(programName, "emitterDirection");
+        simUniforms.emitterSpread = glGetUniformLocation(programName, "emitterSpread");
+        simUniforms.emitterSpeed = glGetUniformLocation(programName, "emitterSpeed");
+        simUniforms.emitterLife = glGetUniformLocation(programName, "emitterLife");
+        simUniforms.seed = glGetUniformLocation(programName, "seed");
+
+        const ParticleEmitter& emitter = emitters[0];
+        std::vector<float> initial(particles * 8);
+        for (size_t i = 0; i < particles; i++) {
+            float* p = &initial[i * 8];
+            p[0] = emitter.position.x;
+            p[1] = emitter.position.y;
+            p[2] = emitter.position.z;
+            p[3] = -randomFloat();
+            p[4] = p[5] = p[6] = 0.0f;
+            p[7] = 1.0f / emitter.life;
+        }
+        for (int i = 0; i < 2; i++) {
+            stateBuffers[i] = GPU_CREATE(ResourceBuffer, "particles");
+            glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(stateBuffers[i]));
+            glBufferData(GL_ARRAY_BUFFER, initial.size() * sizeof(float), initial.data(), GL_DYNAMIC_COPY);
+            gpuResources.setBytes(stateBuffers[i], initial.size() * sizeof(float));
+            simVaos[i] = GPU_CREATE(ResourceVertexArray, "particles");
+            glBindVertexArray(gpuResources.name(simVaos[i]));
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*) 0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*) (4 * sizeof(float)));
+            glEnableVertexAttribArray(1);
+            drawVaos[i] = GPU_CREATE(ResourceVertexArray, "particles");
+            glBindVertexArray(gpuResources.name(drawVaos[i]));
+            glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*) 0);
+            glEnableVertexAttribArray(0);
+            glVertexAttribDivisor(0, 1);
+        }
+        glBindVertexArray(0);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        return true;
+    }
+
+    void release() {
+        gpuResources.release(vao);
+        gpuResources.release(instanceBuffer);
+        for (int i = 0; i < 2; i++) {
+            gpuResources.release(drawVaos[i]);
+            gpuResources.release(simVaos[i]);
+            gpuResources.release(stateBuffers[i]);
+        }
+        gpuResources.release(simProgram);
+        gpuResources.release(simTimer);
+    }
+
+    // spawns enough particles with random ages that the emitters look like they ran a whole life
+    void prewarm() {
+        if (backend == ParticleGpu) return;
+        for (const ParticleEmitter& emitter : emitters) {
+            size_t spawn = std::min((size_t) (emitter.rate * emitter.life), capacity - count);
+            size_t first = count;
+            emit(emitter, spawn);
+            for (size_t i = first; i < count; i++) age[i] = randomFloat() * 0.95f;
+        }
+    }
+
+    void emit(const ParticleEmitter& emitter, size_t spawn) {
+        for (size_t n = 0; n < spawn && count < capacity; n++, count++) {
+            glm::vec3 jitter = glm::vec3(randomFloat(), randomFloat(), randomFloat()) * 2.0f - glm::vec3(1.0f);
+            glm::vec3 velocity = glm::normalize(emitter.direction + emitter.spread * jitter) * emitter.speed * (0.8f + 0.4f * randomFloat());
+            px[count] = emitter.position.x;
+            py[count] = emitter.position.y;
+            pz[count] = emitter.position.z;
+            vx[count] = velocity.x;
+            vy[count] = velocity.y;
+            vz[count] = velocity.z;
+            age[count] = 0.0f;
+            ageRate[count] = 1.0f / (emitter.life * (0.75f + 0.5f * randomFloat()));
+        }
+    }
+
+    // one step at scene time `time`, dt is what passed since the last call (0 for the first, at most
+    // 0.1 so a stall doesn't launch everything through the planes)
+    void update(float time) {
+        float dt = lastTime < 0.0f ? 0.0f : std::min(std::max(time - lastTime, 0.0f), 0.1f);
+        lastTime = time;
+        simulate(dt, time);
+    }
+
+    void simulate(float dt, float time) {
+        auto start = std::chrono::steady_clock::now();
+        if (backend == ParticleGpu) {
+            simulateGpu(dt, time);
+        } else {
+            for (ParticleEmitter& emitter : emitters) {
+                emitter.pending += emitter.rate * dt;
+                size_t spawn = (size_t) emitter.pending;
+                emitter.pending -= (float) spawn;
+                emit(emitter, spawn);
+            }
+            float phase = fmodf(time * swirlSpeed, 6.2831853f);
+            if (parallel) {
+                jobs.parallelFor(count, 16384, [this, dt, phase](size_t begin, size_t end) { integrate(begin, end, dt, phase); });
+            } else {
+                integrate(0, count, dt, phase);
+            }
+            removeDead();
+        }
+        simulateMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    void integrate(size_t begin, size_t end, float dt, float phase) {
+        float dragFactor = 1.0f / (1.0f + drag * dt);
+        float f = swirlFrequency, g = 2.1f * swirlFrequency;
+        int planeCount = std::min((int) planes.size(), maxCollisionPlanes);
+        size_t i = begin;
+#if defined(__SSE2__)
+        if (simd) {
+            __m128 zero = _mm_setzero_ps();
+            __m128 dt4 = _mm_set1_ps(dt), drag4 = _mm_set1_ps(dragFactor), strength = _mm_set1_ps(swirlStrength);
+            __m128 f4 = _mm_set1_ps(f), g4 = _mm_set1_ps(g), phase1 = _mm_set1_ps(phase), phase2 = _mm_set1_ps(2.0f * phase);
+            __m128 half = _mm_set1_ps(0.5f), bounce = _mm_set1_ps(1.0f + restitution);
+            __m128 gx = _mm_set1_ps(gravity.x), gy = _mm_set1_ps(gravity.y), gz = _mm_set1_ps(gravity.z);
+            for (; i + 4 <= end; i += 4) {
+                __m128 x = _mm_loadu_ps(&px[i]), y = _mm_loadu_ps(&py[i]), z = _mm_loadu_ps(&pz[i]);
+                __m128 u = _mm_loadu_ps(&vx[i]), v = _mm_loadu_ps(&vy[i]), w = _mm_loadu_ps(&vz[i]);
+                __m128 sx = _mm_add_ps(particleSin4(_mm_add_ps(_mm_mul_ps(f4, y), phase1)),
+                                       _mm_mul_ps(half, particleSin4(_mm_add_ps(_mm_mul_ps(g4, z), phase2))));
+                __m128 sy = _mm_add_ps(particleSin4(_mm_add_ps(_mm_mul_ps(f4, z), phase1)),
+                                       _mm_mul_ps(half, particleSin4(_mm_add_ps(_mm_mul_ps(g4, x), phase2))));
+                __m128 sz = _mm_add_ps(particleSin4(_mm_add_ps(_mm_mul_ps(f4, x), phase1)),
+                                       _mm_mul_ps(half, particleSin4(_mm_add_ps(_mm_mul_ps(g4, y), phase2))));
+                u = _mm_mul_ps(_mm_add_ps(u, _mm_mul_ps(_mm_add_ps(gx, _mm_mul_ps(sx, strength)), dt4)), drag4);
+                v = _mm_mul_ps(_mm_add_ps(v, _mm_mul_ps(_mm_add_ps(gy, _mm_mul_ps(sy, strength)), dt4)), drag4);
+                w = _mm_mul_ps(_mm_add_ps(w, _mm_mul_ps(_mm_add_ps(gz, _mm_mul_ps(sz, strength)), dt4)), drag4);
+                x = _mm_add_ps(x, _mm_mul_ps(u, dt4));
+                y = _mm_add_ps(y, _mm_mul_ps(v, dt4));
+                z = _mm_add_ps(z, _mm_mul_ps(w, dt4));
+                for (int p = 0; p < planeCount; p++) {
+                    __m128 nx = _mm_set1_ps(planes[p].normal.x), ny = _mm_set1_ps(planes[p].normal.y), nz = _mm_set1_ps(planes[p].normal.z);
+                    __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, x), _mm_mul_ps(ny, y)),
+                                          _mm_add_ps(_mm_mul_ps(nz, z), _mm_set1_ps(planes[p].distance)));
+                    // lanes behind the plane get pushed back onto it and lose their velocity into it
+                    __m128 below = _mm_cmplt_ps(d, zero);
+                    __m128 push = _mm_and_ps(below, d);
+                    x = _mm_sub_ps(x, _mm_mul_ps(nx, push));
+                    y = _mm_sub_ps(y, _mm_mul_ps(ny, push));
+                    z = _mm_sub_ps(z, _mm_mul_ps(nz, push));
+                    __m128 vn = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, u), _mm_mul_ps(ny, v)), _mm_mul_ps(nz, w));
+                    __m128 k = _mm_and_ps(_mm_and_ps(below, _mm_cmplt_ps(vn, zero)), _mm_mul_ps(bounce, vn));
+                    u = _mm_sub_ps(u, _mm_mul_ps(nx, k));
+                    v = _mm_sub_ps(v, _mm_mul_ps(ny, k));
+                    w = _mm_sub_ps(w, _mm_mul_ps(nz, k));
+                }
+                __m128 a = _mm_add_ps(_mm_loadu_ps(&age[i]), _mm_mul_ps(_mm_loadu_ps(&ageRate[i]), dt4));
+                _mm_storeu_ps(&px[i], x);
+                _mm_storeu_ps(&py[i], y);
+                _mm_storeu_ps(&pz[i], z);
+                _mm_storeu_ps(&vx[i], u);
+                _mm_storeu_ps(&vy[i], v);
+                _mm_storeu_ps(&vz[i], w);
+                _mm_storeu_ps(&age[i], a);
+                _MM_TRANSPOSE4_PS(x, y, z, a);
+                _mm_storeu_ps(&instances[i * 4], x);
+                _mm_storeu_ps(&instances[i * 4 + 4], y);
+                _mm_storeu_ps(&instances[i * 4 + 8], z);
+                _mm_storeu_ps(&instances[i * 4 + 12], a);
+            }
+        }
+#endif
+        for (; i < end; i++) {
+            float x = px[i], y = py[i], z = pz[i];
+            float sx = particleSin(f * y + phase) + 0.5f * particleSin(g * z + 2.0f * phase);
+            float sy = particleSin(f * z + phase) + 0.5f * particleSin(g * x + 2.0f * phase);
+            float sz = particleSin(f * x + phase) + 0.5f * particleSin(g * y + 2.0f * phase);
+            float u = (vx[i] + (gravity.x + sx * swirlStrength) * dt) * dragFactor;
+            float v = (vy[i] + (gravity.y + sy * swirlStrength) * dt) * dragFactor;
+            float w = (vz[i] + (gravity.z + sz * swirlStrength) * dt) * dragFactor;
+            x += u * dt;
+            y += v * dt;
+            z += w * dt;
+            for (int p = 0; p < planeCount; p++) {
+                const glm::vec3& n = planes[p].normal;
+                float d = n.x * x + n.y * y + n.z * z + planes[p].distance;
+                if (d >= 0.0f) continue;
+                x -= n.x * d;
+                y -= n.y * d;
+                z -= n.z * d;
+                float vn = n.x * u + n.y * v + n.z * w;
+                if (vn >= 0.0f) continue;
+                float k = (1.0f + restitution) * vn;
+                u -= n.x * k;
+                v -= n.y * k;
+                w -= n.z * k;
+            }
+            px[i] = x;
+            py[i] = y;
+            pz[i] = z;
+            vx[i] = u;
+            vy[i] = v;
+            vz[i] = w;
+            age[i] += ageRate[i] * dt;
+            float* instance = &instances[i * 4];
+            instance[0] = x;
+            instance[1] = y;
+            instance[2] = z;
+            instance[3] = age[i];
+        }
+    }
+
+    // swaps the last live particle into every dead one, instances included
+    void removeDead() {
+        for (size_t i = 0; i < count;) {
+            if (age[i] < 1.0f) {
+                i++;
+                continue;
+            }
+            size_t last = --count;
+            px[i] = px[last];
+            py[i] = py[last];
+            pz[i] = pz[last];
+            vx[i] = vx[last];
+            vy[i] = vy[last];
+            vz[i] = vz[last];
+            age[i] = age[last];
+            ageRate[i] = ageRate[last];
+            for (int k = 0; k < 4; k++) instances[i * 4 + k] = instances[last * 4 + k];
+        }
+    }
+
+    void simulateGpu(float dt, float time) {
+        collectSimTimer();
+        bool timing = !simTimerPending;
+        if (timing) glBeginQuery(GL_TIME_ELAPSED, gpuResources.name(simTimer));
+        const ParticleEmitter& emitter = emitters[0];
+        glUseProgram(gpuResources.name(simProgram));
+        glUniform1f(simUniforms.deltaTime, dt);
+        glUniform3f(simUniforms.gravity, gravity.x, gravity.y, gravity.z);
+        glUniform1f(simUniforms.dragFactor, 1.0f / (1.0f + drag * dt));
+        glUniform1f(simUniforms.swirlStrength, swirlStrength);
+        glUniform1f(simUniforms.swirlFrequency, swirlFrequency);
+        glUniform1f(simUniforms.phase, fmodf(time * swirlSpeed, 6.2831853f));
+        int planeCount = std::min((int) planes.size(), maxCollisionPlanes);
+        for (int i = 0; i < planeCount; i++) {
+            glUniform4f(simUniforms.planes[i], planes[i].normal.x, planes[i].normal.y, planes[i].normal.z, planes[i].distance);
+        }
+        glUniform1i(simUniforms.planeCount, planeCount);
+        glUniform1f(simUniforms.restitution, restitution);
+        glUniform3f(simUniforms.emitterPosition, emitter.position.x, emitter.position.y, emitter.position.z);
+        glUniform3f(simUniforms.emitterDirection, emitter.direction.x, emitter.direction.y, emitter.direction.z);
+        glUniform1f(simUniforms.emitterSpread, emitter.spread);
+        glUniform1f(simUniforms.emitterSpeed, emitter.speed);
+        glUniform1f(simUniforms.emitterLife, emitter.life);
+        glUniform1i(simUniforms.seed, simSeed++);
+
+        glEnable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(gpuResources.name(simVaos[current]));
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, gpuResources.name(stateBuffers[1 - current]));
+        glBeginTransformFeedback(GL_POINTS);
+        glDrawArrays(GL_POINTS, 0, (GLsizei) count);
+        glEndTransformFeedback();
+        glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+        glDisable(GL_RASTERIZER_DISCARD);
+        glBindVertexArray(0);
+        current = 1 - current;
+        if (timing) {
+            glEndQuery(GL_TIME_ELAPSED);
+            simTimerPending = true;
+        }
+    }
+
+    void collectSimTimer() {
+        if (!simTimerPending) return;
+        GLint available = 0;
+        glGetQueryObjectiv(gpuResources.name(simTimer), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(gpuResources.name(simTimer), GL_QUERY_RESULT, &nanoseconds);
+        gpuSimulateMilliseconds = nanoseconds / 1e6;
+        simTimerPending = false;
+    }
+
+    // Back to front by view depth: 32 bit keys, three 11 bit radix passes, then the instances are
+    // gathered in that order.
+    void sortBackToFront(const glm::vec3& cameraPos, const glm::vec3& forward) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < count; i++) {
+            const float* p = &instances[i * 4];
+            float depth = (p[0] - cameraPos.x) * forward.x + (p[1] - cameraPos.y) * forward.y + (p[2] - cameraPos.z) * forward.z;
+            uint32_t bits;
+            memcpy(&bits, &depth, sizeof(bits));
+            // order preserving float to uint, inverted so the farthest comes first
+            bits ^= (bits & 0x80000000u) ? 0xFFFFFFFFu : 0x80000000u;
+            sortKeys[i] = ~bits;
+            sortIndices[i] = (uint32_t) i;
+        }
+        for (int shift = 0; shift < 33; shift += 11) {
+            uint32_t histogram[2048] = { 0 };
+            for (size_t i = 0; i < count; i++) histogram[(sortKeys[i] >> shift) & 2047]++;
+            uint32_t sum = 0;
+            for (int b = 0; b < 2048; b++) {
+                uint32_t c = histogram[b];
+                histogram[b] = sum;
+                sum += c;
+            }
+            for (size_t i = 0; i < count; i++) {
+                uint32_t slot = histogram[(sortKeys[i] >> shift) & 2047]++;
+                sortKeysScratch[slot] = sortKeys[i];
+                sortIndicesScratch[slot] = sortIndices[i];
+            }
+            sortKeys.swap(sortKeysScratch);
+            sortIndices.swap(sortIndicesScratch);
+        }
+        for (size_t i = 0; i < count; i++) memcpy(&sortedInstances[i * 4], &instances[sortIndices[i] * 4], 4 * sizeof(float));
+        sortMilliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    // after the opaque geometry; depth tested, no depth writes. With temporal upsampling the scene
+    // target has a motion vector attachment, particles leave it alone.
+    void render(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& cameraPos, bool motionAttachment) {
+        if (count == 0 || program.program == 0) return;
+        unsigned int drawVao;
+        if (backend == ParticleGpu) {
+            drawVao = gpuResources.name(drawVaos[current]);
+            uploadBytes = 0;
+        } else {
+            const float* source = instances.data();
+            if (blend == ParticleAlpha) {
+                glm::vec3 forward = -glm::vec3(view[0][2], view[1][2], view[2][2]);
+                sortBackToFront(cameraPos, forward);
+                source = sortedInstances.data();
+            }
+            // orphaned first so the driver doesn't wait for last frame's draw
+            uploadBytes = count * 4 * sizeof(float);
+            glBindBuffer(GL_ARRAY_BUFFER, gpuResources.name(instanceBuffer));
+            glBufferData(GL_ARRAY_BUFFER, capacity * 4 * sizeof(float), NULL, GL_STREAM_DRAW);
+            glBufferSubData(GL_ARRAY_BUFFER, 0, uploadBytes, source);
+            drawVao = gpuResources.name(vao);
+        }
+        unsigned int shader = program.program;
+        glUseProgram(shader);
+        glUniformMatrix4fv(renderUniforms.view, 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(renderUniforms.projection, 1, GL_FALSE, glm::value_ptr(projection));
+        glUniform1f(renderUniforms.size, size);
+        glUniform3f(renderUniforms.startColor, startColor.x, startColor.y, startColor.z);
+        glUniform3f(renderUniforms.endColor, endColor.x, endColor.y, endColor.z);
+        glUniform1f(renderUniforms.opacity, opacity);
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_SRC_ALPHA, blend == ParticleAlpha ? GL_ONE_MINUS_SRC_ALPHA : GL_ONE);
+        glDepthMask(GL_FALSE);
+        if (motionAttachment) glColorMaski(1, GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        glBindVertexArray(drawVao);
+        glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei) count);
+        glBindVertexArray(0);
+        if (motionAttachment) glColorMaski(1, GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthMask(GL_TRUE);
+        glDisable(GL_BLEND);
+    }
+};
+
+// the demo scene's fountain: about `particles` alive at once in front of the cube field, bouncing off
+// the floor and a back wall
+void particleFountain(ParticleSystem& system, size_t particles) {
+    ParticleEmitter emitter;
+    emitter.position = glm::vec3(0.0f, -3.0f, -6.0f);
+    emitter.speed = 7.0f;
+    emitter.life = 3.0f;
+    emitter.rate = float(particles) / emitter.life;
+    system.emitters.push_back(emitter);
+    system.planes.push_back({ glm::vec3(0.0f, 1.0f, 0.0f), 4.0f });
+    system.planes.push_back({ glm::vec3(0.0f, 0.0f, 1.0f), 14.0f });
+}
+
+// CPU capacity for a fountain of `particles`: lives vary, so does the live count
+size_t particleCapacity(size_t particles) {
+    return particles + particles / 3;
+}
+
+#endif /* particles_h */
@@ -0,0 +1,385 @@
+//
+//  permutations.h
+//  app
+//
+
+#ifndef permutations_h
+#define permutations_h
+
+#include <stdint.h>
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <sstream>
+#include "shaders.h"
+
+// Shader permutations. A shader declares its feature switches with comment lines:
+//
+//   // feature: TEXTURE_COUNT 0 1 2     (valued switch, allowed values)
+//   // feature: ALPHA_TEST              (on/off switch)
+//
+// and branches on them with #if/#ifdef. A variant is specialized by resolving every conditional
+// that only depends on feature switches, so each variant only contains the code it runs. Variants
+// whose specialized sources are identical (a switch the program never reads) share one program,
+// keyed by a hash of that source.
+
+typedef std::map<std::string, int> ShaderFeatures;
+
+uint64_t fnv1a(const std::string& text, uint64_t hash = 14695981039346656037ull) {
+    for (unsigned char c : text) {
+        hash ^= c;
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+std::string trim(const std::string& text) {
+    size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos) return "";
+    size_t end = text.find_last_not_of(" \t\r");
+    return text.substr(begin, end - begin + 1);
+}
+
+// "feature: NAME [values...]" lines, default value of every switch is its first allowed value (0)
+std::map<std::string, std::vector<int>> parseDeclaredFeatures(const std::string& source) {
+    std::map<std::string, std::vector<int>> declared;
+    std::istringstream lines(source);
+    std::string line;
+    while (std::getline(lines, line)) {
+        size_t at = line.find("// feature:");
+        if (at == std::string::npos) continue;
+        std::istringstream words(line.substr(at + 11));
+        std::string name;
+        words >> name;
+        std::vector<int> values;
+        int value;
+        while (words >> value) values.push_back(value);
+        if (values.empty()) values = { 0, 1 };
+        declared[name] = values;
+    }
+    return declared;
+}
+
+// Evaluates a conditional over feature switches: NAME, defined(NAME), !..., NAME <op> N, joined
+// by && and ||. Returns false in `resolved` when it mentions anything that isn't a switch, the
+// directive is then left for the GLSL compiler.
+bool evaluateFeatureCondition(std::string expression, const ShaderFeatures& features,
+                              const std::map<std::string, std::vector<int>>& declared, bool& resolved) {
+    expression = trim(expression);
+    size_t orAt = expression.find("||");
+    if (orAt != std::string::npos) {
+        bool left = evaluateFeatureCondition(expression.substr(0, orAt), features, declared, resolved);
+        if (!resolved) return false;
+        return evaluateFeatureCondition(expression.substr(orAt + 2), features, declared, resolved) || left;
+    }
+    size_t andAt = expression.find("&&");
+    if (andAt != std::string::npos) {
+        bool left = evaluateFeatureCondition(expression.substr(0, andAt), features, declared, resolved);
+        if (!resolved) return false;
+        return evaluateFeatureCondition(expression.substr(andAt + 2), features, declared, resolved) && left;
+    }
+    bool negate = false;
+    while (!expression.empty() && expression[0] == '!') {
+        negate = !negate;
+        expression = trim(expression.substr(1));
+    }
+    bool definedCheck = false;
+    if (expression.compare(0, 7, "defined") == 0) {
+        definedCheck = true;
+        expression = trim(expression.substr(7));
+        if (!expression.empty() && expression[0] == '(') {
+            expression = trim(expression.substr(1, expression.find(')') - 1));
+        }
+    }
+    static const char* operators[] = { ">=", "<=", "==", "!=", ">", "<" };
+    std::string name = expression, op;
+    int operand = 0;
+    for (const char* candidate : operators) {
+        size_t at = expression.find(candidate);
+        if (at != std::string::npos) {
+            name = trim(expression.substr(0, at));
+            op = candidate;
+            operand = atoi(expression.substr(at + op.size()).c_str());
+            break;
+        }
+    }
+    if (declared.find(name) == declared.end()) {
+        resolved = false;
+        return false;
+    }
+    auto it = features.find(name);
+    int value = it == features.end() ? 0 : it->second;
+    bool result;
+    if (definedCheck || op.empty()) result = value != 0;
+    else if (op == ">=") result = value >= operand;
+    else if (op == "<=") result = value <= operand;
+    else if (op == "==") result = value == operand;
+    else if (op == "!=") result = value != operand;
+    else if (op == ">") result = value > operand;
+    else result = value < operand;
+    return negate ? !result : result;
+}
+
+// Resolves feature conditionals, drops comments and blank lines, and defines the switches the
+// remaining code still refers to by name. The result is what gets compiled and hashed.
+std::string specializeShader(const std::string& source, const ShaderFeatures& features) {
+    std::map<std::string, std::vector<int>> declared = parseDeclaredFeatures(source);
+
+    struct Branch {
+        bool resolved;   // decided here, directive is removed
+        bool active;     // current branch emits lines
+        bool taken;      // some branch of this chain was already active
+        bool parentActive;
+    };
+    std::vector<Branch> stack;
+    auto emitting = [&]() { return stack.empty() || stack.back().active; };
+
+    std::string version, body;
+    std::istringstream lines(source);
+    std::string line;
+    bool inBlockComment = false;
+    while (std::getline(lines, line)) {
+        // strip comments so they can't make otherwise identical variants hash differently
+        std::string code;
+        for (size_t i = 0; i < line.size(); i++) {
+            if (inBlockComment) {
+                if (line.compare(i, 2, "*/") == 0) { inBlockComment = false; i++; }
+                continue;
+            }
+            if (line.compare(i, 2, "/*") == 0) { inBlockComment = true; i++; continue; }
+            if (line.compare(i, 2, "//") == 0) break;
+            code += line[i];
+        }
+        code = trim(code);
+        if (code.empty()) continue;
+
+        if (code[0] == '#') {
+            std::string directive = trim(code.substr(1));
+            std::string keyword = directive.substr(0, directive.find_first_of(" \t("));
+            std::string argument = trim(directive.substr(keyword.size()));
+            if (keyword == "version") {
+                version = code;
+                continue;
+            }
+            if (keyword == "if" || keyword == "ifdef" || keyword == "ifndef") {
+                bool resolved = true;
+                std::string condition = keyword == "if" ? argument : "defined(" + argument + ")";
+                bool value = evaluateFeatureCondition(condition, features, declared, resolved);
+                if (keyword == "ifndef") value = !value;
+                bool parentActive = emitting();
+                if (resolved) {
+                    stack.push_back({ true, parentActive && value, value, parentActive });
+                } else {
+                    stack.push_back({ false, parentActive, false, parentActive });
+                    if (parentActive) body += code + "\n";
+                }
+                continue;
+            }
+            if ((keyword == "elif" || keyword == "else" || keyword == "endif") && !stack.empty()) {
+                Branch& branch = stack.back();
+                if (!branch.resolved) {
+                    if (branch.parentActive) body += code + "\n";
+                    if (keyword == "endif") stack.pop_back();
+                    continue;
+                }
+                if (keyword == "endif") {
+                    stack.pop_back();
+                } else if (keyword == "else") {
+                    branch.active = branch.parentActive && !branch.taken;
+                    branch.taken = true;
+                } else {
+                    bool resolved = true;
+                    bool value = evaluateFeatureCondition(argument, features, declared, resolved);
+                    // a non feature #elif after feature branches isn't supported, treat it as false
+                    branch.active = branch.parentActive && !branch.taken && resolved && value;
+                    branch.taken = branch.taken || (resolved && value);
+                }
+                continue;
+            }
+        }
+        if (emitting()) body += code + "\n";
+    }
+
+    std::string defines;
+    for (const auto& feature : features) {
+        if (declared.find(feature.first) == declared.end() || feature.second == 0) continue;
+        if (body.find(feature.first) == std::string::npos) continue;
+        defines += "#define " + feature.first + " " + std::to_string(feature.second) + "\n";
+    }
+    return (version.empty() ? "" : version + "\n") + defines + body;
+}
+
+struct ShaderVariant {
+    ShaderFeatures features;
+    uint64_t hash;
+    HotProgram hot;
+    int seenGeneration = 0;
+};
+
+struct ShaderPermutations {
+    std::string name;
+    ShaderReloader* reloader;
+    std::function<void(unsigned int)> onSwap;
+
+    // deque: HotPrograms are registered with the reloader by address
+    std::deque<ShaderVariant> variants;
+    std::map<uint64_t, ShaderVariant*> byHash;
+    std::map<std::string, ShaderVariant*> byKey;
+    std::map<std::string, ShaderFeatures> keyFeatures;
+    // keys waiting for a variant that is still building in the background
+    std::map<std::string, ShaderVariant*> pending;
+
+    ShaderPermutations(const std::string& name, ShaderReloader* reloader) : name(name), reloader(reloader) {}
+
+    static std::string key(const ShaderFeatures& features) {
+        std::string key;
+        for (const auto& feature : features) {
+            if (feature.second == 0) continue;
+            key += feature.first + "=" + std::to_string(feature.second) + " ";
+        }
+        return key;
+    }
+
+    bool specializedHash(const ShaderFeatures& features, uint64_t& hash) {
+        std::string vertexSource, fragmentSource;
+        if (!readFile(shaderDirectory + "/" + name + ".vert", vertexSource) ||
+            !readFile(shaderDirectory + "/" + name + ".frag", fragmentSource)) {
+            return false;
+        }
+        hash = fnv1a(specializeShader(vertexSource, features));
+        hash = fnv1a(specializeShader(fragmentSource, features), hash ^ 0xff);
+        return true;
+    }
+
+    ShaderVariant* create(const ShaderFeatures& features, uint64_t hash, bool background) {
+        variants.emplace_back();
+        ShaderVariant* variant = &variants.back();
+        variant->features = features;
+        variant->hash = hash;
+        variant->hot.vertexFile = name + ".vert";
+        variant->hot.fragmentFile = name + ".frag";
+        variant->hot.onSwap = onSwap;
+        variant->hot.transform = [features](const std::string& source) { return specializeShader(source, features); };
+        if (background) {
+            reloader->watch(variant->hot);
+        } else if (!reloader->load(variant->hot)) {
+            variants.pop_back();
+            return NULL;
+        }
+        byHash[hash] = variant;
+        return variant;
+    }
+
+    // Variant for a feature set, built synchronously the first time it's asked for. Prewarm the
+    // manifest at startup so this never compiles mid frame.
+    ShaderVariant* get(const ShaderFeatures& features) {
+        std::string k = key(features);
+        auto found = byKey.find(k);
+        if (found != byKey.end()) return found->second;
+
+        uint64_t hash;
+        if (!specializedHash(features, hash)) return NULL;
+        ShaderVariant* variant;
+        auto shared = byHash.find(hash);
+        if (shared != byHash.end()) {
+            variant = shared->second;
+        } else {
+            variant = create(features, hash, false);
+            if (!variant) return NULL;
+        }
+        byKey[k] = variant;
+        keyFeatures[k] = features;
+        return variant;
+    }
+
+    // draw time lookup of an already requested feature set, no allocation
+    ShaderVariant* lookup(const std::string& key) {
+        auto found = byKey.find(key);
+        return found == byKey.end() ? NULL : found->second;
+    }
+
+    // After a hot reload two feature sets may no longer specialize to the same source (an edit
+    // started reading a switch). Re-key everything; new variants build in the background and
+    // keys keep drawing with their old variant until the new one is ready.
+    void update() {
+        bool reloaded = false;
+        for (ShaderVariant& variant : variants) {
+            if (variant.seenGeneration != 0 && variant.hot.generation != variant.seenGeneration) reloaded = true;
+            if (variant.hot.generation != 0) variant.seenGeneration = variant.hot.generation;
+        }
+        if (reloaded) {
+            byHash.clear();
+            for (ShaderVariant& variant : variants) {
+                if (specializedHash(variant.features, variant.hash) && !byHash.count(variant.hash)) {
+                    byHash[variant.hash] = &variant;
+                }
+            }
+            for (auto& entry : byKey) {
+                uint64_t hash;
+                if (!specializedHash(keyFeatures[entry.first], hash)) continue;
+                if (hash == entry.second->hash) {
+                    pending.erase(entry.first);
+                    continue;
+                }
+                auto shared = byHash.find(hash);
+                ShaderVariant* wanted = shared != byHash.end() ? shared->second
+                                                               : create(keyFeatures[entry.first], hash, true);
+                if (wanted) pending[entry.first] = wanted;
+            }
+        }
+        for (auto it = pending.begin(); it != pending.end();) {
+            if (it->second->hot.program != 0) {
+                byKey[it->first] = it->second;
+                it = pending.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // manifest lines: "<program> FEATURE[=value] ...", '#' starts a comment
+    int prewarm(const std::string& manifestPath) {
+        std::string manifest;
+        if (!readFile(manifestPath, manifest)) {
+            std::cout << "[shaders] no variant manifest at " << manifestPath << std::endl;
+            return 0;
+        }
+        std::istringstream lines(manifest);
+        std::string line;
+        int requested = 0;
+        while (std::getline(lines, line)) {
+            line = trim(line.substr(0, line.find('#')));
+            std::istringstream words(line);
+            std::string program, word;
+            if (!(words >> program) || program != name) continue;
+            ShaderFeatures features;
+            while (words >> word) {
+                size_t equals = word.find('=');
+                if (equals == std::string::npos) features[word] = 1;
+                else features[word.substr(0, equals)] = atoi(word.substr(equals + 1).c_str());
+            }
+            if (get(features)) requested++;
+        }
+        std::cout << "[shaders] " << name << ": " << requested << " variants requested, "
+                  << variants.size() << " programs compiled" << std::endl;
+        return requested;
+    }
+};
+
+// What a draw needs from its surface: the feature set picks the shader variant, `textures` are
+// bound to units 0 and 1 (texture1, texture2).
+struct Material {
+    ShaderFeatures features;
+    // TextureStreamer ids
+    int textures[2] = { 0, 0 };
+    std::string key;
+    // discards fragments, can't take part in depth only passes
+    bool alphaTested;
+
+    Material(const ShaderFeatures& features)
+        : features(features), key(ShaderPermutations::key(features)),
+          alphaTested(features.count("ALPHA_TEST") && features.at("ALPHA_TEST") != 0) {}
+};
+
+#endif /* permutations_h */
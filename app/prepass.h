@@ -0,0 +1,147 @@
+//
+//  prepass.h
+//  app
+//
+
+#ifndef prepass_h
+#define prepass_h
+
+#include <stdint.h>
+#include "shaders.h"
+#include "hierarchy.h"
+#include "meshlets.h"
+#include <glm/gtc/type_ptr.hpp>
+
+// Optional depth only prepass. Opaque geometry is first drawn with color writes off through a
+// position only vertex stream, then shaded with GL_EQUAL and depth writes off, so every pixel runs
+// the expensive fragment shader once.
+//
+// It only pays off when there is enough overdraw, so in auto mode it's measured: with the prepass
+// on, samples passed in the prepass (the fragments a normal pass would have shaded, same draw
+// order) are divided by samples passed in the shading pass (visible pixels). While off, a probe
+// frame with the prepass on runs every probeInterval frames to keep the number fresh. Queries are
+// read back a frame or more later, only when ready.
+//
+// depth.vert must compute gl_Position with exactly the same expression as cube.vert, both declare
+// it invariant, or GL_EQUAL drops pixels.
+
+enum PrepassMode {
+    PrepassAuto,
+    PrepassOn,
+    PrepassOff
+};
+
+struct DepthPrepass {
+    PrepassMode mode = PrepassAuto;
+    HotProgram program;
+    // turn on above enableOverdraw, back off below disableOverdraw
+    float enableOverdraw = 1.5f;
+    float disableOverdraw = 1.2f;
+    int probeInterval = 60;
+
+    // prepass runs this frame
+    bool active = false;
+    bool enabled = false;
+    // smoothed shaded fragments per visible pixel without a prepass, 0 until measured
+    float overdraw = 0.0f;
+    uint64_t frame = 0;
+
+    ResourceHandle depthQuery;
+    ResourceHandle shadeQuery;
+    bool queryPending = false;
+    bool measuring = false;
+
+    bool init(ShaderReloader& reloader) {
+        program.vertexFile = "depth.vert";
+        program.fragmentFile = "shadow.frag";
+        program.onSwap = [](unsigned int program) {
+            glUniform1i(glGetUniformLocation(program, "modelMatrices"), 2);
+        };
+        if (!reloader.load(program)) return false;
+        depthQuery = GPU_CREATE(ResourceQuery, "prepass");
+        shadeQuery = GPU_CREATE(ResourceQuery, "prepass");
+        return true;
+    }
+
+    void release() {
+        gpuResources.release(depthQuery);
+        gpuResources.release(shadeQuery);
+    }
+
+    // decides whether this frame gets a prepass
+    void beginFrame() {
+        frame++;
+        collect();
+        if (mode == PrepassAuto && overdraw > 0.0f) {
+            if (!enabled && overdraw > enableOverdraw) enabled = true;
+            if (enabled && overdraw < disableOverdraw) enabled = false;
+        }
+        bool probe = mode == PrepassAuto && (overdraw == 0.0f || frame % probeInterval == 0);
+        active = program.program != 0 &&
+                 (mode == PrepassOn || (mode == PrepassAuto && (enabled || probe)));
+        measuring = active && !queryPending;
+    }
+
+    void collect() {
+        if (!queryPending) return;
+        GLint available = 0;
+        glGetQueryObjectiv(gpuResources.name(shadeQuery), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        GLuint64 depthSamples = 0, shadeSamples = 0;
+        glGetQueryObjectui64v(gpuResources.name(depthQuery), GL_QUERY_RESULT, &depthSamples);
+        glGetQueryObjectui64v(gpuResources.name(shadeQuery), GL_QUERY_RESULT, &shadeSamples);
+        queryPending = false;
+        if (shadeSamples == 0) return;
+        float measured = float(depthSamples) / float(shadeSamples);
+        overdraw = overdraw == 0.0f ? measured : overdraw * 0.8f + measured * 0.2f;
+    }
+
+    // Lays down depth for the draws `occluder` accepts. Each draw needs a `mesh` with a
+    // positionVao, a hierarchy `slot` and the `clusters` culling kept (NULL for all).
+    template <typename Draws, typename Occluder>
+    void render(const Draws& draws, const Occluder& occluder, const glm::mat4& view, const glm::mat4& projection) {
+        if (!active) return;
+        glUseProgram(program.program);
+        glUniformMatrix4fv(glGetUniformLocation(program.program, "view"), 1, GL_FALSE, glm::value_ptr(view));
+        glUniformMatrix4fv(glGetUniformLocation(program.program, "projection"), 1, GL_FALSE, glm::value_ptr(projection));
+        int modelIndexLoc = glGetUniformLocation(program.program, "modelIndex");
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        if (measuring) glBeginQuery(GL_SAMPLES_PASSED, gpuResources.name(depthQuery));
+        unsigned int boundVao = 0;
+        for (const auto& draw : draws) {
+            if (!occluder(draw)) continue;
+            if (draw.mesh.positionVao != boundVao) {
+                boundVao = draw.mesh.positionVao;
+                glBindVertexArray(boundVao);
+            }
+            glUniform1i(modelIndexLoc, (int) draw.slot);
+            drawVisible(draw);
+        }
+        if (measuring) glEndQuery(GL_SAMPLES_PASSED);
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    }
+
+    // wraps the shading pass so its visible samples get counted
+    void beginShading() {
+        if (measuring) glBeginQuery(GL_SAMPLES_PASSED, gpuResources.name(shadeQuery));
+    }
+
+    void endShading() {
+        if (measuring) {
+            glEndQuery(GL_SAMPLES_PASSED);
+            queryPending = true;
+        }
+        glDepthFunc(GL_LESS);
+        glDepthMask(GL_TRUE);
+    }
+
+    // depth state for a material in the shading pass; materials kept out of the prepass (alpha
+    // tested) test and write depth as usual
+    void setDepthState(bool prepassed) {
+        bool equal = active && prepassed;
+        glDepthFunc(equal ? GL_EQUAL : GL_LESS);
+        glDepthMask(equal ? GL_FALSE : GL_TRUE);
+    }
+};
+
+#endif /* prepass_h */
@@ -0,0 +1,531 @@
+//
+//  raycast.h
+//  app
+//
+
+#ifndef raycast_h
+#define raycast_h
+
+#include <stdint.h>
+#include <math.h>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <algorithm>
+#include "jobs.h"
+#include "collision.h"
+#include <glm/glm.hpp>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Ray queries against the bodies of a CollisionWorld (the scene's boxes), for picking and
+// visibility.
+//
+// A bounding volume hierarchy over the bodies' tight boxes, split with the surface area heuristic
+// over 16 centroid bins per axis. The top levels are split on the main thread with the binning
+// spread over the workers; once subtrees are small enough they are built whole, one per job.
+//
+// When bodies move the node boxes are refitted bottom up instead of rebuilding. Refitting keeps
+// the topology, so the tree gets worse as things drift apart; its SAH cost is tracked and once it
+// reaches rebuildRatio times the cost right after the build, the tree is built again.
+//
+// Rays go in batches (nearest hit or any hit), in packets of four that traverse the tree together
+// with SSE: a node is entered when any ray of the packet hits it, so neighbouring rays (a screen
+// tile, shadow rays of one) share most of the work.
+
+struct Ray {
+    glm::vec3 origin;
+    glm::vec3 direction;
+    float tMax;
+};
+
+struct RayHit {
+    // noBody on a miss
+    uint32_t body;
+    float t;
+};
+
+struct BvhNode {
+    glm::vec3 min;
+    // first index of a leaf, left child of an inner node (the right one follows it)
+    uint32_t start;
+    glm::vec3 max;
+    // bodies in a leaf, 0 for inner nodes; those keep the axis they were split along
+    uint32_t count : 30;
+    uint32_t axis : 2;
+};
+
+const int bvhBins = 16;
+const int bvhMaxDepth = 64;
+// direction components closer to zero than this are clamped, keeps 1/d finite
+const float rayMinDirection = 1e-12f;
+
+struct BvhBins {
+    Aabb box[3][bvhBins];
+    uint32_t count[3][bvhBins];
+};
+
+inline Aabb emptyAabb() {
+    return { glm::vec3(1e30f), glm::vec3(-1e30f) };
+}
+
+// where the ray enters the body's oriented box, 0 when it starts inside; false when it misses it
+// or enters beyond tMax. Same arithmetic as the packet version, lane for lane.
+inline bool rayHitsShape(const CollisionShape& shape, const glm::vec3& origin, const glm::vec3& direction, float tMax, float& t) {
+    float tNear = 0.0f, tFar = tMax;
+    float ox = origin.x - shape.center[0], oy = origin.y - shape.center[1], oz = origin.z - shape.center[2];
+    for (int i = 0; i < 3; i++) {
+        const float* axis = shape.axis[i];
+        float o = ox * axis[0] + oy * axis[1] + oz * axis[2];
+        float d = direction.x * axis[0] + direction.y * axis[1] + direction.z * axis[2];
+        if (fabsf(d) < rayMinDirection) d = rayMinDirection;
+        float inverse = 1.0f / d;
+        float t0 = (-shape.extent[i] - o) * inverse, t1 = (shape.extent[i] - o) * inverse;
+        tNear = std::max(tNear, std::min(t0, t1));
+        tFar = std::min(tFar, std::max(t0, t1));
+    }
+    t = tNear;
+    return tNear <= tFar;
+}
+
+inline glm::vec3 rayInverse(const glm::vec3& direction) {
+    glm::vec3 inverse;
+    for (int k = 0; k < 3; k++) inverse[k] = 1.0f / (fabsf(direction[k]) < rayMinDirection ? rayMinDirection : direction[k]);
+    return inverse;
+}
+
+struct RayBvh {
+    int maxLeafSize = 8;
+    float rebuildRatio = 1.5f;
+    // packet traversal with SSE, single rays otherwise
+    bool packets = true;
+
+    // nodes are preallocated for the worst case, nodeCount are in use; children always come after
+    // their parent
+    std::vector<BvhNode> nodes;
+    std::atomic<uint32_t> nodeCount;
+    std::vector<uint32_t> indices;
+    std::vector<glm::vec3> centroids;
+    const CollisionWorld* source = NULL;
+    size_t builtSize = 0;
+    uint64_t builtSceneVersion = 0;
+    uint64_t seenMoveVersion = 0;
+    std::atomic<int> depth;
+
+    // scratch for the parallel top level splits
+    std::vector<Aabb> partBoxes;
+    std::vector<Aabb> partCentroids;
+    std::vector<BvhBins> partBins;
+
+    // SAH cost right after the last build and now
+    float builtCost = 0.0f;
+    float cost = 0.0f;
+    double buildMilliseconds = 0.0;
+    double refitMilliseconds = 0.0;
+    uint64_t builds = 0;
+    uint64_t refits = 0;
+
+    RayBvh() : nodeCount(0), depth(0) {}
+
+    int binOf(float centroid, float low, float scale) const {
+        return std::min(bvhBins - 1, std::max(0, (int) ((centroid - low) * scale)));
+    }
+
+    void measure(uint32_t begin, uint32_t end, Aabb& box, Aabb& centroidBox) const {
+        box = emptyAabb();
+        centroidBox = emptyAabb();
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t body = indices[i];
+            box = aabbMerge(box, source->tightBox(body));
+            centroidBox.min = glm::min(centroidBox.min, centroids[body]);
+            centroidBox.max = glm::max(centroidBox.max, centroids[body]);
+        }
+    }
+
+    void bin(uint32_t begin, uint32_t end, const Aabb& centroidBox, BvhBins& bins) const {
+        for (int axis = 0; axis < 3; axis++) {
+            for (int b = 0; b < bvhBins; b++) {
+                bins.box[axis][b] = emptyAabb();
+                bins.count[axis][b] = 0;
+            }
+        }
+        glm::vec3 extent = centroidBox.max - centroidBox.min;
+        for (uint32_t i = begin; i < end; i++) {
+            uint32_t body = indices[i];
+            Aabb box = source->tightBox(body);
+            for (int axis = 0; axis < 3; axis++) {
+                if (extent[axis] <= 0.0f) continue;
+                int b = binOf(centroids[body][axis], centroidBox.min[axis], bvhBins / extent[axis]);
+                bins.box[axis][b] = aabbMerge(bins.box[axis][b], box);
+                bins.count[axis][b]++;
+            }
+        }
+    }
+
+    // Sets the node's box and splits it in two, or leaves it a leaf (false). `parallel` spreads the
+    // passes over the bodies across the workers, main thread only.
+    bool split(uint32_t index, int level, bool parallel) {
+        BvhNode& node = nodes[index];
+        uint32_t first = node.start, count = node.count;
+        const uint32_t chunkSize = 16384;
+        uint32_t chunks = parallel ? (count + chunkSize - 1) / chunkSize : 1;
+        Aabb box, centroidBox;
+        if (chunks > 1) {
+            partBoxes.resize(chunks);
+            partCentroids.resize(chunks);
+            jobs.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    measure(first + (uint32_t) c * chunkSize, std::min(first + count, first + (uint32_t) (c + 1) * chunkSize), partBoxes[c], partCentroids[c]);
+                }
+            });
+            box = emptyAabb();
+            centroidBox = emptyAabb();
+            for (uint32_t c = 0; c < chunks; c++) {
+                box = aabbMerge(box, partBoxes[c]);
+                centroidBox = aabbMerge(centroidBox, partCentroids[c]);
+            }
+        } else {
+            measure(first, first + count, box, centroidBox);
+        }
+        node.min = box.min;
+        node.max = box.max;
+        node.axis = 0;
+        int seen = depth.load();
+        while (level > seen && !depth.compare_exchange_weak(seen, level)) {}
+        if (count <= 1 || level >= bvhMaxDepth - 1) return false;
+
+        BvhBins bins;
+        if (chunks > 1) {
+            partBins.resize(chunks);
+            jobs.parallelFor(chunks, 1, [&](size_t begin, size_t end) {
+                for (size_t c = begin; c < end; c++) {
+                    bin(first + (uint32_t) c * chunkSize, std::min(first + count, first + (uint32_t) (c + 1) * chunkSize), centroidBox, partBins[c]);
+                }
+            });
+            bins = partBins[0];
+            for (uint32_t c = 1; c < chunks; c++) {
+                for (int axis = 0; axis < 3; axis++) {
+                    for (int b = 0; b < bvhBins; b++) {
+                        bins.box[axis][b] = aabbMerge(bins.box[axis][b], partBins[c].box[axis][b]);
+                        bins.count[axis][b] += partBins[c].count[axis][b];
+                    }
+                }
+            }
+        } else {
+            bin(first, first + count, centroidBox, bins);
+        }
+
+        // cheapest plane between two bins: left and right areas times their body counts
+        glm::vec3 extent = centroidBox.max - centroidBox.min;
+        float bestCost = 1e30f;
+        int bestAxis = -1, bestPlane = 0;
+        for (int axis = 0; axis < 3; axis++) {
+            if (extent[axis] <= 0.0f) continue;
+            float rightCost[bvhBins];
+            Aabb right = emptyAabb();
+            uint32_t rightCount = 0;
+            for (int b = bvhBins - 1; b > 0; b--) {
+                right = aabbMerge(right, bins.box[axis][b]);
+                rightCount += bins.count[axis][b];
+                rightCost[b] = rightCount > 0 ? rightCount * aabbArea(right) : 0.0f;
+            }
+            Aabb left = emptyAabb();
+            uint32_t leftCount = 0;
+            for (int plane = 1; plane < bvhBins; plane++) {
+                left = aabbMerge(left, bins.box[axis][plane - 1]);
+                leftCount += bins.count[axis][plane - 1];
+                if (leftCount == 0 || leftCount == count) continue;
+                float planeCost = leftCount * aabbArea(left) + rightCost[plane];
+                if (planeCost < bestCost) {
+                    bestCost = planeCost;
+                    bestAxis = axis;
+                    bestPlane = plane;
+                }
+            }
+        }
+
+        uint32_t leftCount;
+        if (bestAxis < 0) {
+            // all centroids in one spot: halves by index if it's too big for a leaf
+            if (count <= (uint32_t) maxLeafSize) return false;
+            bestAxis = 0;
+            leftCount = count / 2;
+        } else {
+            // one traversal step costs about one box test
+            float area = aabbArea(box);
+            if (count <= (uint32_t) maxLeafSize && area + bestCost >= count * area) return false;
+            float low = centroidBox.min[bestAxis], scale = bvhBins / extent[bestAxis];
+            uint32_t* begin = indices.data() + first;
+            uint32_t* middle = std::partition(begin, begin + count, [&](uint32_t body) {
+                return binOf(centroids[body][bestAxis], low, scale) < bestPlane;
+            });
+            leftCount = (uint32_t) (middle - begin);
+        }
+
+        uint32_t child = nodeCount.fetch_add(2);
+        nodes[child].start = first;
+        nodes[child].count = leftCount;
+        nodes[child + 1].start = first + leftCount;
+        nodes[child + 1].count = count - leftCount;
+        node.start = child;
+        node.count = 0;
+        node.axis = bestAxis;
+        return true;
+    }
+
+    void buildSubtree(uint32_t index, int level) {
+        if (!split(index, level, false)) return;
+        uint32_t child = nodes[index].start;
+        buildSubtree(child, level + 1);
+        buildSubtree(child + 1, level + 1);
+    }
+
+    void build(const CollisionWorld& world) {
+        auto start = std::chrono::high_resolution_clock::now();
+        source = &world;
+        uint32_t count = (uint32_t) world.size();
+        indices.resize(count);
+        centroids.resize(count);
+        jobs.parallelFor(count, 16384, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                indices[i] = (uint32_t) i;
+                centroids[i] = (glm::vec3(world.tightMin[i]) + glm::vec3(world.tightMax[i])) * 0.5f;
+            }
+        });
+        nodes.resize(std::max(1u, 2 * count));
+        nodes[0].start = 0;
+        nodes[0].count = count;
+        nodeCount = 1;
+        depth = 0;
+        if (count == 0) {
+            nodes[0].min = nodes[0].max = glm::vec3(0.0f);
+        } else {
+            // top levels here, subtrees below handOff bodies are built whole on the workers
+            uint32_t handOff = std::max(4096u, count / (uint32_t) (8 * jobs.threadCount()));
+            std::vector<std::pair<uint32_t, int>> pending(1, std::make_pair(0u, 0));
+            std::vector<std::pair<uint32_t, int>> subtrees;
+            while (!pending.empty()) {
+                std::pair<uint32_t, int> next = pending.back();
+                pending.pop_back();
+                if (nodes[next.first].count <= handOff) {
+                    subtrees.push_back(next);
+                } else if (split(next.first, next.second, true)) {
+                    uint32_t child = nodes[next.first].start;
+                    pending.push_back(std::make_pair(child, next.second + 1));
+                    pending.push_back(std::make_pair(child + 1, next.second + 1));
+                }
+            }
+            jobs.parallelFor(subtrees.size(), 1, [&](size_t begin, size_t end) {
+                for (size_t s = begin; s < end; s++) buildSubtree(subtrees[s].first, subtrees[s].second);
+            });
+        }
+        builtSize = world.size();
+        builtSceneVersion = world.sceneVersion;
+        seenMoveVersion = world.moveVersion;
+        builtCost = cost = sahCost();
+        builds++;
+        buildMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    // expected box tests per ray, relative to the root's area
+    float sahCost() const {
+        uint32_t used = nodeCount.load();
+        float rootArea = aabbArea({ nodes[0].min, nodes[0].max });
+        if (used == 0 || rootArea <= 0.0f) return 0.0f;
+        double total = 0.0;
+        for (uint32_t i = 0; i < used; i++) {
+            total += aabbArea({ nodes[i].min, nodes[i].max }) * (nodes[i].count > 0 ? nodes[i].count : 1);
+        }
+        return (float) (total / rootArea);
+    }
+
+    // leaf boxes from their bodies in parallel, then the inner nodes from the bottom up
+    void refit() {
+        auto start = std::chrono::high_resolution_clock::now();
+        uint32_t used = nodeCount.load();
+        jobs.parallelFor(used, 4096, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; i++) {
+                BvhNode& node = nodes[i];
+                if (node.count == 0) continue;
+                Aabb box = emptyAabb();
+                for (uint32_t k = node.start; k < node.start + node.count; k++) box = aabbMerge(box, source->tightBox(indices[k]));
+                node.min = box.min;
+                node.max = box.max;
+            }
+        });
+        for (uint32_t i = used; i-- > 0;) {
+            BvhNode& node = nodes[i];
+            if (node.count > 0) continue;
+            node.min = glm::min(nodes[node.start].min, nodes[node.start + 1].min);
+            node.max = glm::max(nodes[node.start].max, nodes[node.start + 1].max);
+        }
+        seenMoveVersion = source->moveVersion;
+        cost = sahCost();
+        refits++;
+        refitMilliseconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count() * 1000.0;
+    }
+
+    // before queries: builds when bodies came or went, refits when some moved since
+    void update(const CollisionWorld& world) {
+        if (source != &world || world.size() != builtSize || world.sceneVersion != builtSceneVersion) {
+            build(world);
+            return;
+        }
+        if (world.moveVersion == seenMoveVersion) return;
+        refit();
+        if (cost > builtCost * rebuildRatio) build(world);
+    }
+
+    static bool nodeHit(const BvhNode& node, const glm::vec3& origin, const glm::vec3& inverse, float tMax) {
+        float tNear = 0.0f, tFar = tMax;
+        for (int k = 0; k < 3; k++) {
+            float t0 = (node.min[k] - origin[k]) * inverse[k], t1 = (node.max[k] - origin[k]) * inverse[k];
+            tNear = std::max(tNear, std::min(t0, t1));
+            tFar = std::min(tFar, std::max(t0, t1));
+        }
+        return tNear <= tFar;
+    }
+
+    // one ray, nearer child first
+    RayHit trace(const Ray& ray, bool anyHit) const {
+        RayHit hit = { noBody, ray.tMax };
+        if (builtSize == 0) return hit;
+        glm::vec3 inverse = rayInverse(ray.direction);
+        uint32_t stack[bvhMaxDepth + 1];
+        int top = 0;
+        uint32_t index = 0;
+        while (true) {
+            const BvhNode& node = nodes[index];
+            if (nodeHit(node, ray.origin, inverse, hit.t)) {
+                if (node.count == 0) {
+                    bool backwards = ray.direction[node.axis] < 0.0f;
+                    stack[top++] = node.start + (backwards ? 0 : 1);
+                    index = node.start + (backwards ? 1 : 0);
+                    continue;
+                }
+                for (uint32_t k = node.start; k < node.start + node.count; k++) {
+                    float t;
+                    if (rayHitsShape(source->shapes[indices[k]], ray.origin, ray.direction, hit.t, t)) {
+                        hit.body = indices[k];
+                        hit.t = t;
+                        if (anyHit) return hit;
+                    }
+                }
+            }
+            if (top == 0) break;
+            index = stack[--top];
+        }
+        return hit;
+    }
+
+#if defined(__SSE2__)
+    // up to four rays through the tree together; lanes past `count` stay inactive
+    void tracePacket(const Ray* rays, RayHit* hits, int count, bool anyHit) const {
+        float lanes[10][4];
+        for (int lane = 0; lane < 4; lane++) {
+            const Ray& ray = rays[lane < count ? lane : 0];
+            glm::vec3 inverse = rayInverse(ray.direction);
+            for (int k = 0; k < 3; k++) {
+                lanes[k][lane] = ray.origin[k];
+                lanes[3 + k][lane] = ray.direction[k];
+                lanes[6 + k][lane] = inverse[k];
+            }
+            lanes[9][lane] = ray.tMax;
+        }
+        __m128 origin[3], direction[3], inverse[3];
+        for (int k = 0; k < 3; k++) {
+            origin[k] = _mm_loadu_ps(lanes[k]);
+            direction[k] = _mm_loadu_ps(lanes[3 + k]);
+            inverse[k] = _mm_loadu_ps(lanes[6 + k]);
+        }
+        __m128 tMax = _mm_loadu_ps(lanes[9]);
+        uint32_t body[4] = { noBody, noBody, noBody, noBody };
+        int active = (1 << count) - 1;
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+        const __m128 minDirection = _mm_set1_ps(rayMinDirection);
+
+        uint32_t stack[bvhMaxDepth + 1];
+        int top = 0;
+        uint32_t index = 0;
+        while (builtSize > 0 && active) {
+            const BvhNode& node = nodes[index];
+            __m128 tNear = zero, tFar = tMax;
+            for (int k = 0; k < 3; k++) {
+                __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.min[k]), origin[k]), inverse[k]);
+                __m128 t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(node.max[k]), origin[k]), inverse[k]);
+                tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+                tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+            }
+            if (_mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & active) {
+                if (node.count == 0) {
+                    // the first live ray picks the order for the packet
+                    int lead = 0;
+                    while (!(active & (1 << lead))) lead++;
+                    bool backwards = lanes[3 + node.axis][lead] < 0.0f;
+                    stack[top++] = node.start + (backwards ? 0 : 1);
+                    index = node.start + (backwards ? 1 : 0);
+                    continue;
+                }
+                for (uint32_t k = node.start; k < node.start + node.count && active; k++) {
+                    const CollisionShape& shape = source->shapes[indices[k]];
+                    __m128 offset[3];
+                    for (int c = 0; c < 3; c++) offset[c] = _mm_sub_ps(origin[c], _mm_set1_ps(shape.center[c]));
+                    tNear = zero;
+                    tFar = tMax;
+                    for (int i = 0; i < 3; i++) {
+                        __m128 ax = _mm_set1_ps(shape.axis[i][0]), ay = _mm_set1_ps(shape.axis[i][1]), az = _mm_set1_ps(shape.axis[i][2]);
+                        __m128 o = _mm_add_ps(_mm_add_ps(_mm_mul_ps(offset[0], ax), _mm_mul_ps(offset[1], ay)), _mm_mul_ps(offset[2], az));
+                        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(direction[0], ax), _mm_mul_ps(direction[1], ay)), _mm_mul_ps(direction[2], az));
+                        __m128 tiny = _mm_cmplt_ps(_mm_and_ps(d, absMask), minDirection);
+                        d = _mm_or_ps(_mm_andnot_ps(tiny, d), _mm_and_ps(tiny, minDirection));
+                        __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), d);
+                        __m128 extent = _mm_set1_ps(shape.extent[i]);
+                        __m128 t0 = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(zero, extent), o), inv);
+                        __m128 t1 = _mm_mul_ps(_mm_sub_ps(extent, o), inv);
+                        tNear = _mm_max_ps(tNear, _mm_min_ps(t0, t1));
+                        tFar = _mm_min_ps(tFar, _mm_max_ps(t0, t1));
+                    }
+                    int hitMask = _mm_movemask_ps(_mm_cmple_ps(tNear, tFar)) & active;
+                    if (!hitMask) continue;
+                    __m128 hitLanes = _mm_castsi128_ps(_mm_set_epi32(hitMask & 8 ? -1 : 0, hitMask & 4 ? -1 : 0, hitMask & 2 ? -1 : 0, hitMask & 1 ? -1 : 0));
+                    tMax = _mm_or_ps(_mm_andnot_ps(hitLanes, tMax), _mm_and_ps(hitLanes, tNear));
+                    for (int lane = 0; lane < 4; lane++) {
+                        if (hitMask & (1 << lane)) body[lane] = indices[k];
+                    }
+                    if (anyHit) active &= ~hitMask;
+                }
+            }
+            if (top == 0) break;
+            index = stack[--top];
+        }
+        _mm_storeu_ps(lanes[9], tMax);
+        for (int lane = 0; lane < count; lane++) hits[lane] = { body[lane], lanes[9][lane] };
+    }
+#endif
+
+    // hits[i] for rays[i], spread over the workers. Packets are four consecutive rays, so rays that
+    // travel together (a screen tile) should sit next to each other.
+    void intersect(const Ray* rays, RayHit* hits, size_t count, bool anyHit) const {
+        jobs.parallelFor(count, 256, [&](size_t begin, size_t end) {
+#if defined(__SSE2__)
+            if (packets) {
+                for (size_t i = begin; i < end; i += 4) tracePacket(rays + i, hits + i, (int) std::min<size_t>(4, end - i), anyHit);
+                return;
+            }
+#endif
+            for (size_t i = begin; i < end; i++) hits[i] = trace(rays[i], anyHit);
+        });
+    }
+
+    // true when some body is in the way from `from` to `to`
+    bool occluded(const glm::vec3& from, const glm::vec3& to) const {
+        glm::vec3 delta = to - from;
+        float distance = glm::length(delta);
+        if (distance <= 0.0f) return false;
+        return trace({ from, delta / distance, distance }, true).body != noBody;
+    }
+};
+
+#endif /* raycast_h */
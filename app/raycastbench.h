@@ -0,0 +1,187 @@
+//
+//  raycastbench.h
+//  app
+//
+
+#ifndef raycastbench_h
+#define raycastbench_h
+
+#include <stdint.h>
+#include <math.h>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <algorithm>
+#include "raycast.h"
+#include "collisionbench.h"
+
+// Ray query benchmark ("--raycast-bench [N]"), no window needed.
+//
+// Builds the BVH over the N boxes of the collision benchmark's scene (100k by default) on one
+// thread and on all of them, then traces a 1024x1024 view of it from outside: nearest hits, and
+// any hit shadow rays from those hits to a light, with single rays and with packets. Reports rays
+// per second, then lets the boxes fly for a while to see what refitting costs and how often the
+// tree gets rebuilt.
+//
+// Before that a small scene is checked against brute force, after it moved and was refitted:
+// single rays and packets must find the nearest body, any hit must agree on whether there is one.
+
+// rays through a width x height image from `eye` to `target`, 2x2 pixel quads next to each other
+std::vector<Ray> viewRays(const glm::vec3& eye, const glm::vec3& target, int width, int height, float tMax) {
+    glm::vec3 front = glm::normalize(target - eye);
+    glm::vec3 right = glm::normalize(glm::cross(front, glm::vec3(0.0f, 1.0f, 0.0f)));
+    glm::vec3 up = glm::cross(right, front);
+    float scale = tanf(glm::radians(30.0f));
+    std::vector<Ray> rays;
+    rays.reserve((size_t) width * height);
+    for (int y = 0; y < height; y += 2) {
+        for (int x = 0; x < width; x += 2) {
+            for (int quad = 0; quad < 4; quad++) {
+                float u = ((x + (quad & 1) + 0.5f) / width * 2.0f - 1.0f) * scale * width / height;
+                float v = ((y + (quad >> 1) + 0.5f) / height * 2.0f - 1.0f) * scale;
+                rays.push_back({ eye, glm::normalize(front + right * u + up * v), tMax });
+            }
+        }
+    }
+    return rays;
+}
+
+// nearest hits of the same rays agree when they hit the same body, or different ones at the same distance
+bool sameNearestHit(const RayHit& a, const RayHit& b) {
+    if (a.body == noBody || b.body == noBody) return a.body == b.body;
+    return a.body == b.body || fabsf(a.t - b.t) <= 1e-4f * std::max(1.0f, a.t);
+}
+
+int checkRayBvh(size_t count) {
+    int failures = 0;
+    CollisionBenchScene scene;
+    scene.spawn(count, 2.0f);
+    RayBvh bvh;
+    // refits only, so the refitted tree is what gets checked
+    bvh.rebuildRatio = 1e30f;
+    bvh.update(scene.world);
+    for (int step = 0; step < 20; step++) {
+        scene.integrate(1.0f / 60.0f, step / 60.0f);
+        scene.world.refit();
+        bvh.update(scene.world);
+    }
+    std::vector<Ray> rays;
+    for (int i = 0; i < 4096; i++) {
+        glm::vec3 origin = (glm::vec3(scene.randomFloat(), scene.randomFloat(), scene.randomFloat()) * 2.0f - glm::vec3(1.0f)) * scene.halfSize * 1.5f;
+        glm::vec3 direction = glm::normalize(glm::vec3(scene.randomFloat(), scene.randomFloat(), scene.randomFloat()) * 2.0f - glm::vec3(1.0f));
+        rays.push_back({ origin, direction, scene.halfSize * 4.0f });
+    }
+    // axis aligned rays too, they take the clamped direction path
+    for (int i = 0; i < 64; i++) {
+        glm::vec3 direction = glm::vec3(0.0f);
+        direction[i % 3] = i % 2 ? 1.0f : -1.0f;
+        rays.push_back({ scene.positions[i], direction, scene.halfSize * 4.0f });
+    }
+    std::vector<RayHit> packetHits(rays.size()), anyHits(rays.size());
+    bvh.intersect(rays.data(), packetHits.data(), rays.size(), false);
+    bvh.intersect(rays.data(), anyHits.data(), rays.size(), true);
+    size_t wrong = 0, hits = 0;
+    for (size_t r = 0; r < rays.size(); r++) {
+        RayHit expected = { noBody, rays[r].tMax };
+        for (uint32_t body = 0; body < count; body++) {
+            float t;
+            if (rayHitsShape(scene.world.shapes[body], rays[r].origin, rays[r].direction, expected.t, t)) expected = { body, t };
+        }
+        RayHit single = bvh.trace(rays[r], false);
+        if (expected.body != noBody) hits++;
+        if (!sameNearestHit(expected, single) || !sameNearestHit(expected, packetHits[r]) ||
+            (expected.body == noBody) != (anyHits[r].body == noBody)) {
+            wrong++;
+        }
+    }
+    if (wrong > 0) {
+        std::cout << "[raycast] FAILED: " << wrong << " of " << rays.size() << " rays disagree with brute force" << std::endl;
+        failures++;
+    }
+    std::cout << "[raycast] check: " << count << " bodies, " << hits << "/" << rays.size() << " rays hit, refitted "
+              << bvh.refits << " times, SAH cost " << bvh.builtCost << " -> " << bvh.cost << std::endl;
+    return failures;
+}
+
+void reportRays(const char* name, size_t rays, double seconds, size_t hits) {
+    std::cout << "[raycast] " << name << ": " << rays / seconds / 1e6 << "M rays/s (" << seconds * 1000.0 << " ms, "
+              << hits << " hits)" << std::endl;
+}
+
+size_t traceRays(RayBvh& bvh, const std::vector<Ray>& rays, std::vector<RayHit>& hits, bool anyHit, double& seconds) {
+    auto start = std::chrono::high_resolution_clock::now();
+    bvh.intersect(rays.data(), hits.data(), rays.size(), anyHit);
+    seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    size_t count = 0;
+    for (const RayHit& hit : hits) count += hit.body != noBody;
+    return count;
+}
+
+int runRaycastBenchmark(size_t count) {
+    int failures = checkRayBvh(2000);
+
+    CollisionBenchScene scene;
+    scene.spawn(count, 2.0f);
+    RayBvh bvh;
+    size_t poolWorkers = jobs.threadCount() - 1;
+    jobs.stop();
+    bvh.build(scene.world);
+    double serialMilliseconds = bvh.buildMilliseconds;
+    if (poolWorkers > 0) jobs.start((unsigned int) poolWorkers);
+    bvh.build(scene.world);
+    std::cout << "[raycast] " << count << " bodies, built in " << serialMilliseconds << " ms on 1 thread, " << bvh.buildMilliseconds
+              << " ms on " << jobs.threadCount() << ", " << bvh.nodeCount.load() << " nodes, depth " << bvh.depth.load()
+              << ", SAH cost " << bvh.builtCost << std::endl;
+
+    glm::vec3 eye = glm::vec3(0.3f, 0.5f, 1.0f) * scene.halfSize * 2.5f;
+    std::vector<Ray> rays = viewRays(eye, glm::vec3(0.0f), 1024, 1024, scene.halfSize * 10.0f);
+    std::vector<RayHit> hits(rays.size());
+    double seconds;
+    for (int packets = 0; packets < 2; packets++) {
+        bvh.packets = packets != 0;
+        size_t hitCount = traceRays(bvh, rays, hits, false, seconds);
+        reportRays(packets ? "nearest hit, packets" : "nearest hit, single rays", rays.size(), seconds, hitCount);
+    }
+    // shadow rays from what the view hit towards a light above the volume, in the same order
+    glm::vec3 light = glm::vec3(0.2f, 2.0f, 0.1f) * scene.halfSize;
+    std::vector<Ray> shadowRays;
+    shadowRays.reserve(rays.size());
+    for (size_t r = 0; r < rays.size(); r++) {
+        if (hits[r].body == noBody) continue;
+        glm::vec3 point = rays[r].origin + rays[r].direction * hits[r].t;
+        glm::vec3 toLight = light - point;
+        float distance = glm::length(toLight);
+        glm::vec3 direction = toLight / distance;
+        // off the surface, so the ray doesn't hit the body it starts on right away
+        shadowRays.push_back({ point + direction * 1e-3f, direction, distance });
+    }
+    std::vector<RayHit> shadowHits(shadowRays.size());
+    for (int packets = 0; packets < 2; packets++) {
+        bvh.packets = packets != 0;
+        size_t hitCount = traceRays(bvh, shadowRays, shadowHits, true, seconds);
+        reportRays(packets ? "any hit shadow rays, packets" : "any hit shadow rays, single rays", shadowRays.size(), seconds, hitCount);
+    }
+
+    // let the boxes move, refitting every step
+    const int steps = 60;
+    double refitMilliseconds = 0.0;
+    uint64_t buildsBefore = bvh.builds;
+    float maxCost = bvh.cost;
+    for (int step = 0; step < steps; step++) {
+        scene.integrate(1.0f / 60.0f, step / 60.0f);
+        scene.world.refit();
+        uint64_t refitsBefore = bvh.refits;
+        bvh.update(scene.world);
+        if (bvh.refits > refitsBefore) refitMilliseconds += bvh.refitMilliseconds;
+        maxCost = std::max(maxCost, bvh.cost);
+    }
+    std::cout << "[raycast] moving: refit " << refitMilliseconds / steps << " ms per step, " << bvh.builds - buildsBefore
+              << " rebuilds in " << steps << " steps, SAH cost up to " << maxCost << " (rebuilds at "
+              << bvh.rebuildRatio << "x)" << std::endl;
+    bvh.packets = true;
+    size_t hitCount = traceRays(bvh, rays, hits, false, seconds);
+    reportRays("nearest hit after moving, packets", rays.size(), seconds, hitCount);
+    return failures > 0 ? 1 : 0;
+}
+
+#endif /* raycastbench_h */
@@ -0,0 +1,221 @@
+//
+//  readback.h
+//  app
+//
+
+#ifndef readback_h
+#define readback_h
+
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <iostream>
+#include "jobs.h"
+#include "resources.h"
+#include "regression.h"
+
+// Asynchronous frame readback ("--dump-frames <dir>").
+//
+// glReadPixels into client memory waits until the GPU finished the frame. Into a pixel pack buffer it
+// only queues the copy: every frame reads into the next buffer of a ring and puts a fence behind it,
+// and a later frame maps the buffer once its fence signaled, copies the pixels out and hands them to
+// the job system to encode and write. With ringSize buffers a frame is picked up ringSize - 1 frames
+// later. The loop only waits when the oldest read still isn't done by the time its buffer comes round
+// again, or when the writers fall maxPendingWrites images behind; both count as stalls.
+//
+// "--dump-sync" reads with plain glReadPixels instead, to compare the frame time overhead.
+
+enum DumpFormat {
+    // binary PPM, rows top to bottom
+    DumpPPM,
+    // the rgba bytes as read, rows bottom to top, no header
+    DumpRaw
+};
+
+struct FrameReadback {
+    std::string directory;
+    DumpFormat format = DumpPPM;
+    bool synchronous = false;
+    int ringSize = 3;
+    int maxPendingWrites = 8;
+
+    struct Slot {
+        ResourceHandle buffer;
+        size_t bytes = 0;
+        GLsync fence = 0;
+        int width = 0;
+        int height = 0;
+        uint64_t frame = 0;
+    };
+    std::vector<Slot> slots;
+    // oldest read in flight and how many are
+    int tail = 0;
+    int inFlight = 0;
+    uint64_t frame = 0;
+
+    // cpu copies, recycled once written
+    std::mutex mutex;
+    std::vector<std::vector<unsigned char>*> freePixels;
+    std::atomic<int> pendingWrites{ 0 };
+    std::atomic<uint64_t> written{ 0 };
+    std::atomic<uint64_t> failed{ 0 };
+
+    // stats since the last report: readback time on the render thread per dumped frame
+    uint64_t stalls = 0;
+    uint64_t reportFrames = 0;
+    double reportSeconds = 0.0;
+    double maxMilliseconds = 0.0;
+    double lastAverageMilliseconds = 0.0;
+    double lastMaxMilliseconds = 0.0;
+
+    bool enabled() const {
+        return !directory.empty();
+    }
+
+    std::vector<unsigned char>* takePixels(size_t bytes) {
+        std::vector<unsigned char>* pixels = NULL;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!freePixels.empty()) {
+                pixels = freePixels.back();
+                freePixels.pop_back();
+            }
+        }
+        if (pixels == NULL) pixels = new std::vector<unsigned char>();
+        pixels->resize(bytes);
+        return pixels;
+    }
+
+    void write(std::vector<unsigned char>* pixels, int width, int height, uint64_t number) {
+        if (pendingWrites.load() >= maxPendingWrites) stalls++;
+        while (pendingWrites.load() >= maxPendingWrites) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pendingWrites++;
+        jobs.submit([this, pixels, width, height, number]() {
+            char name[32];
+            snprintf(name, sizeof(name), "/frame_%06llu.%s", (unsigned long long) number, format == DumpPPM ? "ppm" : "rgba");
+            std::string path = directory + name;
+            bool ok;
+            if (format == DumpPPM) {
+                ok = writePPM(path, *pixels, width, height);
+            } else {
+                FILE* file = fopen(path.c_str(), "wb");
+                ok = file != NULL && fwrite(pixels->data(), 1, pixels->size(), file) == pixels->size();
+                if (file) fclose(file);
+            }
+            if (!ok && failed++ == 0) std::cout << "[readback] could not write " << path << std::endl;
+            written++;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                freePixels.push_back(pixels);
+            }
+            pendingWrites--;
+        });
+    }
+
+    // maps the oldest read, waiting for it when `wait`; false when it isn't done yet
+    bool collect(bool wait) {
+        Slot& slot = slots[tail];
+        if (wait) {
+            if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) stalls++;
+            glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+        } else if (glClientWaitSync(slot.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            return false;
+        }
+        glDeleteSync(slot.fence);
+        slot.fence = 0;
+        size_t bytes = (size_t) slot.width * slot.height * 4;
+        std::vector<unsigned char>* pixels = takePixels(bytes);
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, gpuResources.name(slot.buffer));
+        const void* mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+        if (mapped) {
+            memcpy(pixels->data(), mapped, bytes);
+            glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+        }
+        glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+        tail = (tail + 1) % ringSize;
+        inFlight--;
+        if (mapped) {
+            write(pixels, slot.width, slot.height, slot.frame);
+        } else {
+            // the buffer holds nothing we can read, drop the frame rather than write stale pixels
+            std::cout << "[readback] could not map the read of frame " << slot.frame << ", skipped" << std::endl;
+            failed++;
+            std::lock_guard<std::mutex> lock(mutex);
+            freePixels.push_back(pixels);
+        }
+        return true;
+    }
+
+    // After the frame rendered, before the swap: reads the framebuffer bound for reading (the back
+    // buffer once dynamicResolution.endFrame ran) and picks up earlier reads that completed.
+    void capture(int width, int height) {
+        if (!enabled() || width <= 0 || height <= 0) return;
+        auto start = std::chrono::steady_clock::now();
+        size_t bytes = (size_t) width * height * 4;
+        if (synchronous) {
+            std::vector<unsigned char>* pixels = takePixels(bytes);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels->data());
+            write(pixels, width, height, frame++);
+        } else {
+            if (slots.empty()) {
+                slots.resize(ringSize);
+                for (Slot& slot : slots) slot.buffer = GPU_CREATE(ResourceBuffer, "readback");
+            }
+            while (inFlight > 0 && collect(false)) {}
+            if (inFlight == ringSize) collect(true);
+            Slot& slot = slots[(tail + inFlight) % ringSize];
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, gpuResources.name(slot.buffer));
+            if (slot.bytes != bytes) {
+                glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+                gpuResources.setBytes(slot.buffer, bytes);
+                slot.bytes = bytes;
+            }
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+            glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+            slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            slot.width = width;
+            slot.height = height;
+            slot.frame = frame++;
+            inFlight++;
+        }
+        double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        reportFrames++;
+        reportSeconds += milliseconds / 1000.0;
+        maxMilliseconds = std::max(maxMilliseconds, milliseconds);
+    }
+
+    // average and max readback cost per frame since the last call
+    void report() {
+        lastAverageMilliseconds = reportFrames > 0 ? reportSeconds * 1000.0 / reportFrames : 0.0;
+        lastMaxMilliseconds = maxMilliseconds;
+        reportFrames = 0;
+        reportSeconds = 0.0;
+        maxMilliseconds = 0.0;
+    }
+
+    // every read in flight mapped and written
+    void finish() {
+        while (inFlight > 0) collect(true);
+        jobs.waitIdle();
+    }
+
+    void release() {
+        for (Slot& slot : slots) {
+            if (slot.fence) glDeleteSync(slot.fence);
+            gpuResources.release(slot.buffer);
+        }
+        slots.clear();
+        inFlight = 0;
+        for (std::vector<unsigned char>* pixels : freePixels) delete pixels;
+        freePixels.clear();
+    }
+};
+
+#endif /* readback_h */
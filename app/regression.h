@@ -0,0 +1,306 @@
+//
+//  regression.h
+//  app
+//
+
+#ifndef regression_h
+#define regression_h
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <functional>
+#include "clock.h"
+#include "resources.h"
+
+// Headless regression suite: renders a fixed script of frames with a FixedStepClock into an
+// offscreen framebuffer, compares every frame with a stored golden image and times each frame
+// against a stored baseline.
+//
+//   app --regression <dir>            compare against <dir>/frame_NNN.ppm and <dir>/baseline.txt
+//   app --regression <dir> --record   (re)write the golden images and the baseline
+//
+// Returns non zero when an image differs beyond tolerance or frame time regressed.
+
+const int regressionWidth = 800;
+const int regressionHeight = 600;
+
+struct RegressionFrame {
+    double time;
+    glm::vec3 cameraPos;
+    float yaw;
+    float pitch;
+};
+
+// scripted camera path over the cube field, times are what the clock reports for each frame
+const RegressionFrame regressionScript[] = {
+    { 0.0,  glm::vec3(0.0f, 0.0f, 3.0f),  -90.0f,   0.0f },
+    { 0.5,  glm::vec3(0.0f, 0.0f, 3.0f),  -90.0f,   0.0f },
+    { 1.25, glm::vec3(1.0f, 0.5f, 4.0f), -100.0f,  -5.0f },
+    { 2.0,  glm::vec3(-2.0f, 1.0f, 2.0f), -70.0f, -10.0f },
+    { 3.5,  glm::vec3(0.0f, 3.0f, 5.0f),  -90.0f, -30.0f },
+    { 5.0,  glm::vec3(3.0f, -1.0f, 0.0f), -135.0f, 10.0f },
+    { 8.0,  glm::vec3(0.0f, 0.0f, -5.0f), -90.0f,   0.0f },
+    { 13.0, glm::vec3(0.0f, 0.0f, 10.0f), -90.0f,   0.0f },
+};
+
+struct RegressionOptions {
+    std::string dir;
+    bool record = false;
+    // per pixel color distance (0..255 scale) below which two pixels look the same
+    float pixelTolerance = 6.0f;
+    // fraction of the image allowed to differ before the frame fails
+    float maxDifferentPixels = 0.001f;
+    // allowed frame time growth over the baseline, 0.15 = 15%
+    float timeThreshold = 0.15f;
+    // timed renders per scripted frame, after one warm up render
+    int iterations = 30;
+    // compare the last render of every frame instead of the first, for output that converges
+    // over frames (temporal upsampling)
+    bool compareLastIteration = false;
+};
+
+struct FrameTimeStats {
+    double mean = 0.0;
+    double median = 0.0;
+    double p95 = 0.0;
+    double max = 0.0;
+};
+
+FrameTimeStats computeFrameTimeStats(std::vector<double> samples) {
+    FrameTimeStats stats;
+    if (samples.empty()) return stats;
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (double s : samples) sum += s;
+    stats.mean = sum / samples.size();
+    stats.median = samples[samples.size() / 2];
+    stats.p95 = samples[std::min(samples.size() - 1, (size_t) (samples.size() * 0.95))];
+    stats.max = samples.back();
+    return stats;
+}
+
+// binary PPM (P6), rgb rows stored top to bottom. Pixels come in as glReadPixels rgba rows,
+// bottom to top.
+bool writePPM(const std::string& path, const std::vector<unsigned char>& rgba, int width, int height) {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) return false;
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    std::vector<unsigned char> row(width * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        const unsigned char* src = &rgba[y * width * 4];
+        for (int x = 0; x < width; x++) {
+            row[x * 3 + 0] = src[x * 4 + 0];
+            row[x * 3 + 1] = src[x * 4 + 1];
+            row[x * 3 + 2] = src[x * 4 + 2];
+        }
+        fwrite(row.data(), 1, row.size(), file);
+    }
+    fclose(file);
+    return true;
+}
+
+bool readPPM(const std::string& path, std::vector<unsigned char>& rgba, int& width, int& height) {
+    FILE* file = fopen(path.c_str(), "rb");
+    if (!file) return false;
+    int maxValue = 0;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) != 3 || maxValue != 255) {
+        fclose(file);
+        return false;
+    }
+    fgetc(file); // single whitespace after the header
+    rgba.assign(width * height * 4, 255);
+    std::vector<unsigned char> row(width * 3);
+    for (int y = height - 1; y >= 0; y--) {
+        if (fread(row.data(), 1, row.size(), file) != row.size()) {
+            fclose(file);
+            return false;
+        }
+        unsigned char* dst = &rgba[y * width * 4];
+        for (int x = 0; x < width; x++) {
+            dst[x * 4 + 0] = row[x * 3 + 0];
+            dst[x * 4 + 1] = row[x * 3 + 1];
+            dst[x * 4 + 2] = row[x * 3 + 2];
+        }
+    }
+    fclose(file);
+    return true;
+}
+
+// distance in YCbCr with chroma weighted down, closer to what the eye notices than plain rgb
+float perceptualDistance(const unsigned char* a, const unsigned char* b) {
+    float dr = float(a[0]) - float(b[0]);
+    float dg = float(a[1]) - float(b[1]);
+    float db = float(a[2]) - float(b[2]);
+    float dy = 0.299f * dr + 0.587f * dg + 0.114f * db;
+    float dcb = -0.1687f * dr - 0.3313f * dg + 0.5f * db;
+    float dcr = 0.5f * dr - 0.4187f * dg - 0.0813f * db;
+    return sqrtf(dy * dy + 0.25f * (dcb * dcb + dcr * dcr));
+}
+
+// rgb PSNR in dB, 99 for identical images
+double imagePsnrDb(const std::vector<unsigned char>& image, const std::vector<unsigned char>& golden) {
+    double sum = 0.0;
+    for (size_t i = 0; i < image.size(); i += 4) {
+        for (int c = 0; c < 3; c++) {
+            double d = double(image[i + c]) - double(golden[i + c]);
+            sum += d * d;
+        }
+    }
+    if (sum == 0.0) return 99.0;
+    return 10.0 * log10(255.0 * 255.0 * (image.size() / 4 * 3) / sum);
+}
+
+// Fraction of pixels that differ. A pixel only counts when nothing in the 3x3 neighbourhood of
+// the golden image is close to it, so one pixel rasterization shifts between drivers pass.
+float compareImages(const std::vector<unsigned char>& image, const std::vector<unsigned char>& golden,
+                    int width, int height, float pixelTolerance) {
+    int different = 0;
+    for (int y = 0; y < height; y++) {
+        for (int x = 0; x < width; x++) {
+            const unsigned char* p = &image[(y * width + x) * 4];
+            bool matched = false;
+            for (int dy = -1; dy <= 1 && !matched; dy++) {
+                for (int dx = -1; dx <= 1 && !matched; dx++) {
+                    int nx = x + dx, ny = y + dy;
+                    if (nx < 0 || ny < 0 || nx >= width || ny >= height) continue;
+                    matched = perceptualDistance(p, &golden[(ny * width + nx) * 4]) <= pixelTolerance;
+                }
+            }
+            if (!matched) different++;
+        }
+    }
+    return float(different) / float(width * height);
+}
+
+bool readBaseline(const std::string& path, FrameTimeStats& baseline) {
+    FILE* file = fopen(path.c_str(), "r");
+    if (!file) return false;
+    bool ok = fscanf(file, "median %lf p95 %lf", &baseline.median, &baseline.p95) == 2;
+    fclose(file);
+    return ok;
+}
+
+bool writeBaseline(const std::string& path, const FrameTimeStats& stats) {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) return false;
+    fprintf(file, "median %.4f p95 %.4f\n", stats.median, stats.p95);
+    fclose(file);
+    return true;
+}
+
+int runRegressionSuite(const RegressionOptions& options, FixedStepClock& clock,
+                       const std::function<void(float)>& renderFrame) {
+    // offscreen target, so results don't depend on window size or display scaling
+    ResourceHandle fbo = GPU_CREATE(ResourceFramebuffer, "regression");
+    ResourceHandle color = GPU_CREATE(ResourceRenderbuffer, "regression");
+    ResourceHandle depth = GPU_CREATE(ResourceRenderbuffer, "regression");
+    auto releaseTarget = [&]() {
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        gpuResources.release(depth);
+        gpuResources.release(color);
+        gpuResources.release(fbo);
+    };
+    glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(fbo));
+    glBindRenderbuffer(GL_RENDERBUFFER, gpuResources.name(color));
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, regressionWidth, regressionHeight);
+    gpuResources.setBytes(color, (size_t) regressionWidth * regressionHeight * 4);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, gpuResources.name(color));
+    glBindRenderbuffer(GL_RENDERBUFFER, gpuResources.name(depth));
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, regressionWidth, regressionHeight);
+    gpuResources.setBytes(depth, (size_t) regressionWidth * regressionHeight * 4);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, gpuResources.name(depth));
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+        std::cout << "[regression] offscreen framebuffer incomplete" << std::endl;
+        releaseTarget();
+        return 1;
+    }
+    glViewport(0, 0, regressionWidth, regressionHeight);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+    int failures = 0;
+    size_t frameCount = sizeof(regressionScript) / sizeof(regressionScript[0]);
+    std::vector<double> frameTimes;
+    std::vector<unsigned char> pixels(regressionWidth * regressionHeight * 4);
+    std::vector<unsigned char> golden;
+
+    for (size_t i = 0; i < frameCount; i++) {
+        const RegressionFrame& frame = regressionScript[i];
+        cameraPos = frame.cameraPos;
+        setCameraDirection(frame.yaw, frame.pitch);
+
+        // first render warms caches and is the one compared against the golden image (unless
+        // compareLastIteration)
+        for (int iteration = 0; iteration <= options.iterations; iteration++) {
+            clock.set(frame.time);
+            auto start = std::chrono::steady_clock::now();
+            renderFrame((float) clock.tick());
+            glFinish();
+            auto end = std::chrono::steady_clock::now();
+            if (iteration > 0) {
+                frameTimes.push_back(std::chrono::duration<double, std::milli>(end - start).count());
+            }
+            if (iteration == (options.compareLastIteration ? options.iterations : 0)) {
+                glReadPixels(0, 0, regressionWidth, regressionHeight, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+            }
+        }
+
+        char name[32];
+        snprintf(name, sizeof(name), "/frame_%03zu.ppm", i);
+        std::string path = options.dir + name;
+        if (options.record) {
+            if (!writePPM(path, pixels, regressionWidth, regressionHeight)) {
+                std::cout << "[regression] could not write " << path << std::endl;
+                failures++;
+            }
+            continue;
+        }
+
+        int width, height;
+        if (!readPPM(path, golden, width, height) || width != regressionWidth || height != regressionHeight) {
+            std::cout << "[regression] missing or invalid golden image " << path << std::endl;
+            failures++;
+            continue;
+        }
+        float different = compareImages(pixels, golden, width, height, options.pixelTolerance);
+        bool passed = different <= options.maxDifferentPixels;
+        std::cout << "[regression] frame " << i << " t=" << frame.time << "s "
+                  << (different * 100.0f) << "% pixels differ, PSNR " << imagePsnrDb(pixels, golden) << " dB "
+                  << (passed ? "ok" : "FAILED") << std::endl;
+        if (!passed) {
+            writePPM(options.dir + "/failed" + (name + 1), pixels, regressionWidth, regressionHeight);
+            failures++;
+        }
+    }
+
+    FrameTimeStats stats = computeFrameTimeStats(frameTimes);
+    std::cout << "[regression] frame time ms: mean " << stats.mean << " median " << stats.median
+              << " p95 " << stats.p95 << " max " << stats.max << std::endl;
+
+    std::string baselinePath = options.dir + "/baseline.txt";
+    if (options.record) {
+        if (!writeBaseline(baselinePath, stats)) failures++;
+    } else {
+        FrameTimeStats baseline;
+        if (!readBaseline(baselinePath, baseline)) {
+            std::cout << "[regression] missing baseline " << baselinePath << std::endl;
+            failures++;
+        } else {
+            double limit = 1.0 + options.timeThreshold;
+            bool medianOk = stats.median <= baseline.median * limit;
+            bool p95Ok = stats.p95 <= baseline.p95 * limit;
+            std::cout << "[regression] baseline ms: median " << baseline.median << " p95 " << baseline.p95
+                      << (medianOk && p95Ok ? " ok" : " REGRESSED") << std::endl;
+            if (!medianOk || !p95Ok) failures++;
+        }
+    }
+
+    releaseTarget();
+    return failures == 0 ? 0 : 1;
+}
+
+#endif /* regression_h */
@@ -0,0 +1,183 @@
+//
+//  rendertargets.h
+//  app
+//
+
+#ifndef rendertargets_h
+#define rendertargets_h
+
+#include <stdint.h>
+#include <vector>
+#include <iostream>
+#include "resources.h"
+
+// Pool of offscreen render targets. Every target is a framebuffer with a color texture (sampled by
+// whatever pass reads it back, linear filtering); the kind decides what else is attached.
+//
+// acquire() hands out a free target of exactly the requested size and kind, creating one only when
+// none is pooled. Released targets stay allocated and are deleted once nobody asked for their size for
+// maxIdleFrames frames, so a size that comes and goes (dynamic resolution stepping between two
+// scales) costs no allocations after the first time.
+
+enum RenderTargetKind {
+    // RGBA8 color and depth/stencil
+    TargetScene,
+    // plus RG16F screen space motion vectors in attachment 1, nearest filtering
+    TargetSceneMotion,
+    // RGBA16F color only, for buffers that accumulate over frames
+    TargetHistory
+};
+
+struct RenderTarget {
+    int width = 0;
+    int height = 0;
+    RenderTargetKind kind = TargetScene;
+    size_t bytes = 0;
+    ResourceHandle framebuffer;
+    ResourceHandle color;
+    ResourceHandle motion;
+    ResourceHandle depth;
+    bool inUse = false;
+    uint64_t lastUsed = 0;
+};
+
+struct RenderTargetPool {
+    std::vector<RenderTarget> targets;
+    int maxIdleFrames = 120;
+    uint64_t frame = 0;
+    // targets created since startup, stays flat once every size in use is pooled
+    int allocations = 0;
+
+    // index of a free target of that size and kind, -1 when the framebuffer can't be completed
+    int acquire(int width, int height, RenderTargetKind kind = TargetScene) {
+        int freeSlot = -1;
+        for (size_t i = 0; i < targets.size(); i++) {
+            RenderTarget& target = targets[i];
+            if (target.inUse) continue;
+            if (gpuResources.valid(target.framebuffer) && target.width == width && target.height == height &&
+                target.kind == kind) {
+                target.inUse = true;
+                target.lastUsed = frame;
+                return (int) i;
+            }
+            if (!gpuResources.valid(target.framebuffer) && freeSlot < 0) freeSlot = (int) i;
+        }
+        if (freeSlot < 0) {
+            freeSlot = (int) targets.size();
+            targets.push_back(RenderTarget());
+        }
+        RenderTarget& target = targets[freeSlot];
+        if (!create(target, width, height, kind)) return -1;
+        target.inUse = true;
+        target.lastUsed = frame;
+        return freeSlot;
+    }
+
+    void release(int index) {
+        if (index < 0) return;
+        targets[index].inUse = false;
+        targets[index].lastUsed = frame;
+    }
+
+    RenderTarget& target(int index) {
+        return targets[index];
+    }
+
+    static ResourceHandle createAttachment(int width, int height, GLint internalFormat, GLenum format, GLint filter, size_t bytes) {
+        ResourceHandle texture = GPU_CREATE(ResourceTexture, "render targets");
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(texture));
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, GL_UNSIGNED_BYTE, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filter);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        gpuResources.setBytes(texture, bytes);
+        return texture;
+    }
+
+    bool create(RenderTarget& target, int width, int height, RenderTargetKind kind) {
+        size_t texels = (size_t) width * height;
+        target.width = width;
+        target.height = height;
+        target.kind = kind;
+        target.framebuffer = GPU_CREATE(ResourceFramebuffer, "render targets");
+        if (kind == TargetHistory) {
+            target.color = createAttachment(width, height, GL_RGBA16F, GL_RGBA, GL_LINEAR, texels * 8);
+        } else {
+            target.color = createAttachment(width, height, GL_RGBA8, GL_RGBA, GL_LINEAR, texels * 4);
+        }
+        if (kind == TargetSceneMotion) {
+            target.motion = createAttachment(width, height, GL_RG16F, GL_RG, GL_NEAREST, texels * 4);
+        }
+        if (kind != TargetHistory) {
+            target.depth = GPU_CREATE(ResourceRenderbuffer, "render targets");
+            glBindRenderbuffer(GL_RENDERBUFFER, gpuResources.name(target.depth));
+            glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+            gpuResources.setBytes(target.depth, texels * 4);
+        }
+        target.bytes = texels * (kind == TargetSceneMotion ? 12 : 8);
+
+        GLint previousFramebuffer = 0;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(target.framebuffer));
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, gpuResources.name(target.color), 0);
+        if (kind == TargetSceneMotion) {
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, gpuResources.name(target.motion), 0);
+            GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, drawBuffers);
+        }
+        if (kind != TargetHistory) {
+            glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, gpuResources.name(target.depth));
+        }
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+        if (!complete) {
+            std::cout << "[render targets] " << width << "x" << height << " kind " << kind << " framebuffer incomplete" << std::endl;
+            destroy(target);
+            return false;
+        }
+        allocations++;
+        return true;
+    }
+
+    void destroy(RenderTarget& target) {
+        gpuResources.release(target.framebuffer);
+        gpuResources.release(target.color);
+        gpuResources.release(target.motion);
+        gpuResources.release(target.depth);
+        target.inUse = false;
+    }
+
+    // once per frame, after the last release: drops targets idle for too long
+    void endFrame() {
+        frame++;
+        for (RenderTarget& target : targets) {
+            if (!target.inUse && gpuResources.valid(target.framebuffer) && frame - target.lastUsed > (uint64_t) maxIdleFrames) {
+                destroy(target);
+            }
+        }
+    }
+
+    int pooledCount() const {
+        int count = 0;
+        for (const RenderTarget& target : targets) {
+            if (gpuResources.valid(target.framebuffer)) count++;
+        }
+        return count;
+    }
+
+    size_t pooledBytes() const {
+        size_t bytes = 0;
+        for (const RenderTarget& target : targets) {
+            if (gpuResources.valid(target.framebuffer)) bytes += target.bytes;
+        }
+        return bytes;
+    }
+
+    void releaseAll() {
+        for (RenderTarget& target : targets) destroy(target);
+        targets.clear();
+    }
+};
+
+#endif /* rendertargets_h */
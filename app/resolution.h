@@ -0,0 +1,229 @@
+//
+//  resolution.h
+//  app
+//
+
+#ifndef resolution_h
+#define resolution_h
+
+#include <stdint.h>
+#include <math.h>
+#include "shaders.h"
+#include "rendertargets.h"
+#include "temporal.h"
+
+// Dynamic resolution. The scene renders into a pooled offscreen target whose size follows a
+// frame time controller, then upscale.frag stretches it over the window with contrast adaptive
+// sharpening to win back some of the lost detail.
+//
+// GPU frame time is measured with a pair of timestamp queries around the whole frame (the shadow
+// pass keeps GL_TIME_ELAPSED queries open, those can't nest). Results are read a few frames late,
+// only once available. The controller is a PID on the relative error against the budget that
+// outputs the fraction of window pixels to render; render scale is its square root, snapped to
+// scaleStep so the pool only ever sees a handful of sizes, with a dead band so the size doesn't
+// flip between two steps every frame.
+//
+// With temporal upsampling (temporal.h) the scene target also gets motion vectors, the temporal
+// preset caps the render scale (fixed at the cap when the controller is off) and the resolved
+// output is what gets sharpened into the window. The window isn't special: the target bound when
+// the frame begins is where the result goes, the regression suite points it at its framebuffer.
+
+const int resolutionTimerSlots = 4;
+
+struct FrameTimeController {
+    // what frames should take on the GPU, the controller aims a bit under it
+    float budgetMilliseconds = 16.6f;
+    float headroom = 0.9f;
+    float kp = 0.15f;
+    float ki = 0.05f;
+    float kd = 0.02f;
+    float minArea = 0.25f;
+    float maxArea = 1.0f;
+
+    // integral term, starts at full resolution
+    float integral = 1.0f;
+    float lastError = 0.0f;
+    bool primed = false;
+    float area = 1.0f;
+
+    // one measured frame in, fraction of window pixels to render out
+    float update(float milliseconds) {
+        float target = budgetMilliseconds * headroom;
+        float error = (target - milliseconds) / target;
+        float derivative = primed ? error - lastError : 0.0f;
+        lastError = error;
+        primed = true;
+        // the integral is clamped to the output range, no windup while pinned at full resolution
+        integral = fminf(fmaxf(integral + ki * error, minArea), maxArea);
+        area = fminf(fmaxf(integral + kp * error + kd * derivative, minArea), maxArea);
+        return area;
+    }
+};
+
+struct DynamicResolution {
+    // frame time controller on, render scale follows the budget
+    bool enabled = true;
+    float sharpness = 0.5f;
+    // render scale moves in steps of this size between sqrt(minArea) and 1
+    float scaleStep = 0.05f;
+    FrameTimeController controller;
+    TemporalUpsampler temporal;
+    RenderTargetPool pool;
+    HotProgram program;
+    ResourceHandle emptyVao;
+
+    ResourceHandle startQueries[resolutionTimerSlots];
+    ResourceHandle endQueries[resolutionTimerSlots];
+    bool pending[resolutionTimerSlots] = {};
+    uint64_t frame = 0;
+    bool timing = false;
+
+    // scale the current target was acquired at, per axis
+    float scale = 1.0f;
+    int target = -1;
+    int windowWidth = 0;
+    int windowHeight = 0;
+    GLint outputFramebuffer = 0;
+    // smoothed measured GPU milliseconds, for stats
+    float gpuMilliseconds = 0.0f;
+
+    bool init(ShaderReloader& reloader) {
+        program.vertexFile = "upscale.vert";
+        program.fragmentFile = "upscale.frag";
+        program.onSwap = [](unsigned int program) {
+            glUniform1i(glGetUniformLocation(program, "scene"), 0);
+        };
+        if (!reloader.load(program)) return false;
+        if (temporal.enabled() && !temporal.init(reloader)) return false;
+        // core profile won't draw without a vertex array, the fullscreen triangle needs no attributes
+        emptyVao = GPU_CREATE(ResourceVertexArray, "resolution");
+        for (int i = 0; i < resolutionTimerSlots; i++) {
+            startQueries[i] = GPU_CREATE(ResourceQuery, "resolution");
+            endQueries[i] = GPU_CREATE(ResourceQuery, "resolution");
+        }
+        return true;
+    }
+
+    void release() {
+        pool.release(target);
+        target = -1;
+        temporal.release(pool);
+        pool.releaseAll();
+        for (int i = 0; i < resolutionTimerSlots; i++) {
+            gpuResources.release(startQueries[i]);
+            gpuResources.release(endQueries[i]);
+        }
+        gpuResources.release(emptyVao);
+    }
+
+    // reads every finished timer pair into the controller, oldest first
+    void collect() {
+        for (uint64_t f = frame >= resolutionTimerSlots ? frame - resolutionTimerSlots : 0; f < frame; f++) {
+            int slot = (int) (f % resolutionTimerSlots);
+            if (!pending[slot]) continue;
+            GLint available = 0;
+            glGetQueryObjectiv(gpuResources.name(endQueries[slot]), GL_QUERY_RESULT_AVAILABLE, &available);
+            if (!available) break;
+            GLuint64 start = 0, end = 0;
+            glGetQueryObjectui64v(gpuResources.name(startQueries[slot]), GL_QUERY_RESULT, &start);
+            glGetQueryObjectui64v(gpuResources.name(endQueries[slot]), GL_QUERY_RESULT, &end);
+            pending[slot] = false;
+            float milliseconds = float(end - start) / 1e6f;
+            gpuMilliseconds = gpuMilliseconds == 0.0f ? milliseconds : gpuMilliseconds * 0.9f + milliseconds * 0.1f;
+            if (enabled) controller.update(milliseconds);
+        }
+    }
+
+    // scale the controller asks for, moved to a new step only once it's well past the current one
+    float chooseScale() const {
+        float maxScale = sqrtf(controller.maxArea);
+        if (!enabled) return maxScale;
+        float wanted = sqrtf(controller.area);
+        if (fabsf(wanted - scale) < scaleStep * 0.6f) return fminf(scale, maxScale);
+        float snapped = roundf(wanted / scaleStep) * scaleStep;
+        return fminf(fmaxf(snapped, sqrtf(controller.minArea)), maxScale);
+    }
+
+    // temporal preset, call before init
+    void setTemporalPreset(TemporalPreset preset) {
+        temporal.preset = preset;
+        float cap = temporalPresetScale(preset);
+        controller.maxArea = cap * cap;
+        controller.integral = controller.area = controller.maxArea;
+    }
+
+    // Binds the frame's render target and viewport, call before rendering the scene with the
+    // output framebuffer bound. Without dynamic resolution and temporal upsampling (or without
+    // the upscale program) it renders straight to the output.
+    void beginFrame(int width, int height) {
+        collect();
+        windowWidth = width;
+        windowHeight = height;
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &outputFramebuffer);
+        int slot = (int) (frame % resolutionTimerSlots);
+        timing = !pending[slot];
+        if (timing) glQueryCounter(gpuResources.name(startQueries[slot]), GL_TIMESTAMP);
+
+        pool.release(target);
+        target = -1;
+        if ((enabled || temporal.enabled()) && program.program != 0 && width > 0 && height > 0) {
+            scale = chooseScale();
+            int renderWidth = (int) fmaxf(1.0f, roundf(width * scale));
+            int renderHeight = (int) fmaxf(1.0f, roundf(height * scale));
+            target = pool.acquire(renderWidth, renderHeight, temporal.enabled() ? TargetSceneMotion : TargetScene);
+            if (temporal.enabled()) temporal.beginFrame(renderWidth, renderHeight, scale);
+        }
+        if (target >= 0) {
+            RenderTarget& rt = pool.target(target);
+            glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(rt.framebuffer));
+            glViewport(0, 0, rt.width, rt.height);
+        } else {
+            scale = 1.0f;
+            if (temporal.enabled()) temporal.beginFrame(width, height, 1.0f);
+            glViewport(0, 0, width, height);
+        }
+    }
+
+    // projection to render the scene with, jittered when upsampling temporally
+    glm::mat4 sceneProjection(const glm::mat4& projection, const glm::mat4& view) {
+        return target >= 0 && temporal.enabled() ? temporal.jitterProjection(projection, view) : projection;
+    }
+
+    // texture detail the scene should be streamed and sampled at, relative to its render size
+    float textureScale() const {
+        return target >= 0 && temporal.enabled() ? 1.0f / scale : 1.0f;
+    }
+
+    // resolves and upscales into the output and closes the frame's timer
+    void endFrame() {
+        int source = target;
+        if (target >= 0 && temporal.enabled()) {
+            int resolved = temporal.resolve(pool, target, windowWidth, windowHeight, gpuResources.name(emptyVao));
+            if (resolved >= 0) source = resolved;
+        }
+        if (source >= 0) {
+            RenderTarget& rt = pool.target(source);
+            glBindFramebuffer(GL_FRAMEBUFFER, outputFramebuffer);
+            glViewport(0, 0, windowWidth, windowHeight);
+            glDisable(GL_DEPTH_TEST);
+            glUseProgram(program.program);
+            glUniform2f(glGetUniformLocation(program.program, "sourceTexel"), 1.0f / rt.width, 1.0f / rt.height);
+            // nothing to win back at full resolution, unless the temporal resolve softened it
+            glUniform1f(glGetUniformLocation(program.program, "sharpness"), scale < 1.0f || source != target ? sharpness : 0.0f);
+            glActiveTexture(GL_TEXTURE0);
+            glBindTexture(GL_TEXTURE_2D, gpuResources.name(rt.color));
+            glBindVertexArray(gpuResources.name(emptyVao));
+            glDrawArrays(GL_TRIANGLES, 0, 3);
+            glEnable(GL_DEPTH_TEST);
+        }
+        int slot = (int) (frame % resolutionTimerSlots);
+        if (timing) {
+            glQueryCounter(gpuResources.name(endQueries[slot]), GL_TIMESTAMP);
+            pending[slot] = true;
+        }
+        frame++;
+        pool.endFrame();
+    }
+};
+
+#endif /* resolution_h */
@@ -0,0 +1,258 @@
+//
+//  resources.h
+//  app
+//
+
+#ifndef resources_h
+#define resources_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <map>
+#include <string>
+#include <vector>
+
+// Registry of every GL object the app owns.
+//
+// Objects are addressed by generational handles: a slot index plus the generation the slot had
+// when the object was registered, so a handle to a released object resolves to 0 instead of to
+// whatever reused the slot. Each record keeps the GL name, kind, a category for reports, its
+// byte size (kept up to date by the owner when storage is reallocated) and the file and line
+// that created it.
+//
+// release() doesn't delete right away: released names wait for a fence inserted at the end of
+// the frame, and are deleted once the GPU passed it. report() prints live bytes per category and
+// kind; leakReport() lists whatever is still registered at shutdown.
+//
+// GPU_CREATE / GPU_ADOPT record the call site. Like GL itself, only the render thread uses it.
+
+enum ResourceKind {
+    ResourceTexture,
+    ResourceBuffer,
+    ResourceVertexArray,
+    ResourceProgram,
+    ResourceFramebuffer,
+    ResourceRenderbuffer,
+    ResourceQuery,
+    ResourceKindCount
+};
+
+const char* resourceKindName(ResourceKind kind) {
+    static const char* names[] = { "texture", "buffer", "vertex array", "program", "framebuffer", "renderbuffer", "query" };
+    return names[kind];
+}
+
+struct ResourceHandle {
+    uint32_t index = 0;
+    // 0 never names a live slot, so a default handle is always invalid
+    uint32_t generation = 0;
+};
+
+struct ResourceRecord {
+    unsigned int name = 0;
+    ResourceKind kind = ResourceTexture;
+    const char* category = "";
+    size_t bytes = 0;
+    const char* file = "";
+    int line = 0;
+    uint32_t generation = 1;
+    bool live = false;
+};
+
+struct PendingDeletion {
+    ResourceKind kind;
+    unsigned int name;
+    // frame fence, 0 until the end of the frame the name was released in
+    GLsync fence;
+};
+
+void deleteGlObject(ResourceKind kind, unsigned int name) {
+    switch (kind) {
+        case ResourceTexture: glDeleteTextures(1, &name); break;
+        case ResourceBuffer: glDeleteBuffers(1, &name); break;
+        case ResourceVertexArray: glDeleteVertexArrays(1, &name); break;
+        case ResourceProgram: glDeleteProgram(name); break;
+        case ResourceFramebuffer: glDeleteFramebuffers(1, &name); break;
+        case ResourceRenderbuffer: glDeleteRenderbuffers(1, &name); break;
+        case ResourceQuery: glDeleteQueries(1, &name); break;
+        default: break;
+    }
+}
+
+struct GpuResources {
+    std::vector<ResourceRecord> records;
+    std::vector<uint32_t> freeSlots;
+    std::vector<PendingDeletion> pending;
+    size_t liveBytes = 0;
+    size_t liveCount = 0;
+
+    // generates a new GL object of `kind` and registers it
+    ResourceHandle create(ResourceKind kind, const char* category, const char* file, int line) {
+        unsigned int name = 0;
+        switch (kind) {
+            case ResourceTexture: glGenTextures(1, &name); break;
+            case ResourceBuffer: glGenBuffers(1, &name); break;
+            case ResourceVertexArray: glGenVertexArrays(1, &name); break;
+            case ResourceProgram: name = glCreateProgram(); break;
+            case ResourceFramebuffer: glGenFramebuffers(1, &name); break;
+            case ResourceRenderbuffer: glGenRenderbuffers(1, &name); break;
+            case ResourceQuery: glGenQueries(1, &name); break;
+            default: break;
+        }
+        return adopt(kind, name, category, file, line);
+    }
+
+    // registers an object created elsewhere (linked programs)
+    ResourceHandle adopt(ResourceKind kind, unsigned int name, const char* category, const char* file, int line) {
+        uint32_t index;
+        if (!freeSlots.empty()) {
+            index = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            index = (uint32_t) records.size();
+            records.push_back(ResourceRecord());
+        }
+        ResourceRecord& record = records[index];
+        record.name = name;
+        record.kind = kind;
+        record.category = category;
+        record.bytes = 0;
+        record.file = file;
+        record.line = line;
+        record.live = true;
+        liveCount++;
+        ResourceHandle handle;
+        handle.index = index;
+        handle.generation = record.generation;
+        return handle;
+    }
+
+    bool valid(ResourceHandle handle) const {
+        return handle.index < records.size() && records[handle.index].live &&
+               records[handle.index].generation == handle.generation;
+    }
+
+    // GL name, 0 for a released or default handle
+    unsigned int name(ResourceHandle handle) const {
+        return valid(handle) ? records[handle.index].name : 0;
+    }
+
+    // storage size, call again whenever the owner reallocates
+    void setBytes(ResourceHandle handle, size_t bytes) {
+        if (!valid(handle)) return;
+        ResourceRecord& record = records[handle.index];
+        liveBytes = liveBytes - record.bytes + bytes;
+        record.bytes = bytes;
+    }
+
+    // the handle stops resolving now, the GL object goes once the GPU is done with this frame
+    void release(ResourceHandle& handle) {
+        if (!valid(handle)) return;
+        ResourceRecord& record = records[handle.index];
+        pending.push_back({ record.kind, record.name, 0 });
+        liveBytes -= record.bytes;
+        liveCount--;
+        record.live = false;
+        record.bytes = 0;
+        record.generation++;
+        if (record.generation == 0) record.generation = 1;
+        freeSlots.push_back(handle.index);
+        handle = ResourceHandle();
+    }
+
+    // once per frame after the frame's commands were submitted: fences this frame's releases and
+    // deletes the ones whose fence signaled
+    void endFrame() {
+        if (pending.empty()) return;
+        GLsync fence = 0;
+        for (PendingDeletion& deletion : pending) {
+            if (deletion.fence) continue;
+            if (!fence) fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            deletion.fence = fence;
+        }
+        size_t kept = 0;
+        GLsync checked = 0;
+        bool signaled = false;
+        for (size_t i = 0; i < pending.size(); i++) {
+            PendingDeletion& deletion = pending[i];
+            // releases of one frame share a fence and sit next to each other
+            if (deletion.fence != checked) {
+                if (checked && signaled) glDeleteSync(checked);
+                checked = deletion.fence;
+                signaled = deletion.fence != fence && glClientWaitSync(deletion.fence, 0, 0) != GL_TIMEOUT_EXPIRED;
+            }
+            if (signaled) {
+                deleteGlObject(deletion.kind, deletion.name);
+            } else {
+                pending[kept++] = deletion;
+            }
+        }
+        if (checked && signaled) glDeleteSync(checked);
+        pending.resize(kept);
+    }
+
+    // deletes everything waiting for a fence, at shutdown
+    void flush() {
+        glFinish();
+        GLsync last = 0;
+        for (PendingDeletion& deletion : pending) {
+            deleteGlObject(deletion.kind, deletion.name);
+            if (deletion.fence && deletion.fence != last) glDeleteSync(deletion.fence);
+            last = deletion.fence;
+        }
+        pending.clear();
+    }
+
+    size_t categoryBytes(const char* category) {
+        size_t bytes = 0;
+        for (const ResourceRecord& record : records) {
+            if (record.live && std::string(record.category) == category) bytes += record.bytes;
+        }
+        return bytes;
+    }
+
+    void report() {
+        std::map<std::string, std::pair<size_t, int>> byCategory;
+        size_t kindBytes[ResourceKindCount] = {};
+        int kindCount[ResourceKindCount] = {};
+        for (const ResourceRecord& record : records) {
+            if (!record.live) continue;
+            std::pair<size_t, int>& entry = byCategory[record.category];
+            entry.first += record.bytes;
+            entry.second++;
+            kindBytes[record.kind] += record.bytes;
+            kindCount[record.kind]++;
+        }
+        std::cout << "[gpu memory] " << liveCount << " objects, " << (liveBytes >> 10) << " KB live, " << pending.size()
+                  << " waiting for deletion" << std::endl;
+        for (const auto& entry : byCategory) {
+            std::cout << "[gpu memory]   " << entry.first << ": " << (entry.second.first >> 10) << " KB in "
+                      << entry.second.second << " objects" << std::endl;
+        }
+        for (int kind = 0; kind < ResourceKindCount; kind++) {
+            if (kindCount[kind] == 0) continue;
+            std::cout << "[gpu memory]   " << resourceKindName((ResourceKind) kind) << "s: " << (kindBytes[kind] >> 10)
+                      << " KB in " << kindCount[kind] << std::endl;
+        }
+    }
+
+    // everything still registered, returns how many
+    int leakReport() {
+        int leaks = 0;
+        for (const ResourceRecord& record : records) {
+            if (!record.live) continue;
+            leaks++;
+            std::cout << "[gpu leak] " << resourceKindName(record.kind) << " " << record.name << " (" << record.category
+                      << ", " << record.bytes << " bytes) created at " << record.file << ":" << record.line << std::endl;
+        }
+        if (leaks == 0) std::cout << "[gpu leak] none" << std::endl;
+        return leaks;
+    }
+};
+
+GpuResources gpuResources;
+
+#define GPU_CREATE(kind, category) gpuResources.create(kind, category, __FILE__, __LINE__)
+#define GPU_ADOPT(kind, name, category) gpuResources.adopt(kind, name, category, __FILE__, __LINE__)
+
+#endif /* resources_h */
@@ -0,0 +1,417 @@
+//
+//  shaders.h
+//  app
+//
+
+#ifndef shaders_h
+#define shaders_h
+
+#include <sys/stat.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <functional>
+#include "resources.h"
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+
+// Shader hot reload. Programs are built from files in the shader directory. When one of their
+// files changes the program is rebuilt in the background and only swapped in once it linked,
+// so the old program keeps rendering in the meantime and a broken edit never replaces it.
+//
+// Background compilation uses GL_KHR_parallel_shader_compile when the driver exposes it (compile
+// and link return immediately, completion is polled every frame). Otherwise a worker thread with
+// its own context, shared with the main one, does the compile and hands the program back behind
+// a fence.
+
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+typedef void (APIENTRYP PFNGLMAXSHADERCOMPILERTHREADSKHRPROC)(GLuint count);
+
+// shader directory, same checkout as the textures
+std::string shaderDirectory = "/Users/feresr/Workspace/learnOpenGL/app/shaders";
+
+time_t fileModificationTime(const std::string& path) {
+    struct stat info;
+    if (stat(path.c_str(), &info) != 0) return 0;
+    return info.st_mtime;
+}
+
+struct HotProgram {
+    std::string vertexFile;
+    std::string fragmentFile;
+    // full paths, resolved when the program is registered so polling doesn't build strings
+    std::string vertexPath;
+    std::string fragmentPath;
+    // program currently used for rendering, never 0 after the first successful build
+    unsigned int program = 0;
+    // registry entry of `program`
+    ResourceHandle resource;
+    // called with the new program bound, right after it replaced the old one (sampler units...)
+    std::function<void(unsigned int)> onSwap;
+    // optional source rewrite applied to both stages before compiling (variant specialization),
+    // may run on the worker thread
+    std::function<std::string(const std::string&)> transform;
+    // bumped every time a new program is swapped in
+    int generation = 0;
+
+    // background build in flight (KHR path), 0 when idle
+    unsigned int pendingProgram = 0;
+    unsigned int pendingVs = 0;
+    unsigned int pendingFs = 0;
+    // a build was started and its program isn't swapped in (or dropped) yet; edits meanwhile only
+    // leave `dirty` set, so they coalesce into one rebuild after it
+    bool inFlight = false;
+    bool dirty = false;
+    time_t vertexTime = 0;
+    time_t fragmentTime = 0;
+};
+
+bool readProgramSources(const HotProgram& hot, std::string& vertexSource, std::string& fragmentSource) {
+    if (!readFile(shaderDirectory + "/" + hot.vertexFile, vertexSource) ||
+        !readFile(shaderDirectory + "/" + hot.fragmentFile, fragmentSource)) {
+        return false;
+    }
+    if (hot.transform) {
+        vertexSource = hot.transform(vertexSource);
+        fragmentSource = hot.transform(fragmentSource);
+    }
+    return true;
+}
+
+struct CompiledProgram {
+    HotProgram* target;
+    unsigned int program;
+    GLsync fence;
+    bool ok;
+};
+
+bool programBuildSucceeded(unsigned int vs, unsigned int fs, unsigned int program, const std::string& name) {
+    int success;
+    char infoLog[512];
+    unsigned int shaders[] = { vs, fs };
+    for (unsigned int shader : shaders) {
+        glGetShaderiv(shader, GL_COMPILE_STATUS, &success);
+        if (!success) {
+            glGetShaderInfoLog(shader, 512, NULL, infoLog);
+            std::cout << "[shaders] " << name << " failed to compile, keeping the old program\n" << infoLog << std::endl;
+            return false;
+        }
+    }
+    glGetProgramiv(program, GL_LINK_STATUS, &success);
+    if (!success) {
+        glGetProgramInfoLog(program, 512, NULL, infoLog);
+        std::cout << "[shaders] " << name << " failed to link, keeping the old program\n" << infoLog << std::endl;
+        return false;
+    }
+    // no glValidateProgram: it checks the current draw state, and before onSwap assigns the sampler
+    // units every sampler is still on unit 0, which fails for programs mixing sampler types
+    return true;
+}
+
+// starts compile + link, which only blocks when the driver compiles synchronously
+unsigned int startProgramBuild(const std::string& vertexSource, const std::string& fragmentSource,
+                               unsigned int& vs, unsigned int& fs) {
+    const char* vertex = vertexSource.c_str();
+    const char* fragment = fragmentSource.c_str();
+    vs = glCreateShader(GL_VERTEX_SHADER);
+    glShaderSource(vs, 1, &vertex, NULL);
+    glCompileShader(vs);
+    fs = glCreateShader(GL_FRAGMENT_SHADER);
+    glShaderSource(fs, 1, &fragment, NULL);
+    glCompileShader(fs);
+    unsigned int program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    glLinkProgram(program);
+    return program;
+}
+
+void finishProgramBuild(unsigned int vs, unsigned int fs) {
+    glDeleteShader(vs);
+    glDeleteShader(fs);
+}
+
+struct ShaderReloader {
+    std::vector<HotProgram*> programs;
+    bool parallelCompile = false;
+    // off keeps every build on the render thread (GL capture only records that one)
+    bool useWorkerContext = true;
+
+    // shared context worker, only used without KHR_parallel_shader_compile
+    GLFWwindow* workerContext = NULL;
+    std::thread worker;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::deque<HotProgram*> jobs;
+    std::vector<CompiledProgram> finished;
+    // queued or compiling on the worker
+    int workerBuilds = 0;
+    bool stopping = false;
+    // programs swapped in so far, loads included
+    uint64_t swaps = 0;
+
+    int inotifyFd = -1;
+    std::chrono::steady_clock::time_point lastPoll;
+
+    // Call after the main context is current. Watching starts immediately.
+    void init(GLFWwindow* mainWindow) {
+        parallelCompile = glfwExtensionSupported("GL_KHR_parallel_shader_compile") ||
+                          glfwExtensionSupported("GL_ARB_parallel_shader_compile");
+        if (parallelCompile) {
+            PFNGLMAXSHADERCOMPILERTHREADSKHRPROC maxThreads =
+                (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) glfwGetProcAddress("glMaxShaderCompilerThreadsKHR");
+            if (!maxThreads) maxThreads = (PFNGLMAXSHADERCOMPILERTHREADSKHRPROC) glfwGetProcAddress("glMaxShaderCompilerThreadsARB");
+            if (maxThreads) maxThreads(0xFFFFFFFF); // let the driver pick
+        } else if (useWorkerContext) {
+            // windows have to be created on the main thread, the worker only makes it current
+            glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+            workerContext = glfwCreateWindow(1, 1, "shader compiler", NULL, mainWindow);
+            glfwMakeContextCurrent(mainWindow);
+            if (workerContext) {
+                worker = std::thread([this]() { workerLoop(); });
+            }
+        }
+        std::cout << "[shaders] background compile: "
+                  << (parallelCompile ? "KHR_parallel_shader_compile" : workerContext ? "shared context thread" : "none (blocking)")
+                  << std::endl;
+#ifdef __linux__
+        inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotifyFd >= 0) {
+            // watch the directory, editors usually save by renaming a temp file over the original
+            inotify_add_watch(inotifyFd, shaderDirectory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+        }
+#endif
+        lastPoll = std::chrono::steady_clock::now();
+    }
+
+    // Synchronous first build, at startup there is no old program to fall back to.
+    bool load(HotProgram& hot) {
+        std::string vertexSource, fragmentSource;
+        if (!readProgramSources(hot, vertexSource, fragmentSource)) {
+            std::cout << "[shaders] could not read " << hot.vertexFile << " / " << hot.fragmentFile
+                      << " in " << shaderDirectory << std::endl;
+            return false;
+        }
+        hot.vertexPath = shaderDirectory + "/" + hot.vertexFile;
+        hot.fragmentPath = shaderDirectory + "/" + hot.fragmentFile;
+        hot.vertexTime = fileModificationTime(hot.vertexPath);
+        hot.fragmentTime = fileModificationTime(hot.fragmentPath);
+        unsigned int vs = compileShader(GL_VERTEX_SHADER, vertexSource.c_str());
+        unsigned int fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource.c_str());
+        hot.program = createProgram(vs, fs);
+        hot.resource = GPU_ADOPT(ResourceProgram, hot.program, "shaders");
+        glDeleteShader(vs);
+        glDeleteShader(fs);
+        glUseProgram(hot.program);
+        if (hot.onSwap) hot.onSwap(hot.program);
+        hot.generation++;
+        swaps++;
+        programs.push_back(&hot);
+        return true;
+    }
+
+    // releases every registered program, at shutdown
+    void release() {
+        for (HotProgram* hot : programs) {
+            gpuResources.release(hot->resource);
+            hot->program = 0;
+        }
+    }
+
+    // Registers a program without building it, the first build happens in the background like a
+    // reload. `program` stays 0 until then, callers keep drawing with something else meanwhile.
+    void watch(HotProgram& hot) {
+        hot.vertexPath = shaderDirectory + "/" + hot.vertexFile;
+        hot.fragmentPath = shaderDirectory + "/" + hot.fragmentFile;
+        hot.vertexTime = fileModificationTime(hot.vertexPath);
+        hot.fragmentTime = fileModificationTime(hot.fragmentPath);
+        hot.dirty = true;
+        programs.push_back(&hot);
+    }
+
+    void shutdown() {
+        if (worker.joinable()) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            worker.join();
+        }
+        if (workerContext) glfwDestroyWindow(workerContext);
+#ifdef __linux__
+        if (inotifyFd >= 0) close(inotifyFd);
+#endif
+    }
+
+    // Once per frame on the render thread. Never waits on the GPU or the compiler.
+    void update() {
+        detectChanges();
+        for (HotProgram* hot : programs) {
+            if (hot->dirty && !hot->inFlight) {
+                hot->dirty = false;
+                startRebuild(*hot);
+            }
+        }
+        if (parallelCompile) {
+            pollParallelBuilds();
+        } else {
+            pollWorkerBuilds();
+        }
+    }
+
+    // a reload is waiting, compiling or not swapped in yet
+    bool building() {
+        for (HotProgram* hot : programs) {
+            if (hot->dirty || hot->inFlight) return true;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        return workerBuilds > 0 || !finished.empty();
+    }
+
+    void detectChanges() {
+#ifdef __linux__
+        if (inotifyFd >= 0) {
+            alignas(struct inotify_event) char buffer[4096];
+            ssize_t length;
+            while ((length = read(inotifyFd, buffer, sizeof(buffer))) > 0) {
+                for (char* p = buffer; p < buffer + length;) {
+                    struct inotify_event* event = (struct inotify_event*) p;
+                    if (event->len > 0) {
+                        for (HotProgram* hot : programs) {
+                            if (hot->vertexFile == event->name || hot->fragmentFile == event->name) hot->dirty = true;
+                        }
+                    }
+                    p += sizeof(struct inotify_event) + event->len;
+                }
+            }
+            return;
+        }
+#endif
+        // no inotify: stat the files a couple of times per second
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastPoll < std::chrono::milliseconds(500)) return;
+        lastPoll = now;
+        for (HotProgram* hot : programs) {
+            time_t vertexTime = fileModificationTime(hot->vertexPath);
+            time_t fragmentTime = fileModificationTime(hot->fragmentPath);
+            if (vertexTime != hot->vertexTime || fragmentTime != hot->fragmentTime) {
+                hot->vertexTime = vertexTime;
+                hot->fragmentTime = fragmentTime;
+                hot->dirty = true;
+            }
+        }
+    }
+
+    void startRebuild(HotProgram& hot) {
+        std::cout << "[shaders] reloading " << hot.vertexFile << " + " << hot.fragmentFile << std::endl;
+        if (!parallelCompile && workerContext) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(&hot);
+                workerBuilds++;
+            }
+            hot.inFlight = true;
+            wake.notify_one();
+            return;
+        }
+        std::string vertexSource, fragmentSource;
+        if (!readProgramSources(hot, vertexSource, fragmentSource)) {
+            return; // mid save, the next change event will retry
+        }
+        hot.pendingProgram = startProgramBuild(vertexSource, fragmentSource, hot.pendingVs, hot.pendingFs);
+        hot.inFlight = true;
+        if (!parallelCompile) {
+            // no background path at all, the build above already blocked
+            pollParallelBuilds();
+        }
+    }
+
+    void pollParallelBuilds() {
+        for (HotProgram* hot : programs) {
+            if (hot->pendingProgram == 0) continue;
+            int done = GL_TRUE;
+            if (parallelCompile) glGetProgramiv(hot->pendingProgram, GL_COMPLETION_STATUS_KHR, &done);
+            if (!done) continue;
+            bool ok = programBuildSucceeded(hot->pendingVs, hot->pendingFs, hot->pendingProgram, hot->fragmentFile);
+            finishProgramBuild(hot->pendingVs, hot->pendingFs);
+            swap(*hot, hot->pendingProgram, ok);
+            hot->pendingProgram = 0;
+            hot->inFlight = false;
+        }
+    }
+
+    void pollWorkerBuilds() {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (size_t i = 0; i < finished.size();) {
+            CompiledProgram& compiled = finished[i];
+            // the fence covers the worker's compile, once signaled the program is safe to use here
+            if (compiled.fence && glClientWaitSync(compiled.fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+                i++;
+                continue;
+            }
+            if (compiled.fence) glDeleteSync(compiled.fence);
+            // program 0: the sources couldn't be read, the next change event retries
+            if (compiled.program != 0) swap(*compiled.target, compiled.program, compiled.ok);
+            compiled.target->inFlight = false;
+            finished.erase(finished.begin() + i);
+        }
+    }
+
+    void swap(HotProgram& hot, unsigned int program, bool ok) {
+        if (!ok) {
+            glDeleteProgram(program);
+            return;
+        }
+        // draws already submitted may still use the old one
+        gpuResources.release(hot.resource);
+        hot.program = program;
+        hot.resource = GPU_ADOPT(ResourceProgram, program, "shaders");
+        glUseProgram(program);
+        if (hot.onSwap) hot.onSwap(program);
+        hot.generation++;
+        swaps++;
+        std::cout << "[shaders] swapped in program " << program << std::endl;
+    }
+
+    void workerLoop() {
+        glfwMakeContextCurrent(workerContext);
+        while (true) {
+            HotProgram* hot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [this]() { return stopping || !jobs.empty(); });
+                if (stopping) break;
+                hot = jobs.front();
+                jobs.pop_front();
+            }
+            std::string vertexSource, fragmentSource;
+            if (!readProgramSources(*hot, vertexSource, fragmentSource)) {
+                // still reported, the render thread owns the in flight flag
+                std::lock_guard<std::mutex> lock(mutex);
+                finished.push_back({ hot, 0, NULL, false });
+                workerBuilds--;
+                continue;
+            }
+            unsigned int vs, fs;
+            unsigned int program = startProgramBuild(vertexSource, fragmentSource, vs, fs);
+            bool ok = programBuildSucceeded(vs, fs, program, hot->fragmentFile);
+            finishProgramBuild(vs, fs);
+            GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+            glFlush();
+            std::lock_guard<std::mutex> lock(mutex);
+            finished.push_back({ hot, program, fence, ok });
+            workerBuilds--;
+        }
+        glfwMakeContextCurrent(NULL);
+    }
+};
+
+#endif /* shaders_h */
@@ -0,0 +1,139 @@
+#version 330 core
+
+// feature: TEXTURE_COUNT 0 1 2
+// feature: VERTEX_COLOR
+// feature: ALPHA_TEST
+// feature: LIGHTING
+// feature: SHADOWS
+// feature: MOTION_VECTORS
+
+uniform vec4 ucolor;
+#if TEXTURE_COUNT >= 1
+uniform sampler2D texture1;
+#endif
+#if TEXTURE_COUNT >= 2
+uniform sampler2D texture2;
+#endif
+
+#ifdef VERTEX_COLOR
+in vec3 incolor;
+#endif
+in vec2 texCoord;
+
+layout (location = 0) out vec4 fragmentColor;
+
+#ifdef MOTION_VECTORS
+in vec4 currentClip;
+in vec4 previousClip;
+// negative when rendering below output resolution, keeps texture detail at output resolution
+uniform float textureLodBias;
+layout (location = 1) out vec2 motion;
+#else
+const float textureLodBias = 0.0;
+#endif
+
+#ifdef LIGHTING
+// clustered lights, see lighting.h
+uniform samplerBuffer lightData;
+uniform usamplerBuffer lightGrid;
+uniform usamplerBuffer lightIndices;
+uniform ivec3 clusterDims;
+uniform vec4 clusterViewport;
+uniform vec2 clusterDepth;
+uniform vec3 ambient;
+uniform vec3 viewPosition;
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+
+in vec3 worldPosition;
+in vec3 worldNormal;
+in float viewDepth;
+
+#ifdef SHADOWS
+// cascaded sun shadows, see shadows.h
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[4];
+uniform vec4 cascadeSplits;
+
+float sunShadow(vec3 normal)
+{
+    // first cascade covering this depth whose (possibly older) map still contains the point
+    for (int cascade = 0; cascade < 4; cascade++) {
+        if (viewDepth > cascadeSplits[cascade]) continue;
+        vec3 offsetPosition = worldPosition + normal * 0.02 * float(cascade + 1);
+        vec4 projected = cascadeMatrices[cascade] * vec4(offsetPosition, 1.0);
+        vec3 coord = projected.xyz * 0.5 + 0.5;
+        if (any(lessThan(coord, vec3(0.0))) || any(greaterThan(coord, vec3(1.0)))) continue;
+        // 3x3 PCF on top of the hardware 2x2 compare
+        vec2 texel = 1.0 / vec2(textureSize(shadowMap, 0).xy);
+        float lit = 0.0;
+        for (int y = -1; y <= 1; y++) {
+            for (int x = -1; x <= 1; x++) {
+                lit += texture(shadowMap, vec4(coord.xy + vec2(x, y) * texel, float(cascade), coord.z));
+            }
+        }
+        return lit / 9.0;
+    }
+    return 1.0;
+}
+#endif
+
+vec3 shadeLights(vec3 albedo)
+{
+    vec2 screen = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+    ivec3 cell = ivec3(ivec2(screen * vec2(clusterDims.xy)), int(log(viewDepth) * clusterDepth.x + clusterDepth.y));
+    cell = clamp(cell, ivec3(0), clusterDims - 1);
+    uvec2 range = texelFetch(lightGrid, (cell.z * clusterDims.y + cell.y) * clusterDims.x + cell.x).xy;
+
+    vec3 normal = normalize(worldNormal);
+    vec3 toEye = normalize(viewPosition - worldPosition);
+    vec3 color = ambient * albedo;
+    float sun = max(dot(normal, -sunDirection), 0.0);
+#ifdef SHADOWS
+    if (sun > 0.0) sun *= sunShadow(normal);
+#endif
+    color += sunColor * albedo * sun;
+    for (uint i = 0u; i < range.y; i++) {
+        int light = int(texelFetch(lightIndices, int(range.x + i)).x) * 3;
+        vec4 positionRadius = texelFetch(lightData, light);
+        vec4 colorCosOuter = texelFetch(lightData, light + 1);
+        vec4 directionCosInner = texelFetch(lightData, light + 2);
+        vec3 toLight = positionRadius.xyz - worldPosition;
+        float distance = length(toLight);
+        if (distance >= positionRadius.w) continue;
+        vec3 l = toLight / distance;
+        // inverse square, windowed to reach zero at the radius
+        float window = clamp(1.0 - pow(distance / positionRadius.w, 4.0), 0.0, 1.0);
+        float attenuation = window * window / (distance * distance + 1.0);
+        attenuation *= smoothstep(colorCosOuter.w, directionCosInner.w, dot(-l, directionCosInner.xyz));
+        float diffuse = max(dot(normal, l), 0.0);
+        float specular = pow(max(dot(normal, normalize(l + toEye)), 0.0), 32.0) * 0.25;
+        color += colorCosOuter.rgb * attenuation * (albedo * diffuse + specular);
+    }
+    return color;
+}
+#endif
+
+void main()
+{
+#if TEXTURE_COUNT >= 2
+    fragmentColor = mix(texture(texture1, texCoord, textureLodBias), texture(texture2, texCoord, textureLodBias), ucolor.x);
+#elif TEXTURE_COUNT == 1
+    fragmentColor = texture(texture1, texCoord, textureLodBias);
+#else
+    fragmentColor = vec4(1.0);
+#endif
+#ifdef VERTEX_COLOR
+    fragmentColor.rgb *= incolor;
+#endif
+#ifdef ALPHA_TEST
+    if (fragmentColor.a < 0.5) discard;
+#endif
+#ifdef LIGHTING
+    fragmentColor.rgb = shadeLights(fragmentColor.rgb);
+#endif
+#ifdef MOTION_VECTORS
+    // uv units, what the resolve subtracts to find this point in last frame's output
+    motion = (currentClip.xy / currentClip.w - previousClip.xy / previousClip.w) * 0.5;
+#endif
+}
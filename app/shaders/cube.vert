@@ -0,0 +1,86 @@
+#version 330 core
+
+// feature: VERTEX_COLOR
+// feature: INSTANCING
+// feature: MODEL_BUFFER
+// feature: LIGHTING
+// feature: MOTION_VECTORS
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aColor;
+layout (location = 2) in vec2 aTexCoord;
+layout (location = 3) in vec3 aNormal;
+#ifdef INSTANCING
+layout (location = 4) in mat4 aModel;
+#endif
+
+#ifdef MODEL_BUFFER
+// world matrices of the transform hierarchy, 4 texels per matrix
+uniform samplerBuffer modelMatrices;
+uniform int modelIndex;
+#endif
+#if !defined(INSTANCING) && !defined(MODEL_BUFFER)
+uniform mat4 model;
+#endif
+uniform mat4 view;
+uniform mat4 projection;
+
+#ifdef VERTEX_COLOR
+out vec3 incolor;
+#endif
+out vec2 texCoord;
+// bit identical to depth.vert, the depth prepass relies on GL_EQUAL
+invariant gl_Position;
+#ifdef MOTION_VECTORS
+// unjittered clip positions this frame and last, for the temporal resolve
+uniform mat4 viewProjection;
+uniform mat4 previousViewProjection;
+#ifdef MODEL_BUFFER
+uniform samplerBuffer previousModelMatrices;
+#endif
+out vec4 currentClip;
+out vec4 previousClip;
+#endif
+#ifdef LIGHTING
+out vec3 worldPosition;
+out vec3 worldNormal;
+out float viewDepth;
+#endif
+
+void main()
+{
+#ifdef INSTANCING
+    mat4 model = aModel;
+#elif defined(MODEL_BUFFER)
+    int base = modelIndex * 4;
+    mat4 model = mat4(texelFetch(modelMatrices, base),
+                      texelFetch(modelMatrices, base + 1),
+                      texelFetch(modelMatrices, base + 2),
+                      texelFetch(modelMatrices, base + 3));
+#endif
+    vec4 world = model * vec4(aPos.x, aPos.y, aPos.z, 1.0);
+    vec4 eye = view * world;
+    gl_Position = projection * eye;
+    texCoord = aTexCoord;
+#ifdef LIGHTING
+    worldPosition = world.xyz;
+    // models only use uniform scale, no inverse transpose needed
+    worldNormal = mat3(model) * aNormal;
+    viewDepth = -eye.z;
+#endif
+#ifdef VERTEX_COLOR
+    incolor = aColor;
+#endif
+#ifdef MOTION_VECTORS
+#ifdef MODEL_BUFFER
+    mat4 previousModel = mat4(texelFetch(previousModelMatrices, base),
+                              texelFetch(previousModelMatrices, base + 1),
+                              texelFetch(previousModelMatrices, base + 2),
+                              texelFetch(previousModelMatrices, base + 3));
+#else
+    mat4 previousModel = model;
+#endif
+    currentClip = viewProjection * world;
+    previousClip = previousViewProjection * previousModel * vec4(aPos, 1.0);
+#endif
+}
@@ -0,0 +1,24 @@
+#version 330 core
+
+// depth prepass, gl_Position is computed exactly like in cube.vert
+
+layout (location = 0) in vec3 aPos;
+
+uniform samplerBuffer modelMatrices;
+uniform int modelIndex;
+uniform mat4 view;
+uniform mat4 projection;
+
+invariant gl_Position;
+
+void main()
+{
+    int base = modelIndex * 4;
+    mat4 model = mat4(texelFetch(modelMatrices, base),
+                      texelFetch(modelMatrices, base + 1),
+                      texelFetch(modelMatrices, base + 2),
+                      texelFetch(modelMatrices, base + 3));
+    vec4 world = model * vec4(aPos.x, aPos.y, aPos.z, 1.0);
+    vec4 eye = view * world;
+    gl_Position = projection * eye;
+}
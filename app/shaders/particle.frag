@@ -0,0 +1,19 @@
+#version 330 core
+
+in vec2 corner;
+in float age;
+
+uniform vec3 startColor;
+uniform vec3 endColor;
+uniform float opacity;
+
+layout (location = 0) out vec4 fragmentColor;
+
+void main()
+{
+    // round soft sprite that fades out with age
+    float r2 = dot(corner, corner);
+    if (r2 > 1.0) discard;
+    float alpha = (1.0 - r2) * (1.0 - age) * opacity;
+    fragmentColor = vec4(mix(startColor, endColor, age), alpha);
+}
@@ -0,0 +1,27 @@
+#version 330 core
+
+// one camera facing quad per particle instance, drawn as a 4 vertex triangle strip
+
+// xyz position, w age over life: 0 just born, dead at 1, not born yet below 0
+layout (location = 0) in vec4 particle;
+
+uniform mat4 view;
+uniform mat4 projection;
+uniform float size;
+
+out vec2 corner;
+out float age;
+
+void main()
+{
+    corner = vec2(gl_VertexID & 1, gl_VertexID >> 1) * 2.0 - 1.0;
+    age = particle.w;
+    vec4 eye = view * vec4(particle.xyz, 1.0);
+    // shrinks to half its size over its life
+    eye.xy += corner * size * (1.0 - 0.5 * particle.w);
+    gl_Position = projection * eye;
+    if (particle.w < 0.0 || particle.w >= 1.0) {
+        // outside the clip volume, nothing rasterized
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+    }
+}
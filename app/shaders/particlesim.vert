@@ -0,0 +1,76 @@
+#version 330 core
+
+// GPU particle backend: transform feedback runs this once per particle of the pool and captures the
+// next state. Same integration as the CPU backend in particles.h; dead particles respawn at the
+// emitter right away, so the pool stays full.
+
+// xyz, w age over life (below 0: not born yet)
+layout (location = 0) in vec4 position;
+// xyz, w age increase per second (1 / life)
+layout (location = 1) in vec4 velocity;
+
+out vec4 outPosition;
+out vec4 outVelocity;
+
+uniform float deltaTime;
+uniform vec3 gravity;
+uniform float dragFactor;
+uniform float swirlStrength;
+uniform float swirlFrequency;
+uniform float phase;
+uniform vec4 planes[4];
+uniform int planeCount;
+uniform float restitution;
+uniform vec3 emitterPosition;
+uniform vec3 emitterDirection;
+uniform float emitterSpread;
+uniform float emitterSpeed;
+uniform float emitterLife;
+uniform int seed;
+
+// 0..1, integer hash so large particle indices stay well distributed
+float random(uint n)
+{
+    n = (n << 13U) ^ n;
+    n = n * (n * n * 15731U + 789221U) + 1376312589U;
+    return float(n & 0x7fffffffU) / 2147483647.0;
+}
+
+// divergence free: no component depends on its own coordinate
+vec3 swirl(vec3 p)
+{
+    float f = swirlFrequency;
+    float g = 2.1 * swirlFrequency;
+    return vec3(sin(f * p.y + phase) + 0.5 * sin(g * p.z + 2.0 * phase),
+                sin(f * p.z + phase) + 0.5 * sin(g * p.x + 2.0 * phase),
+                sin(f * p.x + phase) + 0.5 * sin(g * p.y + 2.0 * phase));
+}
+
+void main()
+{
+    vec3 p = position.xyz;
+    vec3 v = velocity.xyz;
+    float rate = velocity.w;
+    float age = position.w + deltaTime * rate;
+    if (age >= 1.0) {
+        uint n = uint(gl_VertexID) * 8U + uint(seed) * 2654435761U;
+        vec3 jitter = vec3(random(n), random(n + 1U), random(n + 2U)) * 2.0 - 1.0;
+        v = normalize(emitterDirection + emitterSpread * jitter) * emitterSpeed * (0.8 + 0.4 * random(n + 3U));
+        p = emitterPosition;
+        rate = 1.0 / (emitterLife * (0.75 + 0.5 * random(n + 4U)));
+        age = 0.0;
+    } else if (age >= 0.0) {
+        v = (v + (gravity + swirl(p) * swirlStrength) * deltaTime) * dragFactor;
+        p += v * deltaTime;
+        for (int i = 0; i < planeCount; i++) {
+            float d = dot(planes[i].xyz, p) + planes[i].w;
+            if (d < 0.0) {
+                p -= planes[i].xyz * d;
+                float vn = dot(planes[i].xyz, v);
+                if (vn < 0.0) v -= planes[i].xyz * ((1.0 + restitution) * vn);
+            }
+        }
+    }
+    outPosition = vec4(p, age);
+    outVelocity = vec4(v, rate);
+}
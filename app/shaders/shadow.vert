@@ -0,0 +1,19 @@
+#version 330 core
+
+// depth only pass for the shadow cascades, world matrices come from the hierarchy buffer
+
+layout (location = 0) in vec3 aPos;
+
+uniform samplerBuffer modelMatrices;
+uniform int modelIndex;
+uniform mat4 lightViewProjection;
+
+void main()
+{
+    int base = modelIndex * 4;
+    mat4 model = mat4(texelFetch(modelMatrices, base),
+                      texelFetch(modelMatrices, base + 1),
+                      texelFetch(modelMatrices, base + 2),
+                      texelFetch(modelMatrices, base + 3));
+    gl_Position = lightViewProjection * model * vec4(aPos, 1.0);
+}
@@ -0,0 +1,115 @@
+#version 330 core
+
+// Temporal upsampling resolve, see temporal.h. One invocation per output pixel: gathers the
+// jittered scene samples around it, reprojects last frame's output along the motion vector, clips
+// it to the neighbourhood's color range and blends. Colors are clipped in YCoCg.
+
+in vec2 uv;
+out vec4 result;
+
+// jittered scene at render size
+uniform sampler2D sceneColor;
+// uv offset since last frame, render size
+uniform sampler2D sceneMotion;
+// last frame's output, output size
+uniform sampler2D history;
+uniform vec2 renderSize;
+// render pixels the projection was offset by this frame
+uniform vec2 jitter;
+uniform float historyValid;
+
+vec3 toYCoCg(vec3 c)
+{
+    return vec3(dot(c, vec3(0.25, 0.5, 0.25)), dot(c, vec3(0.5, 0.0, -0.5)), dot(c, vec3(-0.25, 0.5, -0.25)));
+}
+
+vec3 fromYCoCg(vec3 c)
+{
+    return vec3(c.x + c.y - c.z, c.x + c.z, c.x - c.y - c.z);
+}
+
+// Catmull-Rom through 9 bilinear taps, keeps the history from blurring a little more every frame
+vec3 sampleHistory(vec2 coord)
+{
+    vec2 size = vec2(textureSize(history, 0));
+    vec2 position = coord * size;
+    vec2 center = floor(position - 0.5) + 0.5;
+    vec2 f = position - center;
+    vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));
+    vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);
+    vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));
+    vec2 w3 = f * f * (-0.5 + 0.5 * f);
+    vec2 w12 = w1 + w2;
+    vec2 t0 = (center - 1.0) / size;
+    vec2 t12 = (center + w2 / w12) / size;
+    vec2 t3 = (center + 2.0) / size;
+    vec3 color = texture(history, vec2(t0.x, t0.y)).rgb * w0.x * w0.y;
+    color += texture(history, vec2(t12.x, t0.y)).rgb * w12.x * w0.y;
+    color += texture(history, vec2(t3.x, t0.y)).rgb * w3.x * w0.y;
+    color += texture(history, vec2(t0.x, t12.y)).rgb * w0.x * w12.y;
+    color += texture(history, vec2(t12.x, t12.y)).rgb * w12.x * w12.y;
+    color += texture(history, vec2(t3.x, t12.y)).rgb * w3.x * w12.y;
+    color += texture(history, vec2(t0.x, t3.y)).rgb * w0.x * w3.y;
+    color += texture(history, vec2(t12.x, t3.y)).rgb * w12.x * w3.y;
+    color += texture(history, vec2(t3.x, t3.y)).rgb * w3.x * w3.y;
+    return max(color, vec3(0.0));
+}
+
+void main()
+{
+    // this pixel's center in render pixels and the scene sample that landed closest to it
+    vec2 position = uv * renderSize;
+    ivec2 nearest = ivec2(floor(position + jitter));
+    ivec2 limit = ivec2(renderSize) - 1;
+
+    vec3 sum = vec3(0.0);
+    float weightSum = 0.0;
+    float nearestWeight = 0.0;
+    vec3 mean = vec3(0.0);
+    vec3 square = vec3(0.0);
+    vec2 motion = vec2(0.0);
+    float longest = -1.0;
+    for (int y = -1; y <= 1; y++) {
+        for (int x = -1; x <= 1; x++) {
+            ivec2 texel = clamp(nearest + ivec2(x, y), ivec2(0), limit);
+            vec3 color = toYCoCg(texelFetch(sceneColor, texel, 0).rgb);
+            // where the sample sits once the jitter is taken out
+            vec2 offset = vec2(texel) + 0.5 - jitter - position;
+            float weight = exp(-2.29 * dot(offset, offset));
+            if (x == 0 && y == 0) nearestWeight = weight;
+            sum += color * weight;
+            weightSum += weight;
+            mean += color;
+            square += color * color;
+            // longest vector around, so edges of moving objects reproject with the object
+            vec2 texelMotion = texelFetch(sceneMotion, texel, 0).xy;
+            float length2 = dot(texelMotion, texelMotion);
+            if (length2 > longest) {
+                longest = length2;
+                motion = texelMotion;
+            }
+        }
+    }
+    vec3 current = sum / max(weightSum, 1e-5);
+    mean /= 9.0;
+    vec3 deviation = sqrt(max(square / 9.0 - mean * mean, vec3(0.0)));
+
+    vec2 previousUv = uv - motion;
+    if (historyValid == 0.0 || any(lessThan(previousUv, vec2(0.0))) || any(greaterThan(previousUv, vec2(1.0)))) {
+        result = vec4(fromYCoCg(current), 1.0);
+        return;
+    }
+    vec3 previous = toYCoCg(sampleHistory(previousUv));
+
+    // variance clipping: pull the history towards the mean until it's inside mean +- deviation
+    vec3 extent = deviation * 1.25 + vec3(1.0 / 512.0);
+    vec3 fromMean = previous - mean;
+    vec3 units = abs(fromMean) / extent;
+    float outside = max(units.x, max(units.y, units.z));
+    if (outside > 1.0) previous = mean + fromMean / outside;
+
+    // this frame counts more where a sample landed right on the pixel and where things move fast
+    float speed = length(motion * vec2(textureSize(history, 0)));
+    float alpha = clamp(mix(0.03, 0.15, nearestWeight) + speed * 0.01, 0.03, 0.5);
+    result = vec4(fromYCoCg(mix(previous, current, alpha)), 1.0);
+}
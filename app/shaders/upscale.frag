@@ -0,0 +1,30 @@
+#version 330 core
+
+// Dynamic resolution upscale: bilinear stretch of the scene target plus contrast adaptive
+// sharpening. The cross of source texels around the sample is pushed away from its neighbours,
+// less where the neighbourhood already spans most of the range so edges don't ring.
+
+in vec2 uv;
+out vec4 FragColor;
+
+uniform sampler2D scene;
+// 1 / render target size
+uniform vec2 sourceTexel;
+// 0 plain bilinear, 1 strongest
+uniform float sharpness;
+
+void main()
+{
+    vec3 c = texture(scene, uv).rgb;
+    vec3 n = texture(scene, uv + vec2(0.0, sourceTexel.y)).rgb;
+    vec3 s = texture(scene, uv - vec2(0.0, sourceTexel.y)).rgb;
+    vec3 e = texture(scene, uv + vec2(sourceTexel.x, 0.0)).rgb;
+    vec3 w = texture(scene, uv - vec2(sourceTexel.x, 0.0)).rgb;
+    vec3 low = min(c, min(min(n, s), min(e, w)));
+    vec3 high = max(c, max(max(n, s), max(e, w)));
+    // headroom left before clipping, relative to the local maximum
+    vec3 amount = sqrt(clamp(min(low, 1.0 - high) / max(high, vec3(1.0 / 256.0)), 0.0, 1.0));
+    vec3 weight = -amount * sharpness * 0.2;
+    vec3 result = (c + weight * (n + s + e + w)) / (1.0 + 4.0 * weight);
+    FragColor = vec4(clamp(result, 0.0, 1.0), 1.0);
+}
@@ -0,0 +1,319 @@
+//
+//  shadows.h
+//  app
+//
+
+#ifndef shadows_h
+#define shadows_h
+
+#include <stdint.h>
+#include <math.h>
+#include <vector>
+#include "shaders.h"
+#include "hierarchy.h"
+#include "batching.h"
+#include <glm/gtc/type_ptr.hpp>
+
+// Cascaded shadow maps for the directional sun light.
+//
+// The camera frustum up to shadowDistance is split into cascadeCount slices (log/uniform blend).
+// Each cascade is an orthographic box around its slice's bounding sphere, in a light space with a
+// fixed origin, and the box position is snapped to whole texels: while the camera moves less than
+// a texel the matrix stays bit for bit the same, so edges don't shimmer and the map can be kept.
+//
+// A cascade is only re-rendered when its matrix changed or a caster inside its box moved (seen
+// through the hierarchy's changed ranges). Cascades from farCascadeStart on are refreshed
+// round-robin, one per frame, and keep sampling their last map with the matrix it was rendered
+// with until their turn comes.
+
+const int cascadeCount = 4;
+const int farCascadeStart = 2;
+const int shadowMapSize = 2048;
+const float shadowDistance = 40.0f;
+// how far towards the light from a cascade's slice casters are still picked up
+const float shadowCasterMargin = 30.0f;
+// unit cube meshes, bounding sphere radius before scale
+const float casterRadius = 0.87f;
+
+struct CascadeStats {
+    int casterDraws = 0;
+    double cpuMilliseconds = 0.0;
+    double gpuMilliseconds = 0.0;
+    // frames the current map has been reused for
+    int cachedFrames = 0;
+};
+
+struct ShadowCascade {
+    // matrix the map was rendered with, the main pass samples with this one
+    glm::mat4 lightViewProjection = glm::mat4(1.0f);
+    // box in light view space: xy extents, z range (more negative is further from the light)
+    glm::vec3 boxMin = glm::vec3(0.0f);
+    glm::vec3 boxMax = glm::vec3(0.0f);
+    float splitFar = 0.0f;
+    bool dirty = true;
+    bool valid = false;
+    ResourceHandle timer;
+    bool timerPending = false;
+    CascadeStats stats;
+};
+
+struct CascadedShadows {
+    glm::vec3 sunDirection = glm::normalize(glm::vec3(-0.4f, -1.0f, -0.3f));
+    glm::vec3 sunColor = glm::vec3(0.8f, 0.75f, 0.7f);
+    ShadowCascade cascades[cascadeCount];
+    HotProgram program;
+    ResourceHandle depthTexture;
+    ResourceHandle framebuffer;
+    uint64_t frame = 0;
+
+    glm::mat4 lightView = glm::mat4(1.0f);
+    glm::vec3 renderedSunDirection = glm::vec3(0.0f);
+    // light view space center of every slot as of the last caster check, to notice casters leaving
+    std::vector<glm::vec3> lastCenters;
+
+    bool init(ShaderReloader& reloader) {
+        program.vertexFile = "shadow.vert";
+        program.fragmentFile = "shadow.frag";
+        program.onSwap = [](unsigned int program) {
+            glUniform1i(glGetUniformLocation(program, "modelMatrices"), 2);
+        };
+        if (!reloader.load(program)) return false;
+
+        depthTexture = GPU_CREATE(ResourceTexture, "shadows");
+        glBindTexture(GL_TEXTURE_2D_ARRAY, gpuResources.name(depthTexture));
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, shadowMapSize, shadowMapSize, cascadeCount, 0,
+                     GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
+        // drivers pad 24 bit depth to 4 bytes
+        gpuResources.setBytes(depthTexture, (size_t) shadowMapSize * shadowMapSize * 4 * cascadeCount);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        // hardware depth compare, the shader samples with sampler2DArrayShadow
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+
+        framebuffer = GPU_CREATE(ResourceFramebuffer, "shadows");
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(framebuffer));
+        glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, gpuResources.name(depthTexture), 0, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        bool complete = glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        if (!complete) {
+            std::cout << "[shadows] shadow framebuffer incomplete" << std::endl;
+            return false;
+        }
+        for (ShadowCascade& cascade : cascades) cascade.timer = GPU_CREATE(ResourceQuery, "shadows");
+        return true;
+    }
+
+    void release() {
+        for (ShadowCascade& cascade : cascades) gpuResources.release(cascade.timer);
+        gpuResources.release(framebuffer);
+        gpuResources.release(depthTexture);
+    }
+
+    // Fits every cascade to its slice of the camera frustum and marks the ones that need a new map.
+    void fit(const glm::mat4& view, const glm::mat4& projection, float near) {
+        if (sunDirection != renderedSunDirection) {
+            // light space origin stays at the world origin so snapping is stable
+            glm::vec3 up = fabsf(sunDirection.y) > 0.99f ? glm::vec3(1.0f, 0.0f, 0.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            lightView = glm::lookAt(glm::vec3(0.0f), sunDirection, up);
+            renderedSunDirection = sunDirection;
+            for (ShadowCascade& cascade : cascades) cascade.dirty = true;
+        }
+        glm::mat4 cameraToWorld = glm::inverse(view);
+        glm::mat4 cameraToLight = lightView * cameraToWorld;
+        float tanX = 1.0f / projection[0][0];
+        float tanY = 1.0f / projection[1][1];
+        float splitNear = near;
+        for (int c = 0; c < cascadeCount; c++) {
+            // practical split scheme, mostly logarithmic
+            float t = float(c + 1) / cascadeCount;
+            float logSplit = near * powf(shadowDistance / near, t);
+            float uniformSplit = near + (shadowDistance - near) * t;
+            float splitFar = 0.75f * logSplit + 0.25f * uniformSplit;
+
+            // bounding sphere of the slice, its radius only depends on the split so it doesn't
+            // change when the camera turns
+            glm::vec3 center = glm::vec3(0.0f);
+            glm::vec3 corners[8];
+            for (int i = 0; i < 8; i++) {
+                float depth = (i & 4) ? splitFar : splitNear;
+                glm::vec3 corner = glm::vec3((i & 1 ? 1.0f : -1.0f) * tanX * depth, (i & 2 ? 1.0f : -1.0f) * tanY * depth, -depth);
+                corners[i] = corner;
+                center += corner;
+            }
+            center = center / 8.0f;
+            float radius = 0.0f;
+            for (int i = 0; i < 8; i++) radius = fmaxf(radius, glm::length(corners[i] - center));
+            radius = ceilf(radius * 16.0f) / 16.0f;
+
+            glm::vec4 lightCenter = cameraToLight * glm::vec4(center, 1.0f);
+            float texel = 2.0f * radius / shadowMapSize;
+            float x = floorf(lightCenter.x / texel) * texel;
+            float y = floorf(lightCenter.y / texel) * texel;
+            // depth only needs to cover the casters, a coarse step keeps the matrix stable
+            float zStep = radius * 0.25f;
+            float z = floorf(lightCenter.z / zStep) * zStep;
+            // +z points at the light, casters up to shadowCasterMargin in front of the slice count
+            glm::vec3 boxMin = glm::vec3(x - radius, y - radius, z - radius - zStep);
+            glm::vec3 boxMax = glm::vec3(x + radius, y + radius, z + radius + zStep + shadowCasterMargin);
+
+            ShadowCascade& cascade = cascades[c];
+            cascade.splitFar = splitFar;
+            if (boxMin != cascade.boxMin || boxMax != cascade.boxMax) {
+                cascade.boxMin = boxMin;
+                cascade.boxMax = boxMax;
+                cascade.dirty = true;
+            }
+            splitNear = splitFar;
+        }
+    }
+
+    // marks cascades whose box a moved caster is in, or was in before it moved
+    void checkCasters(const TransformHierarchy& hierarchy) {
+        if (lastCenters.size() < hierarchy.size()) lastCenters.resize(hierarchy.size(), glm::vec3(1e30f));
+        for (const SlotRange& range : hierarchy.changedRanges) {
+            for (uint32_t slot = range.begin; slot < range.end; slot++) {
+                const glm::mat4& world = hierarchy.world[slot];
+                float scale = fmaxf(glm::length(glm::vec3(world[0])), fmaxf(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+                float radius = casterRadius * scale;
+                glm::vec3 center = glm::vec3(lightView * world[3]);
+                for (ShadowCascade& cascade : cascades) {
+                    if (cascade.dirty) continue;
+                    if (overlaps(cascade, center, radius) || overlaps(cascade, lastCenters[slot], radius)) cascade.dirty = true;
+                }
+                lastCenters[slot] = center;
+            }
+        }
+    }
+
+    // marks cascades a world space sphere is in, for casters that changed outside the hierarchy
+    void markCaster(const glm::vec3& center, float radius) {
+        glm::vec3 lightCenter = glm::vec3(lightView * glm::vec4(center, 1.0f));
+        for (ShadowCascade& cascade : cascades) {
+            if (!cascade.dirty && overlaps(cascade, lightCenter, radius)) cascade.dirty = true;
+        }
+    }
+
+    static bool overlaps(const ShadowCascade& cascade, const glm::vec3& center, float radius) {
+        return center.x + radius >= cascade.boxMin.x && center.x - radius <= cascade.boxMax.x &&
+               center.y + radius >= cascade.boxMin.y && center.y - radius <= cascade.boxMax.y &&
+               center.z + radius >= cascade.boxMin.z && center.z - radius <= cascade.boxMax.z;
+    }
+
+    // Renders the cascades that need it. `draws` is the frame's draw list (anything with a `mesh`
+    // and a hierarchy `slot`, static batches also carry a world space `center` and `radius`); the
+    // caller's framebuffer and viewport are restored afterwards.
+    template <typename Draws>
+    void render(const Draws& draws, const TransformHierarchy& hierarchy, unsigned int modelBuffer) {
+        frame++;
+        if (program.program == 0) return;
+        GLint previousFramebuffer = 0;
+        GLint viewport[4];
+        glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previousFramebuffer);
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        bool bound = false;
+
+        // near cascades whenever they are dirty, far cascades take turns
+        int farTurn = farCascadeStart + int(frame % (cascadeCount - farCascadeStart));
+        for (int c = 0; c < cascadeCount; c++) {
+            ShadowCascade& cascade = cascades[c];
+            collectTimer(cascade);
+            bool due = c < farCascadeStart || c == farTurn || !cascade.valid;
+            if (!cascade.dirty || !due) {
+                cascade.stats.cachedFrames++;
+                continue;
+            }
+            if (!bound) {
+                bound = true;
+                glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(framebuffer));
+                glViewport(0, 0, shadowMapSize, shadowMapSize);
+                glUseProgram(program.program);
+                glActiveTexture(GL_TEXTURE2);
+                glBindTexture(GL_TEXTURE_BUFFER, modelBuffer);
+                glEnable(GL_POLYGON_OFFSET_FILL);
+                glPolygonOffset(2.0f, 4.0f);
+            }
+            double start = glfwGetTime();
+            bool timing = !cascade.timerPending;
+            if (timing) glBeginQuery(GL_TIME_ELAPSED, gpuResources.name(cascade.timer));
+
+            glm::mat4 lightProjection = glm::ortho(cascade.boxMin.x, cascade.boxMax.x, cascade.boxMin.y, cascade.boxMax.y,
+                                                   -cascade.boxMax.z, -cascade.boxMin.z);
+            cascade.lightViewProjection = lightProjection * lightView;
+            glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, gpuResources.name(depthTexture), 0, c);
+            glClear(GL_DEPTH_BUFFER_BIT);
+            glUniformMatrix4fv(glGetUniformLocation(program.program, "lightViewProjection"), 1, GL_FALSE,
+                               glm::value_ptr(cascade.lightViewProjection));
+            int modelIndexLoc = glGetUniformLocation(program.program, "modelIndex");
+            unsigned int boundVao = 0;
+            int casterDraws = 0;
+            for (const auto& draw : draws) {
+                if (draw.radius > 0.0f) {
+                    if (!overlaps(cascade, glm::vec3(lightView * glm::vec4(draw.center, 1.0f)), draw.radius)) continue;
+                } else {
+                    const glm::mat4& world = hierarchy.world[draw.slot];
+                    float scale = fmaxf(glm::length(glm::vec3(world[0])), fmaxf(glm::length(glm::vec3(world[1])), glm::length(glm::vec3(world[2]))));
+                    if (!overlaps(cascade, glm::vec3(lightView * world[3]), casterRadius * scale)) continue;
+                }
+                if (draw.mesh.positionVao != boundVao) {
+                    boundVao = draw.mesh.positionVao;
+                    glBindVertexArray(boundVao);
+                }
+                glUniform1i(modelIndexLoc, (int) draw.slot);
+                drawMesh(draw.mesh);
+                casterDraws++;
+            }
+
+            if (timing) {
+                glEndQuery(GL_TIME_ELAPSED);
+                cascade.timerPending = true;
+            }
+            cascade.stats.casterDraws = casterDraws;
+            cascade.stats.cpuMilliseconds = (glfwGetTime() - start) * 1000.0;
+            cascade.stats.cachedFrames = 0;
+            cascade.dirty = false;
+            cascade.valid = true;
+        }
+
+        if (bound) {
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glBindFramebuffer(GL_FRAMEBUFFER, previousFramebuffer);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+    }
+
+    // picks up the GPU time of the cascade's last render once it's ready, never waits
+    void collectTimer(ShadowCascade& cascade) {
+        if (!cascade.timerPending) return;
+        GLint available = 0;
+        glGetQueryObjectiv(gpuResources.name(cascade.timer), GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) return;
+        GLuint64 nanoseconds = 0;
+        glGetQueryObjectui64v(gpuResources.name(cascade.timer), GL_QUERY_RESULT, &nanoseconds);
+        cascade.stats.gpuMilliseconds = nanoseconds / 1e6;
+        cascade.timerPending = false;
+    }
+
+    // shadow map on `unit` plus the cascade uniforms for the SHADOWS feature
+    void bind(unsigned int shaderProgram, int unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D_ARRAY, gpuResources.name(depthTexture));
+        glm::mat4 matrices[cascadeCount];
+        float splits[cascadeCount];
+        for (int c = 0; c < cascadeCount; c++) {
+            matrices[c] = cascades[c].lightViewProjection;
+            splits[c] = cascades[c].valid ? cascades[c].splitFar : 0.0f;
+        }
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "cascadeMatrices"), cascadeCount, GL_FALSE,
+                           glm::value_ptr(matrices[0]));
+        glUniform4f(glGetUniformLocation(shaderProgram, "cascadeSplits"), splits[0], splits[1], splits[2], splits[3]);
+        glUniform3f(glGetUniformLocation(shaderProgram, "sunDirection"), sunDirection.x, sunDirection.y, sunDirection.z);
+        glUniform3f(glGetUniformLocation(shaderProgram, "sunColor"), sunColor.x, sunColor.y, sunColor.z);
+    }
+};
+
+#endif /* shadows_h */
@@ -0,0 +1,410 @@
+//
+//  streaming.h
+//  app
+//
+
+#ifndef streaming_h
+#define streaming_h
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <mutex>
+#include "jobs.h"
+#include "resources.h"
+#include "decode.h"
+#include "mipmap.h"
+#include "texcompress.h"
+
+// Mip level texture streaming under a byte budget.
+//
+// A streamed texture only has its finest *needed* levels in video memory. Its GL texture holds
+// levels [residentLevel, levelCount) in immutable storage (glTexStorage2D where the driver has it,
+// every level allocated up front with glTexImage2D otherwise), so gaining or dropping a level
+// means allocating a new texture and copying the levels both share on the GPU.
+//
+// Every frame the renderer reports how many pixels a texture covers on screen; that picks the
+// level it wants. update() then evicts levels from the least recently used textures (those with
+// more detail than they want first) while over budget, and uploads the next finer level of
+// textures that want more. The first time a texture is wanted a job decodes its file, filters the
+// whole chain down (mipmap.h) and block compresses it (texcompress.h) into the format
+// chooseTextureFormat() picks for the image; the texture keeps that chain on the CPU and every
+// later level, evicted ones coming back included, is uploaded from it without decoding again.
+// Until its tail arrives a texture samples a 1x1 grey fallback.
+//
+// Budgets count bytes in the texture's format, known by the time anything is uploaded. GL 3.3
+// can't copy between compressed textures on the GPU, so a compressed texture's next allocation
+// gets its resident levels from the chain too (an eighth to a quarter of the RGBA8 size).
+
+// levels at or below this size are always resident once loaded
+const int streamingTailSize = 64;
+
+struct StreamedTexture {
+    std::string path;
+    bool flip = false;
+    int width = 0;
+    int height = 0;
+    int levelCount = 0;
+    // finest level in video memory, levelCount when nothing is
+    int residentLevel = 0;
+    // coarsest level that still gets streamed, the tail below it stays resident
+    int tailLevel = 0;
+    int desiredLevel = 0;
+    float screenPixels = 0.0f;
+    ResourceHandle texture;
+    uint64_t lastUsed = 0;
+    bool loading = false;
+    bool failed = false;
+    TextureFormat format = TextureRGBA8;
+    size_t residentBytes = 0;
+    // every level in `format` once the first load finished, indexed by level
+    std::vector<std::vector<unsigned char>> chain;
+};
+
+// a texture's whole chain on its way from a worker
+struct StreamedLevels {
+    int texture;
+    TextureFormat format;
+    // RGBA8 texels or compressed blocks, indexed by level
+    std::vector<std::vector<unsigned char>> pixels;
+    bool failed;
+};
+
+size_t mipBytes(const StreamedTexture& texture, int level) {
+    return textureLevelBytes(texture.format, mipDimension(texture.width, level), mipDimension(texture.height, level));
+}
+
+struct TextureStreamer {
+    std::vector<StreamedTexture> textures;
+    size_t budget = 256u << 20;
+    size_t residentBytes = 0;
+    // at most this many bytes of new levels uploaded per frame
+    size_t uploadBytesPerFrame = 8u << 20;
+    int maxLoadsInFlight = 2;
+    // block compress where the driver takes the format
+    bool compress = true;
+    CompressQuality compressQuality = CompressNormal;
+    CompressedFormatSupport formats;
+    // every texture wants level 0 regardless of screen size (regression runs)
+    bool pinFullResolution = false;
+    uint64_t frame = 0;
+    ResourceHandle fallback;
+    ResourceHandle copyFramebuffer;
+
+    std::mutex mutex;
+    std::vector<StreamedLevels> completed;
+    int loadsInFlight = 0;
+
+    // stats
+    uint64_t levelsStreamed = 0;
+    uint64_t levelsEvicted = 0;
+    size_t peakResidentBytes = 0;
+    // what the resident levels would take as RGBA8
+    size_t uncompressedBytes = 0;
+    // the chains kept on the CPU
+    size_t cachedBytes = 0;
+
+    void init() {
+        unsigned char grey[4] = { 128, 128, 128, 255 };
+        fallback = GPU_CREATE(ResourceTexture, "textures");
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(fallback));
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        gpuResources.setBytes(fallback, 4);
+        copyFramebuffer = GPU_CREATE(ResourceFramebuffer, "textures");
+        formats.query();
+    }
+
+    void release() {
+        for (StreamedTexture& texture : textures) {
+            gpuResources.release(texture.texture);
+            texture.chain.clear();
+        }
+        residentBytes = 0;
+        uncompressedBytes = 0;
+        cachedBytes = 0;
+        gpuResources.release(copyFramebuffer);
+        gpuResources.release(fallback);
+    }
+
+    // only reads the file header; pixels arrive later on a worker
+    int add(const std::string& path, bool flip) {
+        StreamedTexture texture;
+        texture.path = path;
+        texture.flip = flip;
+        int channels;
+        if (!stbi_info(path.c_str(), &texture.width, &texture.height, &channels)) {
+            std::cout << "Failed to load texture: " << path << std::endl;
+            texture.failed = true;
+        } else {
+            int largest = texture.width > texture.height ? texture.width : texture.height;
+            texture.levelCount = (int) floor(log2((double) largest)) + 1;
+            texture.tailLevel = 0;
+            while (texture.tailLevel + 1 < texture.levelCount && (largest >> texture.tailLevel) > streamingTailSize) {
+                texture.tailLevel++;
+            }
+        }
+        texture.residentLevel = texture.levelCount;
+        texture.desiredLevel = texture.tailLevel;
+        textures.push_back(texture);
+        return (int) textures.size() - 1;
+    }
+
+    // how many pixels the texture's full 0..1 uv range covers on screen this frame
+    void request(int id, float screenPixels) {
+        StreamedTexture& texture = textures[id];
+        if (screenPixels > texture.screenPixels) texture.screenPixels = screenPixels;
+    }
+
+    void bind(int unit, int id) {
+        StreamedTexture& texture = textures[id];
+        texture.lastUsed = frame;
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(gpuResources.valid(texture.texture) ? texture.texture : fallback));
+    }
+
+    // once per frame, before rendering
+    void update() {
+        frame++;
+        for (StreamedTexture& texture : textures) {
+            if (texture.failed) continue;
+            // one texel per pixel: the level whose size matches the on screen size
+            int wanted = texture.tailLevel;
+            if (texture.screenPixels > 0.0f) {
+                float largest = (float) (texture.width > texture.height ? texture.width : texture.height);
+                wanted = (int) floorf(log2f(fmaxf(largest / texture.screenPixels, 1.0f)));
+            }
+            if (pinFullResolution) wanted = 0;
+            texture.desiredLevel = wanted < texture.tailLevel ? wanted : texture.tailLevel;
+            texture.screenPixels = 0.0f;
+        }
+
+        integrateCompleted();
+        while (residentBytes > budget && evictOne(true)) {}
+        scheduleLoads();
+        if (residentBytes > peakResidentBytes) peakResidentBytes = residentBytes;
+    }
+
+    // streams until every texture reached the level it wants (or the budget ran out), for
+    // reproducible frames
+    void settle() {
+        uint64_t streamed;
+        do {
+            streamed = levelsStreamed;
+            update();
+            if (loadsInFlight > 0) jobs.waitIdle();
+        } while (loadsInFlight > 0 || levelsStreamed != streamed);
+    }
+
+    // keeps the chains finished loads brought, scheduleLoads() uploads from them
+    void integrateCompleted() {
+        std::vector<StreamedLevels> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (completed.empty()) return;
+            ready.swap(completed);
+        }
+        for (StreamedLevels& levels : ready) {
+            StreamedTexture& texture = textures[levels.texture];
+            loadsInFlight--;
+            texture.loading = false;
+            if (levels.failed) {
+                std::cout << "Failed to load texture: " << texture.path << std::endl;
+                texture.failed = true;
+                continue;
+            }
+            texture.format = levels.format;
+            texture.chain.swap(levels.pixels);
+            for (const std::vector<unsigned char>& level : texture.chain) cachedBytes += level.size();
+        }
+    }
+
+    // sampled last frame
+    bool inUse(const StreamedTexture& texture) const {
+        return texture.lastUsed + 1 >= frame;
+    }
+
+    // drops the finest level of one texture; textures with more detail than they want go first,
+    // then plain least recently used. Textures in use are only touched if `force`.
+    bool evictOne(bool force) {
+        int best = -1;
+        bool bestSurplus = false;
+        for (size_t i = 0; i < textures.size(); i++) {
+            const StreamedTexture& texture = textures[i];
+            if (!gpuResources.valid(texture.texture) || texture.residentLevel >= texture.tailLevel) continue;
+            bool surplus = texture.residentLevel < texture.desiredLevel;
+            if (!surplus && !force && inUse(texture)) continue;
+            if (best < 0 || (surplus && !bestSurplus) ||
+                (surplus == bestSurplus && texture.lastUsed < textures[best].lastUsed)) {
+                best = (int) i;
+                bestSurplus = surplus;
+            }
+        }
+        if (best < 0) return false;
+        StreamedTexture& texture = textures[best];
+        int first = texture.residentLevel + 1;
+        ResourceHandle replacement = allocate(texture, first);
+        replace(texture, replacement, first);
+        levelsEvicted++;
+        return true;
+    }
+
+    // bytes evictOne(false) could free without touching what's needed this frame
+    size_t reclaimableBytes() const {
+        size_t bytes = 0;
+        for (const StreamedTexture& texture : textures) {
+            if (!gpuResources.valid(texture.texture) || texture.residentLevel >= texture.tailLevel) continue;
+            if (inUse(texture) && texture.residentLevel >= texture.desiredLevel) continue;
+            bytes += mipBytes(texture, texture.residentLevel);
+        }
+        return bytes;
+    }
+
+    void scheduleLoads() {
+        size_t uploaded = 0;
+        for (size_t i = 0; i < textures.size(); i++) {
+            StreamedTexture& texture = textures[i];
+            if (texture.failed || texture.loading || texture.desiredLevel >= texture.residentLevel) continue;
+            if (texture.chain.empty()) {
+                if (loadsInFlight >= maxLoadsInFlight) continue;
+                texture.loading = true;
+                loadsInFlight++;
+                StreamedTexture request = texture;
+                int id = (int) i;
+                jobs.submit([this, request, id]() { decode(request, id); });
+                continue;
+            }
+            // over this frame's upload allowance, the rest waits for the next frame
+            if (uploaded >= uploadBytesPerFrame) continue;
+            // the first upload brings the whole tail, after that one level at a time
+            int first = texture.residentLevel == texture.levelCount ? texture.tailLevel : texture.residentLevel - 1;
+            int last = texture.residentLevel - 1;
+            size_t bytes = 0;
+            for (int level = first; level <= last; level++) bytes += mipBytes(texture, level);
+            if (residentBytes + bytes > budget) {
+                if (residentBytes + bytes > budget + reclaimableBytes()) continue;
+                while (residentBytes + bytes > budget && evictOne(false)) {}
+            }
+            ResourceHandle replacement = allocate(texture, first);
+            for (int level = first; level <= last; level++) {
+                uploadLevel(texture, level, level - first, texture.chain[level]);
+                levelsStreamed++;
+            }
+            replace(texture, replacement, first);
+            uploaded += bytes;
+        }
+    }
+
+    // worker side: decode the file, filter it down to the last level and compress every level
+    // (serially, this is a job)
+    void decode(const StreamedTexture& texture, int id) {
+        StreamedLevels levels;
+        levels.texture = id;
+        levels.failed = true;
+        DecodedImage image;
+        if (decodeImageFile(texture.path, 4, texture.flip, image) && image.width == texture.width &&
+            image.height == texture.height) {
+            std::vector<std::vector<unsigned char>> chain;
+            size_t texels = image.pixels.size() / 4;
+            MipSettings settings = mipSettingsFor(image.pixels.data(), texels);
+            generateMipChain(image.pixels.data(), image.width, image.height, settings, texture.levelCount - 1, false, chain);
+            levels.format = compress ? chooseTextureFormat(alphaUsage(image.pixels.data(), texels), compressQuality, formats)
+                                     : TextureRGBA8;
+            levels.pixels.resize(texture.levelCount);
+            for (int level = 0; level < texture.levelCount; level++) {
+                std::vector<unsigned char>& pixels = level == 0 ? image.pixels : chain[level - 1];
+                if (levels.format == TextureRGBA8) {
+                    levels.pixels[level].swap(pixels);
+                } else {
+                    compressImage(pixels.data(), mipDimension(image.width, level), mipDimension(image.height, level),
+                                  levels.format, compressQuality, false, levels.pixels[level]);
+                }
+            }
+            levels.failed = false;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        completed.push_back(std::move(levels));
+    }
+
+    // new immutable texture for levels [first, levelCount), left bound to GL_TEXTURE_2D
+    ResourceHandle allocate(const StreamedTexture& texture, int first) {
+        int levels = texture.levelCount - first;
+        int width = mipDimension(texture.width, first), height = mipDimension(texture.height, first);
+        ResourceHandle handle = GPU_CREATE(ResourceTexture, "textures");
+        size_t bytes = 0;
+        for (int level = first; level < texture.levelCount; level++) bytes += mipBytes(texture, level);
+        gpuResources.setBytes(handle, bytes);
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(handle));
+        GLenum internalFormat = textureFormatInfo(texture.format).internalFormat;
+        if (glTexStorage2D) {
+            glTexStorage2D(GL_TEXTURE_2D, levels, internalFormat, width, height);
+        } else {
+            for (int level = 0; level < levels; level++) {
+                glTexImage2D(GL_TEXTURE_2D, level, internalFormat, mipDimension(width, level), mipDimension(height, level), 0,
+                             GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+            }
+            glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1);
+        }
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_MIRRORED_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_MIRRORED_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        return handle;
+    }
+
+    // `level` of the texture into level `target` of the one bound to GL_TEXTURE_2D
+    void uploadLevel(const StreamedTexture& texture, int level, int target, const std::vector<unsigned char>& pixels) {
+        int width = mipDimension(texture.width, level), height = mipDimension(texture.height, level);
+        if (texture.format == TextureRGBA8) {
+            glTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+        } else {
+            glCompressedTexSubImage2D(GL_TEXTURE_2D, target, 0, 0, width, height,
+                                      textureFormatInfo(texture.format).internalFormat, (GLsizei) pixels.size(),
+                                      pixels.data());
+        }
+    }
+
+    // copies the levels both textures hold from the old texture into `replacement` (on the GPU, or
+    // from the chain when compressed), then swaps it in
+    void replace(StreamedTexture& texture, ResourceHandle replacement, int first) {
+        // levels finer than the old texture's were just uploaded
+        int shared = first > texture.residentLevel ? first : texture.residentLevel;
+        if (gpuResources.valid(texture.texture)) {
+            if (texture.format != TextureRGBA8) {
+                for (int level = shared; level < texture.levelCount; level++) {
+                    uploadLevel(texture, level, level - first, texture.chain[level]);
+                }
+            } else {
+                GLint previousRead = 0;
+                glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &previousRead);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, gpuResources.name(copyFramebuffer));
+                for (int level = shared; level < texture.levelCount; level++) {
+                    glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                                           gpuResources.name(texture.texture), level - texture.residentLevel);
+                    glCopyTexSubImage2D(GL_TEXTURE_2D, level - first, 0, 0, 0, 0, mipDimension(texture.width, level),
+                                        mipDimension(texture.height, level));
+                }
+                glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+                glBindFramebuffer(GL_READ_FRAMEBUFFER, previousRead);
+            }
+            // earlier draws this frame may still sample it
+            gpuResources.release(texture.texture);
+        }
+        residentBytes -= texture.residentBytes;
+        for (int level = texture.residentLevel; level < texture.levelCount; level++) {
+            uncompressedBytes -= (size_t) mipDimension(texture.width, level) * mipDimension(texture.height, level) * 4;
+        }
+        texture.texture = replacement;
+        texture.residentLevel = first;
+        texture.residentBytes = 0;
+        for (int level = first; level < texture.levelCount; level++) {
+            texture.residentBytes += mipBytes(texture, level);
+            uncompressedBytes += (size_t) mipDimension(texture.width, level) * mipDimension(texture.height, level) * 4;
+        }
+        residentBytes += texture.residentBytes;
+    }
+};
+
+#endif /* streaming_h */
@@ -0,0 +1,184 @@
+//
+//  temporal.h
+//  app
+//
+
+#ifndef temporal_h
+#define temporal_h
+
+#include <stdint.h>
+#include <math.h>
+#include <string>
+#include "shaders.h"
+#include "rendertargets.h"
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+// Temporal upsampling. The scene renders below output resolution with the projection offset by a
+// sub-pixel Halton jitter that changes every frame, and the MOTION_VECTORS shader variants write
+// how far every pixel moved on screen since the last frame (from this and last frame's unjittered
+// view-projection and model matrices, see ModelMatrixBuffer::keepPrevious).
+//
+// temporal.frag then rebuilds every output pixel from the jittered samples around it, reprojects
+// last frame's output along the motion vector and blends the two. The history is clipped to the
+// color range of the current neighbourhood first, which is what keeps disocclusions and lighting
+// changes from ghosting. Output and history are RGBA16F targets at output size, ping-ponged.
+//
+// Presets pick the render scale: native only antialiases, quality, balanced and performance render
+// at 67%, 59% and 50% of the output size per axis.
+
+enum TemporalPreset {
+    TemporalOff,
+    TemporalNative,
+    TemporalQuality,
+    TemporalBalanced,
+    TemporalPerformance
+};
+
+TemporalPreset parseTemporalPreset(const std::string& name) {
+    if (name == "native") return TemporalNative;
+    if (name == "quality") return TemporalQuality;
+    if (name == "balanced") return TemporalBalanced;
+    if (name == "performance") return TemporalPerformance;
+    return TemporalOff;
+}
+
+const char* temporalPresetName(TemporalPreset preset) {
+    static const char* names[] = { "off", "native", "quality", "balanced", "performance" };
+    return names[preset];
+}
+
+float temporalPresetScale(TemporalPreset preset) {
+    static const float scales[] = { 1.0f, 1.0f, 0.67f, 0.59f, 0.5f };
+    return scales[preset];
+}
+
+float halton(uint32_t index, uint32_t base) {
+    float result = 0.0f;
+    float fraction = 1.0f;
+    while (index > 0) {
+        fraction /= base;
+        result += fraction * (index % base);
+        index /= base;
+    }
+    return result;
+}
+
+struct TemporalUpsampler {
+    TemporalPreset preset = TemporalOff;
+    HotProgram program;
+    // output targets, history[current] is written this frame, the other one holds last frame's
+    int history[2] = { -1, -1 };
+    int current = 0;
+    bool historyValid = false;
+    uint64_t frame = 0;
+
+    // this frame's jitter in render pixels, in [-0.5, 0.5)
+    glm::vec2 jitter = glm::vec2(0.0f);
+    glm::vec2 renderSize = glm::vec2(1.0f);
+    // render size over output size, per axis
+    float scale = 1.0f;
+    // unjittered, what motion vectors are measured with
+    glm::mat4 viewProjection = glm::mat4(1.0f);
+    glm::mat4 previousViewProjection = glm::mat4(1.0f);
+    bool hasPreviousViewProjection = false;
+
+    bool enabled() const {
+        return preset != TemporalOff;
+    }
+
+    bool init(ShaderReloader& reloader) {
+        program.vertexFile = "upscale.vert";
+        program.fragmentFile = "temporal.frag";
+        program.onSwap = [](unsigned int program) {
+            glUniform1i(glGetUniformLocation(program, "sceneColor"), 0);
+            glUniform1i(glGetUniformLocation(program, "sceneMotion"), 1);
+            glUniform1i(glGetUniformLocation(program, "history"), 2);
+        };
+        return reloader.load(program);
+    }
+
+    void release(RenderTargetPool& pool) {
+        for (int& target : history) {
+            pool.release(target);
+            target = -1;
+        }
+        historyValid = false;
+    }
+
+    // Picks this frame's jitter for a scene rendered at renderWidth x renderHeight. More phases at
+    // lower scales, so every output pixel still gets a sample close to its center now and then.
+    void beginFrame(int renderWidth, int renderHeight, float scale) {
+        renderSize = glm::vec2((float) renderWidth, (float) renderHeight);
+        this->scale = scale;
+        uint32_t phases = (uint32_t) fminf(32.0f, ceilf(8.0f / (scale * scale)));
+        uint32_t index = (uint32_t) (frame % phases) + 1;
+        jitter = glm::vec2(halton(index, 2) - 0.5f, halton(index, 3) - 0.5f);
+    }
+
+    // projection to draw the scene with this frame; remembers the unjittered view-projection
+    glm::mat4 jitterProjection(const glm::mat4& projection, const glm::mat4& view) {
+        viewProjection = projection * view;
+        if (!hasPreviousViewProjection) {
+            previousViewProjection = viewProjection;
+            hasPreviousViewProjection = true;
+        }
+        glm::vec3 offset = glm::vec3(2.0f * jitter.x / renderSize.x, 2.0f * jitter.y / renderSize.y, 0.0f);
+        return glm::translate(glm::mat4(1.0f), offset) * projection;
+    }
+
+    // per material uniforms of MOTION_VECTORS variants (previous world matrices are bound by the caller)
+    void bindUniforms(unsigned int shaderProgram) {
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "viewProjection"), 1, GL_FALSE, glm::value_ptr(viewProjection));
+        glUniformMatrix4fv(glGetUniformLocation(shaderProgram, "previousViewProjection"), 1, GL_FALSE,
+                           glm::value_ptr(previousViewProjection));
+        // sample textures as sharp as output resolution would
+        glUniform1f(glGetUniformLocation(shaderProgram, "textureLodBias"), log2f(scale));
+    }
+
+    // Resolves the scene target into this frame's history at output size. Returns the target that
+    // holds the result, -1 when there is nothing to resolve with (the caller presents the scene).
+    int resolve(RenderTargetPool& pool, int sceneTarget, int width, int height, unsigned int emptyVao) {
+        frame++;
+        previousViewProjection = viewProjection;
+        if (program.program == 0 || sceneTarget < 0) return -1;
+        for (int i = 0; i < 2; i++) {
+            if (history[i] >= 0 && (pool.target(history[i]).width != width || pool.target(history[i]).height != height)) {
+                pool.release(history[i]);
+                history[i] = -1;
+                historyValid = false;
+            }
+            if (history[i] < 0) {
+                history[i] = pool.acquire(width, height, TargetHistory);
+                historyValid = false;
+            }
+            if (history[i] < 0) return -1;
+        }
+        current = 1 - current;
+        RenderTarget& scene = pool.target(sceneTarget);
+        RenderTarget& output = pool.target(history[current]);
+        RenderTarget& previous = pool.target(history[1 - current]);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, gpuResources.name(output.framebuffer));
+        glViewport(0, 0, width, height);
+        glDisable(GL_DEPTH_TEST);
+        glUseProgram(program.program);
+        glUniform2f(glGetUniformLocation(program.program, "renderSize"), renderSize.x, renderSize.y);
+        glUniform2f(glGetUniformLocation(program.program, "jitter"), jitter.x, jitter.y);
+        glUniform1f(glGetUniformLocation(program.program, "historyValid"), historyValid ? 1.0f : 0.0f);
+        glActiveTexture(GL_TEXTURE0);
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(scene.color));
+        glActiveTexture(GL_TEXTURE1);
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(scene.motion));
+        glActiveTexture(GL_TEXTURE2);
+        glBindTexture(GL_TEXTURE_2D, gpuResources.name(previous.color));
+        glBindVertexArray(emptyVao);
+        glDrawArrays(GL_TRIANGLES, 0, 3);
+        glEnable(GL_DEPTH_TEST);
+        historyValid = true;
+        return history[current];
+    }
+};
+
+#endif /* temporal_h */
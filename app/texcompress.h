@@ -0,0 +1,657 @@
+//
+//  texcompress.h
+//  app
+//
+
+#ifndef texcompress_h
+#define texcompress_h
+
+#include <stdint.h>
+#include <string.h>
+#include <float.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <iostream>
+#include <chrono>
+#include <functional>
+#include "jobs.h"
+#include "decode.h"
+#include "mipmap.h"
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Block compressed textures: BC1 (opaque, or 1 bit alpha for cut-outs), BC3 (BC1 color plus
+// interpolated alpha) and BC7.
+//
+// Every 4x4 block goes through the same steps: endpoints from the texels' principal axis (or their
+// bounding box at CompressFast), the nearest palette entry for every texel, then least squares
+// endpoints for those indices and another round of indices while the error drops (once at
+// CompressNormal, up to three times at CompressHigh). The nearest entry search runs on 4 texels at
+// a time with SSE2. BC7 only writes mode 6 blocks (one RGBA subset, 16 entry palette): a fraction
+// of what BC7 can do, still well ahead of BC1/BC3 on gradients and alpha.
+//
+// chooseTextureFormat() picks the format from how the image uses alpha and what the driver
+// accepts (S3TC is an extension, BC7 is core only from GL 4.2). Rows of blocks are encoded on the
+// job system when `parallel` is set, main thread only like everything built on parallelFor.
+//
+// compressTextureFile() is the offline path ("--compress <image> <out.dds>"): the whole mip chain
+// written as a .dds that texture tools and GPU debuggers open.
+
+// the core loader doesn't name the S3TC formats
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT 0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT 0x83F3
+#endif
+#ifndef GL_COMPRESSED_RGBA_BPTC_UNORM
+#define GL_COMPRESSED_RGBA_BPTC_UNORM 0x8E8C
+#endif
+
+enum TextureFormat {
+    TextureRGBA8,
+    TextureBC1,
+    // BC1 with transparent texels, for cut-outs
+    TextureBC1A,
+    TextureBC3,
+    TextureBC7,
+    TextureFormatCount
+};
+
+enum CompressQuality {
+    CompressFast,
+    CompressNormal,
+    CompressHigh
+};
+
+struct TextureFormatInfo {
+    const char* name;
+    GLenum internalFormat;
+    // 0 for uncompressed
+    int blockBytes;
+};
+
+const TextureFormatInfo& textureFormatInfo(TextureFormat format) {
+    static const TextureFormatInfo infos[] = {
+        { "RGBA8", GL_RGBA8, 0 },
+        { "BC1", GL_COMPRESSED_RGB_S3TC_DXT1_EXT, 8 },
+        { "BC1A", GL_COMPRESSED_RGBA_S3TC_DXT1_EXT, 8 },
+        { "BC3", GL_COMPRESSED_RGBA_S3TC_DXT5_EXT, 16 },
+        { "BC7", GL_COMPRESSED_RGBA_BPTC_UNORM, 16 },
+    };
+    return infos[format];
+}
+
+size_t textureLevelBytes(TextureFormat format, int width, int height) {
+    int blockBytes = textureFormatInfo(format).blockBytes;
+    if (blockBytes == 0) return (size_t) width * height * 4;
+    return (size_t) ((width + 3) / 4) * ((height + 3) / 4) * blockBytes;
+}
+
+// formats the driver lists in GL_COMPRESSED_TEXTURE_FORMATS
+struct CompressedFormatSupport {
+    bool supported[TextureFormatCount] = {};
+
+    void query() {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+        std::vector<GLint> formats(count > 0 ? count : 0);
+        if (count > 0) glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+        supported[TextureRGBA8] = true;
+        for (int format = TextureBC1; format < TextureFormatCount; format++) {
+            for (GLint listed : formats) {
+                if ((GLenum) listed == textureFormatInfo((TextureFormat) format).internalFormat) supported[format] = true;
+            }
+        }
+    }
+};
+
+// BC1 for opaque images, BC1A for cut-outs, BC3 for blended alpha; BC7 for blended alpha when the
+// driver has it and for everything at CompressHigh (twice BC1's size for opaque images)
+TextureFormat chooseTextureFormat(AlphaUsage usage, CompressQuality quality, const CompressedFormatSupport& support) {
+    if (support.supported[TextureBC7] && (quality == CompressHigh || usage == AlphaBlended)) return TextureBC7;
+    TextureFormat format = usage == AlphaOpaque ? TextureBC1 : (usage == AlphaCutout ? TextureBC1A : TextureBC3);
+    return support.supported[format] ? format : TextureRGBA8;
+}
+
+// one 4x4 block as floats, channel major
+struct BlockTexels {
+    alignas(16) float c[4][16];
+};
+
+// edge blocks repeat the last row/column
+void loadBlock(const uint8_t* rgba, int width, int height, int blockX, int blockY, BlockTexels& block) {
+    for (int y = 0; y < 4; y++) {
+        int sy = blockY * 4 + y < height ? blockY * 4 + y : height - 1;
+        for (int x = 0; x < 4; x++) {
+            int sx = blockX * 4 + x < width ? blockX * 4 + x : width - 1;
+            const uint8_t* texel = rgba + ((size_t) sy * width + sx) * 4;
+            for (int ch = 0; ch < 4; ch++) block.c[ch][y * 4 + x] = texel[ch];
+        }
+    }
+}
+
+// Nearest of `count` palette entries over channels [first, first + channels) for every texel.
+// Returns the squared error summed over the texels in `mask`.
+float nearestIndices(const BlockTexels& block, int first, int channels, const float (*palette)[4], int count,
+                     uint32_t mask, uint8_t* indices) {
+    float total = 0.0f;
+#if defined(__SSE2__)
+    alignas(16) int32_t lanes[4];
+    alignas(16) float errors[4];
+    for (int group = 0; group < 16; group += 4) {
+        __m128 best = _mm_set1_ps(FLT_MAX);
+        __m128i bestIndex = _mm_setzero_si128();
+        for (int entry = 0; entry < count; entry++) {
+            __m128 distance = _mm_setzero_ps();
+            for (int ch = first; ch < first + channels; ch++) {
+                __m128 d = _mm_sub_ps(_mm_load_ps(&block.c[ch][group]), _mm_set1_ps(palette[entry][ch]));
+                distance = _mm_add_ps(distance, _mm_mul_ps(d, d));
+            }
+            __m128i closer = _mm_castps_si128(_mm_cmplt_ps(distance, best));
+            best = _mm_min_ps(distance, best);
+            bestIndex = _mm_or_si128(_mm_and_si128(closer, _mm_set1_epi32(entry)), _mm_andnot_si128(closer, bestIndex));
+        }
+        _mm_store_si128((__m128i*) lanes, bestIndex);
+        _mm_store_ps(errors, best);
+        for (int i = 0; i < 4; i++) {
+            indices[group + i] = (uint8_t) lanes[i];
+            if (mask & (1u << (group + i))) total += errors[i];
+        }
+    }
+#else
+    for (int i = 0; i < 16; i++) {
+        float best = FLT_MAX;
+        for (int entry = 0; entry < count; entry++) {
+            float distance = 0.0f;
+            for (int ch = first; ch < first + channels; ch++) {
+                float d = block.c[ch][i] - palette[entry][ch];
+                distance += d * d;
+            }
+            if (distance < best) {
+                best = distance;
+                indices[i] = (uint8_t) entry;
+            }
+        }
+        if (mask & (1u << i)) total += best;
+    }
+#endif
+    return total;
+}
+
+// endpoints along the principal axis of the texels in `mask`, channels [0, channels)
+void principalEndpoints(const BlockTexels& block, uint32_t mask, int channels, float* low, float* high) {
+    float mean[4] = {}, covariance[4][4] = {};
+    int n = 0;
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (1u << i))) continue;
+        for (int ch = 0; ch < channels; ch++) mean[ch] += block.c[ch][i];
+        n++;
+    }
+    for (int ch = 0; ch < channels; ch++) mean[ch] /= n;
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (1u << i))) continue;
+        for (int a = 0; a < channels; a++) {
+            for (int b = a; b < channels; b++) {
+                covariance[a][b] += (block.c[a][i] - mean[a]) * (block.c[b][i] - mean[b]);
+            }
+        }
+    }
+    for (int a = 0; a < channels; a++) {
+        for (int b = 0; b < a; b++) covariance[a][b] = covariance[b][a];
+    }
+    // power iteration
+    float axis[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+    for (int iteration = 0; iteration < 8; iteration++) {
+        float next[4] = {}, length = 0.0f;
+        for (int a = 0; a < channels; a++) {
+            for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+            length = fmaxf(length, fabsf(next[a]));
+        }
+        if (length < 1e-6f) break;
+        for (int a = 0; a < channels; a++) axis[a] = next[a] / length;
+    }
+    float lengthSquared = 0.0f;
+    for (int ch = 0; ch < channels; ch++) lengthSquared += axis[ch] * axis[ch];
+    float minimum = FLT_MAX, maximum = -FLT_MAX;
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (1u << i))) continue;
+        float t = 0.0f;
+        for (int ch = 0; ch < channels; ch++) t += (block.c[ch][i] - mean[ch]) * axis[ch];
+        minimum = fminf(minimum, t);
+        maximum = fmaxf(maximum, t);
+    }
+    for (int ch = 0; ch < channels; ch++) {
+        low[ch] = fminf(fmaxf(mean[ch] + axis[ch] * minimum / lengthSquared, 0.0f), 255.0f);
+        high[ch] = fminf(fmaxf(mean[ch] + axis[ch] * maximum / lengthSquared, 0.0f), 255.0f);
+    }
+}
+
+// per channel bounding box of the texels in `mask`, inset a little like most fast encoders
+void boundingEndpoints(const BlockTexels& block, uint32_t mask, int channels, float* low, float* high) {
+    for (int ch = 0; ch < channels; ch++) {
+        float minimum = 255.0f, maximum = 0.0f;
+        for (int i = 0; i < 16; i++) {
+            if (!(mask & (1u << i))) continue;
+            minimum = fminf(minimum, block.c[ch][i]);
+            maximum = fmaxf(maximum, block.c[ch][i]);
+        }
+        float inset = (maximum - minimum) / 16.0f;
+        low[ch] = minimum + inset;
+        high[ch] = maximum - inset;
+    }
+}
+
+// endpoints minimizing the squared error for fixed indices, texel i sits `weights[indices[i]]` of
+// the way from low to high; false when the indices don't pin them down
+bool leastSquaresEndpoints(const BlockTexels& block, uint32_t mask, int channels, const uint8_t* indices,
+                           const float* weights, float* low, float* high) {
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, ax[4] = {}, bx[4] = {};
+    for (int i = 0; i < 16; i++) {
+        if (!(mask & (1u << i))) continue;
+        float b = weights[indices[i]], a = 1.0f - b;
+        aa += a * a;
+        ab += a * b;
+        bb += b * b;
+        for (int ch = 0; ch < channels; ch++) {
+            ax[ch] += a * block.c[ch][i];
+            bx[ch] += b * block.c[ch][i];
+        }
+    }
+    float determinant = aa * bb - ab * ab;
+    if (fabsf(determinant) < 1e-6f) return false;
+    for (int ch = 0; ch < channels; ch++) {
+        low[ch] = fminf(fmaxf((ax[ch] * bb - bx[ch] * ab) / determinant, 0.0f), 255.0f);
+        high[ch] = fminf(fmaxf((bx[ch] * aa - ax[ch] * ab) / determinant, 0.0f), 255.0f);
+    }
+    return true;
+}
+
+int refinementPasses(CompressQuality quality) {
+    return quality == CompressFast ? 0 : (quality == CompressNormal ? 1 : 3);
+}
+
+// bits of a block, least significant first
+struct BlockBits {
+    uint8_t bytes[16] = {};
+    int position = 0;
+
+    void put(uint32_t value, int bits) {
+        for (int i = 0; i < bits; i++, position++) {
+            if (value & (1u << i)) bytes[position >> 3] |= (uint8_t) (1u << (position & 7));
+        }
+    }
+};
+
+// BC1
+
+uint16_t packColor565(const float* rgb) {
+    int r = (int) (rgb[0] * 31.0f / 255.0f + 0.5f), g = (int) (rgb[1] * 63.0f / 255.0f + 0.5f);
+    int b = (int) (rgb[2] * 31.0f / 255.0f + 0.5f);
+    return (uint16_t) ((r << 11) | (g << 5) | b);
+}
+
+void unpackColor565(uint16_t color, float* rgb) {
+    int r = (color >> 11) & 31, g = (color >> 5) & 63, b = color & 31;
+    rgb[0] = (float) ((r << 3) | (r >> 2));
+    rgb[1] = (float) ((g << 2) | (g >> 4));
+    rgb[2] = (float) ((b << 3) | (b >> 2));
+}
+
+struct ColorBlock {
+    uint16_t color0, color1;
+    uint8_t indices[16];
+    float error;
+};
+
+// quantizes both endpoints and picks indices; `transparent` texels (3 color mode) get index 3
+ColorBlock evaluateColorBlock(const BlockTexels& block, uint32_t opaque, const float* low, const float* high) {
+    ColorBlock result;
+    bool threeColor = opaque != 0xFFFF;
+    uint16_t a = packColor565(high), b = packColor565(low);
+    // 4 color mode needs color0 > color1, 3 color mode color0 <= color1
+    if (threeColor ? a > b : a < b) {
+        uint16_t swap = a;
+        a = b;
+        b = swap;
+    }
+    result.color0 = a;
+    result.color1 = b;
+    float palette[4][4] = {};
+    unpackColor565(a, palette[0]);
+    unpackColor565(b, palette[1]);
+    int count;
+    if (threeColor) {
+        for (int ch = 0; ch < 3; ch++) palette[2][ch] = (palette[0][ch] + palette[1][ch]) * 0.5f;
+        count = 3;
+    } else if (a == b) {
+        count = 1;
+    } else {
+        for (int ch = 0; ch < 3; ch++) {
+            palette[2][ch] = (2.0f * palette[0][ch] + palette[1][ch]) / 3.0f;
+            palette[3][ch] = (palette[0][ch] + 2.0f * palette[1][ch]) / 3.0f;
+        }
+        count = 4;
+    }
+    result.error = nearestIndices(block, 0, 3, palette, count, opaque, result.indices);
+    for (int i = 0; i < 16; i++) {
+        if (!(opaque & (1u << i))) result.indices[i] = 3;
+    }
+    return result;
+}
+
+// color half of BC1/BC3; with `punchThrough` texels with alpha under 128 become transparent
+void encodeColorBlock(const BlockTexels& block, CompressQuality quality, bool punchThrough, uint8_t* out) {
+    uint32_t opaque = 0xFFFF;
+    if (punchThrough) {
+        opaque = 0;
+        for (int i = 0; i < 16; i++) {
+            if (block.c[3][i] >= 128.0f) opaque |= 1u << i;
+        }
+    }
+    ColorBlock best;
+    if (opaque == 0) {
+        best.color0 = best.color1 = 0;
+        memset(best.indices, 3, sizeof(best.indices));
+    } else {
+        float low[4], high[4];
+        if (quality == CompressFast) {
+            boundingEndpoints(block, opaque, 3, low, high);
+        } else {
+            principalEndpoints(block, opaque, 3, low, high);
+        }
+        best = evaluateColorBlock(block, opaque, low, high);
+        for (int pass = 0; pass < refinementPasses(quality) && best.error > 0.0f; pass++) {
+            // weight of color1 for every index, in the block's mode
+            static const float fourColor[4] = { 0.0f, 1.0f, 1.0f / 3.0f, 2.0f / 3.0f };
+            static const float threeColor[4] = { 0.0f, 1.0f, 0.5f, 0.0f };
+            float e0[4], e1[4];
+            if (!leastSquaresEndpoints(block, opaque, 3, best.indices, opaque != 0xFFFF ? threeColor : fourColor, e0, e1)) {
+                break;
+            }
+            ColorBlock candidate = evaluateColorBlock(block, opaque, e1, e0);
+            if (candidate.error >= best.error) break;
+            best = candidate;
+        }
+    }
+    out[0] = (uint8_t) best.color0;
+    out[1] = (uint8_t) (best.color0 >> 8);
+    out[2] = (uint8_t) best.color1;
+    out[3] = (uint8_t) (best.color1 >> 8);
+    uint32_t bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (uint32_t) best.indices[i] << (i * 2);
+    memcpy(out + 4, &bits, 4);
+}
+
+// BC3 alpha (a BC4 block)
+
+float alphaBlockError(const BlockTexels& block, int alpha0, int alpha1, uint8_t* indices) {
+    float palette[8][4] = {};
+    palette[0][3] = (float) alpha0;
+    palette[1][3] = (float) alpha1;
+    if (alpha0 > alpha1) {
+        for (int i = 2; i < 8; i++) palette[i][3] = ((8 - i) * alpha0 + (i - 1) * alpha1) / 7.0f;
+    } else {
+        for (int i = 2; i < 6; i++) palette[i][3] = ((6 - i) * alpha0 + (i - 1) * alpha1) / 5.0f;
+        palette[6][3] = 0.0f;
+        palette[7][3] = 255.0f;
+    }
+    return nearestIndices(block, 3, 1, palette, 8, 0xFFFF, indices);
+}
+
+void encodeAlphaBlock(const BlockTexels& block, CompressQuality quality, uint8_t* out) {
+    int minimum = 255, maximum = 0, innerMinimum = 255, innerMaximum = 0;
+    for (int i = 0; i < 16; i++) {
+        int a = (int) block.c[3][i];
+        minimum = a < minimum ? a : minimum;
+        maximum = a > maximum ? a : maximum;
+        if (a > 0 && a < 255) {
+            innerMinimum = a < innerMinimum ? a : innerMinimum;
+            innerMaximum = a > innerMaximum ? a : innerMaximum;
+        }
+    }
+    uint8_t indices[16] = {};
+    int alpha0 = maximum, alpha1 = minimum;
+    if (maximum != minimum) {
+        float error = alphaBlockError(block, alpha0, alpha1, indices);
+        // 6 value mode with exact 0 and 255, for blocks mixing hard and soft alpha
+        if (quality == CompressHigh && innerMinimum <= innerMaximum && (minimum == 0 || maximum == 255)) {
+            uint8_t candidate[16];
+            float candidateError = alphaBlockError(block, innerMinimum, innerMaximum, candidate);
+            if (candidateError < error) {
+                alpha0 = innerMinimum;
+                alpha1 = innerMaximum;
+                memcpy(indices, candidate, sizeof(indices));
+            }
+        }
+    }
+    out[0] = (uint8_t) alpha0;
+    out[1] = (uint8_t) alpha1;
+    uint64_t bits = 0;
+    for (int i = 0; i < 16; i++) bits |= (uint64_t) indices[i] << (i * 3);
+    for (int i = 0; i < 6; i++) out[2 + i] = (uint8_t) (bits >> (i * 8));
+}
+
+// BC7 mode 6: 7 bit RGBA endpoints plus a shared low bit each, 4 bit indices
+
+const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };
+
+struct Bc7Block {
+    // 7 bit endpoint channels and the p bit of each endpoint
+    int endpoint[2][4];
+    int pbit[2];
+    uint8_t indices[16];
+    float error;
+};
+
+// best 7 bit values for an endpoint given its p bit, returns the quantization error
+float quantizeBc7Endpoint(const float* value, int pbit, int* quantized) {
+    float error = 0.0f;
+    for (int ch = 0; ch < 4; ch++) {
+        int q = (int) ((value[ch] - pbit) / 2.0f + 0.5f);
+        q = q < 0 ? 0 : (q > 127 ? 127 : q);
+        quantized[ch] = q;
+        float d = (float) ((q << 1) | pbit) - value[ch];
+        error += d * d;
+    }
+    return error;
+}
+
+void evaluateBc7Block(const BlockTexels& block, Bc7Block& result) {
+    float palette[16][4];
+    for (int ch = 0; ch < 4; ch++) {
+        int e0 = (result.endpoint[0][ch] << 1) | result.pbit[0], e1 = (result.endpoint[1][ch] << 1) | result.pbit[1];
+        for (int i = 0; i < 16; i++) palette[i][ch] = (float) (((64 - bc7Weights[i]) * e0 + bc7Weights[i] * e1 + 32) >> 6);
+    }
+    result.error = nearestIndices(block, 0, 4, palette, 16, 0xFFFF, result.indices);
+}
+
+// quantizes low/high; CompressHigh tries every p bit pair, otherwise each endpoint keeps its own best
+Bc7Block quantizeBc7Block(const BlockTexels& block, const float* low, const float* high, CompressQuality quality) {
+    Bc7Block best;
+    best.error = FLT_MAX;
+    if (quality == CompressHigh) {
+        for (int p = 0; p < 4; p++) {
+            Bc7Block candidate;
+            candidate.pbit[0] = p & 1;
+            candidate.pbit[1] = p >> 1;
+            quantizeBc7Endpoint(low, candidate.pbit[0], candidate.endpoint[0]);
+            quantizeBc7Endpoint(high, candidate.pbit[1], candidate.endpoint[1]);
+            evaluateBc7Block(block, candidate);
+            if (candidate.error < best.error) best = candidate;
+        }
+        return best;
+    }
+    const float* values[2] = { low, high };
+    for (int e = 0; e < 2; e++) {
+        int zero[4], one[4];
+        float zeroError = quantizeBc7Endpoint(values[e], 0, zero), oneError = quantizeBc7Endpoint(values[e], 1, one);
+        best.pbit[e] = oneError < zeroError ? 1 : 0;
+        memcpy(best.endpoint[e], best.pbit[e] ? one : zero, sizeof(zero));
+    }
+    evaluateBc7Block(block, best);
+    return best;
+}
+
+void encodeBc7Block(const BlockTexels& block, CompressQuality quality, uint8_t* out) {
+    float low[4], high[4];
+    if (quality == CompressFast) {
+        boundingEndpoints(block, 0xFFFF, 4, low, high);
+    } else {
+        principalEndpoints(block, 0xFFFF, 4, low, high);
+    }
+    Bc7Block best = quantizeBc7Block(block, low, high, quality);
+    float weights[16];
+    for (int i = 0; i < 16; i++) weights[i] = bc7Weights[i] / 64.0f;
+    for (int pass = 0; pass < refinementPasses(quality) && best.error > 0.0f; pass++) {
+        if (!leastSquaresEndpoints(block, 0xFFFF, 4, best.indices, weights, low, high)) break;
+        Bc7Block candidate = quantizeBc7Block(block, low, high, quality);
+        if (candidate.error >= best.error) break;
+        best = candidate;
+    }
+    // the first texel's index has an implied 0 top bit
+    if (best.indices[0] >= 8) {
+        for (int ch = 0; ch < 4; ch++) {
+            int swap = best.endpoint[0][ch];
+            best.endpoint[0][ch] = best.endpoint[1][ch];
+            best.endpoint[1][ch] = swap;
+        }
+        int swap = best.pbit[0];
+        best.pbit[0] = best.pbit[1];
+        best.pbit[1] = swap;
+        for (int i = 0; i < 16; i++) best.indices[i] = (uint8_t) (15 - best.indices[i]);
+    }
+    BlockBits bits;
+    bits.put(1u << 6, 7);
+    for (int ch = 0; ch < 4; ch++) {
+        bits.put((uint32_t) best.endpoint[0][ch], 7);
+        bits.put((uint32_t) best.endpoint[1][ch], 7);
+    }
+    bits.put((uint32_t) best.pbit[0], 1);
+    bits.put((uint32_t) best.pbit[1], 1);
+    bits.put(best.indices[0], 3);
+    for (int i = 1; i < 16; i++) bits.put(best.indices[i], 4);
+    memcpy(out, bits.bytes, 16);
+}
+
+void encodeBlock(const BlockTexels& block, TextureFormat format, CompressQuality quality, uint8_t* out) {
+    switch (format) {
+        case TextureBC1: encodeColorBlock(block, quality, false, out); break;
+        case TextureBC1A: encodeColorBlock(block, quality, true, out); break;
+        case TextureBC3:
+            encodeAlphaBlock(block, quality, out);
+            encodeColorBlock(block, quality, false, out + 8);
+            break;
+        case TextureBC7: encodeBc7Block(block, quality, out); break;
+        default: break;
+    }
+}
+
+// Encodes an 8 bit RGBA image into `format` (RGBA8 copies it).
+void compressImage(const uint8_t* rgba, int width, int height, TextureFormat format, CompressQuality quality,
+                   bool parallel, std::vector<uint8_t>& out) {
+    out.resize(textureLevelBytes(format, width, height));
+    if (format == TextureRGBA8) {
+        memcpy(out.data(), rgba, out.size());
+        return;
+    }
+    int blocksWide = (width + 3) / 4, blocksHigh = (height + 3) / 4;
+    int blockBytes = textureFormatInfo(format).blockBytes;
+    auto rows = [&](size_t begin, size_t end) {
+        BlockTexels block;
+        for (size_t y = begin; y < end; y++) {
+            for (int x = 0; x < blocksWide; x++) {
+                loadBlock(rgba, width, height, x, (int) y, block);
+                encodeBlock(block, format, quality, &out[((size_t) y * blocksWide + x) * blockBytes]);
+            }
+        }
+    };
+    if (parallel) {
+        jobs.parallelFor((size_t) blocksHigh, 4, rows);
+    } else {
+        rows(0, (size_t) blocksHigh);
+    }
+}
+
+// uploads one level of the texture bound to GL_TEXTURE_2D
+void uploadTextureLevel(int level, TextureFormat format, int width, int height, const std::vector<uint8_t>& data) {
+    if (format == TextureRGBA8) {
+        glTexImage2D(GL_TEXTURE_2D, level, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, data.data());
+    } else {
+        glCompressedTexImage2D(GL_TEXTURE_2D, level, textureFormatInfo(format).internalFormat, width, height, 0,
+                               (GLsizei) data.size(), data.data());
+    }
+}
+
+// DDS with a DX10 header for BC7, levels top row first like every other DDS
+bool writeDds(const std::string& path, TextureFormat format, int width, int height,
+              const std::vector<std::vector<uint8_t>>& levels) {
+    if (format == TextureRGBA8) return false;
+    uint32_t header[31] = {};
+    header[0] = 124;
+    // caps, height, width, pixel format, mip count, linear size
+    header[1] = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;
+    header[2] = (uint32_t) height;
+    header[3] = (uint32_t) width;
+    header[4] = (uint32_t) levels[0].size();
+    header[6] = (uint32_t) levels.size();
+    // pixel format: size, FOURCC flag, four character code
+    header[18] = 32;
+    header[19] = 0x4;
+    const char* fourCC = format == TextureBC1 || format == TextureBC1A ? "DXT1" : (format == TextureBC3 ? "DXT5" : "DX10");
+    memcpy(&header[20], fourCC, 4);
+    // texture, mipmap, complex
+    header[26] = 0x1000 | 0x400000 | 0x8;
+    std::ofstream file(path, std::ios::binary);
+    if (!file) return false;
+    file.write("DDS ", 4);
+    file.write((const char*) header, sizeof(header));
+    if (format == TextureBC7) {
+        // DXGI_FORMAT_BC7_UNORM, 2D texture, no flags, one layer, straight alpha
+        uint32_t dx10[5] = { 98, 3, 0, 1, 0 };
+        file.write((const char*) dx10, sizeof(dx10));
+    }
+    for (const std::vector<uint8_t>& level : levels) file.write((const char*) level.data(), level.size());
+    return (bool) file;
+}
+
+// Offline: decodes `input`, builds its mip chain and writes it block compressed to `output`. The
+// format is chosen as if the driver took every format.
+int compressTextureFile(const std::string& input, const std::string& output, CompressQuality quality) {
+    DecodedImage image;
+    if (!decodeImageFile(input, 4, false, image)) {
+        std::cout << "[compress] could not load " << input << std::endl;
+        return 1;
+    }
+    auto start = std::chrono::high_resolution_clock::now();
+    size_t texels = (size_t) image.width * image.height;
+    AlphaUsage usage = alphaUsage(image.pixels.data(), texels);
+    CompressedFormatSupport everything;
+    for (int format = 0; format < TextureFormatCount; format++) everything.supported[format] = true;
+    TextureFormat format = chooseTextureFormat(usage, quality, everything);
+    std::vector<std::vector<uint8_t>> chain;
+    generateMipChain(image.pixels.data(), image.width, image.height, mipSettingsFor(image.pixels.data(), texels),
+                     mipLevelCount(image.width, image.height) - 1, true, chain);
+    std::vector<std::vector<uint8_t>> levels(chain.size() + 1);
+    size_t uncompressed = 0, compressed = 0;
+    for (size_t level = 0; level < levels.size(); level++) {
+        int width = mipDimension(image.width, (int) level), height = mipDimension(image.height, (int) level);
+        compressImage(level == 0 ? image.pixels.data() : chain[level - 1].data(), width, height, format, quality, true,
+                      levels[level]);
+        uncompressed += (size_t) width * height * 4;
+        compressed += levels[level].size();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::high_resolution_clock::now() - start).count();
+    if (!writeDds(output, format, image.width, image.height, levels)) {
+        std::cout << "[compress] could not write " << output << std::endl;
+        return 1;
+    }
+    std::cout << "[compress] " << input << " -> " << output << ": " << textureFormatInfo(format).name << ", "
+              << levels.size() << " levels, " << (uncompressed >> 10) << " KB -> " << (compressed >> 10) << " KB in "
+              << seconds * 1000.0 << " ms" << std::endl;
+    return 0;
+}
+
+#endif /* texcompress_h */